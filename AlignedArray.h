@@ -0,0 +1,122 @@
+/***********************************************************************
+AlignedArray - Class for arrays of plain-old-data values in cache-line
+aligned, optionally huge-page backed, storage whose capacity is managed
+by the caller.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef ALIGNEDARRAY_INCLUDED
+#define ALIGNEDARRAY_INCLUDED
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <new>
+
+#include "Common.h"
+
+inline Size growCapacity(Size capacity,Size minCapacity) // Returns a geometrically grown capacity that holds at least the given number of elements
+	{
+	while(capacity<minCapacity)
+		capacity=(capacity*3)/2+16;
+	return capacity;
+	}
+
+template <class ValueParam>
+class AlignedArray
+	{
+	/* Embedded classes: */
+	public:
+	typedef ValueParam Value; // Type of array elements; must be copyable with memcpy
+	static const size_t cacheLineSize=64; // Alignment of regular allocations
+	static const size_t hugePageSize=2*1024*1024; // Alignment and granularity of huge-page backed allocations
+	
+	/* Elements: */
+	private:
+	Value* values; // Pointer to the array's storage
+	Size capacity; // Number of elements the array can hold
+	size_t numReallocations; // Number of times the array's storage was reallocated
+	
+	/* Constructors and destructors: */
+	public:
+	AlignedArray(void) // Creates an empty array
+		:values(0),capacity(0),numReallocations(0)
+		{
+		}
+	private:
+	AlignedArray(const AlignedArray& source); // Prohibit copy constructor
+	AlignedArray& operator=(const AlignedArray& source); // Prohibit assignment operator
+	public:
+	~AlignedArray(void)
+		{
+		free(values);
+		}
+	
+	/* Methods: */
+	Size getCapacity(void) const // Returns the number of elements the array can hold
+		{
+		return capacity;
+		}
+	size_t getNumReallocations(void) const // Returns the number of times the array's storage was reallocated
+		{
+		return numReallocations;
+		}
+	void setCapacity(Size newCapacity,bool preserve,bool useHugePages) // Grows the array to the given capacity, optionally preserving its contents and backing large arrays with huge pages; does nothing if the array is already large enough
+		{
+		if(capacity>=newCapacity)
+			return;
+		
+		/* Allocate new storage aligned to cache lines, or to huge pages if requested and the array is large enough: */
+		size_t numBytes=size_t(newCapacity)*sizeof(Value);
+		size_t alignment=cacheLineSize;
+		if(useHugePages&&numBytes>=hugePageSize)
+			{
+			alignment=hugePageSize;
+			numBytes=((numBytes+hugePageSize-1)/hugePageSize)*hugePageSize;
+			}
+		void* newValues;
+		if(posix_memalign(&newValues,alignment,numBytes)!=0)
+			throw std::bad_alloc();
+		#ifdef MADV_HUGEPAGE
+		if(alignment==hugePageSize)
+			madvise(newValues,numBytes,MADV_HUGEPAGE);
+		#endif
+		
+		/* Copy the current contents and replace the old storage: */
+		if(preserve&&capacity>0)
+			memcpy(newValues,values,size_t(capacity)*sizeof(Value));
+		free(values);
+		values=static_cast<Value*>(newValues);
+		capacity=newCapacity;
+		++numReallocations;
+		}
+	Value* getArray(void) // Returns the array's storage
+		{
+		return values;
+		}
+	const Value& operator[](Index index) const // Returns an array element
+		{
+		return values[index];
+		}
+	Value& operator[](Index index) // Ditto
+		{
+		return values[index];
+		}
+	};
+
+#endif
@@ -0,0 +1,302 @@
+/***********************************************************************
+BondStatistics - Structure for statistics about the bonds between
+structural units, and class to calculate them from simulation state
+snapshots in a background thread.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "BondStatistics.h"
+
+#include <Math/Math.h>
+#include <Math/Constants.h>
+
+#include "Histogram.h"
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const Index unbondedSite=~Index(0); // Marker for bonding sites that are not bonded to another unit
+
+inline Vector wrapDistance(const Box& domain,const Vector& distance) // Returns the given distance vector wrapped to the given periodic domain
+	{
+	Vector result=distance;
+	for(int i=0;i<3;++i)
+		{
+		Scalar ds=domain.getSize(i);
+		if(result[i]>Math::div2(ds))
+			result[i]-=ds;
+		else if(result[i]<-Math::div2(ds))
+			result[i]+=ds;
+		}
+	
+	return result;
+	}
+
+}
+
+/*****************************************
+Methods of class BondStatisticsCalculator:
+*****************************************/
+
+void BondStatisticsCalculator::setBonds(const BondStatisticsCalculator::Snapshot& fullSnapshot)
+	{
+	/* Copy the simulation setup: */
+	header=fullSnapshot.header;
+	
+	/* Assign each unit's bonding sites a range of entries in flat bond partner arrays: */
+	bondSiteBases.clear();
+	bondSiteBases.reserve(fullSnapshot.states.states.size());
+	Index numBondSites=0;
+	for(UnitStateArray::UnitStateList::const_iterator sIt=fullSnapshot.states.states.begin();sIt!=fullSnapshot.states.states.end();++sIt)
+		{
+		bondSiteBases.push_back(numBondSites);
+		numBondSites+=Index(header.unitTypes[sIt->unitType].bondSites.size());
+		}
+	
+	/* Enter both halves of all bonds into the bond partner arrays: */
+	partnerUnits.assign(numBondSites,unbondedSite);
+	partnerSites.assign(numBondSites,unbondedSite);
+	numBonds=0;
+	for(std::vector<StateFileBond>::const_iterator bIt=fullSnapshot.bonds.begin();bIt!=fullSnapshot.bonds.end();++bIt)
+		{
+		for(int i=0;i<2;++i)
+			{
+			Index site=bondSiteBases[bIt->unitIndex[i]]+bIt->bondSiteIndex[i];
+			partnerUnits[site]=bIt->unitIndex[1-i];
+			partnerSites[site]=bIt->bondSiteIndex[1-i];
+			}
+		++numBonds;
+		}
+	}
+
+void BondStatisticsCalculator::updateBonds(const std::vector<BondStatisticsCalculator::BondEvent>& bondEvents)
+	{
+	/* Enter or remove both halves of each created or broken bond in order: */
+	for(std::vector<BondEvent>::const_iterator beIt=bondEvents.begin();beIt!=bondEvents.end();++beIt)
+		{
+		for(int i=0;i<2;++i)
+			{
+			Index site=bondSiteBases[beIt->bond.unitIndex[i]]+beIt->bond.bondSiteIndex[i];
+			partnerUnits[site]=beIt->created?beIt->bond.unitIndex[1-i]:unbondedSite;
+			partnerSites[site]=beIt->created?beIt->bond.bondSiteIndex[1-i]:unbondedSite;
+			}
+		if(beIt->created)
+			++numBonds;
+		else
+			--numBonds;
+		}
+	}
+
+void BondStatisticsCalculator::calcStatistics(const UnitStateArray& states,BondStatistics& stats) const
+	{
+	/* Initialize the statistics structure using the same histogram ranges as the legacy grid statistics: */
+	Size numUnits(states.states.size());
+	stats.timeStamp=states.timeStamp;
+	stats.numUnits=numUnits;
+	stats.numBonds=numBonds;
+	stats.numUnbondedSites=0;
+	stats.bondLengthMin=Scalar(1.2);
+	stats.bondLengthMax=Scalar(2.2);
+	for(int i=0;i<BondStatistics::numBondLengthBins;++i)
+		stats.bondLengthHistogram[i]=0;
+	stats.averageBondLength=Scalar(0);
+	stats.bondAngleMin=Scalar(0.5)*Math::Constants<Scalar>::pi;
+	stats.bondAngleMax=Math::Constants<Scalar>::pi;
+	for(int i=0;i<BondStatistics::numBondAngleBins;++i)
+		stats.bondAngleHistogram[i]=0;
+	stats.averageBondAngle=Scalar(0);
+	stats.centerDistMin=Scalar(2.0);
+	stats.centerDistMax=Scalar(3.5);
+	for(int i=0;i<BondStatistics::numCenterDistBins;++i)
+		stats.centerDistHistogram[i]=0;
+	stats.averageCenterDist=Scalar(0);
+	stats.internalBondLengthMin=Scalar(2.2);
+	stats.internalBondLengthMax=Scalar(3.2);
+	for(int i=0;i<BondStatistics::numInternalBondLengthBins;++i)
+		stats.internalBondLengthHistogram[i]=0;
+	stats.averageInternalBondLength=Scalar(0);
+	stats.internalBondAngleMin=Scalar(0.5)*Math::Constants<Scalar>::pi;
+	stats.internalBondAngleMax=Math::Constants<Scalar>::pi;
+	for(int i=0;i<BondStatistics::numInternalBondAngleBins;++i)
+		stats.internalBondAngleHistogram[i]=0;
+	stats.averageInternalBondAngle=Scalar(0);
+	
+	/* Process all units: */
+	Size numBondHalves=0;
+	Size numInternalBonds=0;
+	std::vector<Point> sites;
+	std::vector<Vector> siteDirs;
+	std::vector<Scalar> siteDists;
+	for(Index ui0=0;ui0<numUnits;++ui0)
+		{
+		const UnitState& u0=states.states[ui0];
+		const UnitType& ut0=header.unitTypes[u0.unitType];
+		Index numSites=Index(ut0.bondSites.size());
+		sites.resize(numSites);
+		siteDirs.resize(numSites);
+		siteDists.resize(numSites);
+		
+		/* Process all the unit's bond sites: */
+		for(Index bsi0=0;bsi0<numSites;++bsi0)
+			{
+			Point site0=u0.position+u0.orientation.transform(ut0.bondSites[bsi0].offset);
+			Index site=bondSiteBases[ui0]+bsi0;
+			if(partnerUnits[site]!=unbondedSite)
+				{
+				/* Calculate the position of the bonded unit's image closest to this unit: */
+				const UnitState& u1=states.states[partnerUnits[site]];
+				const UnitType& ut1=header.unitTypes[u1.unitType];
+				Point pos1=u0.position+wrapDistance(header.domain,u1.position-u0.position);
+				
+				/* Calculate position of bond midpoint: */
+				sites[bsi0]=Geometry::mid(site0,pos1+u1.orientation.transform(ut1.bondSites[partnerSites[site]].offset));
+				Vector v1=u0.position-sites[bsi0];
+				siteDirs[bsi0]=v1;
+				Vector v2=pos1-sites[bsi0];
+				
+				/* Calculate bond lengths for this bond: */
+				Scalar l1=Geometry::mag(v1);
+				siteDists[bsi0]=l1;
+				Scalar l2=Geometry::mag(v2);
+				addToHistogram(stats.bondLengthHistogram,BondStatistics::numBondLengthBins,stats.bondLengthMin,stats.bondLengthMax,l1);
+				addToHistogram(stats.bondLengthHistogram,BondStatistics::numBondLengthBins,stats.bondLengthMin,stats.bondLengthMax,l2);
+				stats.averageBondLength+=l1+l2;
+				
+				/* Calculate bond angle for this bond: */
+				Scalar angle=calcAngle(v1,l1,v2,l2);
+				addToHistogram(stats.bondAngleHistogram,BondStatistics::numBondAngleBins,stats.bondAngleMin,stats.bondAngleMax,angle);
+				stats.averageBondAngle+=angle;
+				
+				/* Calculate center distance for this bond: */
+				Scalar cd=Geometry::dist(u0.position,pos1);
+				addToHistogram(stats.centerDistHistogram,BondStatistics::numCenterDistBins,stats.centerDistMin,stats.centerDistMax,cd);
+				stats.averageCenterDist+=cd;
+				
+				++numBondHalves;
+				}
+			else
+				{
+				sites[bsi0]=site0;
+				siteDirs[bsi0]=u0.position-site0;
+				siteDists[bsi0]=Geometry::mag(siteDirs[bsi0]);
+				
+				/* Increment number of unbonded sites: */
+				++stats.numUnbondedSites;
+				}
+			}
+		
+		/* Calculate internal bond lengths and bond angles: */
+		for(Index i1=0;i1+1<numSites;++i1)
+			for(Index i2=i1+1;i2<numSites;++i2)
+				{
+				Scalar l=Geometry::dist(sites[i1],sites[i2]);
+				addToHistogram(stats.internalBondLengthHistogram,BondStatistics::numInternalBondLengthBins,stats.internalBondLengthMin,stats.internalBondLengthMax,l);
+				stats.averageInternalBondLength+=l;
+				Scalar angle=calcAngle(siteDirs[i1],siteDists[i1],siteDirs[i2],siteDists[i2]);
+				addToHistogram(stats.internalBondAngleHistogram,BondStatistics::numInternalBondAngleBins,stats.internalBondAngleMin,stats.internalBondAngleMax,angle);
+				stats.averageInternalBondAngle+=angle;
+				++numInternalBonds;
+				}
+		}
+	
+	/* Calculate averages: */
+	if(numBondHalves>0)
+		{
+		stats.averageBondLength/=Scalar(numBondHalves)*Scalar(2);
+		stats.averageBondAngle/=Scalar(numBondHalves);
+		stats.averageCenterDist/=Scalar(numBondHalves);
+		}
+	if(numInternalBonds>0)
+		{
+		stats.averageInternalBondLength/=Scalar(numInternalBonds);
+		stats.averageInternalBondAngle/=Scalar(numInternalBonds);
+		}
+	}
+
+void* BondStatisticsCalculator::calcThreadMethod(void)
+	{
+	while(true)
+		{
+		/* Wait for the next posted snapshot: */
+		{
+		Threads::MutexCond::Lock calcLock(calcCond);
+		while(!posted&&!shutdown)
+			calcCond.wait(calcLock);
+		if(shutdown)
+			break;
+		}
+		
+		/* Bring the bonds up to date, then calculate statistics from the snapshot and post them: */
+		if(snapshot.fullUpdate)
+			setBonds(snapshot);
+		else
+			updateBonds(snapshot.bondEvents);
+		calcStatistics(snapshot.states,results.startNewValue());
+		results.postNewValue();
+		
+		/* Release the snapshot buffer: */
+		{
+		Threads::MutexCond::Lock calcLock(calcCond);
+		posted=false;
+		busy=false;
+		}
+		}
+	
+	return 0;
+	}
+
+BondStatisticsCalculator::BondStatisticsCalculator(Threads::TripleBuffer<BondStatistics>& sResults)
+	:results(sResults),
+	 busy(false),posted(false),shutdown(false),
+	 numBonds(0)
+	{
+	/* Start the calculation thread: */
+	calcThread.start(this,&BondStatisticsCalculator::calcThreadMethod);
+	}
+
+BondStatisticsCalculator::~BondStatisticsCalculator(void)
+	{
+	/* Shut down the calculation thread; a posted snapshot is outdated and can be dropped: */
+	{
+	Threads::MutexCond::Lock calcLock(calcCond);
+	shutdown=true;
+	calcCond.signal();
+	}
+	calcThread.join();
+	}
+
+BondStatisticsCalculator::Snapshot* BondStatisticsCalculator::startSnapshot(void)
+	{
+	/* Grab the snapshot buffer unless the previous snapshot is still being processed: */
+	Threads::MutexCond::Lock calcLock(calcCond);
+	if(busy)
+		return 0;
+	busy=true;
+	return &snapshot;
+	}
+
+void BondStatisticsCalculator::postSnapshot(BondStatisticsCalculator::Snapshot* newSnapshot)
+	{
+	/* Wake up the calculation thread: */
+	Threads::MutexCond::Lock calcLock(calcCond);
+	posted=true;
+	calcCond.signal();
+	}
+
@@ -0,0 +1,129 @@
+/***********************************************************************
+BondStatistics - Structure for statistics about the bonds between
+structural units, and class to calculate them from simulation state
+snapshots in a background thread.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef BONDSTATISTICS_INCLUDED
+#define BONDSTATISTICS_INCLUDED
+
+#include <vector>
+#include <Threads/MutexCond.h>
+#include <Threads/Thread.h>
+#include <Threads/TripleBuffer.h>
+
+#include "Common.h"
+#include "StateFile.h"
+
+struct BondStatistics // Structure to report statistics about the bonds between structural units in a simulation state
+	{
+	/* Elements: */
+	public:
+	Index timeStamp; // Simulation step for which the statistics were calculated
+	Size numUnits; // Number of structural units
+	Size numBonds; // Number of bonds between structural units
+	Size numUnbondedSites; // Number of bonding sites not bonded to another unit
+	static const int numBondLengthBins=20;
+	Scalar bondLengthMin,bondLengthMax; // Range of the bond length histogram
+	Size bondLengthHistogram[numBondLengthBins]; // Histogram of distances from unit centers to bond midpoints
+	Scalar averageBondLength;
+	static const int numBondAngleBins=18;
+	Scalar bondAngleMin,bondAngleMax; // Range of the bond angle histogram
+	Size bondAngleHistogram[numBondAngleBins]; // Histogram of angles between bonded unit centers at bond midpoints
+	Scalar averageBondAngle;
+	static const int numCenterDistBins=30;
+	Scalar centerDistMin,centerDistMax; // Range of the center distance histogram
+	Size centerDistHistogram[numCenterDistBins]; // Histogram of distances between bonded unit centers
+	Scalar averageCenterDist;
+	static const int numInternalBondLengthBins=20;
+	Scalar internalBondLengthMin,internalBondLengthMax; // Range of the internal bond length histogram
+	Size internalBondLengthHistogram[numInternalBondLengthBins]; // Histogram of distances between bonding sites or bond midpoints of the same unit
+	Scalar averageInternalBondLength;
+	static const int numInternalBondAngleBins=18;
+	Scalar internalBondAngleMin,internalBondAngleMax; // Range of the internal bond angle histogram
+	Size internalBondAngleHistogram[numInternalBondAngleBins]; // Histogram of angles between bonding sites or bond midpoints of the same unit at the unit's center
+	Scalar averageInternalBondAngle;
+	};
+
+class BondStatisticsCalculator
+	{
+	/* Embedded classes: */
+	public:
+	struct BondEvent // Structure for a bond created or broken between two snapshots
+		{
+		/* Elements: */
+		public:
+		bool created; // Flag whether the bond was created or broken
+		StateFileBond bond; // The bond's two halves
+		
+		/* Constructors and destructors: */
+		BondEvent(bool sCreated,Index unitIndex0,Index bondSiteIndex0,Index unitIndex1,Index bondSiteIndex1)
+			:created(sCreated)
+			{
+			bond.unitIndex[0]=unitIndex0;
+			bond.bondSiteIndex[0]=bondSiteIndex0;
+			bond.unitIndex[1]=unitIndex1;
+			bond.bondSiteIndex[1]=bondSiteIndex1;
+			}
+		};
+	
+	struct Snapshot // Structure for a simulation state queued for statistics calculation
+		{
+		/* Elements: */
+		public:
+		bool fullUpdate; // Flag whether the snapshot replaces the simulation setup and all bonds instead of updating the previous bonds, to be set by the caller
+		StateFileHeader header; // Simulation setup, to be filled in by the caller for full updates
+		UnitStateArray states; // Simulation step and unit states, to be filled in by the caller
+		std::vector<StateFileBond> bonds; // "Up" halves of all bonds, to be filled in by the caller for full updates
+		std::vector<BondEvent> bondEvents; // Bonds created or broken since the previous snapshot in order, to be filled in by the caller for incremental updates
+		};
+	
+	/* Elements: */
+	private:
+	Threads::TripleBuffer<BondStatistics>& results; // Triple buffer receiving calculated statistics
+	Threads::MutexCond calcCond; // Condition variable protecting the calculation state and signaling posted snapshots
+	Snapshot snapshot; // The single snapshot buffer
+	bool busy; // Flag whether the snapshot buffer is being filled in or processed
+	bool posted; // Flag whether the snapshot buffer is waiting to be processed
+	bool shutdown; // Flag to shut down the calculation thread
+	Threads::Thread calcThread; // Thread calculating statistics from posted snapshots
+	
+	/* Bond state maintained by the calculation thread: */
+	StateFileHeader header; // Simulation setup of the most recent full update
+	std::vector<Index> bondSiteBases; // Index of each unit's first bonding site in the bond partner arrays
+	std::vector<Index> partnerUnits; // Index of the unit bonded to each bonding site, or ~0 for unbonded sites
+	std::vector<Index> partnerSites; // Index of the bonding site bonded to each bonding site, or ~0 for unbonded sites
+	Size numBonds; // Number of current bonds
+	
+	/* Private methods: */
+	void setBonds(const Snapshot& fullSnapshot); // Replaces the simulation setup and all bonds from a full snapshot
+	void updateBonds(const std::vector<BondEvent>& bondEvents); // Applies the given bond events to the current bonds
+	void calcStatistics(const UnitStateArray& states,BondStatistics& stats) const; // Calculates bond statistics for the given unit states and the current bonds
+	void* calcThreadMethod(void); // Method calculating statistics from posted snapshots until shut down
+	
+	/* Constructors and destructors: */
+	public:
+	BondStatisticsCalculator(Threads::TripleBuffer<BondStatistics>& sResults); // Creates an idle calculator posting statistics into the given triple buffer
+	~BondStatisticsCalculator(void); // Shuts down the calculation thread after an ongoing calculation
+	
+	/* Methods: */
+	Snapshot* startSnapshot(void); // Returns the snapshot buffer to be filled in by the caller; returns null if the previous snapshot is still being processed
+	void postSnapshot(Snapshot* newSnapshot); // Starts calculating statistics from a filled-in snapshot
+	};
+
+#endif
@@ -0,0 +1,691 @@
+/***********************************************************************
+CarFileAtoms - Functions to read the atoms from an atom coordinate file
+in CAR format, and to fit SiO_4 tetrahedra to them.
+Copyright (c) 2004-2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "CarFileAtoms.h"
+
+#include <string.h>
+#include <strings.h>
+#include <iostream>
+#include <vector>
+#include <stdexcept>
+#include <Misc/StdError.h>
+#include <Threads/Thread.h>
+#include <Math/Math.h>
+#include <Math/Constants.h>
+#include <Geometry/ComponentArray.h>
+#include <Geometry/Point.h>
+
+#include "MappedFile.h"
+#include "AffineSpace.h"
+
+namespace NCK {
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+inline const char* skipSpace(const char* ptr,const char* end) // Skips whitespace inside a line
+	{
+	while(ptr!=end&&(*ptr==' '||*ptr=='\t'||*ptr=='\r'))
+		++ptr;
+	return ptr;
+	}
+
+inline const char* skipLine(const char* ptr,const char* end) // Returns pointer to the beginning of the next line
+	{
+	while(ptr!=end&&*ptr!='\n')
+		++ptr;
+	return ptr!=end?ptr+1:end;
+	}
+
+inline bool isDigit(char c)
+	{
+	return c>='0'&&c<='9';
+	}
+
+bool parseScalar(const char*& ptr,const char* end,Scalar& value) // Parses a decimal number in fixed or exponential notation; returns false on syntax error
+	{
+	static const double powers[]={1.0e0,1.0e1,1.0e2,1.0e3,1.0e4,1.0e5,1.0e6,1.0e7,1.0e8,1.0e9,1.0e10,1.0e11,1.0e12,1.0e13,1.0e14,1.0e15,1.0e16,1.0e17,1.0e18,1.0e19,1.0e20,1.0e21,1.0e22};
+	
+	ptr=skipSpace(ptr,end);
+	
+	/* Parse the sign: */
+	bool negative=false;
+	if(ptr!=end&&(*ptr=='-'||*ptr=='+'))
+		{
+		negative=*ptr=='-';
+		++ptr;
+		}
+	
+	/* Parse up to 18 significant digits of the mantissa into an integer, and track the decimal exponent: */
+	unsigned long long mantissa=0;
+	int numSignificantDigits=0;
+	int exponent=0;
+	bool haveDigits=false;
+	for(;ptr!=end&&isDigit(*ptr);++ptr)
+		{
+		haveDigits=true;
+		if(numSignificantDigits<18)
+			{
+			mantissa=mantissa*10+(unsigned long long)(*ptr-'0');
+			if(mantissa!=0)
+				++numSignificantDigits;
+			}
+		else
+			++exponent;
+		}
+	if(ptr!=end&&*ptr=='.')
+		{
+		for(++ptr;ptr!=end&&isDigit(*ptr);++ptr)
+			{
+			haveDigits=true;
+			if(numSignificantDigits<18)
+				{
+				mantissa=mantissa*10+(unsigned long long)(*ptr-'0');
+				if(mantissa!=0)
+					++numSignificantDigits;
+				--exponent;
+				}
+			}
+		}
+	if(!haveDigits)
+		return false;
+	
+	/* Parse the optional exponent: */
+	if(ptr!=end&&(*ptr=='e'||*ptr=='E'))
+		{
+		++ptr;
+		bool negativeExponent=false;
+		if(ptr!=end&&(*ptr=='-'||*ptr=='+'))
+			{
+			negativeExponent=*ptr=='-';
+			++ptr;
+			}
+		if(ptr==end||!isDigit(*ptr))
+			return false;
+		int e=0;
+		for(;ptr!=end&&isDigit(*ptr);++ptr)
+			if(e<10000)
+				e=e*10+(*ptr-'0');
+		exponent+=negativeExponent?-e:e;
+		}
+	
+	/* Assemble the result; dividing by exact powers of ten keeps typical coordinates correctly rounded: */
+	double result=double(mantissa);
+	if(exponent<0)
+		result=exponent>=-22?result/powers[-exponent]:result*Math::pow(10.0,double(exponent));
+	else if(exponent>0)
+		result=exponent<=22?result*powers[exponent]:result*Math::pow(10.0,double(exponent));
+	value=Scalar(negative?-result:result);
+	
+	return true;
+	}
+
+class CarFileParser // Class to parse a range of atom lines from a CAR file
+	{
+	/* Elements: */
+	public:
+	const CarFileAtoms* atoms; // Atom structure defining the cell grid
+	const char* begin; // Beginning of the first line in the parser's range
+	const char* end; // End of the parser's range, at the beginning of a line
+	std::vector<unsigned char> elements; // Elements of the parsed atoms
+	std::vector<Point> positions; // Positions of the parsed atoms
+	std::vector<unsigned int> cells; // Cell indices of the parsed atoms
+	bool sawEnd; // Flag if the parser encountered the end of the atom section
+	unsigned int numBadLines; // Number of lines that could not be parsed
+	
+	/* Methods: */
+	void* run(void); // Parses all atom lines in the parser's range
+	};
+
+void* CarFileParser::run(void)
+	{
+	sawEnd=false;
+	numBadLines=0;
+	for(const char* linePtr=begin;linePtr!=end;linePtr=skipLine(linePtr,end))
+		{
+		/* Skip empty lines, and stop at the end of the atom section: */
+		const char* ptr=skipSpace(linePtr,end);
+		if(ptr==end||*ptr=='\n')
+			continue;
+		if(end-ptr>=3&&strncmp(ptr,"end",3)==0)
+			{
+			sawEnd=true;
+			break;
+			}
+		
+		/* Parse the atom's element from the prefix of the atom's name: */
+		CarFileAtoms::Element element;
+		if(end-ptr>=2&&strncasecmp(ptr,"Si",2)==0)
+			element=CarFileAtoms::SI;
+		else if(*ptr=='O'||*ptr=='o')
+			element=CarFileAtoms::O;
+		else
+			{
+			++numBadLines;
+			continue;
+			}
+		while(ptr!=end&&*ptr!=' '&&*ptr!='\t'&&*ptr!='\n')
+			++ptr;
+		
+		/* Parse the atom's position: */
+		Point position;
+		bool ok=true;
+		for(int i=0;i<3&&ok;++i)
+			ok=parseScalar(ptr,end,position[i]);
+		if(!ok)
+			{
+			++numBadLines;
+			continue;
+			}
+		
+		/* Store the atom: */
+		elements.push_back((unsigned char)(element));
+		positions.push_back(position);
+		cells.push_back(atoms->calcCellIndex(position));
+		}
+	
+	return 0;
+	}
+
+}
+
+/*****************************
+Methods of struct CarFileAtoms:
+*****************************/
+
+unsigned int CarFileAtoms::calcCellIndex(const Point& p) const
+	{
+	unsigned int result=0;
+	for(int i=0;i<3;++i)
+		{
+		int index=int(Math::floor(p[i]/cellSize[i]));
+		if(index<0)
+			index=0;
+		else if(index>gridSize[i]-1)
+			index=gridSize[i]-1;
+		result=result*(unsigned int)(gridSize[i])+(unsigned int)(index);
+		}
+	return result;
+	}
+
+int CarFileAtoms::findClosestAtoms(const Point& center,CarFileAtoms::Element element,Scalar maxDist,int maxNumAtoms,unsigned int atomIndices[],Vector atomShifts[],int* numCandidates) const
+	{
+	/* Find the index of the cell containing the center point: */
+	int centerIndex[3];
+	for(int i=0;i<3;++i)
+		{
+		centerIndex[i]=int(Math::floor(center[i]/cellSize[i]));
+		if(centerIndex[i]<0)
+			centerIndex[i]=0;
+		else if(centerIndex[i]>gridSize[i]-1)
+			centerIndex[i]=gridSize[i]-1;
+		}
+	
+	/* Search the cell's neighbourhood, wrapping around the periodic box instead of storing ghost atoms: */
+	Scalar maxDist2=Math::sqr(maxDist);
+	int numAtoms=0;
+	int numWithin=0;
+	int offset[3];
+	for(offset[0]=-1;offset[0]<=1;++offset[0])
+		for(offset[1]=-1;offset[1]<=1;++offset[1])
+			for(offset[2]=-1;offset[2]<=1;++offset[2])
+				{
+				/* Calculate the wrapped cell index and the position shift of the cell's atoms: */
+				unsigned int cellIndex=0;
+				Vector shift;
+				for(int i=0;i<3;++i)
+					{
+					int index=centerIndex[i]+offset[i];
+					shift[i]=Scalar(0);
+					if(index<0)
+						{
+						index+=gridSize[i];
+						shift[i]=-boxSize[i];
+						}
+					else if(index>=gridSize[i])
+						{
+						index-=gridSize[i];
+						shift[i]=boxSize[i];
+						}
+					cellIndex=cellIndex*(unsigned int)(gridSize[i])+(unsigned int)(index);
+					}
+				
+				/* Test all atoms of the requested element in the cell: */
+				for(unsigned int cai=cellStarts[cellIndex];cai<cellStarts[cellIndex+1];++cai)
+					{
+					unsigned int atomIndex=cellAtoms[cai];
+					if(elements[atomIndex]!=element)
+						continue;
+					Scalar dist2=Geometry::sqrDist(positions[atomIndex]+shift,center);
+					if(dist2>=Math::sqr(maxDist))
+						continue;
+					++numWithin;
+					
+					/* Sort the atom into the result arrays: */
+					if(dist2<maxDist2)
+						{
+						int i=numAtoms<maxNumAtoms?numAtoms++:maxNumAtoms-1;
+						for(;i>0&&Geometry::sqrDist(positions[atomIndices[i-1]]+atomShifts[i-1],center)>dist2;--i)
+							{
+							atomIndices[i]=atomIndices[i-1];
+							atomShifts[i]=atomShifts[i-1];
+							}
+						atomIndices[i]=atomIndex;
+						atomShifts[i]=shift;
+						if(numAtoms==maxNumAtoms)
+							maxDist2=Geometry::sqrDist(positions[atomIndices[maxNumAtoms-1]]+atomShifts[maxNumAtoms-1],center);
+						}
+					}
+				}
+	
+	if(numCandidates!=0)
+		*numCandidates=numWithin;
+	return numAtoms;
+	}
+
+void readCarFileAtoms(const char* carFileName,Scalar minCellSize,int numThreads,CarFileAtoms& atoms)
+	{
+	/* Map the CAR file into memory: */
+	MappedFile carFile(carFileName);
+	const char* filePtr=carFile.begin();
+	const char* fileEnd=carFile.end();
+	
+	/* Skip CAR file header: */
+	for(int i=0;i<4;++i)
+		filePtr=skipLine(filePtr,fileEnd);
+	
+	/* Read grid size: */
+	const char* ptr=skipSpace(filePtr,fileEnd);
+	bool ok=fileEnd-ptr>=3&&strncmp(ptr,"PBC",3)==0;
+	if(ok)
+		ptr+=3;
+	for(int i=0;i<3&&ok;++i)
+		ok=parseScalar(ptr,fileEnd,atoms.boxSize[i]);
+	if(!ok)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Cannot parse grid size from input file");
+	filePtr=skipLine(filePtr,fileEnd);
+	
+	/* Determine optimum number of cells: */
+	for(int i=0;i<3;++i)
+		{
+		atoms.gridSize[i]=int(Math::floor(atoms.boxSize[i]/minCellSize));
+		if(atoms.gridSize[i]<1)
+			atoms.gridSize[i]=1;
+		atoms.cellSize[i]=atoms.boxSize[i]/Scalar(atoms.gridSize[i]);
+		}
+	
+	/* Split the atom section into line-aligned chunks, one per parser: */
+	if(numThreads<1)
+		numThreads=1;
+	std::vector<CarFileParser> parsers(numThreads);
+	const char* chunkBegin=filePtr;
+	for(int i=0;i<numThreads;++i)
+		{
+		const char* chunkEnd=fileEnd;
+		if(i<numThreads-1)
+			{
+			chunkEnd=filePtr+((fileEnd-filePtr)*(i+1))/numThreads;
+			if(chunkEnd<chunkBegin)
+				chunkEnd=chunkBegin;
+			else if(chunkEnd>chunkBegin)
+				chunkEnd=skipLine(chunkEnd-1,fileEnd);
+			}
+		parsers[i].atoms=&atoms;
+		parsers[i].begin=chunkBegin;
+		parsers[i].end=chunkEnd;
+		chunkBegin=chunkEnd;
+		}
+	
+	/* Run all but the first parser in their own threads, and the first parser in the calling thread: */
+	Threads::Thread* parserThreads=numThreads>1?new Threads::Thread[numThreads-1]:0;
+	for(int i=1;i<numThreads;++i)
+		parserThreads[i-1].start(&parsers[i],&CarFileParser::run);
+	parsers[0].run();
+	for(int i=1;i<numThreads;++i)
+		parserThreads[i-1].join();
+	delete[] parserThreads;
+	
+	/* Concatenate the parsed atoms in file order up to the end of the atom section: */
+	int numParsers=0;
+	size_t numAtoms=0;
+	unsigned int numBadLines=0;
+	while(numParsers<numThreads)
+		{
+		numAtoms+=parsers[numParsers].positions.size();
+		numBadLines+=parsers[numParsers].numBadLines;
+		if(parsers[numParsers++].sawEnd)
+			break;
+		}
+	if(numBadLines>0)
+		std::cerr<<"Skipped "<<numBadLines<<" unparseable atom lines"<<std::endl;
+	atoms.elements.clear();
+	atoms.elements.reserve(numAtoms);
+	atoms.positions.clear();
+	atoms.positions.reserve(numAtoms);
+	atoms.cellStarts.assign(size_t(atoms.gridSize[0])*size_t(atoms.gridSize[1])*size_t(atoms.gridSize[2])+1,0);
+	for(int i=0;i<numParsers;++i)
+		{
+		CarFileParser& p=parsers[i];
+		atoms.elements.insert(atoms.elements.end(),p.elements.begin(),p.elements.end());
+		atoms.positions.insert(atoms.positions.end(),p.positions.begin(),p.positions.end());
+		for(std::vector<unsigned int>::iterator cIt=p.cells.begin();cIt!=p.cells.end();++cIt)
+			++atoms.cellStarts[*cIt+1];
+		}
+	
+	/* Sort the atoms into their cells: */
+	size_t numCells=atoms.cellStarts.size()-1;
+	for(size_t i=0;i<numCells;++i)
+		atoms.cellStarts[i+1]+=atoms.cellStarts[i];
+	atoms.cellAtoms.resize(numAtoms);
+	unsigned int atomIndex=0;
+	for(int i=0;i<numParsers;++i)
+		for(std::vector<unsigned int>::iterator cIt=parsers[i].cells.begin();cIt!=parsers[i].cells.end();++cIt,++atomIndex)
+			atoms.cellAtoms[atoms.cellStarts[*cIt]++]=atomIndex;
+	
+	/* Each cell's insertion cursor now points to the next cell's start; shift the start indices back: */
+	for(size_t i=numCells;i>0;--i)
+		atoms.cellStarts[i]=atoms.cellStarts[i-1];
+	atoms.cellStarts[0]=0;
+	}
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const Scalar maxSiOBondLength=Scalar(2); // Largest distance between a silicon atom and a bonded oxygen atom in Angstrom
+const Scalar maxFitResidual=Scalar(0.05); // Largest acceptable sum of squared distances between fitted unit vertex and oxygen directions
+
+void calcMaxEigenvector(Scalar a[4][4],Scalar eigenvector[4]) // Returns the eigenvector of the largest eigenvalue of the given symmetric matrix, which is destroyed in the process
+	{
+	/* Diagonalize the matrix by cyclic Jacobi rotations: */
+	Scalar v[4][4];
+	for(int i=0;i<4;++i)
+		for(int j=0;j<4;++j)
+			v[i][j]=i==j?Scalar(1):Scalar(0);
+	for(int sweep=0;sweep<50;++sweep)
+		{
+		/* Stop when the off-diagonal elements vanish: */
+		Scalar offDiagonal=Scalar(0);
+		for(int p=0;p<3;++p)
+			for(int q=p+1;q<4;++q)
+				offDiagonal+=Math::abs(a[p][q]);
+		if(offDiagonal<Scalar(1.0e-14))
+			break;
+		
+		for(int p=0;p<3;++p)
+			for(int q=p+1;q<4;++q)
+				if(a[p][q]!=Scalar(0))
+					{
+					/* Calculate the Jacobi rotation that annihilates a[p][q]: */
+					Scalar theta=(a[q][q]-a[p][p])/(Scalar(2)*a[p][q]);
+					Scalar t=Scalar(1)/(Math::abs(theta)+Math::sqrt(Math::sqr(theta)+Scalar(1)));
+					if(theta<Scalar(0))
+						t=-t;
+					Scalar c=Scalar(1)/Math::sqrt(Math::sqr(t)+Scalar(1));
+					Scalar s=t*c;
+					
+					/* Apply the rotation to the matrix and accumulate it into the eigenvectors: */
+					for(int k=0;k<4;++k)
+						{
+						Scalar akp=a[k][p];
+						Scalar akq=a[k][q];
+						a[k][p]=c*akp-s*akq;
+						a[k][q]=s*akp+c*akq;
+						}
+					for(int k=0;k<4;++k)
+						{
+						Scalar apk=a[p][k];
+						Scalar aqk=a[q][k];
+						a[p][k]=c*apk-s*aqk;
+						a[q][k]=s*apk+c*aqk;
+						}
+					for(int k=0;k<4;++k)
+						{
+						Scalar vkp=v[k][p];
+						Scalar vkq=v[k][q];
+						v[k][p]=c*vkp-s*vkq;
+						v[k][q]=s*vkp+c*vkq;
+						}
+					}
+		}
+	
+	/* Return the eigenvector of the largest eigenvalue: */
+	int maxIndex=0;
+	for(int i=1;i<4;++i)
+		if(a[maxIndex][maxIndex]<a[i][i])
+			maxIndex=i;
+	for(int i=0;i<4;++i)
+		eigenvector[i]=v[i][maxIndex];
+	}
+
+Scalar calcOrientation(const Vector directions[4]) // Returns the signed volume spanned by four directions around a common center
+	{
+	Vector d[3];
+	for(int i=0;i<3;++i)
+		d[i]=directions[i+1]-directions[0];
+	return Geometry::cross(d[0],d[1])*d[2];
+	}
+
+Scalar fitTetrahedron(const Vector vertexDirections[4],const Point& silicon,const Point oxygens[4],Rotation& orientation,int vertexOxygens[4]) // Fits a tetrahedron with the given normalized vertex directions to the given four oxygens; returns the residual and the oxygen matched to each vertex
+	{
+	/* Calculate offset directions of given atom configuration: */
+	Vector atomOffsets[4];
+	for(int i=0;i<4;++i)
+		atomOffsets[i]=Geometry::normalize(oxygens[i]-silicon);
+	
+	/* Create mapping between atoms and tetrahedron vertices that preserves the tetrahedron's chirality: */
+	vertexOxygens[0]=0;
+	vertexOxygens[1]=1;
+	if((calcOrientation(atomOffsets)>Scalar(0))==(calcOrientation(vertexDirections)>Scalar(0)))
+		{
+		/* Atom configuration has the same orientation as the tetrahedron: */
+		vertexOxygens[2]=2;
+		vertexOxygens[3]=3;
+		}
+	else
+		{
+		/* Atom configuration has the opposite orientation: */
+		vertexOxygens[2]=3;
+		vertexOxygens[3]=2;
+		}
+	
+	/* Calculate the cross-covariance matrix between tetrahedron vertex directions and atom directions: */
+	Scalar s[3][3];
+	for(int i=0;i<3;++i)
+		for(int j=0;j<3;++j)
+			s[i][j]=Scalar(0);
+	for(int v=0;v<4;++v)
+		{
+		const Vector& ao=atomOffsets[vertexOxygens[v]];
+		for(int i=0;i<3;++i)
+			for(int j=0;j<3;++j)
+				s[i][j]+=vertexDirections[v][i]*ao[j];
+		}
+	
+	/* Calculate the optimal rotation as the dominant eigenvector of Horn's symmetric quaternion matrix: */
+	Scalar n[4][4];
+	n[0][0]=s[0][0]+s[1][1]+s[2][2];
+	n[0][1]=n[1][0]=s[1][2]-s[2][1];
+	n[0][2]=n[2][0]=s[2][0]-s[0][2];
+	n[0][3]=n[3][0]=s[0][1]-s[1][0];
+	n[1][1]=s[0][0]-s[1][1]-s[2][2];
+	n[1][2]=n[2][1]=s[0][1]+s[1][0];
+	n[1][3]=n[3][1]=s[2][0]+s[0][2];
+	n[2][2]=-s[0][0]+s[1][1]-s[2][2];
+	n[2][3]=n[3][2]=s[1][2]+s[2][1];
+	n[3][3]=-s[0][0]-s[1][1]+s[2][2];
+	Scalar q[4];
+	calcMaxEigenvector(n,q);
+	
+	/* Convert the unit quaternion (w, x, y, z) to a rotation: */
+	if(q[0]<Scalar(0))
+		for(int i=0;i<4;++i)
+			q[i]=-q[i];
+	Vector axis(q[1],q[2],q[3]);
+	Scalar axisLen=Geometry::mag(axis);
+	if(axisLen>Scalar(1.0e-12))
+		orientation=Rotation(axis*(Scalar(2)*Math::atan2(axisLen,q[0])/axisLen));
+	else
+		orientation=Rotation::identity;
+	
+	/* Return the residual between the rotated vertex directions and the atom directions: */
+	Scalar residual=Scalar(0);
+	for(int v=0;v<4;++v)
+		residual+=Geometry::sqrDist(Point::origin+orientation.transform(vertexDirections[v]),Point::origin+atomOffsets[vertexOxygens[v]]);
+	return residual;
+	}
+
+Scalar alignTetrahedron(const Vector vertexDirections[4],const Point& silicon,int numOxygens,const Point oxygens[],Rotation& orientation,int vertexOxygens[4]) // Fits a tetrahedron to the best four of the given oxygens, sorted by distance; returns the residual and the oxygen matched to each vertex
+	{
+	/* Fit the tetrahedron to the four closest oxygens: */
+	Scalar bestResidual=fitTetrahedron(vertexDirections,silicon,oxygens,orientation,vertexOxygens);
+	
+	/* Test all other subsets of four atoms from the given oxygens if the closest four are a poor fit: */
+	if(bestResidual>maxFitResidual&&numOxygens>4)
+		{
+		int is[4];
+		for(is[0]=0;is[0]<numOxygens-3;++is[0])
+			for(is[1]=is[0]+1;is[1]<numOxygens-2;++is[1])
+				for(is[2]=is[1]+1;is[2]<numOxygens-1;++is[2])
+					for(is[3]=is[2]+1;is[3]<numOxygens-0;++is[3])
+						{
+						/* Pick the four candidate oxygens: */
+						Point fit[4];
+						for(int i=0;i<4;++i)
+							fit[i]=oxygens[is[i]];
+						
+						/* Fit the tetrahedron to the selected oxygen atoms: */
+						Rotation fitOrientation;
+						int fitVertexOxygens[4];
+						Scalar residual=fitTetrahedron(vertexDirections,silicon,fit,fitOrientation,fitVertexOxygens);
+						if(residual<bestResidual)
+							{
+							bestResidual=residual;
+							orientation=fitOrientation;
+							for(int v=0;v<4;++v)
+								vertexOxygens[v]=is[fitVertexOxygens[v]];
+							}
+						}
+		}
+	
+	return bestResidual;
+	}
+
+class TetrahedronFitter // Class to fit tetrahedra to a range of silicon atoms
+	{
+	/* Elements: */
+	public:
+	const CarFileAtoms* atoms; // Atoms read from the CAR file
+	const Vector* vertexDirections; // Normalized directions from the tetrahedron's center to its four vertices
+	unsigned int begin,end; // Range of atom indices to process
+	std::vector<CarFileTetrahedron> results; // Fitted tetrahedra in atom order
+	unsigned int numAmbiguous; // Number of silicon atoms with more candidate oxygens than considered
+	
+	/* Methods: */
+	void* run(void); // Fits tetrahedra to all silicon atoms in the fitter's range
+	};
+
+void* TetrahedronFitter::run(void)
+	{
+	numAmbiguous=0;
+	for(unsigned int siIndex=begin;siIndex<end;++siIndex)
+		if(atoms->elements[siIndex]==CarFileAtoms::SI)
+			{
+			/* Find the closest oxygen atoms surrounding the atom: */
+			const Point& siPos=atoms->positions[siIndex];
+			const int maxNumOxygens=8;
+			unsigned int oxygenIndices[maxNumOxygens];
+			Vector oxygenShifts[maxNumOxygens];
+			int numOxygensTested;
+			int numOxygens=atoms->findClosestAtoms(siPos,CarFileAtoms::O,maxSiOBondLength,maxNumOxygens,oxygenIndices,oxygenShifts,&numOxygensTested);
+			
+			/* Check if four oxygen atoms were found: */
+			if(numOxygens>=4)
+				{
+				/* Count the unit if the correct four oxygen atoms cannot be detected: */
+				if(numOxygensTested>maxNumOxygens)
+					++numAmbiguous;
+				
+				/* Fit a tetrahedron to the oxygen positions: */
+				Point oxygens[maxNumOxygens];
+				for(int i=0;i<numOxygens;++i)
+					oxygens[i]=atoms->positions[oxygenIndices[i]]+oxygenShifts[i];
+				CarFileTetrahedron result;
+				result.siliconIndex=siIndex;
+				int vertexOxygens[4];
+				alignTetrahedron(vertexDirections,siPos,numOxygens,oxygens,result.orientation,vertexOxygens);
+				for(int v=0;v<4;++v)
+					result.oxygenIndices[v]=oxygenIndices[vertexOxygens[v]];
+				results.push_back(result);
+				}
+			}
+	
+	return 0;
+	}
+
+}
+
+unsigned int fitCarFileTetrahedra(const CarFileAtoms& atoms,const Vector vertexOffsets[4],int numThreads,std::vector<CarFileTetrahedron>& tetrahedra)
+	{
+	/* Normalize the tetrahedron's vertex offsets: */
+	Vector vertexDirections[4];
+	for(int v=0;v<4;++v)
+		vertexDirections[v]=Geometry::normalize(vertexOffsets[v]);
+	
+	/* Split the atoms evenly between the requested number of fitters: */
+	if(numThreads<1)
+		numThreads=1;
+	unsigned int numAtoms=(unsigned int)(atoms.positions.size());
+	std::vector<TetrahedronFitter> fitters(numThreads);
+	for(int i=0;i<numThreads;++i)
+		{
+		fitters[i].atoms=&atoms;
+		fitters[i].vertexDirections=vertexDirections;
+		fitters[i].begin=(unsigned int)((size_t(numAtoms)*size_t(i))/size_t(numThreads));
+		fitters[i].end=(unsigned int)((size_t(numAtoms)*size_t(i+1))/size_t(numThreads));
+		}
+	
+	/* Run all but the first fitter in their own threads, and the first fitter in the calling thread: */
+	Threads::Thread* fitterThreads=numThreads>1?new Threads::Thread[numThreads-1]:0;
+	for(int i=1;i<numThreads;++i)
+		fitterThreads[i-1].start(&fitters[i],&TetrahedronFitter::run);
+	fitters[0].run();
+	for(int i=1;i<numThreads;++i)
+		fitterThreads[i-1].join();
+	delete[] fitterThreads;
+	
+	/* Collect the fitted tetrahedra in atom order: */
+	tetrahedra.clear();
+	unsigned int numAmbiguous=0;
+	for(int i=0;i<numThreads;++i)
+		{
+		tetrahedra.insert(tetrahedra.end(),fitters[i].results.begin(),fitters[i].results.end());
+		numAmbiguous+=fitters[i].numAmbiguous;
+		}
+	
+	return numAmbiguous;
+	}
+
+}
@@ -0,0 +1,70 @@
+/***********************************************************************
+CarFileAtoms - Functions to read the atoms from an atom coordinate file
+in CAR format, and to fit SiO_4 tetrahedra to them.
+Copyright (c) 2004-2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef CARFILEATOMS_INCLUDED
+#define CARFILEATOMS_INCLUDED
+
+#include <vector>
+#include <Geometry/ComponentArray.h>
+
+#include "AffineSpace.h"
+
+namespace NCK {
+
+struct CarFileAtoms // Structure for the atoms read from a CAR file, binned into a periodic grid of cells
+	{
+	/* Embedded classes: */
+	public:
+	enum Element // Enumerated type for chemical elements
+		{
+		SI,O
+		};
+	
+	typedef Geometry::ComponentArray<Scalar,3> Size; // Data type for sizes of boxes and cells
+	
+	/* Elements: */
+	Size boxSize; // Size of the CAR file's periodic box, whose lower corner is at the origin
+	int gridSize[3]; // Number of cells along each axis
+	Size cellSize; // Size of a single cell
+	std::vector<unsigned char> elements; // Elements of all atoms in file order
+	std::vector<Point> positions; // Positions of all atoms in file order
+	std::vector<unsigned int> cellStarts; // Index of the first entry of each cell in the cell atom array, followed by the total number of atoms
+	std::vector<unsigned int> cellAtoms; // Indices of all atoms sorted by cell
+	
+	/* Methods: */
+	unsigned int calcCellIndex(const Point& p) const; // Returns the linear index of the cell containing the given point, clamped to the grid
+	int findClosestAtoms(const Point& center,Element element,Scalar maxDist,int maxNumAtoms,unsigned int atomIndices[],Vector atomShifts[],int* numCandidates =0) const; // Finds up to the given number of atoms of the given element closest to the given point, sorted by distance; periodic images are returned as atom indices with position shifts; returns number of atoms found and optionally the number of atoms within the maximum distance
+	};
+
+struct CarFileTetrahedron // Structure for an SiO_4 tetrahedron fitted to the atoms of a CAR file
+	{
+	/* Elements: */
+	public:
+	unsigned int siliconIndex; // Index of the tetrahedron's silicon atom
+	Rotation orientation; // Best-fit orientation of the tetrahedron's vertex offsets
+	unsigned int oxygenIndices[4]; // Indices of the oxygen atoms matched to the tetrahedron's four vertices
+	};
+
+void readCarFileAtoms(const char* carFileName,Scalar minCellSize,int numThreads,CarFileAtoms& atoms); // Reads all atoms from the given CAR file, parsing it in parallel with the given number of threads
+unsigned int fitCarFileTetrahedra(const CarFileAtoms& atoms,const Vector vertexOffsets[4],int numThreads,std::vector<CarFileTetrahedron>& tetrahedra); // Fits tetrahedra with the given vertex offsets to all silicon atoms with at least four oxygen neighbors, in parallel with the given number of threads; returns the number of silicon atoms with ambiguous oxygen neighborhoods
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+/***********************************************************************
+CarImporter - Function to convert an atom coordinate file in CAR format
+into an initial unit state array and bond list for the simulation.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "CarImporter.h"
+
+#include <vector>
+#include <Misc/StdError.h>
+#include <Math/Math.h>
+
+#include "AffineSpace.h"
+#include "CarFileAtoms.h"
+
+void importCarFile(const char* carFileName,const UnitTypeList& unitTypes,const std::string& unitTypeName,int numThreads,CarImport& result)
+	{
+	/* Find the unit type representing SiO_4 tetrahedra: */
+	UnitTypeID unitTypeId=0;
+	while(unitTypeId<unitTypes.size()&&unitTypes[unitTypeId].name!=unitTypeName)
+		++unitTypeId;
+	if(unitTypeId==unitTypes.size())
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Unit type %s not found",unitTypeName.c_str());
+	const UnitType& ut=unitTypes[unitTypeId];
+	if(ut.bondSites.size()!=4)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Unit type %s does not have four bonding sites",unitTypeName.c_str());
+	
+	/* Read all atoms from the CAR file: */
+	NCK::CarFileAtoms atoms;
+	NCK::readCarFileAtoms(carFileName,NCK::Scalar(2),numThreads,atoms); // Maximal Si-O bond distance is 2 Angstrom
+	
+	/* Fit the unit type's bonding sites to the oxygen atoms surrounding all silicon atoms: */
+	NCK::Vector vertexOffsets[4];
+	for(int v=0;v<4;++v)
+		for(int i=0;i<3;++i)
+			vertexOffsets[v][i]=NCK::Scalar(ut.bondSites[v].offset[i]);
+	std::vector<NCK::CarFileTetrahedron> tetrahedra;
+	result.numAmbiguous=Size(NCK::fitCarFileTetrahedra(atoms,vertexOffsets,numThreads,tetrahedra));
+	
+	/* Set the simulation domain to the CAR file's periodic box: */
+	Point domainMax;
+	for(int i=0;i<3;++i)
+		domainMax[i]=Scalar(atoms.boxSize[i]);
+	result.domain=Box(Point::origin,domainMax);
+	
+	/* Create a unit at rest for each fitted tetrahedron, wrapped into the periodic box: */
+	result.states.states.clear();
+	result.states.states.reserve(tetrahedra.size());
+	for(std::vector<NCK::CarFileTetrahedron>::iterator tIt=tetrahedra.begin();tIt!=tetrahedra.end();++tIt)
+		{
+		UnitState unit;
+		unit.unitType=unitTypeId;
+		unit.pickId=0;
+		const NCK::Point& siPos=atoms.positions[tIt->siliconIndex];
+		for(int i=0;i<3;++i)
+			{
+			NCK::Scalar size=atoms.boxSize[i];
+			unit.position[i]=Scalar(siPos[i]-Math::floor(siPos[i]/size)*size);
+			}
+		unit.orientation=Rotation(tIt->orientation);
+		unit.linearVelocity=Vector::zero;
+		unit.angularVelocity=Vector::zero;
+		result.states.states.push_back(unit);
+		}
+	
+	/* Bond the bonding sites of all pairs of units that were fitted to the same oxygen atom: */
+	const Index unbonded=~Index(0);
+	std::vector<Index> oxygenUnitIndices(atoms.positions.size(),unbonded); // Index of the first unit fitted to each oxygen atom
+	std::vector<Index> oxygenBondSiteIndices(atoms.positions.size(),unbonded); // Index of the first unit's bonding site fitted to each oxygen atom, or unbonded if the oxygen is already shared
+	result.bonds.clear();
+	Index unitIndex=0;
+	for(std::vector<NCK::CarFileTetrahedron>::iterator tIt=tetrahedra.begin();tIt!=tetrahedra.end();++tIt,++unitIndex)
+		for(Index bsi=0;bsi<4;++bsi)
+			{
+			unsigned int oxygenIndex=tIt->oxygenIndices[bsi];
+			if(oxygenUnitIndices[oxygenIndex]==unbonded)
+				{
+				/* Claim the oxygen atom for this unit's bonding site: */
+				oxygenUnitIndices[oxygenIndex]=unitIndex;
+				oxygenBondSiteIndices[oxygenIndex]=bsi;
+				}
+			else if(oxygenBondSiteIndices[oxygenIndex]!=unbonded&&oxygenUnitIndices[oxygenIndex]!=unitIndex)
+				{
+				/* Bond this unit's bonding site to the first unit's bonding site: */
+				CarImport::Bond bond;
+				bond.unitIndex[0]=oxygenUnitIndices[oxygenIndex];
+				bond.bondSiteIndex[0]=oxygenBondSiteIndices[oxygenIndex];
+				bond.unitIndex[1]=unitIndex;
+				bond.bondSiteIndex[1]=bsi;
+				result.bonds.push_back(bond);
+				
+				/* Mark the oxygen atom as shared; oxygens can only bridge two units: */
+				oxygenBondSiteIndices[oxygenIndex]=unbonded;
+				}
+			}
+	}
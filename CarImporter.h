@@ -0,0 +1,49 @@
+/***********************************************************************
+CarImporter - Function to convert an atom coordinate file in CAR format
+into an initial unit state array and bond list for the simulation.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef CARIMPORTER_INCLUDED
+#define CARIMPORTER_INCLUDED
+
+#include <vector>
+
+#include "Common.h"
+
+struct CarImport // Structure holding the contents of a CAR file converted to structural units
+	{
+	/* Embedded classes: */
+	public:
+	struct Bond // Structure for a bond between two imported units created from a shared oxygen atom
+		{
+		/* Elements: */
+		public:
+		Index unitIndex[2]; // Indices of the two bonded units in the unit state array
+		Index bondSiteIndex[2]; // Indices of the two bonded units' bonding sites
+		};
+	
+	/* Elements: */
+	Box domain; // Simulation domain covering the CAR file's periodic box
+	UnitStateArray states; // States of all imported units, at rest and in silicon atom order
+	std::vector<Bond> bonds; // List of bonds between imported units
+	Size numAmbiguous; // Number of units whose oxygen neighborhood was ambiguous
+	};
+
+void importCarFile(const char* carFileName,const UnitTypeList& unitTypes,const std::string& unitTypeName,int numThreads,CarImport& result); // Converts all SiO_4 tetrahedra in the given CAR file into units of the unit type of the given name, using the given number of threads
+
+#endif
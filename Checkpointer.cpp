@@ -0,0 +1,545 @@
+/***********************************************************************
+Checkpointer - Class to write periodic base and incremental checkpoints
+of a simulation state from a background thread, and function to recover
+the newest checkpointed simulation state.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "Checkpointer.h"
+
+#include <string.h>
+#include <utility>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <Misc/StdError.h>
+#include <Misc/MessageLogger.h>
+#include <IO/OpenFile.h>
+
+#include "IO.h"
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const char* checkpointFileTag="NCK Checkpoint 1.0\r\n";
+const char diffTag[4]={'D','I','F','F'}; // Tag starting an incremental checkpoint
+const char diffEndTag[4]={'D','E','N','D'}; // Tag ending an incremental checkpoint
+typedef StateRecord<UnitState> Record; // Packed representation of unit states in incremental checkpoints
+
+struct BondLess // Functor to sort bonds lexicographically
+	{
+	/* Methods: */
+	public:
+	bool operator()(const StateFileBond& b0,const StateFileBond& b1) const
+		{
+		for(int i=0;i<2;++i)
+			{
+			if(b0.unitIndex[i]!=b1.unitIndex[i])
+				return b0.unitIndex[i]<b1.unitIndex[i];
+			if(b0.bondSiteIndex[i]!=b1.bondSiteIndex[i])
+				return b0.bondSiteIndex[i]<b1.bondSiteIndex[i];
+			}
+		return false;
+		}
+	};
+
+std::string getCheckpointFileName(const std::string& baseFileName,Misc::UInt32 sequence) // Returns the name of the checkpoint file holding the base checkpoint of the given sequence number
+	{
+	std::string result=baseFileName;
+	result.push_back('.');
+	result.push_back(sequence%2U==0U?'0':'1');
+	return result;
+	}
+
+Misc::UInt32 readCheckpointHeader(IO::File& file) // Reads a checkpoint file's header and returns the sequence number of its base checkpoint
+	{
+	/* Check the file identifier: */
+	char tag[32];
+	file.read(tag,sizeof(tag));
+	tag[sizeof(tag)-1]='\0';
+	if(strcmp(tag,checkpointFileTag)!=0)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Input file is not a checkpoint file");
+	
+	return file.read<Misc::UInt32>();
+	}
+
+bool readCheckpointSequence(const std::string& fileName,Misc::UInt32& sequence) // Reads the base checkpoint sequence number of the given checkpoint file; returns false if the file can not be read
+	{
+	try
+		{
+		IO::FilePtr file=IO::openFile(fileName.c_str());
+		file->setEndianness(Misc::LittleEndian);
+		sequence=readCheckpointHeader(*file);
+		return true;
+		}
+	catch(const std::runtime_error&)
+		{
+		return false;
+		}
+	}
+
+void packStates(const UnitStateArray& states,std::vector<Misc::UInt8>& packedStates) // Packs the given unit states into the given byte buffer
+	{
+	packedStates.resize(states.states.size()*Record::size);
+	Misc::UInt8* rPtr=packedStates.data();
+	for(UnitStateArray::UnitStateList::const_iterator sIt=states.states.begin();sIt!=states.states.end();++sIt,rPtr+=Record::size)
+		Record::pack(*sIt,rPtr);
+	}
+
+void writeBondList(IO::File& file,const std::vector<StateFileBond>& bonds) // Writes a list of bonds to an incremental checkpoint
+	{
+	file.write<Size>(Size(bonds.size()));
+	for(std::vector<StateFileBond>::const_iterator bIt=bonds.begin();bIt!=bonds.end();++bIt)
+		for(int i=0;i<2;++i)
+			{
+			file.write<Index>(bIt->unitIndex[i]);
+			file.write<Misc::UInt8>(Misc::UInt8(bIt->bondSiteIndex[i]));
+			}
+	}
+
+void readBondList(IO::File& file,std::vector<StateFileBond>& bonds) // Reads a list of bonds from an incremental checkpoint
+	{
+	Size numBonds=file.read<Size>();
+	bonds.clear();
+	bonds.reserve(numBonds);
+	StateFileBond bond;
+	for(Size i=0;i<numBonds;++i)
+		{
+		for(int j=0;j<2;++j)
+			{
+			bond.unitIndex[j]=file.read<Index>();
+			bond.bondSiteIndex[j]=file.read<Misc::UInt8>();
+			}
+		bonds.push_back(bond);
+		}
+	}
+
+struct Increment // Structure holding an incremental checkpoint read from a checkpoint file
+	{
+	/* Elements: */
+	public:
+	Index timeStamp; // Simulation step of the incremental checkpoint
+	Size numUnits; // Number of units in the checkpointed simulation state
+	Size chunkSize; // Number of units per chunk
+	std::vector<Index> chunkIndices; // Indices of changed chunks
+	std::vector<UnitState> chunkStates; // Unit states of all changed chunks, in chunk index order
+	std::vector<StateFileBond> removedBonds; // Bonds removed since the previous checkpoint
+	std::vector<StateFileBond> addedBonds; // Bonds added since the previous checkpoint
+	};
+
+bool readIncrement(IO::File& file,Increment& increment) // Reads the next incremental checkpoint from the given file; returns false if there is no complete incremental checkpoint
+	{
+	try
+		{
+		/* Check the record tag: */
+		char tag[4];
+		file.read(tag,sizeof(tag));
+		if(memcmp(tag,diffTag,sizeof(tag))!=0)
+			return false;
+		
+		/* Read the record header: */
+		increment.timeStamp=file.read<Index>();
+		increment.numUnits=file.read<Size>();
+		increment.chunkSize=file.read<Size>();
+		Misc::UInt32 numChangedChunks=file.read<Misc::UInt32>();
+		if(increment.chunkSize==0)
+			return false;
+		Size numChunks=(increment.numUnits+increment.chunkSize-1)/increment.chunkSize;
+		
+		/* Read all changed chunks: */
+		increment.chunkIndices.clear();
+		increment.chunkStates.clear();
+		bool swap=file.mustSwapOnRead();
+		std::vector<Misc::UInt8> chunk;
+		UnitState state;
+		for(Misc::UInt32 i=0;i<numChangedChunks;++i)
+			{
+			Index chunkIndex=file.read<Misc::UInt32>();
+			if(chunkIndex>=numChunks||(!increment.chunkIndices.empty()&&chunkIndex<=increment.chunkIndices.back()))
+				return false;
+			increment.chunkIndices.push_back(chunkIndex);
+			Index first=chunkIndex*increment.chunkSize;
+			Size chunkNumUnits=std::min(increment.numUnits-first,increment.chunkSize);
+			chunk.resize(chunkNumUnits*Record::size);
+			file.read(chunk.data(),chunk.size());
+			if(swap)
+				swapStateRecords<UnitState>(chunk.data(),chunkNumUnits);
+			const Misc::UInt8* rPtr=chunk.data();
+			for(Size j=0;j<chunkNumUnits;++j,rPtr+=Record::size)
+				{
+				Record::unpack(rPtr,state);
+				increment.chunkStates.push_back(state);
+				}
+			}
+		
+		/* Read the lists of removed and added bonds: */
+		readBondList(file,increment.removedBonds);
+		readBondList(file,increment.addedBonds);
+		
+		/* Check the record end tag: */
+		file.read(tag,sizeof(tag));
+		return memcmp(tag,diffEndTag,sizeof(tag))==0;
+		}
+	catch(const std::runtime_error&)
+		{
+		/* The record was truncated: */
+		return false;
+		}
+	}
+
+bool applyIncrement(const Increment& increment,const StateFileHeader& header,UnitStateArray& states,std::vector<StateFileBond>& bonds) // Applies an incremental checkpoint to the given simulation state; returns false and leaves the state unchanged if the increment is inconsistent with the state
+	{
+	/* Check that all units not present in the previous state are contained in changed chunks: */
+	Size oldNumUnits(states.states.size());
+	std::vector<Index>::const_iterator ciIt=increment.chunkIndices.begin();
+	for(Index first=(oldNumUnits/increment.chunkSize)*increment.chunkSize;first<increment.numUnits;first+=increment.chunkSize)
+		{
+		while(ciIt!=increment.chunkIndices.end()&&*ciIt<first/increment.chunkSize)
+			++ciIt;
+		if(ciIt==increment.chunkIndices.end()||*ciIt!=first/increment.chunkSize)
+			return false;
+		}
+	
+	/* Check the unit types of all changed units: */
+	for(std::vector<UnitState>::const_iterator sIt=increment.chunkStates.begin();sIt!=increment.chunkStates.end();++sIt)
+		if(sIt->unitType>=header.unitTypes.size())
+			return false;
+	
+	/* Apply the changed chunks to a copy of the unit states: */
+	UnitStateArray newStates;
+	newStates.sessionId=states.sessionId;
+	newStates.timeStamp=increment.timeStamp;
+	newStates.states.reserve(increment.numUnits);
+	for(Index i=0;i<increment.numUnits&&i<oldNumUnits;++i)
+		newStates.states.push_back(states.states[i]);
+	UnitState dummy;
+	for(Index i=oldNumUnits;i<increment.numUnits;++i)
+		newStates.states.push_back(dummy);
+	std::vector<UnitState>::const_iterator csIt=increment.chunkStates.begin();
+	for(ciIt=increment.chunkIndices.begin();ciIt!=increment.chunkIndices.end();++ciIt)
+		{
+		Index end=std::min((*ciIt+1)*increment.chunkSize,increment.numUnits);
+		for(Index i=*ciIt*increment.chunkSize;i<end;++i,++csIt)
+			newStates.states[i]=*csIt;
+		}
+	
+	/* Remove and add bonds: */
+	std::sort(bonds.begin(),bonds.end(),BondLess());
+	std::vector<StateFileBond> removedBonds=increment.removedBonds;
+	std::sort(removedBonds.begin(),removedBonds.end(),BondLess());
+	std::vector<StateFileBond> newBonds;
+	newBonds.reserve(bonds.size()+increment.addedBonds.size());
+	std::set_difference(bonds.begin(),bonds.end(),removedBonds.begin(),removedBonds.end(),std::back_inserter(newBonds),BondLess());
+	newBonds.insert(newBonds.end(),increment.addedBonds.begin(),increment.addedBonds.end());
+	
+	/* Check the new bonds for consistency: */
+	for(std::vector<StateFileBond>::const_iterator bIt=newBonds.begin();bIt!=newBonds.end();++bIt)
+		for(int i=0;i<2;++i)
+			{
+			if(bIt->unitIndex[i]>=increment.numUnits)
+				return false;
+			if(bIt->bondSiteIndex[i]>=header.unitTypes[newStates.states[bIt->unitIndex[i]].unitType].bondSites.size())
+				return false;
+			}
+	
+	/* Commit the new state: */
+	states.timeStamp=newStates.timeStamp;
+	states.states.clear();
+	states.states.reserve(increment.numUnits);
+	for(UnitStateArray::UnitStateList::const_iterator sIt=newStates.states.begin();sIt!=newStates.states.end();++sIt)
+		states.states.push_back(*sIt);
+	std::swap(bonds,newBonds);
+	
+	return true;
+	}
+
+}
+
+/*****************************
+Methods of class Checkpointer:
+*****************************/
+
+void Checkpointer::writeBase(Checkpointer::Snapshot& snapshot)
+	{
+	/* Overwrite the checkpoint file holding the older base checkpoint: */
+	file=0;
+	++sequence;
+	IO::FilePtr newFile=IO::openFile(getCheckpointFileName(baseFileName,sequence).c_str(),IO::File::WriteOnly);
+	newFile->setEndianness(Misc::LittleEndian);
+	
+	/* Write the file header: */
+	char tag[32];
+	memset(tag,0,sizeof(tag));
+	strcpy(tag,checkpointFileTag);
+	newFile->write(tag,sizeof(tag));
+	newFile->write<Misc::UInt32>(sequence);
+	
+	/* Write the complete simulation state: */
+	newFile->write<Index>(snapshot.states.timeStamp);
+	writeStateFile(*newFile,snapshot.header,snapshot.states,snapshot.bonds);
+	newFile->flush();
+	
+	/* Remember the checkpointed state to calculate the next increment: */
+	file=newFile;
+	sessionId=snapshot.states.sessionId;
+	numIncrements=0;
+	packStates(snapshot.states,packedStates);
+	lastHeader=snapshot.header;
+	std::swap(sortedBonds,snapshot.bonds);
+	std::sort(sortedBonds.begin(),sortedBonds.end(),BondLess());
+	}
+
+bool Checkpointer::needsBase(const Checkpointer::Snapshot& snapshot) const
+	{
+	/* Write a base checkpoint if there is no current checkpoint file, if the session changed, or if the base interval is up: */
+	if(file==0||snapshot.states.sessionId!=sessionId||numIncrements>=baseInterval)
+		return true;
+	
+	/* Write a base checkpoint if simulation parameters changed, as increments only store unit states and bonds: */
+	const StateFileHeader& h=snapshot.header;
+	return h.vertexForceRadius!=lastHeader.vertexForceRadius||h.vertexForceStrength!=lastHeader.vertexForceStrength||h.centralForceOvershoot!=lastHeader.centralForceOvershoot||h.centralForceStrength!=lastHeader.centralForceStrength;
+	}
+
+void Checkpointer::writeIncrement(Checkpointer::Snapshot& snapshot)
+	{
+	/* Pack the new unit states and find all chunks that differ from the previous checkpoint: */
+	packStates(snapshot.states,newPackedStates);
+	Size numUnits(snapshot.states.states.size());
+	size_t chunkBytes=size_t(chunkSize)*Record::size;
+	std::vector<Misc::UInt32> changedChunks;
+	for(size_t begin=0;begin<newPackedStates.size();begin+=chunkBytes)
+		{
+		size_t end=std::min(begin+chunkBytes,newPackedStates.size());
+		if(end>packedStates.size()||memcmp(newPackedStates.data()+begin,packedStates.data()+begin,end-begin)!=0)
+			changedChunks.push_back(Misc::UInt32(begin/chunkBytes));
+		}
+	
+	/* Find all bonds removed or added since the previous checkpoint: */
+	std::sort(snapshot.bonds.begin(),snapshot.bonds.end(),BondLess());
+	std::vector<StateFileBond> removedBonds,addedBonds;
+	std::set_difference(sortedBonds.begin(),sortedBonds.end(),snapshot.bonds.begin(),snapshot.bonds.end(),std::back_inserter(removedBonds),BondLess());
+	std::set_difference(snapshot.bonds.begin(),snapshot.bonds.end(),sortedBonds.begin(),sortedBonds.end(),std::back_inserter(addedBonds),BondLess());
+	
+	/* Write the record header: */
+	file->write(diffTag,sizeof(diffTag));
+	file->write<Index>(snapshot.states.timeStamp);
+	file->write<Size>(numUnits);
+	file->write<Size>(chunkSize);
+	file->write<Misc::UInt32>(Misc::UInt32(changedChunks.size()));
+	
+	/* Write all changed chunks: */
+	bool swap=file->mustSwapOnWrite();
+	std::vector<Misc::UInt8> swapped;
+	for(std::vector<Misc::UInt32>::iterator ccIt=changedChunks.begin();ccIt!=changedChunks.end();++ccIt)
+		{
+		file->write<Misc::UInt32>(*ccIt);
+		size_t begin=size_t(*ccIt)*chunkBytes;
+		size_t end=std::min(begin+chunkBytes,newPackedStates.size());
+		if(swap)
+			{
+			swapped.assign(newPackedStates.begin()+begin,newPackedStates.begin()+end);
+			swapStateRecords<UnitState>(swapped.data(),(end-begin)/Record::size);
+			file->write(swapped.data(),swapped.size());
+			}
+		else
+			file->write(newPackedStates.data()+begin,end-begin);
+		}
+	
+	/* Write the lists of removed and added bonds and the record end tag: */
+	writeBondList(*file,removedBonds);
+	writeBondList(*file,addedBonds);
+	file->write(diffEndTag,sizeof(diffEndTag));
+	file->flush();
+	
+	/* Remember the checkpointed state to calculate the next increment: */
+	++numIncrements;
+	std::swap(packedStates,newPackedStates);
+	std::swap(sortedBonds,snapshot.bonds);
+	}
+
+void* Checkpointer::writerThreadMethod(void)
+	{
+	while(true)
+		{
+		/* Wait for the next queued snapshot: */
+		Snapshot* snapshot;
+		{
+		Threads::MutexCond::Lock queueLock(queueCond);
+		while(queuedSnapshots.empty()&&!shutdown)
+			queueCond.wait(queueLock);
+		if(queuedSnapshots.empty())
+			break;
+		snapshot=queuedSnapshots.front();
+		queuedSnapshots.pop_front();
+		}
+		
+		/* Write the snapshot as a base or incremental checkpoint: */
+		try
+			{
+			if(needsBase(*snapshot))
+				writeBase(*snapshot);
+			else
+				writeIncrement(*snapshot);
+			}
+		catch(const std::runtime_error& err)
+			{
+			/* Start over with a base checkpoint: */
+			Misc::formattedUserError("Checkpointer: Unable to write checkpoint for simulation step %u due to exception %s",(unsigned int)(snapshot->states.timeStamp),err.what());
+			file=0;
+			}
+		
+		/* Return the snapshot buffer to the pool: */
+		{
+		Threads::MutexCond::Lock queueLock(queueCond);
+		freeSnapshots.push_back(snapshot);
+		}
+		}
+	
+	return 0;
+	}
+
+Checkpointer::Checkpointer(const char* sBaseFileName,unsigned int sBaseInterval,Size sChunkSize,unsigned int queueSize)
+	:baseFileName(sBaseFileName),baseInterval(sBaseInterval),chunkSize(sChunkSize>0?sChunkSize:1),
+	 numDroppedSnapshots(0),
+	 snapshots(queueSize>0?queueSize:1),
+	 shutdown(false),
+	 sequence(0),sessionId(0),numIncrements(0)
+	{
+	/* Continue the sequence numbers of existing checkpoint files so that the next base checkpoint overwrites the older one: */
+	for(Misc::UInt32 i=0;i<2;++i)
+		{
+		Misc::UInt32 fileSequence;
+		if(readCheckpointSequence(getCheckpointFileName(baseFileName,i),fileSequence)&&fileSequence%2U==i&&sequence<fileSequence)
+			sequence=fileSequence;
+		}
+	
+	/* Make all snapshot buffers available: */
+	for(std::vector<Snapshot>::iterator sIt=snapshots.begin();sIt!=snapshots.end();++sIt)
+		freeSnapshots.push_back(&*sIt);
+	
+	/* Start the writer thread: */
+	writerThread.start(this,&Checkpointer::writerThreadMethod);
+	}
+
+Checkpointer::~Checkpointer(void)
+	{
+	/* Shut down the writer thread after it has written all queued snapshots: */
+	{
+	Threads::MutexCond::Lock queueLock(queueCond);
+	shutdown=true;
+	queueCond.signal();
+	}
+	writerThread.join();
+	
+	if(numDroppedSnapshots>0)
+		Misc::formattedUserWarning("Checkpointer: Dropped %u checkpoints because the writer fell behind",(unsigned int)(numDroppedSnapshots));
+	}
+
+Checkpointer::Snapshot* Checkpointer::startSnapshot(void)
+	{
+	/* Grab a free snapshot buffer, or drop the snapshot if the writer thread fell behind: */
+	Snapshot* snapshot=0;
+	{
+	Threads::MutexCond::Lock queueLock(queueCond);
+	if(!freeSnapshots.empty())
+		{
+		snapshot=freeSnapshots.back();
+		freeSnapshots.pop_back();
+		}
+	}
+	if(snapshot==0)
+		++numDroppedSnapshots;
+	
+	return snapshot;
+	}
+
+void Checkpointer::postSnapshot(Checkpointer::Snapshot* snapshot)
+	{
+	/* Queue the snapshot and wake up the writer thread: */
+	Threads::MutexCond::Lock queueLock(queueCond);
+	queuedSnapshots.push_back(snapshot);
+	queueCond.signal();
+	}
+
+Index readCheckpoint(const char* baseFileName,StateFileHeader& header,UnitStateArray& states,std::vector<StateFileBond>& bonds)
+	{
+	/* Order the two checkpoint files by the sequence numbers of their base checkpoints, newest first: */
+	std::string fileNames[2];
+	Misc::UInt32 sequences[2];
+	bool valid[2];
+	for(int i=0;i<2;++i)
+		{
+		fileNames[i]=getCheckpointFileName(baseFileName,Misc::UInt32(i));
+		valid[i]=readCheckpointSequence(fileNames[i],sequences[i]);
+		}
+	int order[2]={0,1};
+	if(!valid[0]||(valid[1]&&sequences[1]>sequences[0]))
+		std::swap(order[0],order[1]);
+	
+	/* Recover from the newest checkpoint file whose base checkpoint can be read completely: */
+	std::string lastError="No checkpoint files";
+	for(int i=0;i<2;++i)
+		{
+		if(!valid[order[i]])
+			continue;
+		
+		/* Read the base checkpoint into temporary structures to leave the given ones untouched if recovery fails: */
+		IO::FilePtr file;
+		Index timeStamp;
+		StateFileHeader fileHeader;
+		UnitStateArray fileStates;
+		std::vector<StateFileBond> fileBonds;
+		try
+			{
+			file=IO::openFile(fileNames[order[i]].c_str());
+			file->setEndianness(Misc::LittleEndian);
+			readCheckpointHeader(*file);
+			timeStamp=file->read<Index>();
+			if(readStateFile(*file,fileHeader,fileStates,fileBonds)!=3)
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Base checkpoint has wrong format");
+			}
+		catch(const std::runtime_error& err)
+			{
+			/* Fall back to the other checkpoint file: */
+			lastError=err.what();
+			continue;
+			}
+		
+		/* Apply all complete and consistent incremental checkpoints following the base checkpoint: */
+		Increment increment;
+		Size numIncrements=0;
+		while(readIncrement(*file,increment)&&applyIncrement(increment,fileHeader,fileStates,fileBonds))
+			{
+			timeStamp=increment.timeStamp;
+			++numIncrements;
+			}
+		
+		Misc::formattedUserNote("Checkpointer: Recovered simulation step %u from checkpoint file %s after %u increments",(unsigned int)(timeStamp),fileNames[order[i]].c_str(),(unsigned int)(numIncrements));
+		
+		/* Hand the reconstructed simulation state to the caller: */
+		std::swap(header,fileHeader);
+		std::swap(states.states,fileStates.states);
+		std::swap(bonds,fileBonds);
+		states.timeStamp=timeStamp;
+		return timeStamp;
+		}
+	
+	throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Unable to recover checkpoint %s due to exception %s",baseFileName,lastError.c_str());
+	}
@@ -0,0 +1,121 @@
+/***********************************************************************
+Checkpointer - Class to write periodic base and incremental checkpoints
+of a simulation state from a background thread, and function to recover
+the newest checkpointed simulation state.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+Layout of a checkpoint file; all data is little-endian:
+- 32-byte tag "NCK Checkpoint 1.0\r\n", zero-padded
+- Sequence number of the file's base checkpoint
+- Base checkpoint: simulation step, followed by the complete simulation
+  state in NCK 3.0 state file format
+- Sequence of incremental checkpoints, each consisting of a four-
+  character record tag "DIFF", the simulation step, the number of
+  units, the number of units per chunk, the number of changed chunks,
+  each changed chunk's index and packed unit states as written by
+  writeStateArray, the lists of bonds removed and added since the
+  previous checkpoint, and a four-character end tag "DEND"
+Checkpoints alternate between two files whose names are formed by
+appending ".0" and ".1" to a common base name. Each base checkpoint
+overwrites the older of the two files, so that the newest complete
+base checkpoint and its increments survive a crash while the next base
+checkpoint is being written. Recovery reads the newest base checkpoint
+that can be read completely and applies all complete incremental
+checkpoints following it.
+***********************************************************************/
+
+#ifndef CHECKPOINTER_INCLUDED
+#define CHECKPOINTER_INCLUDED
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <Misc/SizedTypes.h>
+#include <Threads/MutexCond.h>
+#include <Threads/Thread.h>
+#include <IO/File.h>
+
+#include "Common.h"
+#include "StateFile.h"
+
+class Checkpointer
+	{
+	/* Embedded classes: */
+	public:
+	struct Snapshot // Structure for a simulation state queued for checkpointing
+		{
+		/* Elements: */
+		public:
+		StateFileHeader header; // Simulation setup, to be filled in by the caller
+		UnitStateArray states; // Session ID, simulation step, and unit states, to be filled in by the caller
+		std::vector<StateFileBond> bonds; // "Up" halves of all bonds, to be filled in by the caller
+		};
+	
+	/* Elements: */
+	private:
+	std::string baseFileName; // Base name of the two alternating checkpoint files
+	unsigned int baseInterval; // Maximum number of incremental checkpoints between base checkpoints
+	Size chunkSize; // Number of units per chunk compared between consecutive checkpoints
+	size_t numDroppedSnapshots; // Number of snapshots dropped because the writer thread fell behind
+	
+	/* Snapshot queue: */
+	Threads::MutexCond queueCond; // Condition variable protecting the snapshot queue and signaling queued snapshots
+	std::vector<Snapshot> snapshots; // Pool of snapshot buffers
+	std::vector<Snapshot*> freeSnapshots; // List of snapshot buffers available for checkpointing
+	std::deque<Snapshot*> queuedSnapshots; // Queue of snapshots waiting to be written
+	bool shutdown; // Flag to shut down the writer thread once the queue is empty
+	
+	/* Writer-side state: */
+	Threads::Thread writerThread; // Thread writing queued snapshots to the checkpoint files
+	IO::FilePtr file; // Checkpoint file receiving incremental checkpoints, or null if the next checkpoint must be a base checkpoint
+	Misc::UInt32 sequence; // Sequence number of the most recent base checkpoint
+	SessionID sessionId; // ID of the session of the most recent checkpoint
+	unsigned int numIncrements; // Number of incremental checkpoints written since the most recent base checkpoint
+	std::vector<Misc::UInt8> packedStates; // Packed unit states of the most recent checkpoint
+	std::vector<Misc::UInt8> newPackedStates; // Packed unit states of the checkpoint being written
+	StateFileHeader lastHeader; // Simulation setup of the most recent checkpoint
+	std::vector<StateFileBond> sortedBonds; // Sorted bonds of the most recent checkpoint
+	
+	/* Private methods: */
+	void writeBase(Snapshot& snapshot); // Writes the given snapshot as a base checkpoint into the older checkpoint file
+	bool needsBase(const Snapshot& snapshot) const; // Returns true if the given snapshot must be written as a base checkpoint
+	void writeIncrement(Snapshot& snapshot); // Appends the differences between the given snapshot and the most recent checkpoint to the current checkpoint file
+	void* writerThreadMethod(void); // Method writing queued snapshots until shut down
+	
+	/* Constructors and destructors: */
+	public:
+	Checkpointer(const char* sBaseFileName,unsigned int sBaseInterval,Size sChunkSize,unsigned int queueSize); // Creates a checkpointer writing to the checkpoint files of the given base name, with the given maximum number of incremental checkpoints between base checkpoints, the given number of units per compared chunk, and the given number of queued snapshots
+	~Checkpointer(void); // Writes all queued snapshots
+	
+	/* Methods: */
+	const std::string& getBaseFileName(void) const // Returns the base name of the checkpoint files
+		{
+		return baseFileName;
+		}
+	Snapshot* startSnapshot(void); // Returns a snapshot buffer to be filled in by the caller; returns null if the snapshot had to be dropped
+	void postSnapshot(Snapshot* snapshot); // Queues a filled-in snapshot for writing
+	size_t getNumDroppedSnapshots(void) const // Returns the number of snapshots dropped so far
+		{
+		return numDroppedSnapshots;
+		}
+	};
+
+Index readCheckpoint(const char* baseFileName,StateFileHeader& header,UnitStateArray& states,std::vector<StateFileBond>& bonds); // Reconstructs the newest recoverable simulation state from the checkpoint files of the given base name; returns the simulation step of the reconstructed state; leaves the given structures untouched if no checkpoint can be recovered
+
+#endif
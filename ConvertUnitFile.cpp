@@ -0,0 +1,123 @@
+/***********************************************************************
+ConvertUnitFile - Utility to convert unit files written by the old
+Nanotech Construction Kit into state files for the new Nanotech
+Construction Kit.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <iostream>
+#include <Misc/StandardValueCoders.h>
+#include <Misc/ConfigurationFile.h>
+#include <IO/File.h>
+#include <IO/OpenFile.h>
+
+#include "Common.h"
+#include "StateFile.h"
+#include "UnitFileImporter.h"
+
+#include "Config.h"
+
+int main(int argc,char* argv[])
+	{
+	/* Open the main configuration file: */
+	Misc::ConfigurationFile configFile(NCK_CONFIG_ETCDIR "/" NCK_CONFIG_CONFIGFILENAME);
+	Misc::ConfigurationFileSection rootSection=configFile.getSection("NewNanotechConstructionKit");
+	
+	/* Read the simulation setup written into all converted files: */
+	StateFileHeader header;
+	readUnitTypes(rootSection,header.unitTypes);
+	header.vertexForceRadius=rootSection.retrieveValue<Scalar>("./vertexForceRadius");
+	header.vertexForceStrength=rootSection.retrieveValue<Scalar>("./vertexForceStrength");
+	header.centralForceOvershoot=rootSection.retrieveValue<Scalar>("./centralForceOvershoot");
+	header.centralForceStrength=rootSection.retrieveValue<Scalar>("./centralForceStrength");
+	int numThreads=rootSection.retrieveValue<int>("./numImportThreads",1);
+	
+	/* Map old unit types to new unit types of the same names by default: */
+	std::vector<std::string> unitTypeNames;
+	for(int i=0;i<numLegacyUnitTypes;++i)
+		unitTypeNames.push_back(getLegacyUnitTypeName(i));
+	
+	/* Parse the command line: */
+	std::vector<const char*> fileNames;
+	for(int argi=1;argi<argc;++argi)
+		{
+		if(argv[argi][0]=='-')
+			{
+			if(strcasecmp(argv[argi]+1,"threads")==0&&argi+1<argc)
+				numThreads=atoi(argv[++argi]);
+			else if(strcasecmp(argv[argi]+1,"map")==0&&argi+2<argc)
+				{
+				/* Find the old unit type of the given name: */
+				int legacyUnitType=0;
+				while(legacyUnitType<numLegacyUnitTypes&&strcasecmp(argv[argi+1],getLegacyUnitTypeName(legacyUnitType))!=0)
+					++legacyUnitType;
+				if(legacyUnitType<numLegacyUnitTypes)
+					unitTypeNames[legacyUnitType]=argv[argi+2];
+				else
+					std::cerr<<"Ignoring unknown old unit type "<<argv[argi+1]<<std::endl;
+				argi+=2;
+				}
+			else
+				std::cerr<<"Ignoring command line option "<<argv[argi]<<std::endl;
+			}
+		else
+			fileNames.push_back(argv[argi]);
+		}
+	if(fileNames.empty()||fileNames.size()%2!=0)
+		{
+		std::cerr<<"Usage: "<<argv[0]<<" [-threads <number of threads>] [-map <old unit type> <unit type>]... <old unit file> <state file> [<old unit file> <state file>]..."<<std::endl;
+		return 1;
+		}
+	
+	/* Convert all pairs of old unit files and state files: */
+	int result=0;
+	for(size_t i=0;i<fileNames.size();i+=2)
+		{
+		try
+			{
+			/* Read the old unit file: */
+			UnitFileImport import;
+			importUnitFile(fileNames[i],header.unitTypes,unitTypeNames,numThreads,import);
+			
+			/* Write the converted simulation state: */
+			header.domain=import.domain;
+			import.states.sessionId=1;
+			import.states.timeStamp=1;
+			IO::FilePtr file=IO::openFile(fileNames[i+1],IO::File::WriteOnly);
+			file->setEndianness(Misc::LittleEndian);
+			writeStateFile(*file,header,import.states,import.bonds);
+			
+			std::cout<<"Converted unit file "<<fileNames[i]<<" to "<<fileNames[i+1]<<": "<<import.states.states.size()<<" units, "<<import.bonds.size()<<" bonds";
+			if(import.numBadLinks!=0)
+				std::cout<<", "<<import.numBadLinks<<" invalid vertex links dropped";
+			std::cout<<std::endl;
+			}
+		catch(const std::runtime_error& err)
+			{
+			std::cerr<<"Unable to convert unit file "<<fileNames[i]<<" due to exception "<<err.what()<<std::endl;
+			result=1;
+			}
+		}
+	
+	return result;
+	}
@@ -33,53 +33,52 @@ namespace NCK {
 Methods of class CylinderRenderer:
 *********************************/
 
-void CylinderRenderer::initContext(GLContextData& contextData) const
+void CylinderRenderer::createMesh(UnitRenderer::Mesh& mesh) const
 	{
-	/* Create context data item: */
-	DataItem* dataItem=new DataItem;
-	contextData.addDataItem(this,dataItem);
-	
-	/* Create model display list: */
-	glNewList(dataItem->displayListId,GL_COMPILE);
-	
-	/* Render cylinder: */
+	/* Calculate the cylinder's rim vertices and normals: */
 	Scalar hradius=Cylinder::radius/Scalar(3);
-	glNormal3f(0.0f,0.0f,-1.0);
-	glBegin(GL_POLYGON);
-	for(int i=7;i>=0;--i)
+	Point bottom[8],top[8];
+	Vector normals[8];
+	for(int i=0;i<8;++i)
 		{
 		Scalar angle=Scalar(2)*Math::Constants<Scalar>::pi*Scalar(i)/Scalar(8);
 		Scalar c=Math::cos(angle);
 		Scalar s=Math::sin(angle);
-		glVertex(Point(c*hradius,s*hradius,-Cylinder::radius));
+		normals[i]=Vector(c,s,Scalar(0));
+		bottom[i]=Point(c*hradius,s*hradius,-Cylinder::radius);
+		top[i]=Point(c*hradius,s*hradius,Cylinder::radius);
 		}
-	glEnd();
 	
-	glBegin(GL_QUAD_STRIP);
-	for(int i=0;i<=8;++i)
-		{
-		Scalar angle=Scalar(2)*Math::Constants<Scalar>::pi*Scalar(i%8)/Scalar(8);
-		Scalar c=Math::cos(angle);
-		Scalar s=Math::sin(angle);
-		glNormal(Vector(c,s,Scalar(0)));
-		glVertex(Point(c*hradius,s*hradius,Cylinder::radius));
-		glVertex(Point(c*hradius,s*hradius,-Cylinder::radius));
-		}
-	glEnd();
+	/* Create the bottom cap as a triangle fan: */
+	Vector bottomNormal(Scalar(0),Scalar(0),Scalar(-1));
+	for(int i=6;i>=1;--i)
+		addTriangle(mesh,bottomNormal,bottom[7],bottom[i],bottom[i-1]);
 	
-	glNormal3f(0.0f,0.0f,1.0);
-	glBegin(GL_POLYGON);
+	/* Create the smooth-shaded mantle: */
 	for(int i=0;i<8;++i)
 		{
-		Scalar angle=Scalar(2)*Math::Constants<Scalar>::pi*Scalar(i)/Scalar(8);
-		Scalar c=Math::cos(angle);
-		Scalar s=Math::sin(angle);
-		glVertex(Point(c*hradius,s*hradius,Cylinder::radius));
+		int i1=(i+1)%8;
+		MeshVertex v[4];
+		v[0].normal=normals[i];
+		v[0].position=top[i];
+		v[1].normal=normals[i];
+		v[1].position=bottom[i];
+		v[2].normal=normals[i1];
+		v[2].position=bottom[i1];
+		v[3].normal=normals[i1];
+		v[3].position=top[i1];
+		mesh.push_back(v[0]);
+		mesh.push_back(v[1]);
+		mesh.push_back(v[2]);
+		mesh.push_back(v[0]);
+		mesh.push_back(v[2]);
+		mesh.push_back(v[3]);
 		}
-	glEnd();
 	
-	/* Finish model display list: */
-	glEndList();
+	/* Create the top cap as a triangle fan: */
+	Vector topNormal(Scalar(0),Scalar(0),Scalar(1));
+	for(int i=1;i<7;++i)
+		addTriangle(mesh,topNormal,top[0],top[i],top[i+1]);
 	}
 
 /*********************************
@@ -21,13 +21,15 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #define CYLINDER_INCLUDED
 
 #include "StructuralUnit.h"
+#include "UnitManager.h"
 
 namespace NCK {
 
 class CylinderRenderer:public UnitRenderer
 	{
-	/* Methods: */
-	virtual void initContext(GLContextData& contextData) const;
+	/* Methods from class UnitRenderer: */
+	public:
+	virtual void createMesh(Mesh& mesh) const;
 	};
 
 class Cylinder:public StructuralUnit
@@ -62,6 +64,10 @@ class Cylinder:public StructuralUnit
 		{
 		return radius;
 		};
+	static Scalar getClassMass(void) // Returns mass of all cylinders
+		{
+		return mass;
+		};
 	static int getClassNumVertices(void) // Returns number of vertices of tetrahedron class
 		{
 		return 4;
@@ -80,6 +86,10 @@ class Cylinder:public StructuralUnit
 		{
 		return mass;
 		};
+	virtual int getUnitType(void) const
+		{
+		return UnitManager::CYLINDER;
+		};
 	virtual Vector getVertexOffset(int index) const
 		{
 		return orientation.transform(vertexOffsets[index]);
@@ -90,6 +100,10 @@ class Cylinder:public StructuralUnit
 		};
 	virtual void applyVertexForce(int index,const Vector& force,Scalar timeStep);
 	virtual void applyCentralForce(const Vector& force,Scalar timeStep);
+	virtual const UnitRenderer* getUnitRenderer(void) const
+		{
+		return unitRenderer;
+		};
 	virtual void glRenderAction(GLContextData& contextData) const;
 	};
 
@@ -48,6 +48,10 @@ class GhostUnit:public StructuralUnit
 		{
 		return sourceUnit->getMass();
 		};
+	virtual int getUnitType(void) const
+		{
+		return sourceUnit->getUnitType();
+		};
 	virtual Vector getVertexOffset(int index) const
 		{
 		return sourceUnit->getVertexOffset(index);
@@ -64,6 +68,10 @@ class GhostUnit:public StructuralUnit
 		{
 		//sourceUnit->applyCentralForce(force,timeStep);
 		};
+	virtual const UnitRenderer* getUnitRenderer(void) const
+		{
+		return sourceUnit->getUnitRenderer();
+		};
 	virtual void glRenderAction(GLContextData& contextData) const;
 	void updateState(void); // Aligns state of ghost unit with that of source unit
 	const StructuralUnit* getSourceUnit(void) const // Returns source unit of the ghost unit
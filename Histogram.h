@@ -0,0 +1,51 @@
+/***********************************************************************
+Histogram - Helper functions to accumulate histograms of bond lengths
+and bond angles, shared by the legacy and new simulation statistics.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef HISTOGRAM_INCLUDED
+#define HISTOGRAM_INCLUDED
+
+#include <Math/Math.h>
+#include <Geometry/Vector.h>
+
+template <class CountParam,class ScalarParam>
+inline void addToHistogram(CountParam histogram[],int numBins,ScalarParam min,ScalarParam max,ScalarParam value) // Adds a value to a histogram, clamping out-of-range values to the first or last bin
+	{
+	ScalarParam binSize=(max-min)/ScalarParam(numBins);
+	int index=int(Math::floor((value-min)/binSize));
+	if(index<=0)
+		++histogram[0];
+	else if(index>=numBins-1)
+		++histogram[numBins-1];
+	else
+		++histogram[index];
+	}
+
+template <class ScalarParam>
+inline ScalarParam calcAngle(const Geometry::Vector<ScalarParam,3>& v1,ScalarParam l1,const Geometry::Vector<ScalarParam,3>& v2,ScalarParam l2) // Returns the angle between two vectors of the given lengths
+	{
+	ScalarParam cosAngle=(v1*v2)/(l1*l2);
+	if(cosAngle<ScalarParam(-1))
+		cosAngle=ScalarParam(-1);
+	else if(cosAngle>ScalarParam(1))
+		cosAngle=ScalarParam(1);
+	return Math::acos(cosAngle);
+	}
+
+#endif
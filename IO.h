@@ -21,6 +21,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef IO_INCLUDED
 #define IO_INCLUDED
 
+#include <string.h>
+#include <Misc/SizedTypes.h>
 #include <Misc/Marshaller.h>
 #include <Misc/StandardMarshallers.h>
 #include <Misc/CompoundMarshallers.h>
@@ -28,6 +30,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Misc/CompoundValueCoders.h>
 #include <Geometry/GeometryMarshallers.h>
 #include <Geometry/GeometryValueCoders.h>
+#include <IO/File.h>
 
 #include "Common.h"
 
@@ -229,6 +232,193 @@ class Marshaller<ReducedUnitState> // Class to read/write reduced unit states fr
 
 }
 
+template <class UnitStateParam>
+struct StateRecord // Class describing the packed binary representation of unit states written by their marshallers
+	{
+	};
+
+template <>
+struct StateRecord<UnitState>
+	{
+	/* Embedded classes: */
+	public:
+	typedef Scalar RecordScalar; // Scalar type of packed unit states
+	
+	/* Elements: */
+	static const size_t numScalars=3+4+3+3; // Number of scalars following the unit type ID
+	static const size_t size=sizeof(UnitTypeID)+numScalars*sizeof(RecordScalar); // Size of a packed unit state in bytes
+	
+	/* Methods: */
+	static void pack(const UnitState& state,Misc::UInt8* record) // Packs the given unit state into the given record
+		{
+		RecordScalar s[numScalars];
+		for(int i=0;i<3;++i)
+			s[i]=state.position[i];
+		const RecordScalar* q=state.orientation.getQuaternion();
+		for(int i=0;i<4;++i)
+			s[3+i]=q[i];
+		for(int i=0;i<3;++i)
+			{
+			s[7+i]=state.linearVelocity[i];
+			s[10+i]=state.angularVelocity[i];
+			}
+		memcpy(record,&state.unitType,sizeof(UnitTypeID));
+		memcpy(record+sizeof(UnitTypeID),s,sizeof(s));
+		}
+	static void unpack(const Misc::UInt8* record,UnitState& state) // Unpacks a unit state from the given record
+		{
+		RecordScalar s[numScalars];
+		memcpy(&state.unitType,record,sizeof(UnitTypeID));
+		memcpy(s,record+sizeof(UnitTypeID),sizeof(s));
+		state.pickId=0;
+		state.position=Point(s);
+		state.orientation=Rotation::fromQuaternion(s+3);
+		state.linearVelocity=Vector(s+7);
+		state.angularVelocity=Vector(s+10);
+		}
+	};
+
+template <>
+struct StateRecord<ReducedUnitState>
+	{
+	/* Embedded classes: */
+	public:
+	typedef ReducedUnitState::Scalar RecordScalar; // Scalar type of packed reduced unit states
+	
+	/* Elements: */
+	static const size_t numScalars=3+4; // Number of scalars following the unit type ID
+	static const size_t size=sizeof(UnitTypeID)+numScalars*sizeof(RecordScalar); // Size of a packed reduced unit state in bytes
+	
+	/* Methods: */
+	static void pack(const ReducedUnitState& state,Misc::UInt8* record) // Packs the given reduced unit state into the given record
+		{
+		RecordScalar s[numScalars];
+		for(int i=0;i<3;++i)
+			s[i]=state.position[i];
+		const RecordScalar* q=state.orientation.getQuaternion();
+		for(int i=0;i<4;++i)
+			s[3+i]=q[i];
+		memcpy(record,&state.unitType,sizeof(UnitTypeID));
+		memcpy(record+sizeof(UnitTypeID),s,sizeof(s));
+		}
+	static void unpack(const Misc::UInt8* record,ReducedUnitState& state) // Unpacks a reduced unit state from the given record
+		{
+		RecordScalar s[numScalars];
+		memcpy(&state.unitType,record,sizeof(UnitTypeID));
+		memcpy(s,record+sizeof(UnitTypeID),sizeof(s));
+		state.position=ReducedUnitState::Point(s);
+		state.orientation=ReducedUnitState::Rotation::fromQuaternion(s+3);
+		}
+	};
+
+template <size_t wordSizeParam>
+inline void swapWords(Misc::UInt8* words,size_t numWords) // Reverses the byte order of each in a sequence of words of the given size
+	{
+	for(size_t w=0;w<numWords;++w,words+=wordSizeParam)
+		for(size_t i=0;i<wordSizeParam/2;++i)
+			{
+			Misc::UInt8 t=words[i];
+			words[i]=words[wordSizeParam-1-i];
+			words[wordSizeParam-1-i]=t;
+			}
+	}
+
+template <class UnitStateParam>
+inline void swapStateRecords(Misc::UInt8* records,size_t numRecords) // Reverses the byte order of all fields in a block of packed unit states
+	{
+	typedef StateRecord<UnitStateParam> Record;
+	for(size_t r=0;r<numRecords;++r,records+=Record::size)
+		{
+		swapWords<sizeof(UnitTypeID)>(records,1);
+		swapWords<sizeof(typename Record::RecordScalar)>(records+sizeof(UnitTypeID),Record::numScalars);
+		}
+	}
+
+template <class DataPipeParam>
+struct IsFile // Helper class to detect whether a data sink or source is derived from IO::File
+	{
+	/* Methods: */
+	private:
+	static char test(const IO::File*);
+	static long test(...);
+	
+	/* Elements: */
+	public:
+	static const bool value=sizeof(test(static_cast<DataPipeParam*>(0)))==sizeof(char);
+	};
+
+template <bool isFileParam>
+struct StateListMarshaller // Class to read/write lists of unit states one unit state at a time from/to generic binary sinks and sources
+	{
+	/* Methods: */
+	public:
+	template <class UnitStateParam,class DataSinkParam>
+	static void write(const StateArray<UnitStateParam>& states,DataSinkParam& sink)
+		{
+		for(typename StateArray<UnitStateParam>::UnitStateList::const_iterator sIt=states.states.begin();sIt!=states.states.end();++sIt)
+			Misc::Marshaller<UnitStateParam>::write(*sIt,sink);
+		}
+	template <class UnitStateParam,class DataSourceParam>
+	static void read(DataSourceParam& source,Size numUnits,StateArray<UnitStateParam>& states)
+		{
+		for(Index i=0;i<numUnits;++i)
+			states.states.push_back(Misc::Marshaller<UnitStateParam>::read(source));
+		}
+	};
+
+template <>
+struct StateListMarshaller<true> // Class to read/write lists of unit states in packed blocks from/to files and pipes
+	{
+	/* Elements: */
+	public:
+	static const size_t blockSize=256; // Number of unit states packed into each block
+	
+	/* Methods: */
+	template <class UnitStateParam>
+	static void write(const StateArray<UnitStateParam>& states,IO::File& file)
+		{
+		typedef StateRecord<UnitStateParam> Record;
+		Misc::UInt8 block[blockSize*Record::size];
+		bool swap=file.mustSwapOnWrite();
+		
+		/* Pack, swap if necessary, and write blocks of unit states: */
+		typename StateArray<UnitStateParam>::UnitStateList::const_iterator sIt=states.states.begin();
+		while(sIt!=states.states.end())
+			{
+			size_t numRecords=0;
+			for(Misc::UInt8* rPtr=block;numRecords<blockSize&&sIt!=states.states.end();++numRecords,++sIt,rPtr+=Record::size)
+				Record::pack(*sIt,rPtr);
+			if(swap)
+				swapStateRecords<UnitStateParam>(block,numRecords);
+			file.write(block,numRecords*Record::size);
+			}
+		}
+	template <class UnitStateParam>
+	static void read(IO::File& file,Size numUnits,StateArray<UnitStateParam>& states)
+		{
+		typedef StateRecord<UnitStateParam> Record;
+		Misc::UInt8 block[blockSize*Record::size];
+		bool swap=file.mustSwapOnRead();
+		
+		/* Read, swap if necessary, and unpack blocks of unit states: */
+		UnitStateParam state;
+		while(numUnits>0)
+			{
+			size_t numRecords=numUnits<blockSize?numUnits:blockSize;
+			file.read(block,numRecords*Record::size);
+			if(swap)
+				swapStateRecords<UnitStateParam>(block,numRecords);
+			const Misc::UInt8* rPtr=block;
+			for(size_t i=0;i<numRecords;++i,rPtr+=Record::size)
+				{
+				Record::unpack(rPtr,state);
+				states.states.push_back(state);
+				}
+			numUnits-=Size(numRecords);
+			}
+		}
+	};
+
 template <class UnitStateParam,class DataSinkParam>
 void writeStateArray(const StateArray<UnitStateParam>& states,DataSinkParam& sink,bool writeHeader) // Writes an array of unit states to a binary file
 	{
@@ -242,9 +432,8 @@ void writeStateArray(const StateArray<UnitStateParam>& states,DataSinkParam& sin
 	/* Write the number of unit states in the array: */
 	sink.template write(Size(states.states.size()));
 	
-	/* Write the array of unit states: */
-	for(typename StateArray<UnitStateParam>::UnitStateList::const_iterator sIt=states.states.begin();sIt!=states.states.end();++sIt)
-		Misc::Marshaller<UnitStateParam>::write(*sIt,sink);
+	/* Write the array of unit states, in packed blocks if the sink is a file: */
+	StateListMarshaller<IsFile<DataSinkParam>::value>::write(states,sink);
 	}
 
 template <class UnitStateParam,class DataSourceParam>
@@ -264,9 +453,8 @@ void readStateArray(DataSourceParam& source,StateArray<UnitStateParam>& states,b
 	states.states.clear();
 	states.states.reserve(numUnits);
 	
-	/* Read the array of unit states: */
-	for(Index i=0;i<numUnits;++i)
-		states.states.push_back(Misc::Marshaller<UnitStateParam>::read(source));
+	/* Read the array of unit states, in packed blocks if the source is a file: */
+	StateListMarshaller<IsFile<DataSourceParam>::value>::read(source,numUnits,states);
 	}
 
 template <class DataSinkParam>
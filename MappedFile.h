@@ -0,0 +1,93 @@
+/***********************************************************************
+MappedFile - Class to map a file into memory for reading.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef MAPPEDFILE_INCLUDED
+#define MAPPEDFILE_INCLUDED
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <Misc/StdError.h>
+
+class MappedFile // Class to map a file into memory for reading
+	{
+	/* Elements: */
+	private:
+	int fd; // File descriptor of the mapped file
+	const char* data; // Pointer to the mapped file contents
+	size_t size; // Size of the file in bytes
+	
+	/* Constructors and destructors: */
+	public:
+	MappedFile(const char* fileName) // Maps the file of the given name
+		:fd(open(fileName,O_RDONLY)),data(0),size(0)
+		{
+		if(fd<0)
+			throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Cannot open file %s due to error %s",fileName,strerror(errno));
+		struct stat fileStats;
+		if(fstat(fd,&fileStats)<0)
+			{
+			int error=errno;
+			close(fd);
+			throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Cannot query size of file %s due to error %s",fileName,strerror(error));
+			}
+		size=size_t(fileStats.st_size);
+		if(size>0)
+			{
+			void* mapping=mmap(0,size,PROT_READ,MAP_PRIVATE,fd,0);
+			if(mapping==MAP_FAILED)
+				{
+				int error=errno;
+				close(fd);
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Cannot map file %s due to error %s",fileName,strerror(error));
+				}
+			data=static_cast<const char*>(mapping);
+			}
+		};
+	private:
+	MappedFile(const MappedFile& source); // Prohibit copy constructor
+	MappedFile& operator=(const MappedFile& source); // Prohibit assignment operator
+	public:
+	~MappedFile(void)
+		{
+		if(data!=0)
+			munmap(const_cast<char*>(data),size);
+		close(fd);
+		};
+	
+	/* Methods: */
+	const char* begin(void) const // Returns pointer to the beginning of the file contents
+		{
+		return data;
+		};
+	const char* end(void) const // Returns pointer past the end of the file contents
+		{
+		return data+size;
+		};
+	size_t getSize(void) const // Returns the size of the file in bytes
+		{
+		return size;
+		};
+	};
+
+#endif
@@ -27,6 +27,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Misc/MessageLogger.h>
 #include <Misc/Marshaller.h>
 #include <Misc/CommandDispatcher.h>
+#include <Misc/FileNameExtensions.h>
 #include <IO/File.h>
 #include <IO/OpenFile.h>
 #include <Realtime/Time.h>
@@ -397,6 +398,13 @@ MessageContinuation* NCKServer::saveStateRequestCallback(unsigned int messageId,
 	return 0;
 	}
 
+void NCKServer::checkpointCallback(Threads::EventDispatcher::TimerEvent& event)
+	{
+	/* Checkpoint the simulation state unless the simulation is paused and the state therefore did not change: */
+	if(!pauseSimulationThread)
+		sim->checkpoint(checkpointFileName.c_str());
+	}
+
 void NCKServer::setUpdateRateCommandCallback(const char* argumentBegin,const char* argumentEnd)
 	{
 	/* Read the requested update rate: */
@@ -421,10 +429,8 @@ void NCKServer::setUpdateRateCommandCallback(const char* argumentBegin,const cha
 
 void NCKServer::loadFileCommandCallback(const char* argumentBegin,const char* argumentEnd)
 	{
-	/* Open the requested file: */
+	/* Extract the requested file name: */
 	std::string fileName(argumentBegin,argumentEnd);
-	IO::FilePtr file=IO::openFile(fileName.c_str());
-	file->setEndianness(Misc::LittleEndian);
 	
 	#if 0
 	/* Broadcast a session invalid notification to all connected clients: */
@@ -434,8 +440,20 @@ void NCKServer::loadFileCommandCallback(const char* argumentBegin,const char* ar
 	}
 	#endif
 	
-	/* Ask the simulation to load the requested file: */
-	sim->loadState(*file);
+	if(Misc::hasCaseExtension(fileName.c_str(),".car"))
+		{
+		/* Ask the simulation to import the requested CAR file: */
+		sim->importCarFile(fileName.c_str());
+		}
+	else
+		{
+		/* Open the requested file: */
+		IO::FilePtr file=IO::openFile(fileName.c_str());
+		file->setEndianness(Misc::LittleEndian);
+		
+		/* Ask the simulation to load the requested file: */
+		sim->loadState(*file);
+		}
 	
 	/* Check if the simulation is currently asleep: */
 	{
@@ -473,13 +491,155 @@ void NCKServer::saveFileCommandCallback(const char* argumentBegin,const char* ar
 	}
 	}
 
+void NCKServer::startRecordingCommandCallback(const char* argumentBegin,const char* argumentEnd)
+	{
+	/* Ask the simulation to start recording into the requested trajectory file: */
+	std::string fileName(argumentBegin,argumentEnd);
+	sim->startRecording(fileName.c_str());
+	}
+
+void NCKServer::stopRecordingCommandCallback(const char* argumentBegin,const char* argumentEnd)
+	{
+	/* Ask the simulation to finish the current trajectory recording: */
+	sim->stopRecording();
+	
+	/* Check if the simulation is currently asleep: */
+	{
+	Threads::MutexCond::Lock pauseSimulationThreadLock(pauseSimulationThreadCond);
+	if(pauseSimulationThread)
+		{
+		/* Wake up the simulation until the I/O operation is completed: */
+		pauseSimulationThread=false;
+		pauseSimulationThreadAfterIO=true;
+		pauseSimulationThreadCond.signal();
+		}
+	}
+	}
+
+void NCKServer::recoverCheckpointCommandCallback(const char* argumentBegin,const char* argumentEnd)
+	{
+	/* Ask the simulation to recover the requested or the configured checkpoint: */
+	std::string fileName(argumentBegin,argumentEnd);
+	if(fileName.empty())
+		fileName=checkpointFileName;
+	sim->recoverCheckpoint(fileName.c_str());
+	
+	/* Check if the simulation is currently asleep: */
+	{
+	Threads::MutexCond::Lock pauseSimulationThreadLock(pauseSimulationThreadCond);
+	if(pauseSimulationThread)
+		{
+		/* Wake up the simulation until the I/O operation is completed: */
+		pauseSimulationThread=false;
+		pauseSimulationThreadAfterIO=true;
+		pauseSimulationThreadCond.signal();
+		}
+	}
+	}
+
+void NCKServer::exportFileCommandCallback(const char* argumentBegin,const char* argumentEnd)
+	{
+	/* Check for the optional bonding site flag: */
+	std::string arguments(argumentBegin,argumentEnd);
+	bool exportBondSites=arguments.compare(0,11,"-bondSites ")==0;
+	std::string fileName=exportBondSites?arguments.substr(11):arguments;
+	
+	/* Ask the simulation to export the current state to the requested file: */
+	sim->exportState(fileName.c_str(),exportBondSites);
+	
+	/* Check if the simulation is currently asleep: */
+	{
+	Threads::MutexCond::Lock pauseSimulationThreadLock(pauseSimulationThreadCond);
+	if(pauseSimulationThread)
+		{
+		/* Wake up the simulation until the I/O operation is completed: */
+		pauseSimulationThread=false;
+		pauseSimulationThreadAfterIO=true;
+		pauseSimulationThreadCond.signal();
+		}
+	}
+	}
+
+void NCKServer::storePrefabCommandCallback(const char* argumentBegin,const char* argumentEnd)
+	{
+	/* Ask the simulation to store the current copy buffer as a prefab of the requested name: */
+	sim->storePrefab(std::string(argumentBegin,argumentEnd).c_str());
+	
+	/* Check if the simulation is currently asleep: */
+	{
+	Threads::MutexCond::Lock pauseSimulationThreadLock(pauseSimulationThreadCond);
+	if(pauseSimulationThread)
+		{
+		/* Wake up the simulation until the I/O operation is completed: */
+		pauseSimulationThread=false;
+		pauseSimulationThreadAfterIO=true;
+		pauseSimulationThreadCond.signal();
+		}
+	}
+	}
+
+void NCKServer::selectPrefabCommandCallback(const char* argumentBegin,const char* argumentEnd)
+	{
+	/* Ask the simulation to replace the current copy buffer with the requested prefab: */
+	sim->selectPrefab(std::string(argumentBegin,argumentEnd).c_str());
+	
+	/* Check if the simulation is currently asleep: */
+	{
+	Threads::MutexCond::Lock pauseSimulationThreadLock(pauseSimulationThreadCond);
+	if(pauseSimulationThread)
+		{
+		/* Wake up the simulation until the I/O operation is completed: */
+		pauseSimulationThread=false;
+		pauseSimulationThreadAfterIO=true;
+		pauseSimulationThreadCond.signal();
+		}
+	}
+	}
+
+void NCKServer::savePrefabsCommandCallback(const char* argumentBegin,const char* argumentEnd)
+	{
+	/* Ask the simulation to save its prefab library to the requested file: */
+	sim->savePrefabs(std::string(argumentBegin,argumentEnd).c_str());
+	
+	/* Check if the simulation is currently asleep: */
+	{
+	Threads::MutexCond::Lock pauseSimulationThreadLock(pauseSimulationThreadCond);
+	if(pauseSimulationThread)
+		{
+		/* Wake up the simulation until the I/O operation is completed: */
+		pauseSimulationThread=false;
+		pauseSimulationThreadAfterIO=true;
+		pauseSimulationThreadCond.signal();
+		}
+	}
+	}
+
+void NCKServer::loadPrefabsCommandCallback(const char* argumentBegin,const char* argumentEnd)
+	{
+	/* Ask the simulation to merge the prefabs from the requested file into its prefab library: */
+	sim->loadPrefabs(std::string(argumentBegin,argumentEnd).c_str());
+	
+	/* Check if the simulation is currently asleep: */
+	{
+	Threads::MutexCond::Lock pauseSimulationThreadLock(pauseSimulationThreadCond);
+	if(pauseSimulationThread)
+		{
+		/* Wake up the simulation until the I/O operation is completed: */
+		pauseSimulationThread=false;
+		pauseSimulationThreadAfterIO=true;
+		pauseSimulationThreadCond.signal();
+		}
+	}
+	}
+
 NCKServer::NCKServer(Server* sServer)
 	:PluginServer(sServer),
 	 metadosis(MetadosisServer::requestServer(server)),
 	 simulationUpdateRate(60),
 	 sim(0),
 	 keepSimulationThreadRunning(false),pauseSimulationThread(true),pauseSimulationThreadAfterIO(false),
-	 sessionChangedSignalKey(0),sendSimulationUpdateTimerKey(0)
+	 sessionChangedSignalKey(0),sendSimulationUpdateTimerKey(0),
+	 checkpointFileName("NCKCheckpoint"),checkpointInterval(60),checkpointTimerKey(0)
 	{
 	/* Depend on Metadosis protocol: */
 	metadosis->addDependentPlugin(this);
@@ -489,6 +649,8 @@ NCKServer::NCKServer(Server* sServer)
 	serverConfig.updateValue("./simulationUpdateRate",simulationUpdateRate);
 	Box domain(Point::origin,Point(100,100,100));
 	serverConfig.updateValue("./domain",domain);
+	checkpointFileName=serverConfig.retrieveString("./checkpointFileName",checkpointFileName);
+	serverConfig.updateValue("./checkpointInterval",checkpointInterval);
 	
 	/* Open the main configuration file: */
 	Misc::ConfigurationFile configFile(NCK_CONFIG_ETCDIR "/" NCK_CONFIG_CONFIGFILENAME);
@@ -505,8 +667,16 @@ NCKServer::NCKServer(Server* sServer)
 	
 	/* Register pipe commands: */
 	server->getCommandDispatcher().addCommandCallback("NCK::setUpdateRate",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::setUpdateRateCommandCallback>,this,"<update rate in Hz>","Sets the rate at which state updates are sent to clients");
-	server->getCommandDispatcher().addCommandCallback("NCK::loadFile",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::loadFileCommandCallback>,this,"<unit file name>","Loads the NCK unit file of the given name");
+	server->getCommandDispatcher().addCommandCallback("NCK::loadFile",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::loadFileCommandCallback>,this,"<unit file name>","Loads the NCK unit file, or imports the CAR file, of the given name");
 	server->getCommandDispatcher().addCommandCallback("NCK::saveFile",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::saveFileCommandCallback>,this,"<unit file name>","Saves the current simulation state to an NCK unit file of the given name");
+	server->getCommandDispatcher().addCommandCallback("NCK::startRecording",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::startRecordingCommandCallback>,this,"<trajectory file name>","Starts recording the simulation into a trajectory file of the given name");
+	server->getCommandDispatcher().addCommandCallback("NCK::stopRecording",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::stopRecordingCommandCallback>,this,"","Finishes the current trajectory recording");
+	server->getCommandDispatcher().addCommandCallback("NCK::recoverCheckpoint",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::recoverCheckpointCommandCallback>,this,"[<checkpoint base file name>]","Replaces the current simulation state with the newest recoverable checkpoint of the given or configured base name");
+	server->getCommandDispatcher().addCommandCallback("NCK::exportFile",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::exportFileCommandCallback>,this,"[-bondSites] <.xyz, .extxyz, or .pdb file name>","Exports the current simulation state, optionally including bonding sites, to an XYZ or PDB file of the given name");
+	server->getCommandDispatcher().addCommandCallback("NCK::storePrefab",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::storePrefabCommandCallback>,this,"<prefab name>","Stores the current copy buffer, including its internal bonds, as a prefab of the given name");
+	server->getCommandDispatcher().addCommandCallback("NCK::selectPrefab",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::selectPrefabCommandCallback>,this,"<prefab name>","Replaces the current copy buffer with the prefab of the given name");
+	server->getCommandDispatcher().addCommandCallback("NCK::savePrefabs",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::savePrefabsCommandCallback>,this,"<prefab library file name>","Saves the prefab library to a file of the given name");
+	server->getCommandDispatcher().addCommandCallback("NCK::loadPrefabs",Misc::CommandDispatcher::wrapMethod<NCKServer,&NCKServer::loadPrefabsCommandCallback>,this,"<prefab library file name>","Merges the prefabs from the file of the given name into the prefab library");
 	}
 
 NCKServer::~NCKServer(void)
@@ -530,11 +700,21 @@ NCKServer::~NCKServer(void)
 	server->getDispatcher().removeSignalListener(sessionChangedSignalKey);
 	if(sendSimulationUpdateTimerKey!=0)
 		server->getDispatcher().removeTimerEventListener(sendSimulationUpdateTimerKey);
+	if(checkpointTimerKey!=0)
+		server->getDispatcher().removeTimerEventListener(checkpointTimerKey);
 	
 	/* Remove the pipe command: */
 	server->getCommandDispatcher().removeCommandCallback("NCK::setUpdateRate");
 	server->getCommandDispatcher().removeCommandCallback("NCK::loadFile");
 	server->getCommandDispatcher().removeCommandCallback("NCK::saveFile");
+	server->getCommandDispatcher().removeCommandCallback("NCK::startRecording");
+	server->getCommandDispatcher().removeCommandCallback("NCK::stopRecording");
+	server->getCommandDispatcher().removeCommandCallback("NCK::recoverCheckpoint");
+	server->getCommandDispatcher().removeCommandCallback("NCK::exportFile");
+	server->getCommandDispatcher().removeCommandCallback("NCK::storePrefab");
+	server->getCommandDispatcher().removeCommandCallback("NCK::selectPrefab");
+	server->getCommandDispatcher().removeCommandCallback("NCK::savePrefabs");
+	server->getCommandDispatcher().removeCommandCallback("NCK::loadPrefabs");
 	
 	/* Release dependence on Metadosis protocol: */
 	metadosis->removeDependentPlugin(this);
@@ -584,6 +764,13 @@ void NCKServer::start(void)
 	/* Start the simulation thread in paused mode: */
 	keepSimulationThreadRunning=true;
 	simulationThread.start(this,&NCKServer::simulationThreadMethod);
+	
+	if(checkpointInterval>0.0)
+		{
+		/* Add an event listener for periodic checkpoints: */
+		Threads::EventDispatcher::Time interval(checkpointInterval);
+		checkpointTimerKey=server->getDispatcher().addTimerEventListener(Threads::EventDispatcher::Time::now(),interval,Threads::EventDispatcher::wrapMethod<NCKServer,&NCKServer::checkpointCallback>,this);
+		}
 	}
 
 void NCKServer::clientConnected(unsigned int clientId)
@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef NCKSERVER_INCLUDED
 #define NCKSERVER_INCLUDED
 
+#include <string>
 #include <Misc/HashTable.h>
 #include <Threads/MutexCond.h>
 #include <Threads/Thread.h>
@@ -77,6 +78,9 @@ class NCKServer:public PluginServer,public NCKProtocol
 	Threads::Thread simulationThread; // Background thread simulating the Jell-O crystal
 	Threads::EventDispatcher::ListenerKey sessionChangedSignalKey; // Signal event key to signal that the backend has finished (re-)initializing the session
 	Threads::EventDispatcher::ListenerKey sendSimulationUpdateTimerKey; // Timer event key to signal that a simulation update should be broadcast to all clients
+	std::string checkpointFileName; // Base name of the checkpoint files
+	double checkpointInterval; // Interval between checkpoints in seconds, or 0 to disable checkpointing
+	Threads::EventDispatcher::ListenerKey checkpointTimerKey; // Timer event key to signal that the simulation state should be checkpointed
 	ReducedUnitStateArray reducedStates; // Array holding reduced unit states for network transmission
 	
 	/* Message marshalling methods: */
@@ -86,6 +90,7 @@ class NCKServer:public PluginServer,public NCKProtocol
 	static void sessionChangedCallback(SessionID sessionId,void* userData);
 	void frontendSessionChangedCallback(Threads::EventDispatcher::SignalEvent& event);
 	void sendSimulationUpdateCallback(Threads::EventDispatcher::TimerEvent& event);
+	void checkpointCallback(Threads::EventDispatcher::TimerEvent& event);
 	MessageContinuation* setParametersRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* pointPickRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* rayPickRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
@@ -100,6 +105,14 @@ class NCKServer:public PluginServer,public NCKProtocol
 	void setUpdateRateCommandCallback(const char* argumentBegin,const char* argumentEnd);
 	void loadFileCommandCallback(const char* argumentBegin,const char* argumentEnd);
 	void saveFileCommandCallback(const char* argumentBegin,const char* argumentEnd);
+	void startRecordingCommandCallback(const char* argumentBegin,const char* argumentEnd);
+	void stopRecordingCommandCallback(const char* argumentBegin,const char* argumentEnd);
+	void recoverCheckpointCommandCallback(const char* argumentBegin,const char* argumentEnd);
+	void exportFileCommandCallback(const char* argumentBegin,const char* argumentEnd);
+	void storePrefabCommandCallback(const char* argumentBegin,const char* argumentEnd);
+	void selectPrefabCommandCallback(const char* argumentBegin,const char* argumentEnd);
+	void savePrefabsCommandCallback(const char* argumentBegin,const char* argumentEnd);
+	void loadPrefabsCommandCallback(const char* argumentBegin,const char* argumentEnd);
 	
 	/* Constructors and destructors: */
 	public:
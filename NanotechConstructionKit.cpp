@@ -29,6 +29,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Misc/StandardValueCoders.h>
 #include <Misc/ConfigurationFile.h>
 #include <IO/Directory.h>
+#include <Realtime/Time.h>
 #include <Math/Math.h>
 #include <Math/Constants.h>
 #include <Geometry/Point.h>
@@ -190,6 +191,9 @@ GLMotif::PopupMenu* NanotechConstructionKit::createIoMenu(void)
 	GLMotif::Button* saveGridStatisticsButton=new GLMotif::Button("SaveGridStatisticsButton",ioMenu,"Save Grid Statistics...");
 	saveGridStatisticsButton->getSelectCallbacks().add(this,&NanotechConstructionKit::saveGridStatisticsCallback);
 	
+	GLMotif::Button* saveVoidDistributionButton=new GLMotif::Button("SaveVoidDistributionButton",ioMenu,"Save Void Distribution...");
+	saveVoidDistributionButton->getSelectCallbacks().add(this,&NanotechConstructionKit::saveVoidDistributionCallback);
+	
 	ioMenu->manageChild();
 	
 	return ioMenuPopup;
@@ -289,8 +293,8 @@ GLMotif::PopupWindow* NanotechConstructionKit::createStatisticsDialog(void)
 
 void NanotechConstructionKit::updateStatisticsDialog(void)
 	{
-	/* Get statistics from space grid: */
-	NCK::SpaceGrid::GridStatistics stats=grid->calcGridStatistics();
+	/* Get the most recent statistics calculated by the simulation thread: */
+	const NCK::SpaceGrid::GridStatistics& stats=gridStatistics.getLockedValue();
 	
 	/* Update number of tetrahedra: */
 	numTetrahedraValue->setValue(stats.numUnits);
@@ -305,9 +309,124 @@ void NanotechConstructionKit::updateStatisticsDialog(void)
 	averageBondLengthValue->setValue(stats.averageBondLength);
 	}
 
+void* NanotechConstructionKit::simulationThreadMethod(void)
+	{
+	/* Run the simulation thread until interrupted: */
+	Realtime::TimePointMonotonic timer;
+	double pendingSteps=0.0;
+	std::vector<UnitDragger::EditRequest> requests;
+	while(keepRunning)
+		{
+		/* Calculate the number of simulation steps owed to the wall-clock time passed since the last update: */
+		pendingSteps+=double(timer.setAndDiff())*simulationRate;
+		int numSteps=int(Math::floor(pendingSteps));
+		pendingSteps-=double(numSteps);
+		if(numSteps>maxStepsPerUpdate)
+			{
+			/* Drop the steps that can not be caught up with: */
+			numSteps=maxStepsPerUpdate;
+			}
+		
+		{
+		Threads::Mutex::Lock gridLock(gridMutex);
+		
+		/* Apply all edit requests queued by unit draggers since the last update: */
+		{
+		Threads::Spinlock::Lock editRequestLock(editRequestMutex);
+		std::swap(requests,editRequests);
+		}
+		for(std::vector<UnitDragger::EditRequest>::iterator rIt=requests.begin();rIt!=requests.end();++rIt)
+			rIt->dragger->applyEditRequest(*rIt);
+		bool changed=gridChanged||!requests.empty()||numSteps>0;
+		requests.clear();
+		gridChanged=false;
+		
+		/* Advance simulation state: */
+		for(int i=0;i<numSteps;++i)
+			grid->advanceTime(timeStep);
+		
+		if(changed)
+			{
+			/* Post a snapshot of the new simulation state to the front end: */
+			grid->getRenderState(renderStates.startNewValue());
+			renderStates.postNewValue();
+			
+			/* Post a snapshot of the new simulation state to the statistics thread if it is ready for one: */
+			Threads::MutexCond::Lock statisticsLock(statisticsCond);
+			if(showStatistics&&statisticsSnapshotRequested)
+				{
+				statisticsSnapshotRequested=false;
+				grid->getStatisticsSnapshot(statisticsSnapshots.startNewValue());
+				statisticsSnapshots.postNewValue();
+				statisticsCond.signal();
+				}
+			}
+		}
+		
+		/* Sleep until at least the minimum simulation interval has passed: */
+		Realtime::TimePointMonotonic::sleep(timer+Realtime::TimeVector(0,1000000)); // 1ms minimum update interval
+		}
+	
+	return 0;
+	}
+
+void* NanotechConstructionKit::statisticsThreadMethod(void)
+	{
+	/* Run the statistics thread until interrupted: */
+	Realtime::TimePointMonotonic nextUpdate;
+	Realtime::TimeVector interval(0,100000000); // Calculate statistics at most every 100ms
+	while(true)
+		{
+		/* Wait for the simulation thread to post the requested snapshot: */
+		{
+		Threads::MutexCond::Lock statisticsLock(statisticsCond);
+		while(keepRunning&&statisticsSnapshotRequested)
+			statisticsCond.wait(statisticsLock);
+		if(!keepRunning)
+			break;
+		}
+		
+		/* Calculate statistics from the newest snapshot and post them to the front end: */
+		if(statisticsSnapshots.lockNewValue())
+			{
+			gridStatistics.startNewValue()=NCK::SpaceGrid::calcGridStatistics(statisticsSnapshots.getLockedValue(),numStatisticsThreads);
+			gridStatistics.postNewValue();
+			}
+		
+		/* Sleep until the next update time: */
+		nextUpdate+=interval;
+		Realtime::TimePointMonotonic::sleep(nextUpdate);
+		
+		/* Request the next snapshot from the simulation thread: */
+		{
+		Threads::MutexCond::Lock statisticsLock(statisticsCond);
+		statisticsSnapshotRequested=true;
+		}
+		}
+	
+	return 0;
+	}
+
+void NanotechConstructionKit::queueEditRequest(const UnitDragger::EditRequest& request)
+	{
+	Threads::Spinlock::Lock editRequestLock(editRequestMutex);
+	editRequests.push_back(request);
+	}
+
+void NanotechConstructionKit::postNewVoid(NCK::Polyhedron* newNewVoid)
+	{
+	Threads::Spinlock::Lock editRequestLock(editRequestMutex);
+	
+	/* Replace a previous void that was not yet picked up by the front end: */
+	delete newVoid;
+	newVoid=newNewVoid;
+	}
+
 NanotechConstructionKit::NanotechConstructionKit(int& argc,char**& argv)
 	:Vrui::Application(argc,argv),
-	 grid(0),oversampling(1),
+	 grid(0),timeStep(0.05),simulationRate(60.0),maxStepsPerUpdate(10),
+	 gridChanged(true),newVoid(0),showStatistics(false),statisticsSnapshotRequested(true),keepRunning(true),
+	 numStatisticsThreads(1),
 	 createType(UnitDragger::NONE),draggingMode(UnitDragger::SINGLE_UNIT),
 	 overrideTools(true),
 	 influenceSphereRadius(10.0*Vrui::getUiSize()),
@@ -319,6 +438,7 @@ NanotechConstructionKit::NanotechConstructionKit(int& argc,char**& argv)
 	const char* loadFileName=0;
 	const char* configFileName=NCK_CONFIG_ETCDIR "/" NCK_CONFIG_CONFIGFILENAME;
 	NCK::Scalar domainSize(24);
+	int oversampling=1;
 	for(int i=1;i<argc;++i)
 		{
 		if(argv[i][0]=='-')
@@ -363,7 +483,7 @@ NanotechConstructionKit::NanotechConstructionKit(int& argc,char**& argv)
 		else
 			{
 			/* Read a CAR file: */
-			grid=NCK::readCarFile(loadFileName);
+			grid=NCK::readCarFile(loadFileName,nckConfigFile.retrieveValue<int>("./numImportThreads",1));
 			}
 		}
 	else
@@ -375,6 +495,15 @@ NanotechConstructionKit::NanotechConstructionKit(int& argc,char**& argv)
 	
 	/* Set space grid parameters: */
 	grid->setAttenuation(Math::pow(nckConfigFile.retrieveValue<double>("./attenuation",0.95),20.0));
+	grid->setAccumulateForces(nckConfigFile.retrieveValue<bool>("./accumulateForces",grid->getAccumulateForces()));
+	grid->setNumSimulationThreads(nckConfigFile.retrieveValue<int>("./numSimulationThreads",grid->getNumSimulationThreads()));
+	grid->setMinimumImage(nckConfigFile.retrieveValue<bool>("./minimumImage",grid->getMinimumImage()));
+	
+	/* Set simulation thread parameters: */
+	timeStep=nckConfigFile.retrieveValue<NCK::Scalar>("./timeStep",timeStep);
+	simulationRate=nckConfigFile.retrieveValue<double>("./simulationRate",simulationRate)*double(oversampling);
+	maxStepsPerUpdate=nckConfigFile.retrieveValue<int>("./maxStepsPerUpdate",maxStepsPerUpdate);
+	numStatisticsThreads=nckConfigFile.retrieveValue<int>("./numStatisticsThreads",numStatisticsThreads);
 	
 	/* Set space grid rendering flags: */
 	grid->readRenderingFlags(nckConfigFile.getSection("./RenderingFlags"));
@@ -386,12 +515,26 @@ NanotechConstructionKit::NanotechConstructionKit(int& argc,char**& argv)
 	mainMenu=createMainMenu();
 	Vrui::setMainMenu(mainMenu);
 	statisticsDialog=createStatisticsDialog();
+	
+	/* Start the simulation and statistics threads: */
+	simulationThread.start(this,&NanotechConstructionKit::simulationThreadMethod);
+	statisticsThread.start(this,&NanotechConstructionKit::statisticsThreadMethod);
 	}
 
 NanotechConstructionKit::~NanotechConstructionKit(void)
 	{
+	/* Shut down the simulation and statistics threads: */
+	keepRunning=false;
+	{
+	Threads::MutexCond::Lock statisticsLock(statisticsCond);
+	statisticsCond.signal();
+	}
+	statisticsThread.join();
+	simulationThread.join();
+	
 	delete grid;
 	delete currentVoid;
+	delete newVoid;
 	delete mainMenu;
 	delete statisticsDialog;
 	
@@ -425,6 +568,17 @@ void NanotechConstructionKit::toolDestructionCallback(Vrui::ToolManager::ToolDes
 			;
 		if(udIt!=unitDraggers.end())
 			{
+			/* Wait until the simulation thread is done with the unit dragger and discard its pending edit requests: */
+			Threads::Mutex::Lock gridLock(gridMutex);
+			{
+			Threads::Spinlock::Lock editRequestLock(editRequestMutex);
+			std::vector<UnitDragger::EditRequest>::iterator destIt=editRequests.begin();
+			for(std::vector<UnitDragger::EditRequest>::iterator rIt=editRequests.begin();rIt!=editRequests.end();++rIt)
+				if(rIt->dragger!=*udIt)
+					*(destIt++)=*rIt;
+			editRequests.erase(destIt,editRequests.end());
+			}
+			
 			/* Remove the unit dragger: */
 			delete *udIt;
 			unitDraggers.erase(udIt);
@@ -434,12 +588,23 @@ void NanotechConstructionKit::toolDestructionCallback(Vrui::ToolManager::ToolDes
 
 void NanotechConstructionKit::frame(void)
 	{
-	/* Advance simulation state: */
-	for(int i=0;i<oversampling;++i)
-		grid->advanceTime(NCK::Scalar(0.05));
+	/* Lock the most recent snapshot of the simulation state: */
+	renderStates.lockNewValue();
+	
+	/* Pick up a new interstitial void extracted by the simulation thread: */
+	{
+	Threads::Spinlock::Lock editRequestLock(editRequestMutex);
+	if(newVoid!=0)
+		{
+		delete currentVoid;
+		currentVoid=newVoid;
+		newVoid=0;
+		}
+	}
 	
 	/* Update statistics dialog: */
-	updateStatisticsDialog();
+	if(gridStatistics.lockNewValue())
+		updateStatisticsDialog();
 	
 	/* Request another frame: */
 	Vrui::scheduleUpdate(Vrui::getNextAnimationTime());
@@ -456,7 +621,7 @@ void NanotechConstructionKit::display(GLContextData& contextData) const
 	glCullFace(GL_BACK);
 	glFrontFace(GL_CCW);
 	glLightModeli(GL_LIGHT_MODEL_TWO_SIDE,GL_FALSE);
-	grid->glRenderAction(contextData);
+	grid->glRenderAction(renderStates.getLockedValue(),contextData);
 	
 	/* Render the current interstitial void: */
 	if(currentVoid!=0)
@@ -553,6 +718,9 @@ void NanotechConstructionKit::draggingModeMenuEntrySelectCallback(GLMotif::Radio
 
 void NanotechConstructionKit::menuToggleSelectCallback(GLMotif::ToggleButton::ValueChangedCallbackData* cbData)
 	{
+	/* Change the rendering flags under the grid lock; the simulation thread hands them to the renderer with the next snapshot: */
+	Threads::Mutex::Lock gridLock(gridMutex);
+	gridChanged=true;
 	if(strcmp(cbData->toggle->getName(),"ShowUnitsToggle")==0)
 		grid->setShowUnits(cbData->set);
 	if(strcmp(cbData->toggle->getName(),"ShowVelocitiesToggle")==0)
@@ -570,6 +738,12 @@ void NanotechConstructionKit::overrideToolsToggleValueChangedCallback(GLMotif::T
 
 void NanotechConstructionKit::showStatisticsToggleValueChangedCallback(GLMotif::ToggleButton::ValueChangedCallbackData* cbData)
 	{
+	/* Enable or disable statistics snapshots in the simulation thread: */
+	{
+	Threads::MutexCond::Lock statisticsLock(statisticsCond);
+	showStatistics=cbData->set;
+	}
+	
 	/* Hide or show statistics dialog: */
 	if(cbData->set)
 		Vrui::popupPrimaryWidget(statisticsDialog);
@@ -579,6 +753,8 @@ void NanotechConstructionKit::showStatisticsToggleValueChangedCallback(GLMotif::
 
 void NanotechConstructionKit::unmarkAllUnitsCallback(Misc::CallbackData* cbData)
 	{
+	Threads::Mutex::Lock gridLock(gridMutex);
+	gridChanged=true;
 	NCK::SpaceGrid::StructuralUnitList units=grid->getAllUnits();
 	for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=units.begin();uIt!=units.end();++uIt)
 		grid->unmarkUnit(*uIt);
@@ -586,6 +762,8 @@ void NanotechConstructionKit::unmarkAllUnitsCallback(Misc::CallbackData* cbData)
 
 void NanotechConstructionKit::unlockAllUnitsCallback(Misc::CallbackData* cbData)
 	{
+	Threads::Mutex::Lock gridLock(gridMutex);
+	gridChanged=true;
 	NCK::SpaceGrid::StructuralUnitList units=grid->getAllUnits();
 	for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=units.begin();uIt!=units.end();++uIt)
 		grid->unlockUnit(*uIt);
@@ -605,7 +783,11 @@ void NanotechConstructionKit::loadUnitsCallback(Misc::CallbackData* cbData)
 void NanotechConstructionKit::loadUnitsOKCallback(GLMotif::FileSelectionDialog::OKCallbackData* cbData)
 	{
 	/* Load the selected unit file: */
+	{
+	Threads::Mutex::Lock gridLock(gridMutex);
 	NCK::readUnitFile(grid,cbData->selectedDirectory->getPath(cbData->selectedFileName).c_str());
+	gridChanged=true;
+	}
 	
 	/* Destroy the file selection dialog: */
 	cbData->fileSelectionDialog->close();
@@ -613,14 +795,20 @@ void NanotechConstructionKit::loadUnitsOKCallback(GLMotif::FileSelectionDialog::
 
 void NanotechConstructionKit::saveUnitsCallback(Misc::CallbackData* cbData)
 	{
+	Threads::Mutex::Lock gridLock(gridMutex);
 	NCK::writeUnitFile("Scratch.units",grid);
 	NCK::writeCarFile("Scratch.car",grid);
 	}
 
 void NanotechConstructionKit::saveGridStatisticsCallback(Misc::CallbackData* cbData)
 	{
-	/* Get statistics from space grid: */
-	NCK::SpaceGrid::GridStatistics stats=grid->calcGridStatistics();
+	/* Take a snapshot of the space grid and calculate statistics from it: */
+	NCK::SpaceGrid::StatisticsSnapshot snapshot;
+	{
+	Threads::Mutex::Lock gridLock(gridMutex);
+	grid->getStatisticsSnapshot(snapshot);
+	}
+	NCK::SpaceGrid::GridStatistics stats=NCK::SpaceGrid::calcGridStatistics(snapshot,numStatisticsThreads);
 	
 	/* Write statistics to file: */
 	FILE* statFile=fopen("GridStatistics.txt","wt");
@@ -695,4 +883,36 @@ void NanotechConstructionKit::saveGridStatisticsCallback(Misc::CallbackData* cbD
 	fclose(statFile);
 	}
 
+void NanotechConstructionKit::saveVoidDistributionCallback(Misc::CallbackData* cbData)
+	{
+	/* Find all interstitial voids while the simulation thread is blocked: */
+	NCK::Polyhedron::VoidDistribution dist;
+	{
+	Threads::Mutex::Lock gridLock(gridMutex);
+	dist=NCK::Polyhedron::analyzeVoids(*grid,numStatisticsThreads);
+	}
+	
+	/* Write void distribution to file: */
+	FILE* voidFile=fopen("VoidDistribution.txt","wt");
+	fprintf(voidFile,"Number of voids            : %6d\n",int(dist.voids.size()));
+	fprintf(voidFile,"Number of closed voids     : %6d\n",dist.numClosedVoids);
+	fprintf(voidFile,"Total closed void volume   : %10.4lf\n\n",dist.totalVolume);
+	
+	fprintf(voidFile,"Void volume histogram:\n");
+	NCK::Scalar volumeBinSize=(dist.volumeMax-dist.volumeMin)/NCK::Scalar(NCK::Polyhedron::VoidDistribution::numVolumeBins);
+	for(int i=0;i<NCK::Polyhedron::VoidDistribution::numVolumeBins;++i)
+		{
+		NCK::Scalar binMin=dist.volumeMin+volumeBinSize*NCK::Scalar(i);
+		NCK::Scalar binMax=dist.volumeMin+volumeBinSize*NCK::Scalar(i+1);
+		fprintf(voidFile,"Bin %3d, [%10.4lf, %10.4lf]: %8.6lf\n",i,binMin,binMax,dist.numClosedVoids>0?double(dist.volumeHistogram[i])/double(dist.numClosedVoids):0.0);
+		}
+	fprintf(voidFile,"Average void volume: %10.4lf\n\n",dist.averageVolume);
+	
+	fprintf(voidFile,"Voids:\n");
+	for(std::vector<NCK::Polyhedron::VoidInfo>::const_iterator vIt=dist.voids.begin();vIt!=dist.voids.end();++vIt)
+		fprintf(voidFile,"(%10.4lf, %10.4lf, %10.4lf) %s volume %10.4lf, area %10.4lf, %4d faces\n",vIt->centroid[0],vIt->centroid[1],vIt->centroid[2],vIt->closed?"closed":"open  ",vIt->volume,vIt->surfaceArea,vIt->numFaces);
+	
+	fclose(voidFile);
+	}
+
 VRUI_APPLICATION_RUN(NanotechConstructionKit)
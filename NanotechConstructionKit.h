@@ -23,6 +23,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #define NANOTECHCONSTRUCTIONKIT_INCLUDED
 
 #include <vector>
+#include <Threads/Thread.h>
+#include <Threads/Mutex.h>
+#include <Threads/MutexCond.h>
+#include <Threads/Spinlock.h>
+#include <Threads/TripleBuffer.h>
 #include <GL/gl.h>
 #include <GL/GLMaterial.h>
 #include <GLMotif/ToggleButton.h>
@@ -32,6 +37,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Vrui/Application.h>
 
 #include "AffineSpace.h"
+#include "SpaceGrid.h"
 #include "UnitDragger.h"
 
 /* Forward declarations: */
@@ -42,7 +48,6 @@ class PopupMenu;
 class PopupWindow;
 }
 namespace NCK {
-class SpaceGrid;
 class Polyhedron;
 }
 
@@ -60,7 +65,26 @@ struct NanotechConstructionKit:public Vrui::Application
 	
 	/* Grid state: */
 	NCK::SpaceGrid* grid; // The space grid containing all tetrahedra
-	int oversampling; // Number of simulation time steps to run per Vrui frame
+	NCK::Scalar timeStep; // Length of a single simulation time step
+	double simulationRate; // Number of simulation time steps to run per second of wall-clock time
+	int maxStepsPerUpdate; // Maximum number of simulation time steps to run in one update when falling behind wall-clock time
+	
+	/* Simulation thread state: */
+	Threads::Mutex gridMutex; // Mutex protecting the space grid against concurrent access by the simulation thread and the front end
+	bool gridChanged; // Flag whether the front end changed the space grid since the last render state snapshot; protected by gridMutex
+	Threads::Spinlock editRequestMutex; // Mutex serializing access to the list of pending edit requests and the new interstitial void
+	std::vector<UnitDragger::EditRequest> editRequests; // List of edit requests queued by unit draggers
+	NCK::Polyhedron* newVoid; // Interstitial void extracted by the simulation thread and not yet picked up by the front end
+	Threads::MutexCond statisticsCond; // Condition variable protecting the statistics snapshot handoff and signaling posted snapshots
+	bool showStatistics; // Flag whether the simulation thread takes snapshots for the statistics dialog; protected by statisticsCond
+	bool statisticsSnapshotRequested; // Flag whether the statistics thread is ready to process a new snapshot; protected by statisticsCond
+	volatile bool keepRunning; // Flag to keep the simulation thread running
+	Threads::Thread simulationThread; // Thread advancing the simulation in the background
+	Threads::TripleBuffer<NCK::SpaceGrid::RenderState> renderStates; // Triple buffer of space grid snapshots for rendering
+	int numStatisticsThreads; // Number of threads used to calculate grid statistics
+	Threads::Thread statisticsThread; // Thread calculating grid statistics from snapshots in the background
+	Threads::TripleBuffer<NCK::SpaceGrid::StatisticsSnapshot> statisticsSnapshots; // Triple buffer of space grid snapshots for statistics calculation
+	Threads::TripleBuffer<NCK::SpaceGrid::GridStatistics> gridStatistics; // Triple buffer of grid statistics for the statistics dialog
 	
 	/* Interaction state: */
 	int createType; // Type of unit to be created by unit draggers
@@ -88,7 +112,11 @@ struct NanotechConstructionKit:public Vrui::Application
 	GLMotif::PopupMenu* createIoMenu(void); // Creates program's input/output menu
 	GLMotif::PopupMenu* createMainMenu(void); // Creates program's main menu
 	GLMotif::PopupWindow* createStatisticsDialog(void); // Creates simulation statistics dialog
-	void updateStatisticsDialog(void); // Updates state of the statistics dialog to the space grid
+	void updateStatisticsDialog(void); // Updates state of the statistics dialog to the most recent grid statistics
+	void* simulationThreadMethod(void); // Method running the background simulation thread
+	void* statisticsThreadMethod(void); // Method running the background statistics thread
+	void queueEditRequest(const UnitDragger::EditRequest& request); // Queues an edit request to be applied by the simulation thread before the next simulation step
+	void postNewVoid(NCK::Polyhedron* newNewVoid); // Hands an interstitial void extracted by the simulation thread to the front end
 	
 	/* Constructors and destructors: */
 	NanotechConstructionKit(int& argc,char**& argv);
@@ -113,6 +141,7 @@ struct NanotechConstructionKit:public Vrui::Application
 	void loadUnitsOKCallback(GLMotif::FileSelectionDialog::OKCallbackData* cbData);
 	void saveUnitsCallback(Misc::CallbackData* cbData);
 	void saveGridStatisticsCallback(Misc::CallbackData* cbData);
+	void saveVoidDistributionCallback(Misc::CallbackData* cbData);
 	};
 
 #endif
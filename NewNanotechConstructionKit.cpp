@@ -21,15 +21,18 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "NewNanotechConstructionKit.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdexcept>
 #include <algorithm>
 #include <iostream>
 #include <Misc/MessageLogger.h>
+#include <Misc/FileNameExtensions.h>
 #include <Misc/Marshaller.h>
 #include <Misc/StandardMarshallers.h>
 #include <Misc/CompoundMarshallers.h>
+#include <Misc/StandardValueCoders.h>
 #include <Misc/ConfigurationFile.h>
 #include <Realtime/Time.h>
 #include <IO/File.h>
@@ -43,6 +46,12 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <GL/gl.h>
 #include <GL/GLColorTemplates.h>
 #include <GL/GLContextData.h>
+#include <GL/GLLightTracker.h>
+#include <GL/GLShaderTools.h>
+#include <GL/Extensions/GLARBDrawInstanced.h>
+#include <GL/Extensions/GLARBInstancedArrays.h>
+#include <GL/Extensions/GLARBShaderObjects.h>
+#include <GL/Extensions/GLARBVertexShader.h>
 #include <GL/Extensions/GLARBVertexBufferObject.h>
 #include <GL/GLGeometryWrappers.h>
 #include <GLMotif/StyleSheet.h>
@@ -65,6 +74,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "IndirectSimulationInterface.h"
 #include "Simulation.h"
 #include "ClusterSlaveSimulation.h"
+#include "TrajectoryPlayer.h"
 #include "NCKClient.h"
 
 #include "Config.h"
@@ -87,6 +97,8 @@ void* NewNanotechConstructionKit::ClusterForwarder::communicationThreadMethod(vo
 			
 			/* Reduce the new unit states into a new reduced state array: */
 			ReducedUnitStateArray& rStates=unitStates.startNewValue();
+			rStates.sessionId=states.sessionId;
+			rStates.timeStamp=states.timeStamp;
 			rStates.states.clear();
 			rStates.states.reserve(states.states.size());
 			ReducedUnitState r;
@@ -410,14 +422,31 @@ Methods of class NewNanotechConstructionKit::DataItem:
 *****************************************************/
 
 NewNanotechConstructionKit::DataItem::DataItem(void)
-	:vertexBufferId(0),meshStartIndices(0),
-	 sessionId(0)
+	:vertexBufferId(0),meshStartIndices(0),reducedMeshStartIndices(0),numMeshes(0),
+	 sessionId(0),
+	 haveInstancing(GLARBDrawInstanced::isSupported()&&GLARBInstancedArrays::isSupported()&&GLARBShaderObjects::isSupported()&&GLARBVertexShader::isSupported()),
+	 instanceBufferId(0),instanceVersion(0),
+	 instanceShader(0),lightStateVersion(0),
+	 numSubmittedInstances(0)
 	{
 	/* Initialize required OpenGL extensions: */
 	GLARBVertexBufferObject::initExtension();
+	if(haveInstancing)
+		{
+		GLARBDrawInstanced::initExtension();
+		GLARBInstancedArrays::initExtension();
+		GLARBShaderObjects::initExtension();
+		GLARBVertexShader::initExtension();
+		}
 	
 	/* Create a vertex buffer: */
 	glGenBuffersARB(1,&vertexBufferId);
+	
+	/* Create an instance buffer if instanced rendering is supported: */
+	if(haveInstancing)
+		glGenBuffersARB(1,&instanceBufferId);
+	
+	instanceAttributeIndices[0]=instanceAttributeIndices[1]=-1;
 	}
 
 NewNanotechConstructionKit::DataItem::~DataItem(void)
@@ -425,8 +454,17 @@ NewNanotechConstructionKit::DataItem::~DataItem(void)
 	/* Destroy the vertex buffer: */
 	glDeleteBuffersARB(1,&vertexBufferId);
 	
-	/* Delete the index array: */
+	/* Delete the index arrays: */
 	delete[] meshStartIndices;
+	delete[] reducedMeshStartIndices;
+	
+	/* Destroy the instance buffer and shader: */
+	if(haveInstancing)
+		{
+		glDeleteBuffersARB(1,&instanceBufferId);
+		if(instanceShader!=0)
+			glDeleteObjectARB(instanceShader);
+		}
 	}
 
 /*******************************************
@@ -581,6 +619,118 @@ void* NewNanotechConstructionKit::simulationThreadMethod(void)
 	return 0;
 	}
 
+template <class UnitStateParam>
+void NewNanotechConstructionKit::bucketUnits(const StateArray<UnitStateParam>& unitStates)
+	{
+	/* Sort the unit states into a new unit instance array and post it to the front end: */
+	unitInstances.startNewValue().set(unitStates,cullingCellSize);
+	unitInstances.postNewValue();
+	}
+
+void* NewNanotechConstructionKit::instancingThreadMethod(void)
+	{
+	/* Determine the type of simulation: */
+	Simulation* localSim=dynamic_cast<Simulation*>(sim);
+	IndirectSimulationInterface* indirectSim=dynamic_cast<IndirectSimulationInterface*>(sim);
+	
+	/* Run the instancing thread until interrupted: */
+	Realtime::TimePointMonotonic nextUpdate;
+	Realtime::TimeVector interval(0,5000000); // Check for new unit states every 5ms
+	while(keepRunning)
+		{
+		/* Bucket the newest unit states based on whether the simulation is local, forwarded local, or remote: */
+		if(forwarder!=0)
+			{
+			if(forwarder->lockNewState())
+				bucketUnits(forwarder->getLockedState());
+			}
+		else if(localSim!=0)
+			{
+			if(localSim->lockNewState()&&localSim->isLockedStateValid())
+				bucketUnits(localSim->getLockedState());
+			}
+		else if(indirectSim!=0)
+			{
+			if(indirectSim->lockNewState()&&indirectSim->isLockedStateValid())
+				bucketUnits(indirectSim->getLockedState());
+			}
+		
+		/* Sleep until the next update time: */
+		nextUpdate+=interval;
+		Realtime::TimePointMonotonic::sleep(nextUpdate);
+		}
+	
+	return 0;
+	}
+
+void NewNanotechConstructionKit::buildInstanceShader(NewNanotechConstructionKit::DataItem* dataItem,GLContextData& contextData) const
+	{
+	/* Destroy a previous shader program: */
+	if(dataItem->instanceShader!=0)
+		glDeleteObjectARB(dataItem->instanceShader);
+	dataItem->instanceShader=0;
+	
+	/* Create light accumulation functions for all enabled light sources: */
+	const GLLightTracker& lt=*contextData.getLightTracker();
+	std::string lightFunctions;
+	std::string lightCalls;
+	for(int lightIndex=0;lightIndex<lt.getMaxNumLights();++lightIndex)
+		if(lt.getLightState(lightIndex).isEnabled())
+			{
+			lightFunctions.append(lt.createAccumulateLightFunction(lightIndex));
+			char call[256];
+			snprintf(call,sizeof(call),"\taccumulateLight%d(vertexEc,normalEc,gl_FrontMaterial.ambient,gl_FrontMaterial.diffuse,gl_FrontMaterial.specular,gl_FrontMaterial.shininess,ambientDiffuse,specular);\n",lightIndex);
+			lightCalls.append(call);
+			}
+	
+	/* Assemble the vertex shader, which rotates and translates each mesh vertex by its instance's orientation quaternion and position: */
+	std::string vertexShaderSource="\
+		attribute vec3 instancePosition;\n\
+		attribute vec4 instanceOrientation;\n\
+		\n\
+		vec3 rotate(in vec4 q,in vec3 v)\n\
+			{\n\
+			return v+2.0*cross(q.xyz,cross(q.xyz,v)+q.w*v);\n\
+			}\n\
+		\n";
+	vertexShaderSource.append(lightFunctions);
+	vertexShaderSource.append("\
+		\n\
+		void main()\n\
+			{\n\
+			vec4 vertex=vec4(rotate(instanceOrientation,gl_Vertex.xyz)+instancePosition,1.0);\n\
+			vec4 vertexEc=gl_ModelViewMatrix*vertex;\n\
+			vec3 normalEc=normalize(gl_NormalMatrix*rotate(instanceOrientation,gl_Normal));\n\
+			vec4 ambientDiffuse=gl_FrontLightModelProduct.sceneColor;\n\
+			vec4 specular=vec4(0.0,0.0,0.0,0.0);\n");
+	vertexShaderSource.append(lightCalls);
+	vertexShaderSource.append("\
+			gl_FrontColor=ambientDiffuse+specular;\n\
+			gl_Position=gl_ModelViewProjectionMatrix*vertex;\n\
+			}\n");
+	
+	/* Fragment shader simply passes through the interpolated color: */
+	static const char* fragmentShaderSource="\
+		void main()\n\
+			{\n\
+			gl_FragColor=gl_Color;\n\
+			}\n";
+	
+	/* Compile and link the shader program: */
+	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource.c_str());
+	GLhandleARB fragmentShader=glCompileFragmentShaderFromString(fragmentShaderSource);
+	dataItem->instanceShader=glLinkShader(vertexShader,fragmentShader);
+	glDeleteObjectARB(vertexShader);
+	glDeleteObjectARB(fragmentShader);
+	
+	/* Retrieve the instance attribute indices: */
+	dataItem->instanceAttributeIndices[0]=glGetAttribLocationARB(dataItem->instanceShader,"instancePosition");
+	dataItem->instanceAttributeIndices[1]=glGetAttribLocationARB(dataItem->instanceShader,"instanceOrientation");
+	
+	/* Mark the shader as up-to-date: */
+	dataItem->lightStateVersion=lt.getVersion();
+	}
+
 void NewNanotechConstructionKit::loadUnitFileCallback(GLMotif::FileSelectionDialog::OKCallbackData* cbData)
 	{
 	try
@@ -648,6 +798,13 @@ void NewNanotechConstructionKit::createMainMenu(void)
 	GLMotif::Button* showSimulationDialogButton=new GLMotif::Button("ShowSimulationDialogButton",mainMenu,"Show Simulation Dialog");
 	showSimulationDialogButton->getSelectCallbacks().add(this,&NewNanotechConstructionKit::showSimulationDialogCallback);
 	
+	if(player!=0)
+		{
+		/* Create a button to show the trajectory playback control window: */
+		GLMotif::Button* showPlaybackDialogButton=new GLMotif::Button("ShowPlaybackDialogButton",mainMenu,"Show Playback Dialog");
+		showPlaybackDialogButton->getSelectCallbacks().add(this,&NewNanotechConstructionKit::showPlaybackDialogCallback);
+		}
+	
 	/* Finish the main menu: */
 	mainMenu->manageMenu();
 	}
@@ -719,21 +876,137 @@ void NewNanotechConstructionKit::createSimulationDialog(void)
 	timeFactorSlider->track(parameters.timeFactor);
 	timeFactorSlider->getValueChangedCallbacks().add(this,&NewNanotechConstructionKit::parametersChangedCallback);
 	
+	if(dynamic_cast<Simulation*>(sim)!=0)
+		{
+		/* Create text fields to display bond statistics calculated by the local simulation: */
+		new GLMotif::Label("NumUnitsLabel",settings,"Units");
+		numUnitsValue=new GLMotif::TextField("NumUnitsValue",settings,8);
+		
+		new GLMotif::Label("NumBondsLabel",settings,"Bonds");
+		numBondsValue=new GLMotif::TextField("NumBondsValue",settings,8);
+		
+		new GLMotif::Label("NumUnbondedSitesLabel",settings,"Unbonded Sites");
+		numUnbondedSitesValue=new GLMotif::TextField("NumUnbondedSitesValue",settings,8);
+		
+		new GLMotif::Label("AverageBondLengthLabel",settings,"Avg Bond Length");
+		averageBondLengthValue=new GLMotif::TextField("AverageBondLengthValue",settings,8);
+		averageBondLengthValue->setFloatFormat(GLMotif::TextField::FIXED);
+		averageBondLengthValue->setPrecision(3);
+		
+		new GLMotif::Label("AverageBondAngleLabel",settings,"Avg Bond Angle");
+		averageBondAngleValue=new GLMotif::TextField("AverageBondAngleValue",settings,8);
+		averageBondAngleValue->setFloatFormat(GLMotif::TextField::FIXED);
+		averageBondAngleValue->setPrecision(2);
+		}
+	
+	settings->manageChild();
+	}
+
+void NewNanotechConstructionKit::updateSimulationDialog(void)
+	{
+	/* Get the most recent bond statistics calculated by the local simulation: */
+	const Simulation::Statistics& stats=static_cast<Simulation*>(sim)->getLockedStatistics();
+	
+	/* Update the statistics display: */
+	numUnitsValue->setValue(int(stats.numUnits));
+	numBondsValue->setValue(int(stats.numBonds));
+	numUnbondedSitesValue->setValue(int(stats.numUnbondedSites));
+	averageBondLengthValue->setValue(double(stats.averageBondLength));
+	averageBondAngleValue->setValue(double(Math::deg(stats.averageBondAngle)));
+	}
+
+void NewNanotechConstructionKit::showPlaybackDialogCallback(Misc::CallbackData* cbData)
+	{
+	/* Show the dialog: */
+	Vrui::popupPrimaryWidget(playbackDialog);
+	}
+
+void NewNanotechConstructionKit::playbackFrameChangedCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData)
+	{
+	/* Jump to the selected frame, which resumes playback that paused at the end of the trajectory: */
+	player->seek(Index(Math::floor(cbData->value+0.5)));
+	playbackPausedToggle->setToggle(player->isPaused());
+	}
+
+void NewNanotechConstructionKit::playbackRateChangedCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData)
+	{
+	/* Set the new playback rate: */
+	playbackRate=cbData->value;
+	player->setPlaybackRate(playbackRate);
+	}
+
+void NewNanotechConstructionKit::playbackPausedChangedCallback(GLMotif::ToggleButton::ValueChangedCallbackData* cbData)
+	{
+	/* Rewind the trajectory when playback is resumed at its end: */
+	if(!cbData->set&&player->getTargetFrame()+1>=player->getNumFrames())
+		{
+		player->seek(0);
+		playbackFrameSlider->setValue(0.0);
+		}
+	player->setPaused(cbData->set);
+	}
+
+void NewNanotechConstructionKit::createPlaybackDialog(void)
+	{
+	const GLMotif::StyleSheet& ss=*Vrui::getUiStyleSheet();
+	
+	playbackDialog=new GLMotif::PopupWindow("PlaybackDialog",Vrui::getWidgetManager(),"Playback Dialog");
+	playbackDialog->setResizableFlags(true,false);
+	playbackDialog->setCloseButton(true);
+	playbackDialog->popDownOnClose();
+	
+	GLMotif::RowColumn* settings=new GLMotif::RowColumn("Settings",playbackDialog,false);
+	settings->setNumMinorWidgets(2);
+	
+	new GLMotif::Label("FrameLabel",settings,"Frame");
+	
+	playbackFrameSlider=new GLMotif::TextFieldSlider("FrameSlider",settings,8,ss.fontHeight*20.0f);
+	playbackFrameSlider->getTextField()->setFieldWidth(8);
+	playbackFrameSlider->setSliderMapping(GLMotif::TextFieldSlider::LINEAR);
+	playbackFrameSlider->setValueType(GLMotif::TextFieldSlider::INT);
+	playbackFrameSlider->setValueRange(0.0,double(player->getNumFrames()-1),1.0);
+	playbackFrameSlider->setValue(0.0);
+	playbackFrameSlider->getValueChangedCallbacks().add(this,&NewNanotechConstructionKit::playbackFrameChangedCallback);
+	
+	new GLMotif::Label("RateLabel",settings,"Steps/s");
+	
+	GLMotif::TextFieldSlider* playbackRateSlider=new GLMotif::TextFieldSlider("RateSlider",settings,8,ss.fontHeight*20.0f);
+	playbackRateSlider->getTextField()->setFloatFormat(GLMotif::TextField::FIXED);
+	playbackRateSlider->getTextField()->setFieldWidth(8);
+	playbackRateSlider->getTextField()->setPrecision(0);
+	playbackRateSlider->setSliderMapping(GLMotif::TextFieldSlider::EXP10);
+	playbackRateSlider->setValueType(GLMotif::TextFieldSlider::FLOAT);
+	playbackRateSlider->setValueRange(10.0,100000.0,0.05);
+	playbackRateSlider->setValue(playbackRate);
+	playbackRateSlider->getValueChangedCallbacks().add(this,&NewNanotechConstructionKit::playbackRateChangedCallback);
+	
+	new GLMotif::Label("PausedLabel",settings,"Playback");
+	
+	playbackPausedToggle=new GLMotif::ToggleButton("PausedToggle",settings,"Paused");
+	playbackPausedToggle->setToggle(false);
+	playbackPausedToggle->getValueChangedCallbacks().add(this,&NewNanotechConstructionKit::playbackPausedChangedCallback);
+	
 	settings->manageChild();
 	}
 
 NewNanotechConstructionKit::NewNanotechConstructionKit(int& argc,char**& argv)
 	:Vrui::Application(argc,argv),
-	 sim(0),forwarder(0),
+	 sim(0),forwarder(0),player(0),
 	 keepRunning(true),
+	 instanceVersion(0),
+	 cullingCellSize(8),lodDistance(40),
 	 unitFileHelper(Vrui::getWidgetManager(),"UnitFile.units",".units"),
 	 mainMenu(0),simulationDialog(0),
+	 numUnitsValue(0),numBondsValue(0),numUnbondedSitesValue(0),averageBondLengthValue(0),averageBondAngleValue(0),
+	 playbackRate(1000.0),playbackDialog(0),playbackFrameSlider(0),playbackPausedToggle(0),
 	 unitCreatorToolBase(0),
 	 unitMaterial(GLMaterial::Color(0.7f,0.7f,0.7f),GLMaterial::Color(0.25f,0.25f,0.25f),16.0f),
 	 pickSphereMaterial(GLMaterial::Color(1.0f,0.0f,0.0f),GLMaterial::Color(0.5f,0.5f,0.5f),32.0f)
 	{
 	/* Parse the command line: */
 	const char* unitFileName=0;
+	const char* trajectoryFileName=0;
+	const char* playbackFileName=0;
 	Box domain=Box(Point::origin,Point(100,100,100));
 	for(int i=1;i<argc;++i)
 		{
@@ -749,6 +1022,26 @@ NewNanotechConstructionKit::NewNanotechConstructionKit(int& argc,char**& argv)
 					}
 				domain=Box(Point::origin,max);
 				}
+			else if(strcasecmp(argv[i],"-cullCellSize")==0)
+				{
+				++i;
+				cullingCellSize=Scalar(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i],"-lodDistance")==0)
+				{
+				++i;
+				lodDistance=Scalar(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i],"-record")==0)
+				{
+				++i;
+				trajectoryFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i],"-play")==0)
+				{
+				++i;
+				playbackFileName=argv[i];
+				}
 			}
 		else if(unitFileName==0)
 			unitFileName=argv[i];
@@ -763,6 +1056,17 @@ NewNanotechConstructionKit::NewNanotechConstructionKit(int& argc,char**& argv)
 		client->addPluginProtocol(nckClient);
 		sim=nckClient;
 		}
+	else if(playbackFileName!=0)
+		{
+		/* Open the main configuration file: */
+		Misc::ConfigurationFile configFile(NCK_CONFIG_ETCDIR "/" NCK_CONFIG_CONFIGFILENAME);
+		Misc::ConfigurationFileSection rootSection=configFile.getSection("NewNanotechConstructionKit");
+		
+		/* Play back a recorded trajectory; all cluster nodes read the trajectory file independently, but select frames based on the synchronized application time: */
+		playbackRate=rootSection.retrieveValue<double>("./playbackRate",playbackRate);
+		unsigned int prefetchSize=rootSection.retrieveValue<unsigned int>("./playbackPrefetchSize",64);
+		sim=player=new TrajectoryPlayer(playbackFileName,playbackRate,prefetchSize);
+		}
 	else if(Vrui::isHeadNode())
 		{
 		/* Open the main configuration file: */
@@ -771,7 +1075,13 @@ NewNanotechConstructionKit::NewNanotechConstructionKit(int& argc,char**& argv)
 		
 		/* Create a local simulation structure: */
 		Simulation* localSim=0;
-		if(unitFileName!=0)
+		if(unitFileName!=0&&Misc::hasCaseExtension(unitFileName,".car"))
+			{
+			/* Create an empty simulation structure and import the CAR file into it: */
+			sim=localSim=new Simulation(rootSection,domain);
+			localSim->importCarFile(unitFileName);
+			}
+		else if(unitFileName!=0)
 			{
 			/* Load a previously saved simulation: */
 			IO::FilePtr unitFile=IO::openFile(unitFileName);
@@ -784,6 +1094,10 @@ NewNanotechConstructionKit::NewNanotechConstructionKit(int& argc,char**& argv)
 			sim=localSim=new Simulation(rootSection,domain);
 			}
 		
+		/* Start recording a trajectory if requested: */
+		if(trajectoryFileName!=0)
+			localSim->startRecording(trajectoryFileName);
+		
 		/* Start the simulation thread: */
 		simulationThread.start(this,&NewNanotechConstructionKit::simulationThreadMethod);
 		
@@ -825,7 +1139,7 @@ NewNanotechConstructionKit::NewNanotechConstructionKit(int& argc,char**& argv)
 	tm.addClass(new UnitToolFactory("DestroyUnitTool","Destroy Unit",toolBase,UnitToolFactory::DESTROY,false,tm),Vrui::ToolManager::defaultToolFactoryDestructor);
 	tm.addClass(new UnitToolFactory("DestroyComplexTool","Destroy Complex",toolBase,UnitToolFactory::DESTROY,true,tm),Vrui::ToolManager::defaultToolFactoryDestructor);
 	
-	if(client==0)
+	if(client==0&&player==0)
 		{
 		/* Create the unit creation tool classes: */
 		createUnitCreationTools();
@@ -839,21 +1153,33 @@ NewNanotechConstructionKit::NewNanotechConstructionKit(int& argc,char**& argv)
 	parameters=sim->getParameters();
 	createSimulationDialog();
 	
+	if(player!=0)
+		{
+		/* Create the trajectory playback control dialog: */
+		createPlaybackDialog();
+		}
+	
 	/* Tell Vrui that navigation space is measured in Angstrom: */
 	Vrui::getCoordinateManager()->setUnit(Geometry::LinearUnit(Geometry::LinearUnit::ANGSTROM,1.0));
 	
 	/* Initialize the pick sphere renderer: */
 	pickSphereRenderer.setFixedRadius(Vrui::getPointPickDistance()*Vrui::getNavigationTransformation().getScaling());
+	
+	/* Start the instancing thread: */
+	instancingThread.start(this,&NewNanotechConstructionKit::instancingThreadMethod);
 	}
 
 NewNanotechConstructionKit::~NewNanotechConstructionKit(void)
 	{
+	/* Shut down the instancing thread: */
+	keepRunning=false;
+	instancingThread.join();
+	
 	/* Check if this is a local simulation: */
 	Simulation* localSim=dynamic_cast<Simulation*>(sim);
 	if(localSim!=0)
 		{
 		/* Shut down the simulation thread: */
-		keepRunning=false;
 		simulationThread.join();
 		}
 	
@@ -871,12 +1197,31 @@ NewNanotechConstructionKit::~NewNanotechConstructionKit(void)
 	/* Clean up: */
 	delete mainMenu;
 	delete simulationDialog;
+	delete playbackDialog;
 	}
 
 void NewNanotechConstructionKit::frame(void)
 	{
-	/* Lock the most recent simulation state: */
-	sim->lockNewState();
+	/* Lock the most recent bucketed unit states: */
+	if(unitInstances.lockNewValue())
+		++instanceVersion;
+	
+	/* Display new bond statistics of a local simulation: */
+	if(numUnitsValue!=0&&static_cast<Simulation*>(sim)->lockNewStatistics())
+		updateSimulationDialog();
+	
+	if(player!=0)
+		{
+		/* Advance trajectory playback by the application's frame time, which is identical on all cluster nodes: */
+		bool wasPaused=player->isPaused();
+		if(player->advance(Vrui::getFrameTime()))
+			{
+			/* Track the new frame in the playback dialog: */
+			playbackFrameSlider->setValue(double(player->getTargetFrame()));
+			}
+		if(player->isPaused()!=wasPaused)
+			playbackPausedToggle->setToggle(player->isPaused());
+		}
 	
 	/* Request another frame: */
 	Vrui::scheduleUpdate(Vrui::getNextAnimationTime());
@@ -888,21 +1233,46 @@ namespace {
 Helper functions:
 ****************/
 
-template <class UnitStateParam>
+template <class VertexParam>
+inline
+void storeTriangle(
+	VertexParam* vPtr,
+	const Point& p0,
+	const Point& p1,
+	const Point& p2)
+	{
+	/* Calculate the triangle's normal vector: */
+	Vector normal=(p1-p0)^(p2-p0);
+	normal.normalize();
+	
+	/* Store the triangle: */
+	vPtr[0].normal=normal;
+	vPtr[0].position=p0;
+	vPtr[1].normal=normal;
+	vPtr[1].position=p1;
+	vPtr[2].normal=normal;
+	vPtr[2].position=p2;
+	}
+
 inline
 void renderUnits(
-	const StateArray<UnitStateParam>& unitStates,
-	const GLuint* meshStartIndices)
+	const std::vector<UnitInstanceArray::Instance>& instances,
+	const UnitInstanceArray::DrawRange& range,
+	GLuint meshStartIndex,
+	GLsizei meshNumVertices)
 	{
-	for(typename StateArray<UnitStateParam>::UnitStateList::const_iterator sIt=unitStates.states.begin();sIt!=unitStates.states.end();++sIt)
+	/* Fallback path if instanced rendering is not supported: */
+	GLuint lastInstance=range.firstInstance+range.numInstances;
+	for(GLuint ii=range.firstInstance;ii<lastInstance;++ii)
 		{
 		/* Go to the unit's local coordinate system: */
+		const UnitInstanceArray::Instance& ui=instances[ii];
 		glPushMatrix();
-		glTranslate(sIt->position[0],sIt->position[1],sIt->position[2]);
-		glRotate(sIt->orientation);
+		glTranslate(ui.position[0],ui.position[1],ui.position[2]);
+		glRotate(Rotation::fromQuaternion(ui.orientation));
 		
 		/* Draw the unit: */
-		glDrawArrays(GL_TRIANGLES,meshStartIndices[sIt->unitType],meshStartIndices[sIt->unitType+1]-meshStartIndices[sIt->unitType]);
+		glDrawArrays(GL_TRIANGLES,meshStartIndex,meshNumVertices);
 		
 		/* Go back to navigational coordinates: */
 		glPopMatrix();
@@ -947,8 +1317,9 @@ void NewNanotechConstructionKit::display(GLContextData& contextData) const
 	glVertex(domain.min[0],domain.max[1],domain.max[2]);
 	glEnd();
 	
-	/* Check if the locked unit state array is valid: */
-	if(sim->isLockedStateValid())
+	/* Check if the locked unit instance array is valid: */
+	const UnitInstanceArray& uia=unitInstances.getLockedValue();
+	if(uia.getSessionId()==sim->getSessionId())
 		{
 		/* Retrieve the data item: */
 		DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
@@ -959,16 +1330,30 @@ void NewNanotechConstructionKit::display(GLContextData& contextData) const
 		/* Check if the mesh buffer is outdated: */
 		if(dataItem->sessionId!=sim->getSessionId())
 			{
-			/* Count the total number of vertices needed and initialize the mesh start index array: */
+			/* Count the total number of vertices needed and initialize the mesh start index arrays: */
 			const UnitTypeList& unitTypes=sim->getUnitTypes();
 			Size numTypes=unitTypes.size();
+			delete[] dataItem->meshStartIndices;
 			dataItem->meshStartIndices=new GLuint[numTypes+1]; // One extra to calculate length of last mesh
+			delete[] dataItem->reducedMeshStartIndices;
+			dataItem->reducedMeshStartIndices=new GLuint[numTypes+1]; // Ditto
+			dataItem->meshRadii.clear();
 			dataItem->meshStartIndices[0]=0;
 			GLuint numVertices=0;
 			for(Index uti=0;uti<numTypes;++uti)
 				{
 				numVertices+=unitTypes[uti].meshTriangles.size();
 				dataItem->meshStartIndices[uti+1]=numVertices;
+				dataItem->meshRadii.push_back(unitTypes[uti].radius);
+				}
+			
+			/* Reduced meshes are octahedra inscribed into each mesh's bounding box, or copies of the full mesh if those are already simpler: */
+			dataItem->reducedMeshStartIndices[0]=numVertices;
+			for(Index uti=0;uti<numTypes;++uti)
+				{
+				GLuint numMeshVertices=dataItem->meshStartIndices[uti+1]-dataItem->meshStartIndices[uti];
+				numVertices+=numMeshVertices>24?24:numMeshVertices;
+				dataItem->reducedMeshStartIndices[uti+1]=numVertices;
 				}
 			
 			/* Create all triangle meshes: */
@@ -982,31 +1367,76 @@ void NewNanotechConstructionKit::display(GLContextData& contextData) const
 				/* Create triangles: */
 				Size numIndices=ut.meshTriangles.size();
 				for(Index i=0;i+2<numIndices;i+=3,vPtr+=3)
+					storeTriangle(vPtr,ut.meshVertices[ut.meshTriangles[i]],ut.meshVertices[ut.meshTriangles[i+1]],ut.meshVertices[ut.meshTriangles[i+2]]);
+				}
+			for(Index uti=0;uti<numTypes;++uti)
+				{
+				/* Get the unit type: */
+				const UnitType& ut=unitTypes[uti];
+				
+				Size numIndices=ut.meshTriangles.size();
+				if(numIndices>24)
 					{
-					/* Get the triangle's points: */
-					Point p0=ut.meshVertices[ut.meshTriangles[i]];
-					Point p1=ut.meshVertices[ut.meshTriangles[i+1]];
-					Point p2=ut.meshVertices[ut.meshTriangles[i+2]];
+					/* Calculate the mesh's bounding box in local unit coordinates: */
+					Box meshBox=Box::empty;
+					for(Index i=0;i<numIndices;++i)
+						meshBox.addPoint(ut.meshVertices[ut.meshTriangles[i]]);
+					Point center=Geometry::mid(meshBox.min,meshBox.max);
+					Vector halfSize=(meshBox.max-meshBox.min)*Scalar(0.5);
+					Scalar minHalfSize=Math::max(halfSize[0],Math::max(halfSize[1],halfSize[2]))*Scalar(0.01);
+					for(int i=0;i<3;++i)
+						if(halfSize[i]<minHalfSize)
+							halfSize[i]=minHalfSize;
 					
-					/* Calculate the triangle's normal vector: */
-					Vector normal=(p1-p0)^(p2-p0);
-					normal.normalize();
-					
-					/* Store the triangle: */
-					vPtr[0].normal=normal;
-					vPtr[0].position=p0;
-					vPtr[1].normal=normal;
-					vPtr[1].position=p1;
-					vPtr[2].normal=normal;
-					vPtr[2].position=p2;
+					/* Create one octahedron face per octant: */
+					for(int octant=0;octant<8;++octant,vPtr+=3)
+						{
+						Point ps[3];
+						Scalar orientation(1);
+						for(int i=0;i<3;++i)
+							{
+							ps[i]=center;
+							Scalar s=(octant&(1<<i))?Scalar(1):Scalar(-1);
+							ps[i][i]+=s*halfSize[i];
+							orientation*=s;
+							}
+						if(orientation>Scalar(0))
+							storeTriangle(vPtr,ps[0],ps[1],ps[2]);
+						else
+							storeTriangle(vPtr,ps[0],ps[2],ps[1]);
+						}
+					}
+				else
+					{
+					/* Copy the full mesh: */
+					for(Index i=0;i+2<numIndices;i+=3,vPtr+=3)
+						storeTriangle(vPtr,ut.meshVertices[ut.meshTriangles[i]],ut.meshVertices[ut.meshTriangles[i+1]],ut.meshVertices[ut.meshTriangles[i+2]]);
 					}
 				}
 			glUnmapBufferARB(GL_ARRAY_BUFFER_ARB);
 			
 			/* Mark the mesh buffer as up-to-date: */
+			dataItem->numMeshes=numTypes;
 			dataItem->sessionId=sim->getSessionId();
 			}
 		
+		/* Extract the view frustum in navigational coordinates from the current OpenGL matrices: */
+		GLdouble projection[16],modelview[16],clip[16];
+		glGetDoublev(GL_PROJECTION_MATRIX,projection);
+		glGetDoublev(GL_MODELVIEW_MATRIX,modelview);
+		for(int i=0;i<4;++i)
+			for(int j=0;j<4;++j)
+				{
+				clip[j*4+i]=0.0;
+				for(int k=0;k<4;++k)
+					clip[j*4+i]+=projection[k*4+i]*modelview[j*4+k];
+				}
+		UnitInstanceArray::Frustum frustum(clip);
+		
+		/* Cull the unit instances against the view frustum and select levels of detail: */
+		Point eyePos(Vrui::getInverseNavigationTransformation().transform(Vrui::getHeadPosition()));
+		dataItem->numSubmittedInstances=uia.cull(frustum,eyePos,lodDistance,dataItem->meshRadii,dataItem->drawRanges);
+		
 		/* Set up triangle mesh rendering: */
 		glEnable(GL_LIGHTING);
 		glMaterial(GLMaterialEnums::FRONT,unitMaterial);
@@ -1015,19 +1445,60 @@ void NewNanotechConstructionKit::display(GLContextData& contextData) const
 		GLVertexArrayParts::enable(Vertex::getPartsMask());
 		glVertexPointer(static_cast<Vertex*>(0));
 		
-		/* Retrieve current unit states based on whether the simulation is local, forwarded local, or remote: */
-		if(forwarder!=0)
-			renderUnits(forwarder->getLockedState(),dataItem->meshStartIndices);
-		else
+		if(dataItem->haveInstancing)
 			{
-			Simulation* localSim=dynamic_cast<Simulation*>(sim);
-			if(localSim!=0)
-				renderUnits(localSim->getLockedState(),dataItem->meshStartIndices);
-			else
+			/* Check if the instance shader is outdated: */
+			if(dataItem->instanceShader==0||dataItem->lightStateVersion!=contextData.getLightTracker()->getVersion())
+				buildInstanceShader(dataItem,contextData);
+			
+			/* Bind the instance buffer and upload the current instance array if it is outdated: */
+			glBindBufferARB(GL_ARRAY_BUFFER_ARB,dataItem->instanceBufferId);
+			if(dataItem->instanceVersion!=instanceVersion)
 				{
-				IndirectSimulationInterface* indirectSim=static_cast<IndirectSimulationInterface*>(sim);
-				renderUnits(indirectSim->getLockedState(),dataItem->meshStartIndices);
+				const std::vector<UnitInstanceArray::Instance>& instances=uia.getInstances();
+				glBufferDataARB(GL_ARRAY_BUFFER_ARB,instances.size()*sizeof(UnitInstanceArray::Instance),instances.empty()?0:&instances[0],GL_STREAM_DRAW_ARB);
+				dataItem->instanceVersion=instanceVersion;
 				}
+			
+			/* Set up instanced vertex attributes: */
+			glUseProgramObjectARB(dataItem->instanceShader);
+			GLint posIndex=dataItem->instanceAttributeIndices[0];
+			GLint oriIndex=dataItem->instanceAttributeIndices[1];
+			glEnableVertexAttribArrayARB(posIndex);
+			glEnableVertexAttribArrayARB(oriIndex);
+			glVertexAttribDivisorARB(posIndex,1);
+			glVertexAttribDivisorARB(oriIndex,1);
+			
+			/* Draw each potentially visible range of instances with a single instanced draw call: */
+			for(std::vector<UnitInstanceArray::DrawRange>::const_iterator drIt=dataItem->drawRanges.begin();drIt!=dataItem->drawRanges.end();++drIt)
+				if(drIt->unitType<dataItem->numMeshes)
+					{
+					/* Point the instance attributes to the first instance of the range: */
+					const UnitInstanceArray::Instance* firstInstance=static_cast<const UnitInstanceArray::Instance*>(0)+drIt->firstInstance;
+					glVertexAttribPointerARB(posIndex,3,GL_FLOAT,GL_FALSE,sizeof(UnitInstanceArray::Instance),firstInstance->position);
+					glVertexAttribPointerARB(oriIndex,4,GL_FLOAT,GL_FALSE,sizeof(UnitInstanceArray::Instance),firstInstance->orientation);
+					
+					/* Draw the unit type's full or reduced mesh once per instance: */
+					const GLuint* msi=drIt->reduced?dataItem->reducedMeshStartIndices:dataItem->meshStartIndices;
+					glDrawArraysInstancedARB(GL_TRIANGLES,msi[drIt->unitType],msi[drIt->unitType+1]-msi[drIt->unitType],drIt->numInstances);
+					}
+			
+			/* Reset instanced vertex attributes: */
+			glVertexAttribDivisorARB(posIndex,0);
+			glVertexAttribDivisorARB(oriIndex,0);
+			glDisableVertexAttribArrayARB(posIndex);
+			glDisableVertexAttribArrayARB(oriIndex);
+			glUseProgramObjectARB(0);
+			}
+		else
+			{
+			/* Draw each potentially visible range of instances one unit at a time: */
+			for(std::vector<UnitInstanceArray::DrawRange>::const_iterator drIt=dataItem->drawRanges.begin();drIt!=dataItem->drawRanges.end();++drIt)
+				if(drIt->unitType<dataItem->numMeshes)
+					{
+					const GLuint* msi=drIt->reduced?dataItem->reducedMeshStartIndices:dataItem->meshStartIndices;
+					renderUnits(uia.getInstances(),*drIt,msi[drIt->unitType],msi[drIt->unitType+1]-msi[drIt->unitType]);
+					}
 			}
 		
 		/* Disable vertex array rendering: */
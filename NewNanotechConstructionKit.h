@@ -28,7 +28,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <GL/GLSphereRenderer.h>
 #include <GL/GLGeometryWrappers.h>
 #include <GL/GLGeometryVertex.h>
+#include <GL/Extensions/GLARBShaderObjects.h>
 #include <GLMotif/ToggleButton.h>
+#include <GLMotif/TextField.h>
 #include <GLMotif/TextFieldSlider.h>
 #include <GLMotif/FileSelectionDialog.h>
 #include <GLMotif/FileSelectionHelper.h>
@@ -37,6 +39,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "Common.h"
 #include "SimulationInterface.h"
+#include "UnitInstanceArray.h"
 
 /* Forward declarations: */
 namespace Cluster {
@@ -48,6 +51,7 @@ class PopupWindow;
 }
 class SimulationInterface;
 class Simulation;
+class TrajectoryPlayer;
 
 class NewNanotechConstructionKit:public Vrui::Application,public GLObject
 	{
@@ -153,7 +157,18 @@ class NewNanotechConstructionKit:public Vrui::Application,public GLObject
 		public:
 		GLuint vertexBufferId; // ID of vertex buffer object holding all unit type meshes
 		GLuint* meshStartIndices; // Array of indices at which each unit type's mesh starts
+		GLuint* reducedMeshStartIndices; // Array of indices at which each unit type's reduced mesh for distant rendering starts
+		Size numMeshes; // Number of unit type meshes in the vertex buffer
+		std::vector<Scalar> meshRadii; // Radii of all unit types in the vertex buffer, to pad culling bounding boxes
 		SessionID sessionId; // ID of the session for which the unit type meshes were generated
+		bool haveInstancing; // Flag whether the OpenGL context supports instanced rendering
+		GLuint instanceBufferId; // ID of vertex buffer object holding unit instances
+		unsigned int instanceVersion; // Version number of the unit instance array in the instance buffer
+		GLhandleARB instanceShader; // Shader program to render instanced units
+		unsigned int lightStateVersion; // Version number of the lighting state for which the instance shader was built
+		GLint instanceAttributeIndices[2]; // Indices of the instance position and orientation vertex attributes
+		std::vector<UnitInstanceArray::DrawRange> drawRanges; // List of potentially visible instance ranges for the current rendering pass
+		Size numSubmittedInstances; // Number of instances submitted during the most recent rendering pass
 		
 		/* Constructors and destructors: */
 		DataItem(void);
@@ -164,11 +179,26 @@ class NewNanotechConstructionKit:public Vrui::Application,public GLObject
 	SimulationInterface* sim; // Pointer to a local or remote simulation interface
 	SimulationInterface::Parameters parameters; // Local copy of current simulation parameters
 	ClusterForwarder* forwarder; // Pointer to simulation state forwarder on a cluster's master node
+	TrajectoryPlayer* player; // Pointer to the simulation interface if a recorded trajectory is being played back
 	Threads::Thread simulationThread; // Thread to run the simulation in the background
-	volatile bool keepRunning; // Flag to keep the simulation thread running
+	volatile bool keepRunning; // Flag to keep the simulation and instancing threads running
+	Threads::Thread instancingThread; // Thread to bucket new unit state snapshots by unit type for rendering
+	Threads::TripleBuffer<UnitInstanceArray> unitInstances; // Triple buffer of bucketed unit states
+	unsigned int instanceVersion; // Version number of the currently locked unit instance array
+	Scalar cullingCellSize; // Size of spatial grid cells used to cull unit instances against the view frustum
+	Scalar lodDistance; // Distance from the viewer beyond which units are rendered using reduced meshes, or zero to disable
 	GLMotif::FileSelectionHelper unitFileHelper; // Helper object to load/save unit files
 	GLMotif::PopupMenu* mainMenu; // Program's main menu
 	GLMotif::PopupWindow* simulationDialog; // Dialog window to control simulation parameters
+	GLMotif::TextField* numUnitsValue; // Text field displaying the number of units in a local simulation, or null if the simulation is not local
+	GLMotif::TextField* numBondsValue; // Text field displaying the number of bonds in a local simulation
+	GLMotif::TextField* numUnbondedSitesValue; // Text field displaying the number of unbonded bonding sites in a local simulation
+	GLMotif::TextField* averageBondLengthValue; // Text field displaying the average bond length in a local simulation
+	GLMotif::TextField* averageBondAngleValue; // Text field displaying the average bond angle in a local simulation
+	double playbackRate; // Trajectory playback rate in simulation steps per second
+	GLMotif::PopupWindow* playbackDialog; // Dialog window to control trajectory playback
+	GLMotif::TextFieldSlider* playbackFrameSlider; // Slider to scrub through a played-back trajectory
+	GLMotif::ToggleButton* playbackPausedToggle; // Toggle to pause trajectory playback
 	Vrui::ToolFactory* unitCreatorToolBase; // Base tool class for unit-creating tools
 	std::vector<UnitToolFactory*> createToolClasses; // List of existing tool classes that create structural units
 	GLMaterial unitMaterial; // OpenGL material properties to render units
@@ -182,6 +212,10 @@ class NewNanotechConstructionKit:public Vrui::Application,public GLObject
 	static void sessionChangedCallback(SessionID newSessionId,void* userData); // Callback called after the simulation session is updated by a remote server
 	static void newDataCallback(void* userData); // Callback called when new simulation data arrives from a remote server
 	void* simulationThreadMethod(void); // Method running the background simulation thread
+	template <class UnitStateParam>
+	void bucketUnits(const StateArray<UnitStateParam>& unitStates); // Sorts the given unit state array by unit type and grid cell and posts it to the front end
+	void* instancingThreadMethod(void); // Method running the background instancing thread
+	void buildInstanceShader(DataItem* dataItem,GLContextData& contextData) const; // Builds a shader program to render instanced units according to the current lighting state
 	void loadUnitFileCallback(GLMotif::FileSelectionDialog::OKCallbackData* cbData);
 	void saveUnitFileCompleteCallback(IO::File& file);
 	void saveUnitFileCallback(GLMotif::FileSelectionDialog::OKCallbackData* cbData);
@@ -189,6 +223,12 @@ class NewNanotechConstructionKit:public Vrui::Application,public GLObject
 	void createMainMenu(void);
 	void parametersChangedCallback(Misc::CallbackData* cbData);
 	void createSimulationDialog(void);
+	void updateSimulationDialog(void); // Updates the simulation dialog's statistics display from the most recent bond statistics of a local simulation
+	void showPlaybackDialogCallback(Misc::CallbackData* cbData);
+	void playbackFrameChangedCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData);
+	void playbackRateChangedCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData);
+	void playbackPausedChangedCallback(GLMotif::ToggleButton::ValueChangedCallbackData* cbData);
+	void createPlaybackDialog(void);
 	
 	/* Constructors and destructors: */
 	public:
@@ -34,29 +34,14 @@ namespace NCK {
 Methods of class OctahedronRenderer:
 ***********************************/
 
-void OctahedronRenderer::initContext(GLContextData& contextData) const
+void OctahedronRenderer::createMesh(UnitRenderer::Mesh& mesh) const
 	{
-	/* Create context data item: */
-	DataItem* dataItem=new DataItem;
-	contextData.addDataItem(this,dataItem);
-	
-	/* Create model display list: */
-	glNewList(dataItem->displayListId,GL_COMPILE);
-	
-	/* Render octahedron: */
+	/* Create octahedron: */
 	static const int faceVertexIndices[8][3]={{2,0,4},{1,2,4},{3,1,4},{0,3,4},
 	                                          {0,2,5},{2,1,5},{1,3,5},{3,0,5}};
-	glBegin(GL_TRIANGLES);
+	const Point* v=Octahedron::renderVertices;
 	for(int face=0;face<8;++face)
-		{
-		glNormal(Octahedron::renderNormals[face]);
-		for(int i=0;i<3;++i)
-			glVertex(Octahedron::renderVertices[faceVertexIndices[face][i]]);
-		}
-	glEnd();
-	
-	/* Finish model display list: */
-	glEndList();
+		addTriangle(mesh,Octahedron::renderNormals[face],v[faceVertexIndices[face][0]],v[faceVertexIndices[face][1]],v[faceVertexIndices[face][2]]);
 	}
 
 /***********************************
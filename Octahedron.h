@@ -22,13 +22,15 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #define OCTAHEDRON_INCLUDED
 
 #include "StructuralUnit.h"
+#include "UnitManager.h"
 
 namespace NCK {
 
 class OctahedronRenderer:public UnitRenderer
 	{
-	/* Methods: */
-	virtual void initContext(GLContextData& contextData) const;
+	/* Methods from class UnitRenderer: */
+	public:
+	virtual void createMesh(Mesh& mesh) const;
 	};
 
 class Octahedron:public StructuralUnit
@@ -65,6 +67,10 @@ class Octahedron:public StructuralUnit
 		{
 		return radius;
 		};
+	static Scalar getClassMass(void) // Returns mass of all octahedra
+		{
+		return mass;
+		};
 	static int getClassNumVertices(void) // Returns number of vertices of octahedron class
 		{
 		return 6;
@@ -83,6 +89,10 @@ class Octahedron:public StructuralUnit
 		{
 		return mass;
 		};
+	virtual int getUnitType(void) const
+		{
+		return UnitManager::OCTAHEDRON;
+		};
 	virtual Vector getVertexOffset(int index) const
 		{
 		return orientation.transform(vertexOffsets[index]);
@@ -93,6 +103,10 @@ class Octahedron:public StructuralUnit
 		};
 	virtual void applyVertexForce(int index,const Vector& force,Scalar timeStep);
 	virtual void applyCentralForce(const Vector& force,Scalar timeStep);
+	virtual const UnitRenderer* getUnitRenderer(void) const
+		{
+		return unitRenderer;
+		};
 	virtual void glRenderAction(GLContextData& contextData) const;
 	};
 
@@ -18,8 +18,12 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 ***********************************************************************/
 
 #include <assert.h>
+#include <utility>
+#include <algorithm>
 #include <Misc/HashTable.h>
 #include <Misc/OneTimeQueue.h>
+#include <Threads/Thread.h>
+#include <Math/Math.h>
 #include <Math/Constants.h>
 #include <Geometry/AffineCombiner.h>
 #include <GL/gl.h>
@@ -27,6 +31,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <GL/GLGeometryWrappers.h>
 
 #include "StructuralUnit.h"
+#include "UnitManager.h"
 #include "Tetrahedron.h"
 #include "SpaceGrid.h"
 
@@ -34,35 +39,135 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 namespace NCK {
 
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+inline Tetrahedron* getTetrahedron(StructuralUnit* unit) // Returns the given unit as a tetrahedron, or null if it is not one
+	{
+	if(unit!=0&&unit->getUnitType()==UnitManager::TETRAHEDRON)
+		return static_cast<Tetrahedron*>(unit);
+	else
+		return 0;
+	}
+
+typedef std::pair<unsigned int,Polyhedron::VoidInfo> KeyedVoid; // Type for voids keyed by the smallest index of a bounding tetrahedron face
+
+struct KeyedVoidLess // Functor to sort keyed voids by key
+	{
+	bool operator()(const KeyedVoid& v1,const KeyedVoid& v2) const
+		{
+		return v1.first<v2.first;
+		}
+	};
+
+}
+
+/***************************************
+Methods of class Polyhedron::VoidWorker:
+***************************************/
+
+struct Polyhedron::VoidWorker // Class to find interstitial voids seeded from the faces of a range of tetrahedra
+	{
+	/* Elements: */
+	public:
+	SpaceGrid* grid; // Space grid containing the structure
+	const std::vector<Tetrahedron*>* tets; // List of all tetrahedra in the space grid
+	const Misc::HashTable<Tetrahedron*,unsigned int>* tetIndices; // Map from tetrahedra to their indices in the list
+	unsigned int begin,end; // Range of tetrahedron indices from which to seed voids
+	std::vector<KeyedVoid> voids; // List of found voids
+	
+	/* Methods: */
+	void* run(void); // Finds all voids seeded from the worker's range of tetrahedra
+	};
+
+void* Polyhedron::VoidWorker::run(void)
+	{
+	/* Keep track of tetrahedron faces that already bound a found void: */
+	std::vector<bool> faceDone(tets->size()*4,false);
+	
+	/* Reuse the same polyhedron and its element pools for all voids: */
+	Polyhedron polyhedron;
+	std::vector<TetFace> boundaryFaces;
+	for(unsigned int tetIndex=begin;tetIndex<end;++tetIndex)
+		{
+		Tetrahedron* tet=(*tets)[tetIndex];
+		for(int faceIndex=0;faceIndex<4;++faceIndex)
+			{
+			if(faceDone[tetIndex*4+faceIndex])
+				continue;
+			faceDone[tetIndex*4+faceIndex]=true;
+			
+			/* Seed a void just outside the face's center: */
+			Point::AffineCombiner fcc;
+			for(int i=1;i<4;++i)
+				fcc.addPoint(tet->getVertex((faceIndex+i)%4));
+			Point faceCenter=fcc.getPoint();
+			Point seed=faceCenter+(faceCenter-tet->getVertex(faceIndex))*Scalar(0.25);
+			boundaryFaces.clear();
+			polyhedron.build(*grid,seed,&boundaryFaces);
+			
+			/* Mark all faces bounding the void and key the void by the smallest one: */
+			unsigned int key=~0U;
+			for(std::vector<TetFace>::iterator bfIt=boundaryFaces.begin();bfIt!=boundaryFaces.end();++bfIt)
+				{
+				Misc::HashTable<Tetrahedron*,unsigned int>::ConstIterator tiIt=tetIndices->findEntry(bfIt->tet);
+				if(!tiIt.isFinished())
+					{
+					unsigned int faceKey=tiIt->getDest()*4+bfIt->faceIndex;
+					faceDone[faceKey]=true;
+					if(key>faceKey)
+						key=faceKey;
+					}
+				}
+			
+			/* Store the void if it is bounded by at least one tetrahedron face: */
+			if(key!=~0U)
+				voids.push_back(KeyedVoid(key,polyhedron.calcVoidInfo()));
+			}
+		}
+	
+	return 0;
+	}
+
 /***************************
 Methods of class Polyhedron:
 ***************************/
 
 Polyhedron::Vertex* Polyhedron::createVertex(const Point& newPos)
 	{
-	return &*vertices.insert(vertices.end(),Vertex(newPos));
+	Vertex* result=vertices.allocate();
+	*result=Vertex(newPos);
+	return result;
 	}
 
 Polyhedron::Edge* Polyhedron::createEdge(void)
 	{
-	return &*edges.insert(edges.end(),Edge());
+	Edge* result=edges.allocate();
+	*result=Edge();
+	return result;
 	}
 
 Polyhedron::Face* Polyhedron::createFace(void)
 	{
-	return &*faces.insert(faces.end(),Face());
-	}
-
-Polyhedron::Polyhedron(void)
-	{
+	Face* result=faces.allocate();
+	*result=Face();
+	return result;
 	}
 
-Polyhedron::Polyhedron(SpaceGrid& grid,const Point& queryPosition)
+void Polyhedron::build(SpaceGrid& grid,const Point& queryPosition,std::vector<Polyhedron::TetFace>* boundaryFaces)
 	{
+	/* Remove all elements from the current polyhedron, but keep the pools' storage: */
+	vertices.clear();
+	edges.clear();
+	faces.clear();
+	
 	typedef Misc::HashTable<Tetrahedron*,TetVertices> TetVertexHash; // Hash table to associate polyhedron vertices with tetrahedra
 	
 	/* Create hash table to map tetrahedra to polyhedron vertices: */
-	TetVertexHash vertices(101);
+	TetVertexHash tetVertices(101);
 	
 	typedef Misc::OneTimeQueue<Tetrahedron*> TetQueue;
 	
@@ -70,7 +175,7 @@ Polyhedron::Polyhedron(SpaceGrid& grid,const Point& queryPosition)
 	TetQueue tetQueue(101);
 	
 	/* Start traversal by queueing closest tetrahedron to query position: */
-	Tetrahedron* firstTet=dynamic_cast<Tetrahedron*>(grid.findClosestUnit(queryPosition,Math::Constants<Scalar>::max));
+	Tetrahedron* firstTet=getTetrahedron(grid.findClosestUnit(queryPosition,Math::Constants<Scalar>::max));
 	if(firstTet!=0)
 		tetQueue.push(firstTet);
 	
@@ -95,11 +200,11 @@ Polyhedron::Polyhedron(SpaceGrid& grid,const Point& queryPosition)
 		for(int i=0;i<4;++i)
 			{
 			StructuralUnit::VertexLink& vl=tet->getVertexLink(i);
-			Tetrahedron* otherTet=dynamic_cast<Tetrahedron*>(vl.unit);
+			Tetrahedron* otherTet=getTetrahedron(vl.unit);
 			if(otherTet!=0)
 				{
 				tetPos[i]=Geometry::mid(tet->getVertex(i),otherTet->getVertex(vl.vertexIndex));
-				TetVertexHash::Iterator tvIt=vertices.findEntry(otherTet);
+				TetVertexHash::Iterator tvIt=tetVertices.findEntry(otherTet);
 				mustAddVertex[i]=tvIt.isFinished()||tvIt->getDest().vertices[vl.vertexIndex]==0;
 				if(!mustAddVertex[i])
 					{
@@ -121,6 +226,7 @@ Polyhedron::Polyhedron(SpaceGrid& grid,const Point& queryPosition)
 		/* Determine which vertices are facing the query point: */
 		int numFacingVertices=0;
 		Vertex* facingVertices[4];
+		int nonFacingVertex=-1;
 		for(int i=0;i<4;++i)
 			{
 			#if 1
@@ -146,10 +252,12 @@ Polyhedron::Polyhedron(SpaceGrid& grid,const Point& queryPosition)
 				++numFacingVertices;
 				
 				/* Add the neighbouring tetrahedron to the queue if it has not been added yet: */
-				Tetrahedron* neighbour=dynamic_cast<Tetrahedron*>(tet->getVertexLink(i).unit);
+				Tetrahedron* neighbour=getTetrahedron(tet->getVertexLink(i).unit);
 				if(neighbour!=0)
 					tetQueue.push(neighbour);
 				}
+			else
+				nonFacingVertex=i;
 			}
 		
 		Edge* externalEdges[3];
@@ -169,6 +277,15 @@ Polyhedron::Polyhedron(SpaceGrid& grid,const Point& queryPosition)
 			}
 		else if(numFacingVertices==3)
 			{
+			/* Report the tet face that bounds the void: */
+			if(boundaryFaces!=0)
+				{
+				TetFace tf;
+				tf.tet=tet;
+				tf.faceIndex=nonFacingVertex;
+				boundaryFaces->push_back(tf);
+				}
+			
 			/* Create an interior triangular face: */
 			Face* f=createFace();
 			Edge* es[3];
@@ -214,8 +331,8 @@ Polyhedron::Polyhedron(SpaceGrid& grid,const Point& queryPosition)
 		Edge* in[4];
 		for(int i=0;i<4;++i)
 			{
-			out[4]=0;
-			in[4]=0;
+			out[i]=0;
+			in[i]=0;
 			}
 		for(int i=0;i<numFacingVertices;++i)
 			{
@@ -329,14 +446,143 @@ Polyhedron::Polyhedron(SpaceGrid& grid,const Point& queryPosition)
 			tv.incomingEdges[i]=in[i];
 			tv.outgoingEdges[i]=out[i];
 			}
-		vertices.setEntry(TetVertexHash::Entry(tet,tv));
+		tetVertices.setEntry(TetVertexHash::Entry(tet,tv));
+		}
+	}
+
+Polyhedron::VoidInfo Polyhedron::calcVoidInfo(void) const
+	{
+	VoidInfo result;
+	
+	/* Calculate the centroid of all polyhedron vertices: */
+	Point::AffineCombiner cc;
+	for(size_t i=0;i<vertices.size();++i)
+		cc.addPoint(vertices[i].pos);
+	result.centroid=vertices.size()>0?cc.getPoint():Point::origin;
+	
+	/* The polyhedron is closed if every half-edge belongs to a face and has an opposite: */
+	result.closed=edges.size()>0;
+	for(size_t i=0;i<edges.size()&&result.closed;++i)
+		result.closed=edges[i].face!=0&&edges[i].opposite!=0;
+	
+	/* Accumulate area and signed volume over fan triangulations of all faces: */
+	result.volume=Scalar(0);
+	result.surfaceArea=Scalar(0);
+	result.numFaces=int(faces.size());
+	for(size_t i=0;i<faces.size();++i)
+		{
+		const Edge* e0=faces[i].edge;
+		const Point& p0=e0->start->pos;
+		for(const Edge* ePtr=e0->faceSucc;ePtr->faceSucc!=e0;ePtr=ePtr->faceSucc)
+			{
+			Vector d1=ePtr->start->pos-p0;
+			Vector d2=ePtr->faceSucc->start->pos-p0;
+			Vector n=Geometry::cross(d1,d2);
+			result.surfaceArea+=Geometry::mag(n)*Scalar(0.5);
+			result.volume+=((p0-result.centroid)*n)/Scalar(6);
+			}
 		}
+	result.volume=Math::abs(result.volume);
+	
+	return result;
+	}
+
+Polyhedron::Polyhedron(void)
+	{
+	}
+
+Polyhedron::Polyhedron(SpaceGrid& grid,const Point& queryPosition)
+	{
+	build(grid,queryPosition,0);
 	}
 
 Polyhedron::~Polyhedron(void)
 	{
 	}
 
+Polyhedron::VoidDistribution Polyhedron::analyzeVoids(SpaceGrid& grid,int numThreads)
+	{
+	/* Collect all tetrahedra in the space grid and assign them indices: */
+	std::vector<Tetrahedron*> tets;
+	SpaceGrid::StructuralUnitList units=grid.getAllUnits();
+	for(SpaceGrid::StructuralUnitList::iterator uIt=units.begin();uIt!=units.end();++uIt)
+		{
+		Tetrahedron* tet=getTetrahedron(*uIt);
+		if(tet!=0)
+			tets.push_back(tet);
+		}
+	Misc::HashTable<Tetrahedron*,unsigned int> tetIndices(tets.size()*2+17);
+	for(unsigned int i=0;i<tets.size();++i)
+		tetIndices.setEntry(Misc::HashTable<Tetrahedron*,unsigned int>::Entry(tets[i],i));
+	
+	/* Prepare the space grid for concurrent closest-unit queries: */
+	grid.updateQueryCells();
+	
+	/* Split the tetrahedra evenly between the requested number of workers: */
+	if(numThreads<1)
+		numThreads=1;
+	unsigned int numTets=(unsigned int)(tets.size());
+	std::vector<VoidWorker> workers(numThreads);
+	for(int i=0;i<numThreads;++i)
+		{
+		workers[i].grid=&grid;
+		workers[i].tets=&tets;
+		workers[i].tetIndices=&tetIndices;
+		workers[i].begin=(unsigned int)((size_t(numTets)*size_t(i))/size_t(numThreads));
+		workers[i].end=(unsigned int)((size_t(numTets)*size_t(i+1))/size_t(numThreads));
+		}
+	
+	/* Run all but the first worker in their own threads, and the first worker in the calling thread: */
+	Threads::Thread* workerThreads=numThreads>1?new Threads::Thread[numThreads-1]:0;
+	for(int i=1;i<numThreads;++i)
+		workerThreads[i-1].start(&workers[i],&VoidWorker::run);
+	workers[0].run();
+	for(int i=1;i<numThreads;++i)
+		workerThreads[i-1].join();
+	delete[] workerThreads;
+	
+	/* Merge the workers' voids and remove voids found by more than one worker: */
+	std::vector<KeyedVoid> allVoids;
+	for(int w=0;w<numThreads;++w)
+		allVoids.insert(allVoids.end(),workers[w].voids.begin(),workers[w].voids.end());
+	std::stable_sort(allVoids.begin(),allVoids.end(),KeyedVoidLess());
+	VoidDistribution result;
+	for(size_t i=0;i<allVoids.size();++i)
+		if(i==0||allVoids[i].first!=allVoids[i-1].first)
+			result.voids.push_back(allVoids[i].second);
+	
+	/* Calculate the volume distribution of all closed voids: */
+	result.numClosedVoids=0;
+	result.totalVolume=Scalar(0);
+	result.volumeMin=Scalar(0);
+	result.volumeMax=Scalar(0);
+	for(std::vector<VoidInfo>::iterator vIt=result.voids.begin();vIt!=result.voids.end();++vIt)
+		if(vIt->closed)
+			{
+			++result.numClosedVoids;
+			result.totalVolume+=vIt->volume;
+			if(result.volumeMax<vIt->volume)
+				result.volumeMax=vIt->volume;
+			}
+	for(int i=0;i<VoidDistribution::numVolumeBins;++i)
+		result.volumeHistogram[i]=0;
+	if(result.volumeMax>result.volumeMin)
+		{
+		Scalar binSize=(result.volumeMax-result.volumeMin)/Scalar(VoidDistribution::numVolumeBins);
+		for(std::vector<VoidInfo>::iterator vIt=result.voids.begin();vIt!=result.voids.end();++vIt)
+			if(vIt->closed)
+				{
+				int index=int(Math::floor((vIt->volume-result.volumeMin)/binSize));
+				if(index>=VoidDistribution::numVolumeBins)
+					index=VoidDistribution::numVolumeBins-1;
+				++result.volumeHistogram[index];
+				}
+		}
+	result.averageVolume=result.numClosedVoids>0?result.totalVolume/Scalar(result.numClosedVoids):Scalar(0);
+	
+	return result;
+	}
+
 void Polyhedron::glRenderAction(GLContextData& contextData) const
 	{
 	glPushAttrib(GL_LIGHTING_BIT|GL_LINE_BIT|GL_POINT_BIT|GL_POLYGON_BIT);
@@ -346,19 +592,20 @@ void Polyhedron::glRenderAction(GLContextData& contextData) const
 	glPointSize(5.0f);
 	glColor3f(1.0f,0.0f,0.0f);
 	glBegin(GL_POINTS);
-	for(VertexList::const_iterator vIt=vertices.begin();vIt!=vertices.end();++vIt)
-		glVertex(vIt->pos);
+	for(size_t i=0;i<vertices.size();++i)
+		glVertex(vertices[i].pos);
 	glEnd();
 	
 	/* Render all edges: */
 	glLineWidth(3.0f);
 	glBegin(GL_LINES);
-	for(EdgeList::const_iterator eIt=edges.begin();eIt!=edges.end();++eIt)
+	for(size_t i=0;i<edges.size();++i)
 		{
-		if(eIt->external&&eIt->opposite!=0)
+		const Edge& e=edges[i];
+		if(e.external&&e.opposite!=0)
 			{
-			glVertex(eIt->start->pos);
-			glVertex(eIt->opposite->start->pos);
+			glVertex(e.start->pos);
+			glVertex(e.opposite->start->pos);
 			}
 		}
 	glEnd();
@@ -369,17 +616,18 @@ void Polyhedron::glRenderAction(GLContextData& contextData) const
 	glMaterial(GLMaterialEnums::FRONT,GLMaterial(GLMaterial::Color(0.9f,0.7f,0.7f),GLMaterial::Color(0.7f,1.7f,0.7f),25.0f));
 	glMaterial(GLMaterialEnums::BACK,GLMaterial(GLMaterial::Color(0.7f,0.7f,0.9f),GLMaterial::Color(0.7f,1.7f,0.7f),25.0f));
 	glDisable(GL_CULL_FACE);
-	for(FaceList::const_iterator fIt=faces.begin();fIt!=faces.end();++fIt)
+	for(size_t i=0;i<faces.size();++i)
 		{
+		const Face& f=faces[i];
 		glBegin(GL_POLYGON);
-		glNormal(fIt->normal);
-		const Edge* ePtr=fIt->edge;
+		glNormal(f.normal);
+		const Edge* ePtr=f.edge;
 		do
 			{
 			glVertex(ePtr->start->pos);
 			ePtr=ePtr->faceSucc;
 			}
-		while(ePtr!=fIt->edge);
+		while(ePtr!=f.edge);
 		glEnd();
 		}
 	
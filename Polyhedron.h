@@ -20,7 +20,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef POLYHEDRON_INCLUDED
 #define POLYHEDRON_INCLUDED
 
-#include <list>
+#include <vector>
 
 #include "AffineSpace.h"
 
@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 class GLContextData;
 namespace NCK {
 class SpaceGrid;
+class Tetrahedron;
 }
 
 namespace NCK {
@@ -35,6 +36,31 @@ namespace NCK {
 class Polyhedron
 	{
 	/* Embedded classes: */
+	public:
+	struct VoidInfo // Structure describing one interstitial void found by batch void analysis
+		{
+		/* Elements: */
+		public:
+		Point centroid; // Centroid of the void polyhedron's vertices
+		Scalar volume; // Enclosed volume of the void polyhedron
+		Scalar surfaceArea; // Surface area of the void polyhedron
+		int numFaces; // Number of faces of the void polyhedron
+		bool closed; // Flag if the void polyhedron's surface is closed; volume is only meaningful for closed voids
+		};
+	
+	struct VoidDistribution // Structure describing all interstitial voids in a structure
+		{
+		/* Elements: */
+		public:
+		std::vector<VoidInfo> voids; // List of all distinct voids, in order of their first bounding tetrahedron
+		int numClosedVoids; // Number of voids with closed surfaces
+		Scalar totalVolume; // Total volume of all closed voids
+		static const int numVolumeBins=20;
+		Scalar volumeMin,volumeMax; // Range of the void volume histogram
+		int volumeHistogram[numVolumeBins]; // Histogram of closed void volumes
+		Scalar averageVolume; // Average volume of closed voids
+		};
+	
 	private:
 	struct Edge;
 	struct Face;
@@ -47,6 +73,10 @@ class Polyhedron
 		Edge* edge; // Pointer to one half-edge starting at the vertex
 		
 		/* Constructors and destructors: */
+		Vertex(void) // Creates an uninitialized vertex
+			:edge(0)
+			{
+			};
 		Vertex(const Point& sPos) // Creates a vertex at the given position
 			:pos(sPos),
 			 edge(0)
@@ -73,9 +103,72 @@ class Polyhedron
 		Edge* edge; // Pointer to one half-edge bounding the face
 		};
 	
-	typedef std::list<Vertex> VertexList;
-	typedef std::list<Edge> EdgeList;
-	typedef std::list<Face> FaceList;
+	template <class ElementParam>
+	class Pool // Class to store polyhedron elements in contiguous chunks at stable addresses; chunks are reused when the pool is cleared
+		{
+		/* Embedded classes: */
+		public:
+		typedef ElementParam Element; // Type of pooled elements
+		
+		/* Elements: */
+		private:
+		static const size_t chunkSize=256; // Number of elements per chunk
+		std::vector<Element*> chunks; // List of allocated chunks
+		size_t numElements; // Number of elements currently in use
+		
+		/* Constructors and destructors: */
+		public:
+		Pool(void) // Creates an empty pool
+			:numElements(0)
+			{
+			};
+		private:
+		Pool(const Pool& source); // Prohibit copy constructor
+		Pool& operator=(const Pool& source); // Prohibit assignment operator
+		public:
+		~Pool(void)
+			{
+			for(typename std::vector<Element*>::iterator cIt=chunks.begin();cIt!=chunks.end();++cIt)
+				delete[] *cIt;
+			};
+		
+		/* Methods: */
+		size_t size(void) const // Returns the number of elements in use
+			{
+			return numElements;
+			};
+		const Element& operator[](size_t index) const // Returns the element of the given index
+			{
+			return chunks[index/chunkSize][index%chunkSize];
+			};
+		Element* allocate(void) // Returns a new element
+			{
+			/* Allocate a new chunk if all existing chunks are full: */
+			if(numElements==chunks.size()*chunkSize)
+				chunks.push_back(new Element[chunkSize]);
+			Element* result=&chunks[numElements/chunkSize][numElements%chunkSize];
+			++numElements;
+			return result;
+			};
+		void clear(void) // Removes all elements but keeps allocated chunks for reuse
+			{
+			numElements=0;
+			};
+		};
+	
+	typedef Pool<Vertex> VertexPool;
+	typedef Pool<Edge> EdgePool;
+	typedef Pool<Face> FacePool;
+	
+	struct TetFace // Structure to identify a face of a tetrahedron by the index of the opposite vertex
+		{
+		/* Elements: */
+		public:
+		Tetrahedron* tet; // Pointer to the tetrahedron
+		int faceIndex; // Index of the vertex opposite the face
+		};
+	
+	struct VoidWorker; // Class to find interstitial voids in parallel
 	
 	struct TetVertices // Helper structure to associate polyhedron vertices with tetrahedra
 		{
@@ -130,14 +223,16 @@ class Polyhedron
 	#endif
 	
 	/* Elements: */
-	VertexList vertices; // Vector of vertices
-	EdgeList edges; // Vector of edges
-	FaceList faces; // Vector of faces
+	VertexPool vertices; // Pool of vertices
+	EdgePool edges; // Pool of half-edges
+	FacePool faces; // Pool of faces
 	
 	/* Private methods: */
 	Vertex* createVertex(const Point& newPos); // Creates a new vertex
 	Edge* createEdge(void); // Creates a new edge
 	Face* createFace(void); // Creates a new face
+	void build(SpaceGrid& grid,const Point& queryPosition,std::vector<TetFace>* boundaryFaces); // Replaces the polyhedron with the interstitial void containing the query position; appends tetrahedron faces bounding the void to the given list if not null
+	VoidInfo calcVoidInfo(void) const; // Returns the size of the current polyhedron
 	
 	/* Constructors and destructors: */
 	public:
@@ -150,6 +245,7 @@ class Polyhedron
 	~Polyhedron(void);
 	
 	/* Methods: */
+	static VoidDistribution analyzeVoids(SpaceGrid& grid,int numThreads); // Finds all interstitial voids in the given space grid using the given number of threads; grid must not change during analysis
 	void glRenderAction(GLContextData& contextData) const; // Renders the polyhedron
 	};
 
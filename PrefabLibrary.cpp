@@ -0,0 +1,255 @@
+/***********************************************************************
+PrefabLibrary - Class for libraries of named prefabricated assemblies of
+structural units, including their internal bonds, which can be saved to
+and loaded from binary files.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "PrefabLibrary.h"
+
+#include <string.h>
+#include <stdexcept>
+#include <Misc/SizedTypes.h>
+#include <Misc/StdError.h>
+#include <Misc/MessageLogger.h>
+#include <IO/SeekableFile.h>
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const char* prefabFileTag="NCK Prefab Library 1.0\r\n";
+const UnitTypeID unmappedUnitType=~UnitTypeID(0); // Marker for unit types that do not exist in the loading simulation
+const size_t prefabHeaderSize=sizeof(Misc::UInt32)+2*sizeof(Size); // Name length and numbers of units and bonds
+const size_t unitRecordSize=sizeof(UnitTypeID)+7*sizeof(Scalar); // Unit type, position offset, and orientation offset
+const size_t bondRecordSize=4*sizeof(Index); // Bonded units' indices and bonding site indices
+
+size_t getRemainingSize(IO::SeekableFile& file) // Returns the number of bytes between the given file's read position and its end
+	{
+	IO::SeekableFile::Offset size=file.getSize();
+	IO::SeekableFile::Offset pos=file.getReadPosAbs();
+	return pos<size?size_t(size-pos):0;
+	}
+
+void writeName(const std::string& name,IO::File& file) // Writes a length-prefixed name to the given file
+	{
+	file.write<Misc::UInt32>(Misc::UInt32(name.size()));
+	file.write(name.data(),name.size());
+	}
+
+void readName(IO::SeekableFile& file,std::string& name) // Reads a length-prefixed name from the given file
+	{
+	size_t length=file.read<Misc::UInt32>();
+	if(length>getRemainingSize(file))
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Invalid name length %u",(unsigned int)(length));
+	name.resize(length);
+	if(length>0)
+		file.read(&name[0],length);
+	}
+
+bool isPrefabValid(const Prefab& prefab,const UnitTypeList& unitTypes) // Returns true if all units and bonds in the given prefab are valid for the given unit types, and no bonding site is bonded twice
+	{
+	/* Check all units' types and assign each unit's bonding sites a range of flags: */
+	Size numUnits(prefab.units.size());
+	std::vector<Index> bondSiteBases;
+	bondSiteBases.reserve(numUnits+1);
+	Index numBondSites=0;
+	for(std::vector<PrefabUnit>::const_iterator uIt=prefab.units.begin();uIt!=prefab.units.end();++uIt)
+		{
+		if(uIt->unitType>=unitTypes.size())
+			return false;
+		bondSiteBases.push_back(numBondSites);
+		numBondSites+=Index(unitTypes[uIt->unitType].bondSites.size());
+		}
+	bondSiteBases.push_back(numBondSites);
+	
+	/* Check all bonds: */
+	std::vector<bool> bonded(numBondSites,false);
+	for(std::vector<StateFileBond>::const_iterator bIt=prefab.bonds.begin();bIt!=prefab.bonds.end();++bIt)
+		for(int i=0;i<2;++i)
+			{
+			if(bIt->unitIndex[i]>=numUnits)
+				return false;
+			Index bondSite=bondSiteBases[bIt->unitIndex[i]]+bIt->bondSiteIndex[i];
+			if(bondSite>=bondSiteBases[bIt->unitIndex[i]+1]||bonded[bondSite])
+				return false;
+			bonded[bondSite]=true;
+			}
+	
+	return true;
+	}
+
+}
+
+/******************************
+Methods of class PrefabLibrary:
+******************************/
+
+const Prefab* PrefabLibrary::findPrefab(const std::string& name) const
+	{
+	for(std::vector<Prefab>::const_iterator pIt=prefabs.begin();pIt!=prefabs.end();++pIt)
+		if(pIt->name==name)
+			return &*pIt;
+	
+	return 0;
+	}
+
+void PrefabLibrary::storePrefab(const Prefab& prefab)
+	{
+	/* Replace an existing prefab of the same name, or append the new prefab: */
+	for(std::vector<Prefab>::iterator pIt=prefabs.begin();pIt!=prefabs.end();++pIt)
+		if(pIt->name==prefab.name)
+			{
+			*pIt=prefab;
+			return;
+			}
+	prefabs.push_back(prefab);
+	}
+
+void PrefabLibrary::save(IO::File& file,const UnitTypeList& unitTypes) const
+	{
+	/* Write the file identifier: */
+	char tag[32];
+	memset(tag,0,sizeof(tag));
+	strcpy(tag,prefabFileTag);
+	file.write(tag,sizeof(tag));
+	
+	/* Write the names of all unit types: */
+	file.write<Misc::UInt32>(Misc::UInt32(unitTypes.size()));
+	for(UnitTypeList::const_iterator utIt=unitTypes.begin();utIt!=unitTypes.end();++utIt)
+		writeName(utIt->name,file);
+	
+	/* Write all prefabs: */
+	file.write<Misc::UInt32>(Misc::UInt32(prefabs.size()));
+	for(std::vector<Prefab>::const_iterator pIt=prefabs.begin();pIt!=prefabs.end();++pIt)
+		{
+		writeName(pIt->name,file);
+		file.write<Size>(Size(pIt->units.size()));
+		file.write<Size>(Size(pIt->bonds.size()));
+		for(std::vector<PrefabUnit>::const_iterator uIt=pIt->units.begin();uIt!=pIt->units.end();++uIt)
+			{
+			file.write<UnitTypeID>(uIt->unitType);
+			for(int i=0;i<3;++i)
+				file.write<Scalar>(uIt->positionOffset[i]);
+			const Scalar* q=uIt->orientationOffset.getQuaternion();
+			for(int i=0;i<4;++i)
+				file.write<Scalar>(q[i]);
+			}
+		for(std::vector<StateFileBond>::const_iterator bIt=pIt->bonds.begin();bIt!=pIt->bonds.end();++bIt)
+			for(int i=0;i<2;++i)
+				{
+				file.write<Index>(bIt->unitIndex[i]);
+				file.write<Index>(bIt->bondSiteIndex[i]);
+				}
+		}
+	}
+
+Size PrefabLibrary::load(IO::SeekableFile& file,const UnitTypeList& unitTypes)
+	{
+	/* Check the file identifier: */
+	char tag[32];
+	file.read(tag,sizeof(tag));
+	tag[sizeof(tag)-1]='\0';
+	if(strcmp(tag,prefabFileTag)!=0)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Input file is not a prefab library file");
+	
+	/* Read the file's unit type names and map them to the given unit types; counts are checked against the remaining file size to reject corrupted files before allocating memory: */
+	size_t numFileUnitTypes=file.read<Misc::UInt32>();
+	if(numFileUnitTypes>getRemainingSize(file)/sizeof(Misc::UInt32))
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Invalid number of unit types %u",(unsigned int)(numFileUnitTypes));
+	std::vector<UnitTypeID> typeMap;
+	typeMap.reserve(numFileUnitTypes);
+	for(size_t i=0;i<numFileUnitTypes;++i)
+		{
+		std::string unitTypeName;
+		readName(file,unitTypeName);
+		UnitTypeID unitTypeId=0;
+		while(unitTypeId<unitTypes.size()&&unitTypes[unitTypeId].name!=unitTypeName)
+			++unitTypeId;
+		typeMap.push_back(unitTypeId<unitTypes.size()?unitTypeId:unmappedUnitType);
+		}
+	
+	/* Read all prefabs before merging any of them into the library: */
+	size_t numPrefabs=file.read<Misc::UInt32>();
+	if(numPrefabs>getRemainingSize(file)/prefabHeaderSize)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Invalid number of prefabs %u",(unsigned int)(numPrefabs));
+	std::vector<Prefab> filePrefabs;
+	filePrefabs.reserve(numPrefabs);
+	for(size_t prefabIndex=0;prefabIndex<numPrefabs;++prefabIndex)
+		{
+		try
+			{
+			Prefab prefab;
+			readName(file,prefab.name);
+			
+			/* Read the prefab's units and bonds: */
+			size_t numUnits=file.read<Size>();
+			size_t numBonds=file.read<Size>();
+			size_t remainingSize=getRemainingSize(file);
+			if(numUnits>remainingSize/unitRecordSize||numBonds>(remainingSize-numUnits*unitRecordSize)/bondRecordSize)
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Invalid number of units %u or bonds %u",(unsigned int)(numUnits),(unsigned int)(numBonds));
+			prefab.units.reserve(numUnits);
+			for(size_t i=0;i<numUnits;++i)
+				{
+				PrefabUnit unit;
+				UnitTypeID fileUnitType=file.read<UnitTypeID>();
+				unit.unitType=fileUnitType<typeMap.size()?typeMap[fileUnitType]:unmappedUnitType;
+				for(int j=0;j<3;++j)
+					unit.positionOffset[j]=file.read<Scalar>();
+				Scalar q[4];
+				for(int j=0;j<4;++j)
+					q[j]=file.read<Scalar>();
+				unit.orientationOffset=Rotation::fromQuaternion(q);
+				prefab.units.push_back(unit);
+				}
+			prefab.bonds.reserve(numBonds);
+			for(size_t i=0;i<numBonds;++i)
+				{
+				StateFileBond bond;
+				for(int j=0;j<2;++j)
+					{
+					bond.unitIndex[j]=file.read<Index>();
+					bond.bondSiteIndex[j]=file.read<Index>();
+					}
+				prefab.bonds.push_back(bond);
+				}
+			
+			filePrefabs.push_back(prefab);
+			}
+		catch(const std::runtime_error& err)
+			{
+			throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Unable to read prefab %u of %u due to exception %s",(unsigned int)(prefabIndex),(unsigned int)(numPrefabs),err.what());
+			}
+		}
+	
+	/* Merge the prefabs that are valid for the given unit types: */
+	Size numMerged=0;
+	for(std::vector<Prefab>::iterator pIt=filePrefabs.begin();pIt!=filePrefabs.end();++pIt)
+		{
+		if(isPrefabValid(*pIt,unitTypes))
+			{
+			storePrefab(*pIt);
+			++numMerged;
+			}
+		else
+			Misc::formattedUserWarning("PrefabLibrary::load: Skipping prefab %s due to unknown unit types or invalid bonds",pIt->name.c_str());
+		}
+	
+	return numMerged;
+	}
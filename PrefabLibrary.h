@@ -0,0 +1,88 @@
+/***********************************************************************
+PrefabLibrary - Class for libraries of named prefabricated assemblies of
+structural units, including their internal bonds, which can be saved to
+and loaded from binary files.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+Layout of a prefab library file; all data is little-endian:
+- 32-byte tag "NCK Prefab Library 1.0\r\n", zero-padded
+- Number of unit types, followed by each unit type's name
+- Number of prefabs
+- One record per prefab, containing the prefab's name, its number of
+  units and bonds, one entry per unit containing the unit's type index,
+  position offset, and orientation offset as a quaternion, and one entry
+  per bond containing the bonded units' indices and bonding site indices
+Names are stored as 32-bit lengths followed by their characters. Unit
+types are matched to the loading simulation's unit types by name;
+prefabs containing unit types or bonding sites unknown to the loading
+simulation are skipped.
+***********************************************************************/
+
+#ifndef PREFABLIBRARY_INCLUDED
+#define PREFABLIBRARY_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "Common.h"
+#include "StateFile.h"
+
+/* Forward declarations: */
+namespace IO {
+class File;
+class SeekableFile;
+}
+
+struct PrefabUnit // Structure for a structural unit in a prefab
+	{
+	/* Elements: */
+	public:
+	UnitTypeID unitType; // Type of this unit
+	Vector positionOffset; // Offset from the prefab's origin to the unit's center of gravity
+	Rotation orientationOffset; // Offset from the prefab's orientation to the unit's orientation
+	};
+
+struct Prefab // Structure for a named prefabricated assembly of structural units
+	{
+	/* Elements: */
+	public:
+	std::string name; // Name of the prefab
+	std::vector<PrefabUnit> units; // List of the prefab's units
+	std::vector<StateFileBond> bonds; // List of bonds between the prefab's units, in prefab unit index space
+	};
+
+class PrefabLibrary // Class for libraries of named prefabs
+	{
+	/* Elements: */
+	private:
+	std::vector<Prefab> prefabs; // List of prefabs in the library
+	
+	/* Methods: */
+	public:
+	Size getNumPrefabs(void) const // Returns the number of prefabs in the library
+		{
+		return Size(prefabs.size());
+		}
+	const Prefab* findPrefab(const std::string& name) const; // Returns the prefab of the given name, or null if there is no such prefab
+	void storePrefab(const Prefab& prefab); // Stores the given prefab in the library, replacing an existing prefab of the same name
+	void save(IO::File& file,const UnitTypeList& unitTypes) const; // Writes all prefabs, whose units are of the given unit types, to the given file
+	Size load(IO::SeekableFile& file,const UnitTypeList& unitTypes); // Merges all prefabs from the given file whose units can be mapped to the given unit types into the library; returns the number of merged prefabs, and merges none if the file cannot be read completely or is inconsistent with its size
+	};
+
+#endif
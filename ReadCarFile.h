@@ -26,7 +26,7 @@ namespace NCK {
 /* Forward declarations: */
 class SpaceGrid;
 
-SpaceGrid* readCarFile(const char* carFileName);
+SpaceGrid* readCarFile(const char* carFileName,int numThreads =1);
 void writeCarFile(const char* carFileName,SpaceGrid* grid);
 
 }
@@ -31,11 +31,19 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Misc/StandardValueCoders.h>
 #include <Misc/ConfigurationFile.h>
 #include <Misc/CompoundValueCoders.h>
+#include <Threads/Thread.h>
 #include <IO/File.h>
+#include <IO/OpenFile.h>
 #include <Math/Math.h>
+#include <Math/Constants.h>
 #include <Geometry/GeometryValueCoders.h>
 
 #include "IO.h"
+#include "StateFile.h"
+#include "CarImporter.h"
+#include "TrajectoryRecorder.h"
+#include "Checkpointer.h"
+#include "StateExporter.h"
 
 // DEBUGGING
 #include <assert.h>
@@ -51,7 +59,7 @@ struct Simulation::UIRequest
 	public:
 	enum RequestType // Enumerated type for types of requests
 		{
-		PICK_POS,PICK_RAY,PASTE,CREATE,SET_STATE,COPY,DESTROY,RELEASE,SAVE_STATE,LOAD_STATE,NUM_REQUESTTYPES
+		PICK_POS,PICK_RAY,PASTE,CREATE,SET_STATE,COPY,DESTROY,RELEASE,SAVE_STATE,LOAD_STATE,IMPORT_CAR,START_RECORDING,STOP_RECORDING,CHECKPOINT,RECOVER_CHECKPOINT,EXPORT_STATE,STORE_PREFAB,SELECT_PREFAB,SAVE_PREFABS,LOAD_PREFABS,NUM_REQUESTTYPES
 		};
 	
 	/* Elements: */
@@ -69,6 +77,8 @@ struct Simulation::UIRequest
 	IO::FilePtr file; // Pointer to the file from/to which to load/save state
 	Misc::Autopointer<SaveStateCompleteCallback> saveCompleteCallback; // Pointer to callback to call when a save operation is complete
 	SessionID loadSessionId; // Session ID associated with a load state request
+	std::string fileName; // Name of the CAR file to import, the trajectory file to record, the file to export, the prefab library file, or the base name of checkpoint files; name of the prefab to store or select
+	bool exportBondSites; // Flag whether export requests export bonding sites in addition to unit centers
 	
 	/* Constructors and destructors: */
 	UIRequest(void) // Dummy constructor to avoid a ton of compiler warnings
@@ -77,11 +87,62 @@ struct Simulation::UIRequest
 		 pickPos(Point::origin),pickRadius(0),pickDir(Vector::zero),pickConnected(false),
 		 createTypeId(0),
 		 setPosition(Point::origin),setLinearVelocity(Vector::zero),setAngularVelocity(Vector::zero),
-		 loadSessionId(0)
+		 loadSessionId(0),
+		 exportBondSites(false)
 		{
 		}
 	};
 
+/*********************************************
+Declaration of struct Simulation::PasteWorker:
+*********************************************/
+
+struct Simulation::PasteWorker
+	{
+	/* Elements: */
+	public:
+	const Simulation* simulation; // Simulation whose copy buffer is instantiated
+	PickID pickId; // Pick ID assigned to all instantiated units
+	Point position; // Position at which to instantiate the copy buffer
+	Rotation orientation; // Orientation with which to instantiate the copy buffer
+	Vector linearVelocity,angularVelocity; // Linear and angular velocities of the instantiated copy buffer
+	Index begin,end; // Range of copy buffer units to instantiate
+	UnitState* states; // Array receiving the states of all instantiated units
+	PickRecord* pickRecords; // Array receiving the pick records of all instantiated units
+	Index firstIndex; // State array index of the first instantiated unit
+	
+	/* Methods: */
+	void* run(void); // Instantiates all units in the worker's range
+	};
+
+void* Simulation::PasteWorker::run(void)
+	{
+	for(Index i=begin;i<end;++i)
+		{
+		const CopiedUnitState& cu=simulation->copiedUnits[i];
+		
+		/* Set the new unit's state: */
+		UnitState& newUnit=states[i];
+		newUnit.unitType=cu.unitType;
+		newUnit.pickId=pickId;
+		Vector offset=orientation.transform(cu.positionOffset);
+		newUnit.position=simulation->wrapPosition(position+offset);
+		newUnit.orientation=orientation*cu.orientationOffset;
+		newUnit.orientation.renormalize();
+		newUnit.linearVelocity=linearVelocity;
+		newUnit.linearVelocity+=angularVelocity^offset;
+		newUnit.angularVelocity=angularVelocity;
+		
+		/* Create a pick record for the new unit: */
+		PickRecord& pr=pickRecords[i];
+		pr.unitIndex=firstIndex+i;
+		pr.positionOffset=cu.positionOffset;
+		pr.orientationOffset=cu.orientationOffset;
+		}
+	
+	return 0;
+	}
+
 /****************
 Helper functions:
 ****************/
@@ -125,20 +186,77 @@ Misc::Float64 increment(Misc::Float64 value)
 	return incrementer.f;
 	}
 
+void copyStates(const UnitStateArray& source,UnitStateArray& dest) // Copies the time stamp and unit states of the given state array for handing to a background thread
+	{
+	dest.timeStamp=source.timeStamp;
+	dest.states.clear();
+	dest.states.reserve(source.states.size());
+	for(UnitStateArray::UnitStateList::const_iterator sIt=source.states.begin();sIt!=source.states.end();++sIt)
+		dest.states.push_back(*sIt);
+	}
+
+const Index removedUnitIndex=~Index(0); // Marker for destroyed units in maps from old to new unit indices
+
+const Size minUnitsPerPasteThread=4096; // Minimum number of copy buffer units instantiated by each paste thread
+
+const Scalar smallAngle2=Scalar(0.0625); // Squared rotation angle below which quaternion exponentials are evaluated by polynomials accurate to single precision
+
+inline Rotation rotateByAngularStep(const Rotation& orientation,const Vector& angularStep) // Returns the given orientation rotated by the given scaled rotation axis, renormalized
+	{
+	/* Calculate sin(theta/2)/theta and cos(theta/2) of the rotation angle theta, using truncated Taylor series for small angles: */
+	Scalar theta2=Geometry::sqr(angularStep);
+	Scalar s,c;
+	if(theta2<smallAngle2)
+		{
+		s=Scalar(0.5)-theta2*(Scalar(1.0/48.0)-theta2*Scalar(1.0/3840.0));
+		c=Scalar(1)-theta2*(Scalar(0.125)-theta2*Scalar(1.0/384.0));
+		}
+	else
+		{
+		Scalar theta=Math::sqrt(theta2);
+		s=Math::sin(Math::div2(theta))/theta;
+		c=Math::cos(Math::div2(theta));
+		}
+	Scalar dx=angularStep[0]*s;
+	Scalar dy=angularStep[1]*s;
+	Scalar dz=angularStep[2]*s;
+	
+	/* Pre-multiply the orientation's quaternion by the rotation quaternion: */
+	const Scalar* q=orientation.getQuaternion();
+	Scalar r[4];
+	r[0]=c*q[0]+dx*q[3]+dy*q[2]-dz*q[1];
+	r[1]=c*q[1]-dx*q[2]+dy*q[3]+dz*q[0];
+	r[2]=c*q[2]+dx*q[1]-dy*q[0]+dz*q[3];
+	r[3]=c*q[3]-dx*q[0]-dy*q[1]-dz*q[2];
+	
+	/* Renormalize the result quaternion: */
+	Scalar invLen=Scalar(1)/Math::sqrt(r[0]*r[0]+r[1]*r[1]+r[2]*r[2]+r[3]*r[3]);
+	for(int i=0;i<4;++i)
+		r[i]*=invLen;
+	return Rotation::fromQuaternion(r);
+	}
+
+inline Scalar wrapCoordinate(Scalar coordinate,Scalar min,Scalar size,Scalar invSize) // Wraps a coordinate into the periodic interval of the given minimum and size without looping
+	{
+	coordinate-=Math::floor((coordinate-min)*invSize)*size;
+	
+	/* Guard against rounding pushing the coordinate just outside the interval: */
+	coordinate=coordinate<min?coordinate+size:coordinate;
+	return coordinate>=min+size?coordinate-size:coordinate;
+	}
+
 /*********************************
 Methods of class Simulation::Grid:
 *********************************/
 
 Simulation::Grid::Grid(void)
-	:cells(0),
-	 unitCellIndexSize(0),unitCellIndices(0)
+	:cells(0)
 	{
 	}
 
 Simulation::Grid::~Grid(void)
 	{
 	delete[] cells;
-	delete[] unitCellIndices;
 	}
 
 void Simulation::Grid::create(const Box& domain,const UnitTypeList& unitTypes,Scalar centralForceOvershoot,Scalar vertexForceRadius)
@@ -238,33 +356,12 @@ void Simulation::Grid::create(const Box& domain,const UnitTypeList& unitTypes,Sc
 				}
 			}
 		}
-	
-	/* Reset the unit cell index array: */
-	delete[] unitCellIndices;
-	unitCellIndexSize=0;
-	unitCellIndices=0;
 	}
 
-void Simulation::Grid::reserve(Size numUnits)
+void Simulation::Grid::reserve(Size numUnits,bool useHugePages)
 	{
-	/* Check if the unit cell index array is too small: */
-	if(unitCellIndexSize<numUnits)
-		{
-		/* Increase the size of the cell index array: */
-		Size newUnitCellIndexSize=unitCellIndexSize;
-		while(newUnitCellIndexSize<numUnits)
-			newUnitCellIndexSize=(newUnitCellIndexSize*5)/4+1;
-		
-		/* Allocate a new array and copy over current indices: */
-		Index* newUnitCellIndices=new Index[newUnitCellIndexSize];
-		for(Index i=0;i<unitCellIndexSize;++i)
-			newUnitCellIndices[i]=unitCellIndices[i];
-		
-		/* Replace the old array: */
-		delete[] unitCellIndices;
-		unitCellIndexSize=newUnitCellIndexSize;
-		unitCellIndices=newUnitCellIndices;
-		}
+	/* Grow the unit cell index array while preserving current indices: */
+	unitCellIndices.setCapacity(numUnits,true,useHugePages);
 	}
 
 void Simulation::Grid::insertUnit(Index unitIndex,const UnitState& unit)
@@ -342,6 +439,28 @@ void Simulation::Grid::changeUnitIndex(Index currentUnitIndex,Index newUnitIndex
 			}
 	}
 
+void Simulation::Grid::remapUnits(Size numUnits,const Index* unitIndexMap)
+	{
+	/* Rewrite the unit lists of all grid cells, dropping destroyed units: */
+	Cell* cEnd=cells+numCells[2]*numCells[1]*numCells[0];
+	for(Cell* cPtr=cells;cPtr!=cEnd;++cPtr)
+		{
+		std::vector<Index>::iterator dIt=cPtr->unitIndices.begin();
+		for(std::vector<Index>::iterator uiIt=cPtr->unitIndices.begin();uiIt!=cPtr->unitIndices.end();++uiIt)
+			if(unitIndexMap[*uiIt]!=removedUnitIndex)
+				{
+				*dIt=unitIndexMap[*uiIt];
+				++dIt;
+				}
+		cPtr->unitIndices.erase(dIt,cPtr->unitIndices.end());
+		}
+	
+	/* Compact the unit cell index array in place, as units never move to higher indices: */
+	for(Index unitIndex=0;unitIndex<numUnits;++unitIndex)
+		if(unitIndexMap[unitIndex]!=removedUnitIndex)
+			unitCellIndices[unitIndexMap[unitIndex]]=unitCellIndices[unitIndex];
+	}
+
 void Simulation::Grid::moveUnits(Size numUnits,const UnitState* unitStates)
 	{
 	const UnitState* uPtr=unitStates;
@@ -403,6 +522,18 @@ void Simulation::Grid::check(Size numUnits,const UnitState* unitStates) const
 Methods of class Simulation:
 ***************************/
 
+Simulation::Integrator Simulation::parseIntegrator(const std::string& integratorName)
+	{
+	if(integratorName=="VelocityVerlet")
+		return VELOCITY_VERLET;
+	else
+		{
+		if(integratorName!="Midpoint")
+			Misc::formattedUserWarning("Simulation: Unknown integrator %s; using midpoint integrator",integratorName.c_str());
+		return MIDPOINT;
+		}
+	}
+
 Vector Simulation::wrapDistance(const Vector& distance) const
 	{
 	Vector result=distance;
@@ -528,6 +659,24 @@ void Simulation::pickUnits(UnitState* unitStates,Index unitIndex,const Point& pi
 		}
 	}
 
+void Simulation::reserveUnits(Size numUnits)
+	{
+	if(unitCapacity<numUnits)
+		{
+		/* Grow the shared capacity geometrically: */
+		unitCapacity=growCapacity(unitCapacity,numUnits);
+		
+		/* Grow all per-unit arrays together; forces and torques are recalculated and need not be preserved: */
+		forces.setCapacity(unitCapacity,false,useHugePages);
+		torques.setCapacity(unitCapacity,false,useHugePages);
+		forcesValid=false;
+		grid.reserve(unitCapacity,useHugePages);
+		
+		// DEBUGGING
+		// std::cout<<"Grew unit capacity to "<<unitCapacity<<" units, "<<forces.getNumReallocations()<<" reallocations so far"<<std::endl;
+		}
+	}
+
 void Simulation::calcForces(Size numUnits,const UnitState* states,Vector* forces,Vector* torques) const
 	{
 	/* Zero out force arrays: */
@@ -640,10 +789,17 @@ void Simulation::calcForces(Size numUnits,const UnitState* states,Vector* forces
 		}
 	}
 
-void Simulation::applyForces(Size numUnits,const UnitState* source,UnitState* dest,Vector* forces,Vector* torques,Scalar dt)
+void Simulation::integrate(Size numUnits,const UnitState* source,UnitState* dest,const Vector* forces,const Vector* torques,Scalar kickDt,Scalar driftDt,Scalar att)
 	{
+	/* Precompute the domain's periodic wrapping constants: */
+	Scalar domainSize[3],invDomainSize[3];
+	for(int i=0;i<3;++i)
+		{
+		domainSize[i]=domain.getSize(i);
+		invDomainSize[i]=Scalar(1)/domainSize[i];
+		}
+	
 	/* Process all units: */
-	Scalar att=Math::pow(parameters.getLockedValue().attenuation,dt);
 	const UnitState* sPtr=source;
 	UnitState* dPtr=dest;
 	for(Index ui=0;ui<numUnits;++ui,++sPtr,++dPtr)
@@ -653,36 +809,64 @@ void Simulation::applyForces(Size numUnits,const UnitState* source,UnitState* de
 		const UnitType& ut=unitTypes[sPtr->unitType];
 		dPtr->pickId=sPtr->pickId;
 		
-		/* Update linear and angular velocities unless the unit is locked by a pick record: */
-		dPtr->linearVelocity=sPtr->linearVelocity;
-		dPtr->angularVelocity=sPtr->angularVelocity;
-		if(sPtr->pickId==0)
-			{
-			Vector linearAcceleration=forces[ui];
-			linearAcceleration*=ut.invMass*dt;
-			dPtr->linearVelocity+=linearAcceleration;
-			Vector angularAcceleration=Vector(ut.invMomentOfInertia*torques[ui]);
-			angularAcceleration*=dt;
-			dPtr->angularVelocity+=angularAcceleration;
-			}
+		/* Mask out velocity updates and attenuation for units locked by a pick record: */
+		Scalar unlocked=sPtr->pickId==0?Scalar(1):Scalar(0);
+		Scalar unitKickDt=kickDt*unlocked;
+		Scalar unitAtt=Scalar(1)+(att-Scalar(1))*unlocked;
+		
+		/* Update linear and angular velocities: */
+		Vector linearVelocity=sPtr->linearVelocity+forces[ui]*(ut.invMass*unitKickDt);
+		Vector angularVelocity=sPtr->angularVelocity+Vector(ut.invMomentOfInertia*torques[ui])*unitKickDt;
 		
 		/* Update position and orientation: */
-		dPtr->position=wrapPosition(sPtr->position+dPtr->linearVelocity*dt);
-		dPtr->orientation=Rotation(dPtr->angularVelocity*dt)*sPtr->orientation;
-		dPtr->orientation.renormalize();
+		for(int i=0;i<3;++i)
+			dPtr->position[i]=wrapCoordinate(sPtr->position[i]+linearVelocity[i]*driftDt,domain.min[i],domainSize[i],invDomainSize[i]);
+		dPtr->orientation=rotateByAngularStep(sPtr->orientation,angularVelocity*driftDt);
 		
-		if(sPtr->pickId==0)
-			{
-			/* Attenuate velocities: */
-			dPtr->linearVelocity*=att;
-			dPtr->angularVelocity*=att;
-			}
+		/* Attenuate velocities: */
+		dPtr->linearVelocity=linearVelocity*unitAtt;
+		dPtr->angularVelocity=angularVelocity*unitAtt;
 		}
 	
 	/* Update the acceleration grid: */
 	grid.moveUnits(numUnits,dest);
 	}
 
+void Simulation::applyForces(Size numUnits,const UnitState* source,UnitState* dest,Vector* forces,Vector* torques,Scalar dt)
+	{
+	/* Apply the forces for a full step, move units by a full step, and attenuate velocities: */
+	integrate(numUnits,source,dest,forces,torques,dt,dt,Math::pow(parameters.getLockedValue().attenuation,dt));
+	}
+
+void Simulation::kickAndDrift(Size numUnits,const UnitState* source,UnitState* dest,const Vector* forces,const Vector* torques,Scalar dt)
+	{
+	/* Apply the forces for half a step and move units by a full step, rotating freely around the half-step angular velocity: */
+	integrate(numUnits,source,dest,forces,torques,Math::div2(dt),dt,Scalar(1));
+	}
+
+void Simulation::kick(Size numUnits,UnitState* states,const Vector* forces,const Vector* torques,Scalar dt)
+	{
+	/* Process all units: */
+	Scalar halfDt=Math::div2(dt);
+	Scalar att=Math::pow(parameters.getLockedValue().attenuation,dt);
+	UnitState* sPtr=states;
+	for(Index ui=0;ui<numUnits;++ui,++sPtr)
+		{
+		const UnitType& ut=unitTypes[sPtr->unitType];
+		
+		/* Mask out velocity updates and attenuation for units locked by a pick record: */
+		Scalar unlocked=sPtr->pickId==0?Scalar(1):Scalar(0);
+		Scalar unitHalfDt=halfDt*unlocked;
+		Scalar unitAtt=Scalar(1)+(att-Scalar(1))*unlocked;
+		
+		/* Update linear and angular velocities by half a step and attenuate them: */
+		sPtr->linearVelocity+=forces[ui]*(ut.invMass*unitHalfDt);
+		sPtr->angularVelocity+=Vector(ut.invMomentOfInertia*torques[ui])*unitHalfDt;
+		sPtr->linearVelocity*=unitAtt;
+		sPtr->angularVelocity*=unitAtt;
+		}
+	}
+
 void Simulation::updateBonds(Size numUnits,const UnitState* states)
 	{
 	/* Process all units: */
@@ -722,8 +906,7 @@ void Simulation::updateBonds(Size numUnits,const UnitState* states)
 						/* Break the bond by removing both the "up" and "down" directions: */
 						// DEBUGGING
 						// std::cout<<"Breaking bond ("<<ui0<<", "<<bsi0<<")<->("<<ui1<<", "<<bsi1<<")"<<std::endl;
-						bonds.removeEntry(bIt);
-						bonds.removeEntry(Bond(ui1,bsi1));
+						breakBond(b0,Bond(ui1,bsi1));
 						}
 					}
 				}
@@ -763,8 +946,7 @@ void Simulation::updateBonds(Size numUnits,const UnitState* states)
 											/* Create a bond by inserting both the "up" and "down" halves into the bond map: */
 											// DEBUGGING
 											// std::cout<<"Creating bond ("<<ui0<<", "<<bsi0<<")<->("<<*ui1It<<", "<<bsi1<<")"<<std::endl;
-											bonds[b0]=b1;
-											bonds[b1]=b0;
+											createBond(b0,b1);
 											
 											/* Stop looking for bonding opportunities: */
 											goto doneCheckingBondSite;
@@ -782,73 +964,231 @@ void Simulation::updateBonds(Size numUnits,const UnitState* states)
 		}
 	}
 
-void Simulation::save(UnitStateArray& states,IO::File& file) const
+void Simulation::createBond(const Simulation::Bond& b0,const Simulation::Bond& b1)
 	{
-	/* Write a file identifier: */
-	char tag[32];
-	memset(tag,0,sizeof(tag));
-	strcpy(tag,"NanotechConstructionKit 2.0\r\n");
-	file.write(tag,sizeof(tag));
+	bonds[b0]=b1;
+	bonds[b1]=b0;
+	++numBonds;
+	
+	/* Invalidate forces and torques carried over to the next step: */
+	forcesValid=false;
 	
-	/* Write the list of unit types: */
-	Misc::write(unitTypes,file);
+	/* Notify the trajectory recorder: */
+	if(recorder!=0)
+		recorder->addBondEvent(true,b0.unitIndex,b0.bondSiteIndex,b1.unitIndex,b1.bondSiteIndex);
 	
-	/* Write the domain size: */
-	Misc::write(domain,file);
+	/* Queue the change for the statistics calculator unless the next snapshot replaces all bonds anyway: */
+	if(statisticsInterval>0&&statisticsTopologyVersion==topologyVersion)
+		statisticsBondEvents.push_back(BondStatisticsCalculator::BondEvent(true,b0.unitIndex,b0.bondSiteIndex,b1.unitIndex,b1.bondSiteIndex));
+	}
+
+void Simulation::breakBond(Simulation::Bond b0,Simulation::Bond b1)
+	{
+	bonds.removeEntry(b0);
+	bonds.removeEntry(b1);
+	--numBonds;
 	
-	/* Write simulation parameters: */
-	file.write<Scalar>(vertexForceRadius);
-	file.write<Scalar>(vertexForceStrength);
-	file.write<Scalar>(centralForceOvershoot);
-	file.write<Scalar>(centralForceStrength);
+	/* Invalidate forces and torques carried over to the next step: */
+	forcesValid=false;
 	
-	/* Write the given unit state array: */
-	writeStateArray(states,file,false);
+	/* Notify the trajectory recorder: */
+	if(recorder!=0)
+		recorder->addBondEvent(false,b0.unitIndex,b0.bondSiteIndex,b1.unitIndex,b1.bondSiteIndex);
 	
-	/* Write all bonds: */
-	file.write<Size>(bonds.getNumEntries()/2); // Only write "up" halves of bonds
-	for(BondMap::ConstIterator bIt=bonds.begin();!bIt.isFinished();++bIt)
+	/* Queue the change for the statistics calculator unless the next snapshot replaces all bonds anyway: */
+	if(statisticsInterval>0&&statisticsTopologyVersion==topologyVersion)
+		statisticsBondEvents.push_back(BondStatisticsCalculator::BondEvent(false,b0.unitIndex,b0.bondSiteIndex,b1.unitIndex,b1.bondSiteIndex));
+	}
+
+void Simulation::pasteUnits(UnitStateArray& states,PickID pickId,const Point& position,const Rotation& orientation,const Vector& linearVelocity,const Vector& angularVelocity)
+	{
+	/* Make room for all instantiated units, in case the copy buffer changed after units were counted for this step: */
+	Size numCopiedUnits(copiedUnits.size());
+	Index firstIndex(states.states.size());
+	reserveUnits(firstIndex+numCopiedUnits);
+	states.states.reserve(unitCapacity);
+	UnitState newUnit;
+	for(Size i=0;i<numCopiedUnits;++i)
+		states.states.push_back(newUnit);
+	
+	/* Create a pick record entry for all instantiated units: */
+	PickRecordList& prl=pickRecords[pickId].getDest();
+	prl.resize(numCopiedUnits);
+	
+	/* Split the copy buffer into equal-sized ranges, one per worker, but only use multiple workers for large copy buffers: */
+	int numThreads=int(numCopiedUnits/minUnitsPerPasteThread);
+	if(numThreads>numPasteThreads)
+		numThreads=numPasteThreads;
+	if(numThreads<1)
+		numThreads=1;
+	std::vector<PasteWorker> workers(numThreads);
+	for(int i=0;i<numThreads;++i)
 		{
-		/* Check if this is the "up" half of a bond: */
+		PasteWorker& w=workers[i];
+		w.simulation=this;
+		w.pickId=pickId;
+		w.position=position;
+		w.orientation=orientation;
+		w.linearVelocity=linearVelocity;
+		w.angularVelocity=angularVelocity;
+		w.begin=Index((size_t(numCopiedUnits)*size_t(i))/size_t(numThreads));
+		w.end=Index((size_t(numCopiedUnits)*size_t(i+1))/size_t(numThreads));
+		w.states=states.states.data()+firstIndex;
+		w.pickRecords=prl.data();
+		w.firstIndex=firstIndex;
+		}
+	
+	/* Run all but the first worker in their own threads, and the first worker in the calling thread: */
+	Threads::Thread* workerThreads=numThreads>1?new Threads::Thread[numThreads-1]:0;
+	for(int i=1;i<numThreads;++i)
+		workerThreads[i-1].start(&workers[i],&PasteWorker::run);
+	workers[0].run();
+	for(int i=1;i<numThreads;++i)
+		workerThreads[i-1].join();
+	delete[] workerThreads;
+	
+	/* Add all new units to the acceleration grid: */
+	for(Index unitIndex=firstIndex;unitIndex<firstIndex+numCopiedUnits;++unitIndex)
+		grid.insertUnit(unitIndex,states.states[unitIndex]);
+	
+	/* Translate all bonds in the copy buffer from copy buffer index space to state index space and add them to the bond map: */
+	for(std::vector<std::pair<Bond,Bond> >::iterator cbIt=copiedBonds.begin();cbIt!=copiedBonds.end();++cbIt)
+		createBond(Bond(cbIt->first.unitIndex+firstIndex,cbIt->first.bondSiteIndex),Bond(cbIt->second.unitIndex+firstIndex,cbIt->second.bondSiteIndex));
+	
+	/* Mark the units as changed: */
+	++topologyVersion;
+	}
+
+void Simulation::destroyUnits(UnitStateArray& states,const PickRecordList& destroyedUnits)
+	{
+	/* Mark all destroyed units and break their bonds: */
+	Size numUnits(states.states.size());
+	std::vector<Index> unitIndexMap(numUnits,0);
+	for(PickRecordList::const_iterator prlIt=destroyedUnits.begin();prlIt!=destroyedUnits.end();++prlIt)
+		{
+		unitIndexMap[prlIt->unitIndex]=removedUnitIndex;
+		const UnitType& ut=unitTypes[states.states[prlIt->unitIndex].unitType];
+		for(Index bsi=0;bsi<ut.bondSites.size();++bsi)
+			{
+			BondMap::Iterator bIt=bonds.findEntry(Bond(prlIt->unitIndex,bsi));
+			if(!bIt.isFinished())
+				breakBond(bIt->getSource(),bIt->getDest());
+			}
+		}
+	
+	/* Compact the state array in a single pass, building the map from old to new unit indices: */
+	Index numRemainingUnits=0;
+	UnitState* sPtr=states.states.data();
+	for(Index unitIndex=0;unitIndex<numUnits;++unitIndex)
+		if(unitIndexMap[unitIndex]!=removedUnitIndex)
+			{
+			if(numRemainingUnits!=unitIndex)
+				sPtr[numRemainingUnits]=sPtr[unitIndex];
+			unitIndexMap[unitIndex]=numRemainingUnits;
+			++numRemainingUnits;
+			}
+	for(Size i=numRemainingUnits;i<numUnits;++i)
+		states.states.pop_back();
+	
+	/* Apply the index map to the acceleration grid: */
+	grid.remapUnits(numUnits,unitIndexMap.data());
+	
+	/* Apply the index map to all remaining bonds by rebuilding the bond map: */
+	std::vector<std::pair<Bond,Bond> > remainingBonds;
+	remainingBonds.reserve(numBonds);
+	for(BondMap::ConstIterator bIt=bonds.begin();!bIt.isFinished();++bIt)
 		if(bIt->getSource().unitIndex<bIt->getDest().unitIndex)
 			{
-			file.write<Index>(bIt->getSource().unitIndex);
-			file.write<Index>(bIt->getSource().bondSiteIndex);
-			file.write<Index>(bIt->getDest().unitIndex);
-			file.write<Index>(bIt->getDest().bondSiteIndex);
+			Bond b0(unitIndexMap[bIt->getSource().unitIndex],bIt->getSource().bondSiteIndex);
+			Bond b1(unitIndexMap[bIt->getDest().unitIndex],bIt->getDest().bondSiteIndex);
+			remainingBonds.push_back(std::make_pair(b0,b1));
 			}
+	bonds.clear();
+	for(std::vector<std::pair<Bond,Bond> >::iterator rbIt=remainingBonds.begin();rbIt!=remainingBonds.end();++rbIt)
+		{
+		bonds[rbIt->first]=rbIt->second;
+		bonds[rbIt->second]=rbIt->first;
+		}
+	
+	/* Apply the index map to all pick records of remaining units: */
+	for(PickRecordMap::Iterator prIt=pickRecords.begin();!prIt.isFinished();++prIt)
+		{
+		PickRecordList& prl=prIt->getDest();
+		for(PickRecordList::iterator prlIt=prl.begin();prlIt!=prl.end();++prlIt)
+			if(unitIndexMap[prlIt->unitIndex]!=removedUnitIndex)
+				prlIt->unitIndex=unitIndexMap[prlIt->unitIndex];
 		}
 	}
 
-void Simulation::load(IO::File& file,UnitStateArray& states)
+void Simulation::endRecording(void)
 	{
-	/* Check the file identifier: */
-	char tag[32];
-	file.read(tag,sizeof(tag));
-	if(strcmp(tag,"NanotechConstructionKit 2.0\r\n")!=0)
-		throw std::runtime_error("Input file is not a unit file");
-	
-	/* Read the list of unit types: */
-	Misc::read(file,unitTypes);
-	
-	/* Read the domain size: */
-	Misc::read(file,domain);
+	if(recorder!=0)
+		{
+		/* Let the recorder's writer thread finish the trajectory file in the background, and delete the recorder once it is done: */
+		recorder->finish();
+		finishingRecorders.push_back(recorder);
+		recorder=0;
+		}
+	}
+
+void Simulation::getStateFileHeader(StateFileHeader& header) const
+	{
+	/* Collect the simulation setup: */
+	header.unitTypes=unitTypes;
+	header.domain=domain;
+	header.vertexForceRadius=vertexForceRadius;
+	header.vertexForceStrength=vertexForceStrength;
+	header.centralForceOvershoot=centralForceOvershoot;
+	header.centralForceStrength=centralForceStrength;
+	}
+
+void Simulation::getStateFileBonds(std::vector<StateFileBond>& fileBonds) const
+	{
+	/* Collect the "up" halves of all bonds: */
+	fileBonds.clear();
+	fileBonds.reserve(numBonds);
+	for(BondMap::ConstIterator bIt=bonds.begin();!bIt.isFinished();++bIt)
+		if(bIt->getSource().unitIndex<bIt->getDest().unitIndex)
+			{
+			StateFileBond fb;
+			fb.unitIndex[0]=bIt->getSource().unitIndex;
+			fb.bondSiteIndex[0]=bIt->getSource().bondSiteIndex;
+			fb.unitIndex[1]=bIt->getDest().unitIndex;
+			fb.bondSiteIndex[1]=bIt->getDest().bondSiteIndex;
+			fileBonds.push_back(fb);
+			}
+	}
+
+void Simulation::save(UnitStateArray& states,IO::File& file) const
+	{
+	/* Collect the simulation setup and all bonds: */
+	StateFileHeader header;
+	getStateFileHeader(header);
+	std::vector<StateFileBond> fileBonds;
+	getStateFileBonds(fileBonds);
+	
+	/* Write the simulation state in chunked format: */
+	writeStateFile(file,header,states,fileBonds);
+	}
+
+void Simulation::applyStateFile(const StateFileHeader& header,const std::vector<StateFileBond>& fileBonds,UnitStateArray& states)
+	{
+	/* Set the list of unit types and the domain size: */
+	unitTypes=header.unitTypes;
+	domain=header.domain;
 	
-	/* Read simulation parameters: */
-	vertexForceRadius=file.read<Scalar>();
+	/* Set simulation parameters: */
+	vertexForceRadius=header.vertexForceRadius;
 	vertexForceRadius2=Math::sqr(vertexForceRadius);
-	vertexForceStrength=file.read<Scalar>();
-	centralForceOvershoot=file.read<Scalar>();
-	centralForceStrength=file.read<Scalar>();
+	vertexForceStrength=header.vertexForceStrength;
+	centralForceOvershoot=header.centralForceOvershoot;
+	centralForceStrength=header.centralForceStrength;
 	
 	/* Create the acceleration grid: */
 	grid.create(domain,unitTypes,centralForceOvershoot,vertexForceRadius);
 	
-	/* Read units into the given unit state array: */
-	readStateArray(file,states,false);
-	
 	/* Sort the read units into their appropriate grid cells: */
-	grid.reserve(states.states.size());
+	reserveUnits(Size(states.states.size()));
 	Index unitIndex=0;
 	for(UnitStateArray::UnitStateList::iterator sIt=states.states.begin();sIt!=states.states.end();++sIt,++unitIndex)
 		{
@@ -856,33 +1196,82 @@ void Simulation::load(IO::File& file,UnitStateArray& states)
 		grid.insertUnit(unitIndex,*sIt);
 		}
 	
-	/* Read bonds: */
-	Size numBonds=file.read<Size>();
+	/* Insert the "up" and "down" halves of all bonds into the bond map: */
 	bonds.clear();
-	for(Index i=0;i<numBonds;++i)
+	numBonds=0;
+	for(std::vector<StateFileBond>::const_iterator bIt=fileBonds.begin();bIt!=fileBonds.end();++bIt)
+		createBond(Bond(bIt->unitIndex[0],bIt->bondSiteIndex[0]),Bond(bIt->unitIndex[1],bIt->bondSiteIndex[1]));
+	}
+
+void Simulation::load(IO::File& file,UnitStateArray& states)
+	{
+	/* Read the simulation setup, unit states, and bonds: */
+	StateFileHeader header;
+	std::vector<StateFileBond> fileBonds;
+	readStateFile(file,header,states,fileBonds);
+	
+	/* Replace the current simulation state: */
+	applyStateFile(header,fileBonds,states);
+	
+	Misc::formattedUserNote("Simulation::load: Loaded %u units and %u bonds",(unsigned int)(states.states.size()),(unsigned int)(fileBonds.size()));
+	}
+
+void Simulation::loadCheckpoint(const char* baseFileName,UnitStateArray& states)
+	{
+	/* Reconstruct the newest recoverable simulation state from the checkpoint files, keeping simulation steps monotonic: */
+	Index timeStamp=states.timeStamp;
+	StateFileHeader header;
+	std::vector<StateFileBond> fileBonds;
+	readCheckpoint(baseFileName,header,states,fileBonds);
+	states.timeStamp=timeStamp;
+	
+	/* Replace the current simulation state: */
+	applyStateFile(header,fileBonds,states);
+	}
+
+void Simulation::importCar(const char* carFileName,UnitStateArray& states)
+	{
+	/* Convert the CAR file's SiO_4 tetrahedra into units of the configured unit type: */
+	CarImport carImport;
+	::importCarFile(carFileName,unitTypes,carUnitTypeName,numImportThreads,carImport);
+	if(carImport.numAmbiguous>0)
+		Misc::formattedUserWarning("Simulation::importCar: %u units had more than 8 candidate oxygens",(unsigned int)(carImport.numAmbiguous));
+	
+	/* Set the domain to the CAR file's periodic box: */
+	domain=carImport.domain;
+	
+	/* Create the acceleration grid: */
+	grid.create(domain,unitTypes,centralForceOvershoot,vertexForceRadius);
+	
+	/* Copy the imported units into the given unit state array and sort them into their appropriate grid cells: */
+	states.states.clear();
+	states.states.reserve(carImport.states.states.size());
+	reserveUnits(Size(carImport.states.states.size()));
+	Index unitIndex=0;
+	for(UnitStateArray::UnitStateList::iterator sIt=carImport.states.states.begin();sIt!=carImport.states.states.end();++sIt,++unitIndex)
 		{
-		/* Read the bond: */
-		Bond b0;
-		b0.unitIndex=file.read<Index>();
-		b0.bondSiteIndex=file.read<Index>();
-		Bond b1;
-		b1.unitIndex=file.read<Index>();
-		b1.bondSiteIndex=file.read<Index>();
-		
-		/* Insert the "up" and "down" halves of the bond into the bond map: */
-		bonds[b0]=b1;
-		bonds[b1]=b0;
+		states.states.push_back(*sIt);
+		grid.insertUnit(unitIndex,*sIt);
 		}
 	
-	// DEBUGGING
-	std::cout<<"Loaded file: "<<states.states.size()<<" units, "<<numBonds<<" bonds"<<std::endl;
+	/* Insert the bonds between units sharing oxygen atoms into the bond map: */
+	bonds.clear();
+	numBonds=0;
+	for(std::vector<CarImport::Bond>::iterator bIt=carImport.bonds.begin();bIt!=carImport.bonds.end();++bIt)
+		createBond(Bond(bIt->unitIndex[0],bIt->bondSiteIndex[0]),Bond(bIt->unitIndex[1],bIt->bondSiteIndex[1]));
+	
+	Misc::formattedUserNote("Simulation::importCar: Imported %u units and %u bonds",(unsigned int)(states.states.size()),(unsigned int)(numBonds));
 	}
 
 Simulation::Simulation(const Misc::ConfigurationFileSection& configFileSection,const Box& sDomain)
-	:bonds(17),
-	 forceArraySize(0),forces(0),torques(0),
+	:bonds(17),numBonds(0),
+	 statisticsInterval(0),nextStatisticsTimeStamp(0),statisticsCalculator(0),statisticsTopologyVersion(~Index(0)),
+	 recordingFrameInterval(10),recordingKeyframeInterval(100),recordingQueueSize(16),recorder(0),topologyVersion(0),
+	 checkpointBaseInterval(10),checkpointChunkSize(1024),checkpointer(0),checkpointRequested(false),
+	 exporter(0),
+	 unitCapacity(0),useHugePages(false),forcesValid(false),
 	 loadSessionId(1),
-	 lastPickId(0),pickRecords(17)
+	 lastPickId(0),pickRecords(17),bulkDestroyThreshold(256),numPasteThreads(1)
 	{
 	/* Read simulation parameters: */
 	vertexForceRadius=configFileSection.retrieveValue<Scalar>("./vertexForceRadius",vertexForceRadius);
@@ -890,6 +1279,28 @@ Simulation::Simulation(const Misc::ConfigurationFileSection& configFileSection,c
 	vertexForceStrength=configFileSection.retrieveValue<Scalar>("./vertexForceStrength",vertexForceStrength);
 	centralForceOvershoot=configFileSection.retrieveValue<Scalar>("./centralForceOvershoot",centralForceOvershoot);
 	centralForceStrength=configFileSection.retrieveValue<Scalar>("./centralForceStrength",centralForceStrength);
+	integrator=parseIntegrator(configFileSection.retrieveString("./integrator","Midpoint"));
+	statisticsInterval=configFileSection.retrieveValue<Index>("./statisticsInterval",statisticsInterval);
+	carUnitTypeName=configFileSection.retrieveString("./carUnitType","Silicate");
+	numImportThreads=configFileSection.retrieveValue<int>("./numImportThreads",1);
+	
+	/* Read trajectory recording settings: */
+	recordingFrameInterval=configFileSection.retrieveValue<Index>("./recordingFrameInterval",recordingFrameInterval);
+	recordingKeyframeInterval=configFileSection.retrieveValue<unsigned int>("./recordingKeyframeInterval",recordingKeyframeInterval);
+	recordingQueueSize=configFileSection.retrieveValue<unsigned int>("./recordingQueueSize",recordingQueueSize);
+	
+	/* Read checkpointing settings: */
+	checkpointBaseInterval=configFileSection.retrieveValue<unsigned int>("./checkpointBaseInterval",checkpointBaseInterval);
+	checkpointChunkSize=configFileSection.retrieveValue<Size>("./checkpointChunkSize",checkpointChunkSize);
+	
+	/* Read memory management settings: */
+	useHugePages=configFileSection.retrieveValue<bool>("./useHugePages",useHugePages);
+	
+	/* Read unit removal settings: */
+	bulkDestroyThreshold=configFileSection.retrieveValue<Size>("./bulkDestroyThreshold",bulkDestroyThreshold);
+	
+	/* Read paste settings: */
+	numPasteThreads=configFileSection.retrieveValue<int>("./numPasteThreads",numPasteThreads);
 	
 	Parameters& p=parameters.startNewValue();
 	p.linearDampening=configFileSection.retrieveValue<Scalar>("./linearDampening",Scalar(0));
@@ -900,34 +1311,7 @@ Simulation::Simulation(const Misc::ConfigurationFileSection& configFileSection,c
 	mostRecentParameters=&p;
 	
 	/* Read the list of unit types: */
-	std::vector<std::string> unitTypeNames=configFileSection.retrieveValue<std::vector<std::string> >("./structuralUnitTypes");
-	for(std::vector<std::string>::iterator utnIt=unitTypeNames.begin();utnIt!=unitTypeNames.end();++utnIt)
-		{
-		try
-			{
-			/* Go to the unit type's configuration section: */
-			Misc::ConfigurationFileSection utSec=configFileSection.getSection(utnIt->c_str());
-			
-			/* Read a unit type definition: */
-			UnitType newUt;
-			newUt.name=utSec.retrieveString("./name",*utnIt);
-			newUt.radius=utSec.retrieveValue<Scalar>("./radius");
-			newUt.mass=utSec.retrieveValue<Scalar>("./mass");
-			newUt.invMass=Scalar(1)/newUt.mass;
-			newUt.momentOfInertia=utSec.retrieveValue<Tensor>("./momentOfInertia");
-			newUt.invMomentOfInertia=Geometry::invert(newUt.momentOfInertia);
-			newUt.bondSites=utSec.retrieveValue<Misc::Vector<BondSite> >("./bondSites");
-			newUt.meshVertices=utSec.retrieveValue<Misc::Vector<Point> >("./meshVertices");
-			newUt.meshTriangles=utSec.retrieveValue<Misc::Vector<Index> >("./meshTriangles");
-			
-			/* Store the unit type: */
-			unitTypes.push_back(newUt);
-			}
-		catch(const std::runtime_error& err)
-			{
-			Misc::formattedUserError("Simulation::Simulation: Ignoring unit type %s due to exception %s",utnIt->c_str(),err.what());
-			}
-		}
+	readUnitTypes(configFileSection,unitTypes);
 	
 	/* Set the simulation domain: */
 	domain=sDomain;
@@ -947,11 +1331,40 @@ Simulation::Simulation(const Misc::ConfigurationFileSection& configFileSection,c
 	}
 
 Simulation::Simulation(const Misc::ConfigurationFileSection& configFileSection,IO::File& file)
-	:bonds(17),
-	 forceArraySize(0),forces(0),torques(0),
+	:bonds(17),numBonds(0),
+	 statisticsInterval(0),nextStatisticsTimeStamp(0),statisticsCalculator(0),statisticsTopologyVersion(~Index(0)),
+	 recordingFrameInterval(10),recordingKeyframeInterval(100),recordingQueueSize(16),recorder(0),topologyVersion(0),
+	 checkpointBaseInterval(10),checkpointChunkSize(1024),checkpointer(0),checkpointRequested(false),
+	 exporter(0),
+	 unitCapacity(0),useHugePages(false),forcesValid(false),
 	 loadSessionId(0),
-	 lastPickId(0),pickRecords(17)
+	 lastPickId(0),pickRecords(17),bulkDestroyThreshold(256),numPasteThreads(1)
 	{
+	/* Read the integration scheme: */
+	integrator=parseIntegrator(configFileSection.retrieveString("./integrator","Midpoint"));
+	
+	/* Read CAR file import settings: */
+	carUnitTypeName=configFileSection.retrieveString("./carUnitType","Silicate");
+	numImportThreads=configFileSection.retrieveValue<int>("./numImportThreads",1);
+	
+	/* Read trajectory recording settings: */
+	recordingFrameInterval=configFileSection.retrieveValue<Index>("./recordingFrameInterval",recordingFrameInterval);
+	recordingKeyframeInterval=configFileSection.retrieveValue<unsigned int>("./recordingKeyframeInterval",recordingKeyframeInterval);
+	recordingQueueSize=configFileSection.retrieveValue<unsigned int>("./recordingQueueSize",recordingQueueSize);
+	
+	/* Read checkpointing settings: */
+	checkpointBaseInterval=configFileSection.retrieveValue<unsigned int>("./checkpointBaseInterval",checkpointBaseInterval);
+	checkpointChunkSize=configFileSection.retrieveValue<Size>("./checkpointChunkSize",checkpointChunkSize);
+	
+	/* Read memory management settings: */
+	useHugePages=configFileSection.retrieveValue<bool>("./useHugePages",useHugePages);
+	
+	/* Read unit removal settings: */
+	bulkDestroyThreshold=configFileSection.retrieveValue<Size>("./bulkDestroyThreshold",bulkDestroyThreshold);
+	
+	/* Read paste settings: */
+	numPasteThreads=configFileSection.retrieveValue<int>("./numPasteThreads",numPasteThreads);
+	
 	/* Read simulation parameters: */
 	Parameters& p=parameters.startNewValue();
 	p.linearDampening=configFileSection.retrieveValue<Scalar>("./linearDampening",Scalar(0));
@@ -974,8 +1387,17 @@ Simulation::Simulation(const Misc::ConfigurationFileSection& configFileSection,I
 
 Simulation::~Simulation(void)
 	{
-	delete[] forces;
-	delete[] torques;
+	/* Finish an ongoing trajectory recording, all ended trajectory recordings, and all queued checkpoints: */
+	delete recorder;
+	for(std::vector<TrajectoryRecorder*>::iterator frIt=finishingRecorders.begin();frIt!=finishingRecorders.end();++frIt)
+		delete *frIt;
+	delete checkpointer;
+	
+	/* Finish an ongoing export: */
+	delete exporter;
+	
+	/* Shut down the statistics calculator: */
+	delete statisticsCalculator;
 	}
 
 bool Simulation::isSessionValid(void) const
@@ -1167,13 +1589,20 @@ void Simulation::loadState(IO::File& stateFile)
 	}
 	}
 
-void Simulation::saveState(IO::File& stateFile,SimulationInterface::SaveStateCompleteCallback* completeCallback)
+void Simulation::importCarFile(const char* carFileName)
 	{
+	/* Invalidate the current session: */
+	do
+		{
+		++loadSessionId;
+		}
+	while(loadSessionId==0);
+	
 	/* Create a new UI request: */
 	UIRequest newRequest;
-	newRequest.requestType=UIRequest::SAVE_STATE;
-	newRequest.file=&stateFile;
-	newRequest.saveCompleteCallback=completeCallback;
+	newRequest.requestType=UIRequest::IMPORT_CAR;
+	newRequest.fileName=carFileName;
+	newRequest.loadSessionId=loadSessionId;
 	
 	/* Put the UI request into the queue: */
 	{
@@ -1182,54 +1611,192 @@ void Simulation::saveState(IO::File& stateFile,SimulationInterface::SaveStateCom
 	}
 	}
 
-void Simulation::advance(Scalar timeStep)
+void Simulation::startRecording(const char* trajectoryFileName)
 	{
-	/* Lock the most recent simulation parameters: */
-	parameters.lockNewValue();
-	
-	/* Apply the time speed-up factor: */
-	Scalar tf=parameters.getLockedValue().timeFactor;
-	timeStep*=tf;
+	/* Create a new UI request: */
+	UIRequest newRequest;
+	newRequest.requestType=UIRequest::START_RECORDING;
+	newRequest.fileName=trajectoryFileName;
 	
-	/* Limit the time step to the safety region (currently hard-coded based on experiments): */
-	if(timeStep>0.06)
-		timeStep=0.06;
+	/* Put the UI request into the queue: */
+	{
+	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
+	uiRequests.push_back(newRequest);
+	}
+	}
+
+void Simulation::stopRecording(void)
+	{
+	/* Create a new UI request: */
+	UIRequest newRequest;
+	newRequest.requestType=UIRequest::STOP_RECORDING;
 	
-	/* Grab the current queue of UI requests: */
-	std::vector<UIRequest> newUiRequests;
+	/* Put the UI request into the queue: */
 	{
 	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
-	std::swap(uiRequests,newUiRequests);
+	uiRequests.push_back(newRequest);
 	}
+	}
+
+void Simulation::checkpoint(const char* checkpointBaseFileName)
+	{
+	/* Create a new UI request: */
+	UIRequest newRequest;
+	newRequest.requestType=UIRequest::CHECKPOINT;
+	newRequest.fileName=checkpointBaseFileName;
 	
-	/* Increase the sizes of the force and torque arrays if necessary: */
-	Size numUnits(mostRecentStates->states.size());
-	if(forceArraySize<numUnits)
+	/* Put the UI request into the queue: */
+	{
+	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
+	uiRequests.push_back(newRequest);
+	}
+	}
+
+void Simulation::recoverCheckpoint(const char* checkpointBaseFileName)
+	{
+	/* Invalidate the current session: */
+	do
 		{
-		/* Resize the force and torque arrays: */
-		while(forceArraySize<numUnits)
-			forceArraySize=(forceArraySize*5)/4+1;
-		delete[] forces;
-		delete[] torques;
-		forces=new Vector[forceArraySize];
-		torques=new Vector[forceArraySize];
+		++loadSessionId;
 		}
+	while(loadSessionId==0);
 	
-	/* Prepare a new slot in the state triple buffer: */
-	UnitStateArray& nextState=unitStates.startNewValue();
-	nextState.timeStamp=mostRecentStates->timeStamp+1;
-	
-	/* Count how many units might have to be added in this step: */
-	Size numNewUnits=0;
-	for(std::vector<UIRequest>::iterator uiIt=newUiRequests.begin();uiIt!=newUiRequests.end();++uiIt)
-		if(uiIt->requestType==UIRequest::PASTE)
-			numNewUnits+=copiedUnits.size();
-		else if(uiIt->requestType==UIRequest::CREATE)
-			++numNewUnits;
-	
-	/* Make room in the next state buffer and the acceleration grid to add units after simulation: */
-	nextState.states.reserve(numUnits+numNewUnits);
-	grid.reserve(numUnits+numNewUnits);
+	/* Create a new UI request: */
+	UIRequest newRequest;
+	newRequest.requestType=UIRequest::RECOVER_CHECKPOINT;
+	newRequest.fileName=checkpointBaseFileName;
+	newRequest.loadSessionId=loadSessionId;
+	
+	/* Put the UI request into the queue: */
+	{
+	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
+	uiRequests.push_back(newRequest);
+	}
+	}
+
+void Simulation::exportState(const char* exportFileName,bool exportBondSites)
+	{
+	/* Create a new UI request: */
+	UIRequest newRequest;
+	newRequest.requestType=UIRequest::EXPORT_STATE;
+	newRequest.fileName=exportFileName;
+	newRequest.exportBondSites=exportBondSites;
+	
+	/* Put the UI request into the queue: */
+	{
+	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
+	uiRequests.push_back(newRequest);
+	}
+	}
+
+void Simulation::storePrefab(const char* prefabName)
+	{
+	/* Create a new UI request: */
+	UIRequest newRequest;
+	newRequest.requestType=UIRequest::STORE_PREFAB;
+	newRequest.fileName=prefabName;
+	
+	/* Put the UI request into the queue: */
+	{
+	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
+	uiRequests.push_back(newRequest);
+	}
+	}
+
+void Simulation::selectPrefab(const char* prefabName)
+	{
+	/* Create a new UI request: */
+	UIRequest newRequest;
+	newRequest.requestType=UIRequest::SELECT_PREFAB;
+	newRequest.fileName=prefabName;
+	
+	/* Put the UI request into the queue: */
+	{
+	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
+	uiRequests.push_back(newRequest);
+	}
+	}
+
+void Simulation::savePrefabs(const char* prefabFileName)
+	{
+	/* Create a new UI request: */
+	UIRequest newRequest;
+	newRequest.requestType=UIRequest::SAVE_PREFABS;
+	newRequest.fileName=prefabFileName;
+	
+	/* Put the UI request into the queue: */
+	{
+	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
+	uiRequests.push_back(newRequest);
+	}
+	}
+
+void Simulation::loadPrefabs(const char* prefabFileName)
+	{
+	/* Create a new UI request: */
+	UIRequest newRequest;
+	newRequest.requestType=UIRequest::LOAD_PREFABS;
+	newRequest.fileName=prefabFileName;
+	
+	/* Put the UI request into the queue: */
+	{
+	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
+	uiRequests.push_back(newRequest);
+	}
+	}
+
+void Simulation::saveState(IO::File& stateFile,SimulationInterface::SaveStateCompleteCallback* completeCallback)
+	{
+	/* Create a new UI request: */
+	UIRequest newRequest;
+	newRequest.requestType=UIRequest::SAVE_STATE;
+	newRequest.file=&stateFile;
+	newRequest.saveCompleteCallback=completeCallback;
+	
+	/* Put the UI request into the queue: */
+	{
+	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
+	uiRequests.push_back(newRequest);
+	}
+	}
+
+void Simulation::advance(Scalar timeStep)
+	{
+	/* Lock the most recent simulation parameters: */
+	parameters.lockNewValue();
+	
+	/* Apply the time speed-up factor: */
+	Scalar tf=parameters.getLockedValue().timeFactor;
+	timeStep*=tf;
+	
+	/* Limit the time step to the safety region (currently hard-coded based on experiments): */
+	if(timeStep>0.06)
+		timeStep=0.06;
+	
+	/* Grab the current queue of UI requests: */
+	{
+	Threads::Spinlock::Lock uiRequestLock(uiRequestMutex);
+	std::swap(uiRequests,currentUiRequests);
+	}
+	
+	/* Get the current number of units: */
+	Size numUnits(mostRecentStates->states.size());
+	
+	/* Prepare a new slot in the state triple buffer: */
+	UnitStateArray& nextState=unitStates.startNewValue();
+	nextState.timeStamp=mostRecentStates->timeStamp+1;
+	
+	/* Count how many units might have to be added in this step: */
+	Size numNewUnits=0;
+	for(std::vector<UIRequest>::iterator uiIt=currentUiRequests.begin();uiIt!=currentUiRequests.end();++uiIt)
+		if(uiIt->requestType==UIRequest::PASTE)
+			numNewUnits+=copiedUnits.size();
+		else if(uiIt->requestType==UIRequest::CREATE)
+			++numNewUnits;
+	
+	/* Make room in all per-unit arrays to add units after simulation, and grow the next state buffer to the shared capacity so that it only reallocates when the capacity grows: */
+	reserveUnits(numUnits+numNewUnits);
+	nextState.states.reserve(unitCapacity);
 	
 	/* Ensure that the new slot contains the correct number of units: */
 	Size oldNumUnits(nextState.states.size());
@@ -1245,20 +1812,39 @@ void Simulation::advance(Scalar timeStep)
 			nextState.states.pop_back();
 		}
 	
-	/* Calculate forces and torques based on the most recent unit state array: */
-	calcForces(numUnits,mostRecentStates->states.data(),forces,torques);
-	
-	/* Apply the calculated forces and torques for the first half-step: */
-	applyForces(numUnits,mostRecentStates->states.data(),nextState.states.data(),forces,torques,Math::div2(timeStep));
-	
-	/* Calculate forces and torques again based on the first half-step: */
-	calcForces(numUnits,nextState.states.data(),forces,torques);
-	
-	/* Apply the calculated forces and torques for the second half-step: */
-	applyForces(numUnits,mostRecentStates->states.data(),nextState.states.data(),forces,torques,timeStep);
+	if(integrator==VELOCITY_VERLET)
+		{
+		/* Calculate forces and torques based on the most recent unit state array unless they were carried over from the previous step: */
+		if(!forcesValid)
+			calcForces(numUnits,mostRecentStates->states.data(),forces.getArray(),torques.getArray());
+		
+		/* Apply the forces and torques for the first half-step and move all units by a full step: */
+		kickAndDrift(numUnits,mostRecentStates->states.data(),nextState.states.data(),forces.getArray(),torques.getArray(),timeStep);
+		
+		/* Calculate forces and torques based on the moved units, and apply them for the second half-step: */
+		calcForces(numUnits,nextState.states.data(),forces.getArray(),torques.getArray());
+		kick(numUnits,nextState.states.data(),forces.getArray(),torques.getArray(),timeStep);
+		
+		/* Carry the calculated forces and torques over to the next step, unless UI requests or bond updates change the new state: */
+		forcesValid=currentUiRequests.empty();
+		}
+	else
+		{
+		/* Calculate forces and torques based on the most recent unit state array: */
+		calcForces(numUnits,mostRecentStates->states.data(),forces.getArray(),torques.getArray());
+		
+		/* Apply the calculated forces and torques for the first half-step: */
+		applyForces(numUnits,mostRecentStates->states.data(),nextState.states.data(),forces.getArray(),torques.getArray(),Math::div2(timeStep));
+		
+		/* Calculate forces and torques again based on the first half-step: */
+		calcForces(numUnits,nextState.states.data(),forces.getArray(),torques.getArray());
+		
+		/* Apply the calculated forces and torques for the second half-step: */
+		applyForces(numUnits,mostRecentStates->states.data(),nextState.states.data(),forces.getArray(),torques.getArray(),timeStep);
+		}
 	
 	/* Process all UI requests in order: */
-	for(std::vector<UIRequest>::iterator uiIt=newUiRequests.begin();uiIt!=newUiRequests.end();++uiIt)
+	for(std::vector<UIRequest>::iterator uiIt=currentUiRequests.begin();uiIt!=currentUiRequests.end();++uiIt)
 		{
 		switch(uiIt->requestType)
 			{
@@ -1323,60 +1909,8 @@ void Simulation::advance(Scalar timeStep)
 				{
 				if(!copiedUnits.empty())
 					{
-					/* Create a pick record entry for all instantiated units: */
-					PickRecordList& prl=pickRecords[uiIt->pickId].getDest();
-					prl.reserve(copiedUnits.size());
-					
-					/* Adjust linear and angular velocities for the current time speed-up factor: */
-					Vector lv=uiIt->setLinearVelocity/tf;
-					Vector av=uiIt->setAngularVelocity/tf;
-					
-					/* Instantiate each unit in the copy buffer in the current state array: */
-					Index firstIndex(nextState.states.size());
-					for(std::vector<CopiedUnitState>::iterator cuIt=copiedUnits.begin();cuIt!=copiedUnits.end();++cuIt)
-						{
-						// DEBUGGING
-						// std::cout<<"Pasting unit of type "<<unitTypes[cuIt->unitType].name<<" for ID "<<uiIt->pickId<<std::endl;
-						
-						/* Create a new unit: */
-						UnitState newUnit;
-						newUnit.unitType=cuIt->unitType;
-						newUnit.pickId=uiIt->pickId;
-						
-						/* Set the new unit's state: */
-						Vector offset=uiIt->setOrientation.transform(cuIt->positionOffset);
-						newUnit.position=wrapPosition(uiIt->setPosition+offset);
-						newUnit.orientation=uiIt->setOrientation*cuIt->orientationOffset;
-						newUnit.orientation.renormalize();
-						newUnit.linearVelocity=lv;
-						newUnit.linearVelocity+=av^offset;
-						newUnit.angularVelocity=av;
-						
-						/* Add the new unit to the acceleration grid: */
-						grid.insertUnit(Index(nextState.states.size()),newUnit);
-						
-						/* Create a pick record for the new unit: */
-						PickRecord pr;
-						pr.unitIndex=Index(nextState.states.size());
-						pr.positionOffset=cuIt->positionOffset;
-						pr.orientationOffset=cuIt->orientationOffset;
-						prl.push_back(pr);
-						
-						/* Add the new unit to the current state array: */
-						nextState.states.push_back(newUnit);
-						}
-					
-					/* Instantiate all bonds in the copy buffer: */
-					for(std::vector<std::pair<Bond,Bond> >::iterator cbIt=copiedBonds.begin();cbIt!=copiedBonds.end();++cbIt)
-						{
-						/* Translate the bond from copy buffer index space to state index space and add it to the bond map: */
-						Bond b0=cbIt->first;
-						b0.unitIndex+=firstIndex;
-						Bond b1=cbIt->second;
-						b1.unitIndex+=firstIndex;
-						bonds[b0]=b1;
-						bonds[b1]=b0;
-						}
+					/* Instantiate all units and bonds in the copy buffer, adjusting linear and angular velocities for the current time speed-up factor: */
+					pasteUnits(nextState,uiIt->pickId,uiIt->setPosition,uiIt->setOrientation,uiIt->setLinearVelocity/tf,uiIt->setAngularVelocity/tf);
 					}
 				
 				break;
@@ -1416,6 +1950,9 @@ void Simulation::advance(Scalar timeStep)
 					
 					/* Add the new unit to the current state array: */
 					nextState.states.push_back(newUnit);
+					
+					/* Mark the units as changed: */
+					++topologyVersion;
 					}
 				
 				break;
@@ -1538,94 +2075,104 @@ void Simulation::advance(Scalar timeStep)
 					/* Get the pick record: */
 					PickRecordList& prl=prIt->getDest();
 					
-					/* Remove all units in the pick record from the simulation, leaving holes in various state arrays: */
-					std::vector<Index> holes;
-					holes.reserve(prl.size());
-					for(PickRecordList::iterator prlIt=prl.begin();prlIt!=prl.end();++prlIt)
+					if(prl.size()>=bulkDestroyThreshold)
 						{
-						/* Remove all bonds involving the to-be-destroyed unit: */
-						UnitState& unit=nextState.states[prlIt->unitIndex];
-						const UnitType& ut=unitTypes[unit.unitType];
-						for(Index bsi=0;bsi<ut.bondSites.size();++bsi)
-							{
-							/* Check if the bond site is bonded: */
-							BondMap::Iterator bIt=bonds.findEntry(Bond(prlIt->unitIndex,bsi));
-							if(!bIt.isFinished())
-								{
-								/* Remove both halves of the bond: */
-								bonds.removeEntry(bIt);
-								bonds.removeEntry(bIt->getDest());
-								}
-							}
-						
-						/* Remove the to-be-destroyed unit from the acceleration grid: */
-						grid.removeUnit(prlIt->unitIndex);
-						
-						/* Remember the new hole in the state arrays: */
-						holes.push_back(prlIt->unitIndex);
+						/* Remove all units in the pick record in bulk by compacting the state arrays: */
+						destroyUnits(nextState,prl);
 						}
-					
-					/* Fill the holes in the state arrays by copying units from the end, in ascending index order: */
-					std::sort(holes.begin(),holes.end());
-					std::vector<Index>::iterator hIt=holes.begin();
-					std::vector<Index>::iterator hEnd=holes.end();
-					while(true)
+					else
 						{
-						/* Lop off holes at the end of the state arrays: */
-						while(hEnd!=hIt&&*(hEnd-1)==Index(nextState.states.size()-1))
-							{
-							--hEnd;
-							nextState.states.pop_back();
-							}
-						
-						/* Stop if all holes have been filled: */
-						if(hIt==hEnd)
-							break;
-						
-						/* Fill the first remaining hole by moving the last unit forward: */
-						UnitState& unit=nextState.states[*hIt];
-						unit=nextState.states.back();
-						nextState.states.pop_back();
-						const UnitType& ut=unitTypes[unit.unitType];
-						
-						/* Adapt the moved unit's bonds: */
-						for(Index bsi=0;bsi<ut.bondSites.size();++bsi)
+						/* Remove all units in the pick record from the simulation, leaving holes in various state arrays: */
+						std::vector<Index> holes;
+						holes.reserve(prl.size());
+						for(PickRecordList::iterator prlIt=prl.begin();prlIt!=prl.end();++prlIt)
 							{
-							/* Check if the bond site is bonded: */
-							BondMap::Iterator bIt=bonds.findEntry(Bond(Index(nextState.states.size()),bsi));
-							if(!bIt.isFinished())
+							/* Remove all bonds involving the to-be-destroyed unit: */
+							UnitState& unit=nextState.states[prlIt->unitIndex];
+							const UnitType& ut=unitTypes[unit.unitType];
+							for(Index bsi=0;bsi<ut.bondSites.size();++bsi)
 								{
-								/* Delete this bond half, insert an adapted one, and adapt the other bond half: */
-								Bond b(*hIt,bsi);
-								Bond ob=bIt->getDest();
-								bonds.removeEntry(bIt);
-								bonds[b]=ob;
-								bonds[ob]=b;
+								/* Check if the bond site is bonded: */
+								BondMap::Iterator bIt=bonds.findEntry(Bond(prlIt->unitIndex,bsi));
+								if(!bIt.isFinished())
+									{
+									/* Remove both halves of the bond: */
+									breakBond(bIt->getSource(),bIt->getDest());
+									}
 								}
+							
+							/* Remove the to-be-destroyed unit from the acceleration grid: */
+							grid.removeUnit(prlIt->unitIndex);
+							
+							/* Remember the new hole in the state arrays: */
+							holes.push_back(prlIt->unitIndex);
 							}
 						
-						/* Change the moved unit's grid cell entry: */
-						grid.changeUnitIndex(Index(nextState.states.size()),*hIt);
-						
-						/* Check if the moved unit is picked: */
-						if(unit.pickId!=0)
+						/* Fill the holes in the state arrays by copying units from the end, in ascending index order: */
+						std::sort(holes.begin(),holes.end());
+						std::vector<Index>::iterator hIt=holes.begin();
+						std::vector<Index>::iterator hEnd=holes.end();
+						while(true)
 							{
-							/* Adapt the moved unit's pick record: */
-							PickRecordList& prl2=pickRecords[unit.pickId].getDest();
-							for(PickRecordList::iterator prl2It=prl2.begin();prl2It!=prl2.end();++prl2It)
-								if(prl2It->unitIndex==Index(nextState.states.size()))
+							/* Lop off holes at the end of the state arrays: */
+							while(hEnd!=hIt&&*(hEnd-1)==Index(nextState.states.size()-1))
+								{
+								--hEnd;
+								nextState.states.pop_back();
+								}
+							
+							/* Stop if all holes have been filled: */
+							if(hIt==hEnd)
+								break;
+							
+							/* Fill the first remaining hole by moving the last unit forward: */
+							UnitState& unit=nextState.states[*hIt];
+							unit=nextState.states.back();
+							nextState.states.pop_back();
+							const UnitType& ut=unitTypes[unit.unitType];
+							
+							/* Adapt the moved unit's bonds: */
+							for(Index bsi=0;bsi<ut.bondSites.size();++bsi)
+								{
+								/* Check if the bond site is bonded: */
+								BondMap::Iterator bIt=bonds.findEntry(Bond(Index(nextState.states.size()),bsi));
+								if(!bIt.isFinished())
 									{
-									/* Adapt the pick record's unit index and stop searching: */
-									prl2It->unitIndex=*hIt;
-									break;
+									/* Delete this bond half, insert an adapted one, and adapt the other bond half: */
+									Bond b(*hIt,bsi);
+									Bond ob=bIt->getDest();
+									bonds.removeEntry(bIt);
+									bonds[b]=ob;
+									bonds[ob]=b;
 									}
+								}
+							
+							/* Change the moved unit's grid cell entry: */
+							grid.changeUnitIndex(Index(nextState.states.size()),*hIt);
+							
+							/* Check if the moved unit is picked: */
+							if(unit.pickId!=0)
+								{
+								/* Adapt the moved unit's pick record: */
+								PickRecordList& prl2=pickRecords[unit.pickId].getDest();
+								for(PickRecordList::iterator prl2It=prl2.begin();prl2It!=prl2.end();++prl2It)
+									if(prl2It->unitIndex==Index(nextState.states.size()))
+										{
+										/* Adapt the pick record's unit index and stop searching: */
+										prl2It->unitIndex=*hIt;
+										break;
+										}
+								}
+							
+							++hIt;
 							}
-						
-						++hIt;
 						}
 					
 					/* Delete the pick record: */
 					pickRecords.removeEntry(prIt);
+					
+					/* Mark the units as changed: */
+					++topologyVersion;
 					}
 				
 				break;
@@ -1678,10 +2225,14 @@ void Simulation::advance(Scalar timeStep)
 			
 			case UIRequest::LOAD_STATE:
 				{
+				/* End an ongoing trajectory recording, as the new state might have different unit types or domain: */
+				endRecording();
+				
 				try
 					{
 					/* Read the current simulation state from the given file: */
 					load(*uiIt->file,nextState);
+					++topologyVersion;
 					
 					/* Invalidate all picks: */
 					pickRecords.clear();
@@ -1701,6 +2252,259 @@ void Simulation::advance(Scalar timeStep)
 				
 				break;
 				}
+			
+			case UIRequest::IMPORT_CAR:
+				{
+				/* End an ongoing trajectory recording, as the new state might have a different domain: */
+				endRecording();
+				
+				try
+					{
+					/* Import the SiO_4 tetrahedra from the given CAR file: */
+					importCar(uiIt->fileName.c_str(),nextState);
+					++topologyVersion;
+					
+					/* Invalidate all picks: */
+					pickRecords.clear();
+					
+					/* Validate the session state: */
+					sessionId=uiIt->loadSessionId;
+					
+					/* Call the session changed callback if one is set: */
+					if(sessionChangedCallback!=0)
+						sessionChangedCallback(sessionId,sessionChangedCallbackData);
+					}
+				catch(const std::runtime_error& err)
+					{
+					/* Show an error message: */
+					Misc::formattedUserError("Simulation::importCar: Caught exception %s",err.what());
+					}
+				
+				break;
+				}
+			
+			case UIRequest::START_RECORDING:
+				{
+				/* End an ongoing trajectory recording: */
+				endRecording();
+				
+				try
+					{
+					/* Start recording into the given trajectory file: */
+					recorder=new TrajectoryRecorder(uiIt->fileName.c_str(),unitTypes,domain,recordingFrameInterval,recordingKeyframeInterval,recordingQueueSize);
+					}
+				catch(const std::runtime_error& err)
+					{
+					/* Show an error message: */
+					Misc::formattedUserError("Simulation::startRecording: Caught exception %s",err.what());
+					}
+				
+				break;
+				}
+			
+			case UIRequest::STOP_RECORDING:
+				{
+				/* End an ongoing trajectory recording: */
+				endRecording();
+				
+				break;
+				}
+			
+			case UIRequest::CHECKPOINT:
+				{
+				try
+					{
+					/* Switch to the given checkpoint files if necessary: */
+					if(checkpointer==0||checkpointer->getBaseFileName()!=uiIt->fileName)
+						{
+						delete checkpointer;
+						checkpointer=0;
+						checkpointer=new Checkpointer(uiIt->fileName.c_str(),checkpointBaseInterval,checkpointChunkSize,2);
+						}
+					
+					/* Checkpoint the state produced by this simulation step: */
+					checkpointRequested=true;
+					}
+				catch(const std::runtime_error& err)
+					{
+					/* Show an error message: */
+					Misc::formattedUserError("Simulation::checkpoint: Caught exception %s",err.what());
+					}
+				
+				break;
+				}
+			
+			case UIRequest::RECOVER_CHECKPOINT:
+				{
+				/* End an ongoing trajectory recording, as the recovered state might have different unit types or domain: */
+				endRecording();
+				
+				/* Finish all queued checkpoints before reading the checkpoint files: */
+				delete checkpointer;
+				checkpointer=0;
+				checkpointRequested=false;
+				
+				try
+					{
+					/* Read the newest recoverable checkpoint: */
+					loadCheckpoint(uiIt->fileName.c_str(),nextState);
+					++topologyVersion;
+					
+					/* Invalidate all picks: */
+					pickRecords.clear();
+					
+					/* Validate the session state: */
+					sessionId=uiIt->loadSessionId;
+					
+					/* Call the session changed callback if one is set: */
+					if(sessionChangedCallback!=0)
+						sessionChangedCallback(sessionId,sessionChangedCallbackData);
+					}
+				catch(const std::runtime_error& err)
+					{
+					/* Show an error message: */
+					Misc::formattedUserError("Simulation::recoverCheckpoint: Caught exception %s",err.what());
+					}
+				
+				break;
+				}
+			
+			case UIRequest::EXPORT_STATE:
+				{
+				try
+					{
+					/* Determine the export format before taking a snapshot: */
+					StateExporter::Format format=StateExporter::getFormat(uiIt->fileName.c_str());
+					
+					/* Hand a copy of the state to the exporter; this does not block if a previous export is still being written: */
+					if(exporter==0)
+						exporter=new StateExporter;
+					StateExporter::Snapshot* snapshot=exporter->startExport();
+					if(snapshot!=0)
+						{
+						snapshot->fileName=uiIt->fileName;
+						snapshot->format=format;
+						snapshot->exportBondSites=uiIt->exportBondSites;
+						getStateFileHeader(snapshot->header);
+						copyStates(nextState,snapshot->states);
+						snapshot->states.sessionId=sessionId;
+						getStateFileBonds(snapshot->bonds);
+						exporter->postExport(snapshot);
+						}
+					else
+						Misc::formattedUserError("Simulation::exportState: Ignoring export to %s while a previous export is in progress",uiIt->fileName.c_str());
+					}
+				catch(const std::runtime_error& err)
+					{
+					/* Show an error message: */
+					Misc::formattedUserError("Simulation::exportState: Caught exception %s",err.what());
+					}
+				
+				break;
+				}
+			
+			case UIRequest::STORE_PREFAB:
+				{
+				if(!copiedUnits.empty())
+					{
+					/* Convert the copy buffer, including its internal bonds, into a prefab: */
+					Prefab prefab;
+					prefab.name=uiIt->fileName;
+					prefab.units.reserve(copiedUnits.size());
+					for(std::vector<CopiedUnitState>::iterator cuIt=copiedUnits.begin();cuIt!=copiedUnits.end();++cuIt)
+						{
+						PrefabUnit unit;
+						unit.unitType=cuIt->unitType;
+						unit.positionOffset=cuIt->positionOffset;
+						unit.orientationOffset=cuIt->orientationOffset;
+						prefab.units.push_back(unit);
+						}
+					prefab.bonds.reserve(copiedBonds.size());
+					for(std::vector<std::pair<Bond,Bond> >::iterator cbIt=copiedBonds.begin();cbIt!=copiedBonds.end();++cbIt)
+						{
+						StateFileBond bond;
+						bond.unitIndex[0]=cbIt->first.unitIndex;
+						bond.bondSiteIndex[0]=cbIt->first.bondSiteIndex;
+						bond.unitIndex[1]=cbIt->second.unitIndex;
+						bond.bondSiteIndex[1]=cbIt->second.bondSiteIndex;
+						prefab.bonds.push_back(bond);
+						}
+					
+					/* Store the prefab in the library: */
+					prefabs.storePrefab(prefab);
+					}
+				else
+					Misc::formattedUserError("Simulation::storePrefab: Ignoring empty copy buffer for prefab %s",uiIt->fileName.c_str());
+				
+				break;
+				}
+			
+			case UIRequest::SELECT_PREFAB:
+				{
+				const Prefab* prefab=prefabs.findPrefab(uiIt->fileName);
+				if(prefab!=0)
+					{
+					/* Replace the copy buffer with the prefab's units: */
+					copiedUnits.clear();
+					copiedUnits.reserve(prefab->units.size());
+					for(std::vector<PrefabUnit>::const_iterator uIt=prefab->units.begin();uIt!=prefab->units.end();++uIt)
+						{
+						CopiedUnitState copiedUnit;
+						copiedUnit.unitType=uIt->unitType;
+						copiedUnit.positionOffset=uIt->positionOffset;
+						copiedUnit.orientationOffset=uIt->orientationOffset;
+						copiedUnits.push_back(copiedUnit);
+						}
+					
+					/* Replace the copy bond buffer with the prefab's bonds: */
+					copiedBonds.clear();
+					copiedBonds.reserve(prefab->bonds.size());
+					for(std::vector<StateFileBond>::const_iterator bIt=prefab->bonds.begin();bIt!=prefab->bonds.end();++bIt)
+						copiedBonds.push_back(std::pair<Bond,Bond>(Bond(bIt->unitIndex[0],bIt->bondSiteIndex[0]),Bond(bIt->unitIndex[1],bIt->bondSiteIndex[1])));
+					}
+				else
+					Misc::formattedUserError("Simulation::selectPrefab: Unknown prefab %s",uiIt->fileName.c_str());
+				
+				break;
+				}
+			
+			case UIRequest::SAVE_PREFABS:
+				{
+				try
+					{
+					/* Write the prefab library to the given file: */
+					IO::FilePtr file=IO::openFile(uiIt->fileName.c_str(),IO::File::WriteOnly);
+					file->setEndianness(Misc::LittleEndian);
+					prefabs.save(*file,unitTypes);
+					}
+				catch(const std::runtime_error& err)
+					{
+					/* Show an error message: */
+					Misc::formattedUserError("Simulation::savePrefabs: Caught exception %s",err.what());
+					}
+				
+				break;
+				}
+			
+			case UIRequest::LOAD_PREFABS:
+				{
+				try
+					{
+					/* Merge the prefabs from the given file into the prefab library: */
+					IO::SeekableFilePtr file=IO::openSeekableFile(uiIt->fileName.c_str());
+					file->setEndianness(Misc::LittleEndian);
+					Size numMerged=prefabs.load(*file,unitTypes);
+					Misc::formattedUserNote("Simulation::loadPrefabs: Merged %u prefabs from %s; %u prefabs in library",(unsigned int)(numMerged),uiIt->fileName.c_str(),(unsigned int)(prefabs.getNumPrefabs()));
+					}
+				catch(const std::runtime_error& err)
+					{
+					/* Show an error message: */
+					Misc::formattedUserError("Simulation::loadPrefabs: Caught exception %s",err.what());
+					}
+				
+				break;
+				}
+			
 			default:
 				/* Ignore an invalid request: */
 				;
@@ -1710,9 +2514,87 @@ void Simulation::advance(Scalar timeStep)
 	/* Update bonds between units: */
 	updateBonds(Size(nextState.states.size()),nextState.states.data());
 	
+	/* Check if it is time to update bond statistics: */
+	if(statisticsInterval>0&&nextState.timeStamp>=nextStatisticsTimeStamp)
+		{
+		/* Hand a snapshot of the state to the statistics calculator; if it is still busy, try again in the next step: */
+		if(statisticsCalculator==0)
+			statisticsCalculator=new BondStatisticsCalculator(statistics);
+		BondStatisticsCalculator::Snapshot* snapshot=statisticsCalculator->startSnapshot();
+		if(snapshot!=0)
+			{
+			/* Only send the simulation setup and all bonds if units were created, destroyed, or re-ordered since the previous snapshot: */
+			snapshot->fullUpdate=statisticsTopologyVersion!=topologyVersion;
+			if(snapshot->fullUpdate)
+				{
+				getStateFileHeader(snapshot->header);
+				getStateFileBonds(snapshot->bonds);
+				statisticsTopologyVersion=topologyVersion;
+				}
+			else
+				snapshot->bondEvents.swap(statisticsBondEvents);
+			statisticsBondEvents.clear();
+			copyStates(nextState,snapshot->states);
+			snapshot->states.sessionId=sessionId;
+			statisticsCalculator->postSnapshot(snapshot);
+			nextStatisticsTimeStamp=nextState.timeStamp+statisticsInterval;
+			}
+		}
+	
 	// DEBUGGING
 	// grid.check(nextState.numUnits,nextState.states);
 	
+	/* Delete the recorders of ended trajectories whose trajectory files are finished: */
+	for(std::vector<TrajectoryRecorder*>::iterator frIt=finishingRecorders.begin();frIt!=finishingRecorders.end();)
+		{
+		if((*frIt)->isFinished())
+			{
+			delete *frIt;
+			frIt=finishingRecorders.erase(frIt);
+			}
+		else
+			++frIt;
+		}
+	
+	/* End the current trajectory if the recorder's writer thread stopped due to an error: */
+	if(recorder!=0&&recorder->isFinished())
+		endRecording();
+	
+	/* Check if it is time to record a trajectory frame: */
+	if(recorder!=0&&recorder->isFrameDue(nextState.timeStamp))
+		{
+		/* Prepare a frame; this does not block if the recorder's writer thread fell behind: */
+		TrajectoryRecorder::Frame* frame=recorder->startFrame(nextState,topologyVersion);
+		if(frame!=0)
+			{
+			if(frame->keyframe)
+				{
+				/* Add the "up" halves of all bonds to the keyframe: */
+				getStateFileBonds(frame->bonds);
+				}
+			recorder->postFrame(frame);
+			}
+		}
+	
+	/* Check if a checkpoint was requested; skip empty states so as not to overwrite a checkpoint that has yet to be recovered: */
+	if(checkpointRequested&&nextState.states.size()>0)
+		{
+		/* Hand a copy of the state to the checkpointer; this does not block if the checkpointer's writer thread fell behind: */
+		Checkpointer::Snapshot* snapshot=checkpointer->startSnapshot();
+		if(snapshot!=0)
+			{
+			getStateFileHeader(snapshot->header);
+			copyStates(nextState,snapshot->states);
+			snapshot->states.sessionId=sessionId;
+			getStateFileBonds(snapshot->bonds);
+			checkpointer->postSnapshot(snapshot);
+			}
+		}
+	checkpointRequested=false;
+	
+	/* Release the processed UI requests, keeping their storage for the next step: */
+	currentUiRequests.clear();
+	
 	/* Post the updated state slot: */
 	nextState.sessionId=sessionId;
 	mostRecentStates=&nextState;
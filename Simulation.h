@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #define SIMULATION_INCLUDED
 
 #include <stddef.h>
+#include <string>
 #include <vector>
 #include <Misc/Autopointer.h>
 #include <Misc/HashTable.h>
@@ -30,17 +31,34 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <IO/File.h>
 
 #include "Common.h"
+#include "AlignedArray.h"
+#include "PrefabLibrary.h"
+#include "BondStatistics.h"
 #include "SimulationInterface.h"
 
 /* Forward declarations: */
 namespace Misc {
 class ConfigurationFileSection;
 }
+struct StateFileHeader;
+struct StateFileBond;
+class TrajectoryRecorder;
+class Checkpointer;
+class StateExporter;
 
 class Simulation:public SimulationInterface
 	{
 	/* Embedded classes: */
+	public:
+	typedef BondStatistics Statistics; // Type for statistics about the bonds between structural units in the current simulation state
+	
 	private:
+	enum Integrator // Enumerated type for schemes integrating unit states over time
+		{
+		MIDPOINT, // Evaluates forces at the beginning and the middle of each step
+		VELOCITY_VERLET // Evaluates forces once at the end of each step, and carries them over to the next step
+		};
+	
 	struct Bond // Structure to represent bonds between structural units' bonding sites
 		{
 		/* Elements: */
@@ -88,8 +106,7 @@ class Simulation:public SimulationInterface
 		Scalar cellSize[3]; // Size of an acceleration grid cell
 		Scalar origin[3]; // Position of the grid's origin in model space
 		Cell* cells; // 3D array of grid cells
-		Size unitCellIndexSize; // Allocated size of current unit grid cell index array
-		Index* unitCellIndices; // Array holding the index of the grid cell containing each current unit
+		AlignedArray<Index> unitCellIndices; // Array holding the index of the grid cell containing each current unit
 		
 		/* Constructors and destructors: */
 		public:
@@ -98,7 +115,7 @@ class Simulation:public SimulationInterface
 		
 		/* Methods: */
 		void create(const Box& domain,const UnitTypeList& unitTypes,Scalar centralForceOvershoot,Scalar vertexForceRadius); // Creates an empty grid for the given domain, unit types, and simulation parameters
-		void reserve(Size numUnits); // Makes enough room in the unit cell index array to hold the given number of units
+		void reserve(Size numUnits,bool useHugePages); // Makes enough room in the unit cell index array to hold the given number of units
 		const Size* getNumCells(void) const // Returns the number of cells in the grid
 			{
 			return numCells;
@@ -151,11 +168,13 @@ class Simulation:public SimulationInterface
 		void moveUnit(Index unitIndex,const UnitState& unit); // Updates the grid to reflect movement of the given unit
 		void removeUnit(Index unitIndex); // Removes the given unit from the grid without filling the remaining hole in the cell index array
 		void changeUnitIndex(Index currentIndex,Index newIndex); // Changes the index assigned to a unit
+		void remapUnits(Size numUnits,const Index* unitIndexMap); // Applies the given map from old to new unit indices, where destroyed units are mapped to ~0, to the given number of old units
 		void moveUnits(Size numUnits,const UnitState* unitStates); // Updates the grid to reflect movement of the given array of units
 		void check(Size numUnits,const UnitState* unitStates) const; // Checks the grid for consistency
 		};
 	
 	struct UIRequest; // Structure to communicate requests from the UI front-end to the simulation back-end
+	struct PasteWorker; // Structure to instantiate a range of units from the copy buffer in a background thread
 	
 	struct PickRecord // Structure keeping track of currently picked units
 		{
@@ -185,6 +204,7 @@ class Simulation:public SimulationInterface
 	Scalar vertexForceStrength; // Strength of vertex attraction force
 	Scalar centralForceOvershoot; // Factor of how much centroid repelling force overshoots units' radii
 	Scalar centralForceStrength; // Strength of centroid repelling force
+	Integrator integrator; // Scheme integrating unit states over time
 	Threads::TripleBuffer<Parameters> parameters; // Triple buffer of user-changeable simulation parameters
 	Parameters* mostRecentParameters; // Pointer to most recent version of simulation parameters
 	
@@ -193,32 +213,83 @@ class Simulation:public SimulationInterface
 	const UnitStateArray* mostRecentStates; // Unit state array most recently written into
 	Grid grid; // Grid to accelerate computation of interaction forces between units
 	BondMap bonds; // Map of current bonds between structural units
+	Size numBonds; // Number of bonds in the bond map, updated as bonds are created and broken
+	
+	/* Bond statistics: */
+	Index statisticsInterval; // Number of simulation steps between statistics updates, or 0 to disable statistics
+	Index nextStatisticsTimeStamp; // Simulation step at which to calculate the next statistics update
+	BondStatisticsCalculator* statisticsCalculator; // Calculator for bond statistics from snapshots of the simulation state, or null if statistics are disabled
+	Index statisticsTopologyVersion; // Topology version of the most recent snapshot handed to the statistics calculator
+	std::vector<BondStatisticsCalculator::BondEvent> statisticsBondEvents; // Bonds created or broken since the most recent snapshot handed to the statistics calculator
+	Threads::TripleBuffer<Statistics> statistics; // Triple buffer of bond statistics, written by the statistics calculator
+	
+	/* CAR file import settings: */
+	std::string carUnitTypeName; // Name of the unit type representing SiO_4 tetrahedra in imported CAR files
+	int numImportThreads; // Number of threads to use when importing CAR files
+	
+	/* Trajectory recording: */
+	Index recordingFrameInterval; // Number of simulation steps between recorded trajectory frames
+	unsigned int recordingKeyframeInterval; // Maximum number of recorded frames between trajectory keyframes
+	unsigned int recordingQueueSize; // Number of trajectory frames that can be queued for writing before frames are dropped
+	TrajectoryRecorder* recorder; // Recorder for the current trajectory, or null if no trajectory is being recorded
+	std::vector<TrajectoryRecorder*> finishingRecorders; // Recorders of ended trajectories whose writer threads are still finishing their trajectory files
+	Index topologyVersion; // Version number of the current set of units, incremented whenever units are created, destroyed, or re-ordered
+	
+	/* Checkpointing: */
+	unsigned int checkpointBaseInterval; // Maximum number of incremental checkpoints between base checkpoints
+	Size checkpointChunkSize; // Number of units per chunk compared between consecutive checkpoints
+	Checkpointer* checkpointer; // Writer for the current checkpoint files, or null if no checkpoint has been requested
+	bool checkpointRequested; // Flag whether to checkpoint the state produced by the current simulation step
+	
+	/* Exporting: */
+	StateExporter* exporter; // Writer for XYZ and PDB export files, or null if no export has been requested
 	
 	/* Temporary storage for simulation state integration: */
-	Size forceArraySize; // Size of the currently allocated force and torque arrays
-	Vector* forces; // Array of forces acting on units
-	Vector* torques; // Array of torques acting on units
+	Size unitCapacity; // Number of units the per-unit arrays, the acceleration grid, and the state buffers can hold without reallocation
+	bool useHugePages; // Flag whether to back large per-unit arrays with huge pages
+	AlignedArray<Vector> forces; // Array of forces acting on units
+	AlignedArray<Vector> torques; // Array of torques acting on units
+	bool forcesValid; // Flag whether the force and torque arrays hold the forces and torques acting on the most recent unit states, carried over by the velocity Verlet integrator
 	
 	/* UI state: */
 	SessionID loadSessionId; // Session ID associated with the most recent load state or initialization request
 	PickID lastPickId; // Most recent ID assigned to a pick record
 	Threads::Spinlock uiRequestMutex; // Mutex serializing access to the list of UI requests
 	std::vector<UIRequest> uiRequests; // List of pending UI requests
+	std::vector<UIRequest> currentUiRequests; // List of UI requests processed during the current simulation step, whose storage is recycled between steps
 	PickRecordMap pickRecords; // Map of current pick records
 	std::vector<CopiedUnitState> copiedUnits; // List of units in the current copy buffer
 	std::vector<std::pair<Bond,Bond> > copiedBonds; // List of bonds between units in the current copy buffer
+	Size bulkDestroyThreshold; // Minimum number of units destroyed at once to compact the state arrays in bulk instead of filling holes from the end
+	int numPasteThreads; // Maximum number of threads to use when instantiating large copy buffers
+	PrefabLibrary prefabs; // Library of named prefabs that can be selected into the copy buffer
 	
 	/* Private methods: */
+	static Integrator parseIntegrator(const std::string& integratorName); // Returns the integration scheme of the given name
 	Vector wrapDistance(const Vector& distance) const; // Returns wrapped distance vector
 	Point wrapPosition(const Point& position) const; // Wraps the given position to the simulation domain
 	PickID getPickId(void); // Returns a new and currently unused pick ID
 	void unpickUnit(PickID pickId,Index unitIndex); // Removes a picked unit from its current pick list
 	void pickUnits(UnitState* unitStates,Index unitIndex,const Point& pickPosition,const Rotation& pickOrientation,bool pickConnected,PickRecordMap::Entry& pickRecord); // Creates a pick record entry for the given unit, and optionally all units connected to it
+	void reserveUnits(Size numUnits); // Grows the capacity of all per-unit arrays together to hold at least the given number of units
 	void calcForces(Size numUnits,const UnitState* states,Vector* forces,Vector* torques) const; // Calculates forces and torques on all structural units based on current state
+	void integrate(Size numUnits,const UnitState* source,UnitState* dest,const Vector* forces,const Vector* torques,Scalar kickDt,Scalar driftDt,Scalar att); // Integration kernel applying forces and torques over the kick time step, moving units over the drift time step, and attenuating velocities by the given factor
 	void applyForces(Size numUnits,const UnitState* source,UnitState* dest,Vector* forces,Vector* torques,Scalar dt); // Applies forces and torques to transfer source states into destination states
+	void kickAndDrift(Size numUnits,const UnitState* source,UnitState* dest,const Vector* forces,const Vector* torques,Scalar dt); // Applies forces and torques to source velocities for half a step, and moves units by a full step into destination states
+	void kick(Size numUnits,UnitState* states,const Vector* forces,const Vector* torques,Scalar dt); // Applies forces and torques to the given states' velocities for half a step and attenuates them
+	void createBond(const Bond& b0,const Bond& b1); // Inserts both halves of a new bond between the two given bonding sites into the bond map
+	void breakBond(Bond b0,Bond b1); // Removes both halves of an existing bond between the two given bonding sites from the bond map
 	void updateBonds(Size numUnits,const UnitState* states); // Creates and breaks bonds between structural units based on given state array
+	void pasteUnits(UnitStateArray& states,PickID pickId,const Point& position,const Rotation& orientation,const Vector& linearVelocity,const Vector& angularVelocity); // Instantiates all units and bonds in the copy buffer in one batch at the end of the given state array
+	void destroyUnits(UnitStateArray& states,const PickRecordList& destroyedUnits); // Destroys the given units by compacting the given state array in one pass and remapping bonds, pick records, and the acceleration grid
+	void endRecording(void); // Ends the current trajectory recording without waiting for its trajectory file to be finished
+	void getStateFileHeader(StateFileHeader& header) const; // Returns the current simulation setup
+	void getStateFileBonds(std::vector<StateFileBond>& fileBonds) const; // Returns the "up" halves of all current bonds
 	void save(UnitStateArray& states,IO::File& file) const; // Saves the given simulation state to the given file
+	void applyStateFile(const StateFileHeader& header,const std::vector<StateFileBond>& fileBonds,UnitStateArray& states); // Replaces the simulation setup and bonds with the given ones, for the given already read simulation state
 	void load(IO::File& file,UnitStateArray& states); // Loads the given file into the given simulation state
+	void loadCheckpoint(const char* baseFileName,UnitStateArray& states); // Loads the newest recoverable checkpoint of the given base name into the given simulation state
+	void importCar(const char* carFileName,UnitStateArray& states); // Imports the given CAR file into the given simulation state, with all shared oxygen atoms already bonded
 	
 	/* Constructors and destructors: */
 	public:
@@ -244,11 +315,29 @@ class Simulation:public SimulationInterface
 	virtual void saveState(IO::File& stateFile,SaveStateCompleteCallback* completeCallback =0);
 	
 	/* New methods: */
+	void importCarFile(const char* carFileName); // Replaces the current simulation state with the SiO_4 tetrahedra from the given CAR file
+	void startRecording(const char* trajectoryFileName); // Starts recording the simulation into a trajectory file of the given name; loading a new state ends the recording
+	void stopRecording(void); // Ends the current trajectory recording
+	void checkpoint(const char* checkpointBaseFileName); // Writes a base or incremental checkpoint of the next simulation state into the checkpoint files of the given base name from a background thread
+	void recoverCheckpoint(const char* checkpointBaseFileName); // Replaces the current simulation state with the newest recoverable checkpoint of the given base name
+	void exportState(const char* exportFileName,bool exportBondSites); // Exports the current simulation state, optionally including bonding sites, to an XYZ or PDB file of the given name from a background thread
+	void storePrefab(const char* prefabName); // Stores the current copy buffer, including its internal bonds, in the prefab library under the given name
+	void selectPrefab(const char* prefabName); // Replaces the current copy buffer with the prefab of the given name, to be instantiated by subsequent paste requests
+	void savePrefabs(const char* prefabFileName); // Saves the prefab library to a file of the given name
+	void loadPrefabs(const char* prefabFileName); // Merges the prefabs from the file of the given name into the prefab library
 	void advance(Scalar timeStep); // Advances simulation state by the given real-time time step
 	const UnitStateArray& getLockedState(void) const // Returns the currently locked simulation state
 		{
 		return unitStates.getLockedValue();
 		}
+	bool lockNewStatistics(void) // Locks the most recent bond statistics; returns true if they are new
+		{
+		return statistics.lockNewValue();
+		}
+	const Statistics& getLockedStatistics(void) const // Returns the currently locked bond statistics
+		{
+		return statistics.getLockedValue();
+		}
 	};
 
 #endif
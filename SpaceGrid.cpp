@@ -20,13 +20,14 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "SpaceGrid.h"
 
-#include <queue>
+#include <utility>
 #include <iostream>
 #include <iomanip>
-#include <Misc/HashTable.h>
 #include <Misc/OneTimeQueue.h>
 #include <Misc/StandardValueCoders.h>
 #include <Misc/ConfigurationFile.h>
+#include <Misc/MessageLogger.h>
+#include <Threads/Thread.h>
 #include <Math/Math.h>
 #include <Math/Constants.h>
 #include <GL/gl.h>
@@ -35,9 +36,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <GL/GLContextData.h>
 #include <GL/GLModels.h>
 #include <GL/GLGeometryWrappers.h>
+#include <GL/GLTransformationWrappers.h>
 
 #include "StructuralUnit.h"
 #include "GhostUnit.h"
+#include "Histogram.h"
 
 namespace NCK {
 
@@ -101,10 +104,115 @@ SpaceGridCell* SpaceGrid::findCell(const Point& p)
 	return &cells(cellIndex);
 	}
 
+void SpaceGrid::updateCellNeighbours(void)
+	{
+	for(unsigned int caseMask=0;caseMask<64;++caseMask)
+		{
+		UnitStore::CellNeighbour* cnPtr=cellNeighbours+caseMask*27;
+		Index index;
+		for(index[0]=-1;index[0]<=1;++index[0])
+			for(index[1]=-1;index[1]<=1;++index[1])
+				for(index[2]=-1;index[2]<=1;++index[2],++cnPtr)
+					{
+					cnPtr->cellOffset=0;
+					cnPtr->shift=Vector::zero;
+					for(int j=0;j<3;++j)
+						{
+						cnPtr->cellOffset+=index[j]*cells.getIncrement(j);
+						
+						/* Wrap neighbours across periodic boundaries to the opposite side of the grid: */
+						if(minimumImage&&index[j]<0&&(caseMask&(0x1U<<(2*j+0))))
+							{
+							cnPtr->cellOffset+=gridSize[j]*cells.getIncrement(j);
+							cnPtr->shift[j]=-gridBox.getSize(j);
+							}
+						else if(minimumImage&&index[j]>0&&(caseMask&(0x1U<<(2*j+1))))
+							{
+							cnPtr->cellOffset-=gridSize[j]*cells.getIncrement(j);
+							cnPtr->shift[j]=gridBox.getSize(j);
+							}
+						}
+					}
+		}
+	}
+
+void SpaceGrid::createGhostUnits(StructuralUnit* unit)
+	{
+	SpaceGridCell* cell=unit->cell;
+	if(cell->borderCaseMask!=0x0)
+		{
+		/* Create ghosts of the unit in each ghost cell associated with its cell: */
+		for(int i=0;i<26;++i)
+			if((cell->borderCaseMask&borderCases[i].caseMask)==borderCases[i].caseMask)
+				{
+				/* Create a new ghost unit for the unit and link it to the ghost cell: */
+				GhostUnit* newGhostUnit=new GhostUnit(unit,borderCases[i].positionOffset);
+				newGhostUnit->id=0;
+				newGhostUnit->pred=lastGhostUnit;
+				if(lastGhostUnit!=0)
+					lastGhostUnit->succ=newGhostUnit;
+				else
+					firstGhostUnit=newGhostUnit;
+				lastGhostUnit=newGhostUnit;
+				(cell+borderCases[i].pointerOffset)->linkUnit(newGhostUnit);
+				}
+		}
+	}
+
+void SpaceGrid::destroyGhostUnits(StructuralUnit* unit)
+	{
+	if(unit->cell->borderCaseMask!=0x0)
+		{
+		/* Remove all ghost units associated with the unit: */
+		for(int i=0;i<26;++i)
+			if((unit->cell->borderCaseMask&borderCases[i].caseMask)==borderCases[i].caseMask)
+				{
+				/* Find ghost unit associated with unit in old ghost cell: */
+				SpaceGridCell* ghostCell=unit->cell+borderCases[i].pointerOffset;
+				GhostUnit* ghostUnit;
+				for(ghostUnit=static_cast<GhostUnit*>(ghostCell->firstUnit);ghostUnit->getSourceUnit()!=unit;ghostUnit=static_cast<GhostUnit*>(ghostUnit->cellSucc))
+					;
+				
+				/* Clear the ghost unit's vertex links: */
+				ghostUnit->clearVertexLinks();
+				
+				/* Unlink ghost unit from ghost cell: */
+				ghostCell->unlinkUnit(ghostUnit);
+				
+				/* Delete the ghost unit: */
+				if(ghostUnit->pred!=0)
+					ghostUnit->pred->succ=ghostUnit->succ;
+				else
+					firstGhostUnit=ghostUnit->succ;
+				if(ghostUnit->succ!=0)
+					ghostUnit->succ->pred=ghostUnit->pred;
+				else
+					lastGhostUnit=ghostUnit->pred;
+				delete ghostUnit;
+				}
+		}
+	}
+
+Vector SpaceGrid::wrapDistance(const Vector& dist) const
+	{
+	Vector result=dist;
+	if(minimumImage)
+		for(int i=0;i<3;++i)
+			if(periodicFlags[i])
+				{
+				Scalar size=gridBox.getSize(i);
+				if(result[i]>Scalar(0.5)*size)
+					result[i]-=size;
+				else if(result[i]<-Scalar(0.5)*size)
+					result[i]+=size;
+				}
+	return result;
+	}
+
 SpaceGrid::SpaceGrid(const Box& sGridBox,Scalar sMaxUnitRadius,int periodicMask)
-	:gridBox(sGridBox),maxUnitRadius(sMaxUnitRadius),nextUnitId(1),
+	:gridBox(sGridBox),maxUnitRadius(sMaxUnitRadius),minimumImage(false),nextUnitId(1),
 	 firstUnit(0),lastUnit(0),firstGhostUnit(0),lastGhostUnit(0),
-	 attenuation(0.5),
+	 attenuation(0.5),accumulateForces(false),queryCellsValid(false),
 	 showGridBoundary(true),
 	 gridBoundaryColor(1.0f,1.0f,1.0f),
 	 gridBoundaryLineWidth(1.0f),
@@ -120,7 +228,8 @@ SpaceGrid::SpaceGrid(const Box& sGridBox,Scalar sMaxUnitRadius,int periodicMask)
 	 showUnlinkedVertices(false),
 	 unlinkedVertexRadius(0.5f),
 	 unlinkedVertexSubdivision(3),
-	 unlinkedVertexMaterial(Color(1.0f,0.0f,0.0f),Color(1.0f,1.0f,1.0f),25.0f)
+	 unlinkedVertexMaterial(Color(1.0f,0.0f,0.0f),Color(1.0f,1.0f,1.0f),25.0f),
+	 batchedRendering(false)
 	{
 	/* Calculate "optimal" grid cell size: */
 	Scalar minCellSize=Scalar(2)*maxUnitRadius+StructuralUnit::vertexForceRadius;
@@ -197,6 +306,9 @@ SpaceGrid::SpaceGrid(const Box& sGridBox,Scalar sMaxUnitRadius,int periodicMask)
 				}
 			}
 		}
+	
+	/* Initialize the cell neighbour table: */
+	updateCellNeighbours();
 	}
 
 SpaceGrid::~SpaceGrid(void)
@@ -240,13 +352,90 @@ int SpaceGrid::getPeriodicMask(void) const
 	return periodicMask;
 	}
 
+void SpaceGrid::setMinimumImage(bool newMinimumImage)
+	{
+	if(minimumImage==newMinimumImage)
+		return;
+	
+	if(newMinimumImage)
+		{
+		/* Minimum-image distances require at least three grid cells along each periodic axis to not visit any neighbour cell twice: */
+		for(int i=0;i<3;++i)
+			if(periodicFlags[i]&&gridSize[i]<3)
+				{
+				Misc::formattedUserWarning("SpaceGrid::setMinimumImage: Grid has only %d cell(s) along periodic axis %d; keeping ghost units",int(gridSize[i]),i);
+				return;
+				}
+		
+		/* Destroy all ghost units; vertex links to ghost units will be re-established to their source units: */
+		for(StructuralUnit* unit=firstUnit;unit!=0;unit=unit->succ)
+			destroyGhostUnits(unit);
+		}
+	else
+		{
+		/* Create ghost units for all units in border cells: */
+		for(StructuralUnit* unit=firstUnit;unit!=0;unit=unit->succ)
+			createGhostUnits(unit);
+		}
+	
+	minimumImage=newMinimumImage;
+	updateCellNeighbours();
+	}
+
 void SpaceGrid::setAttenuation(Scalar newAttenuation)
 	{
 	attenuation=newAttenuation;
 	}
 
+void SpaceGrid::setAccumulateForces(bool newAccumulateForces)
+	{
+	accumulateForces=newAccumulateForces;
+	}
+
+void SpaceGrid::setNumSimulationThreads(int newNumSimulationThreads)
+	{
+	unitStore.setNumThreads(newNumSimulationThreads);
+	}
+
+void SpaceGrid::updateQueryCells(void)
+	{
+	if(queryCellsValid)
+		return;
+	
+	/* Count the number of real units in each grid cell: */
+	const SpaceGridCell* cellBase=cells.getArray();
+	unsigned int numCells=(unsigned int)(cells.getNumElements());
+	queryCellStarts.assign(numCells+1,0);
+	unsigned int numQueryUnits=0;
+	for(StructuralUnit* uPtr=firstUnit;uPtr!=0;uPtr=uPtr->succ,++numQueryUnits)
+		++queryCellStarts[(uPtr->cell-cellBase)+1];
+	for(unsigned int i=0;i<numCells;++i)
+		queryCellStarts[i+1]+=queryCellStarts[i];
+	
+	/* Sort the units into their grid cells: */
+	queryUnits.resize(numQueryUnits);
+	queryPositions.resize(numQueryUnits);
+	queryRadii.resize(numQueryUnits);
+	for(StructuralUnit* uPtr=firstUnit;uPtr!=0;uPtr=uPtr->succ)
+		{
+		unsigned int qi=queryCellStarts[uPtr->cell-cellBase]++;
+		queryUnits[qi]=uPtr;
+		queryPositions[qi]=uPtr->position;
+		queryRadii[qi]=uPtr->getRadius();
+		}
+	
+	/* Each cell's insertion cursor now points to the next cell's start; shift the start indices back: */
+	for(unsigned int i=numCells;i>0;--i)
+		queryCellStarts[i]=queryCellStarts[i-1];
+	queryCellStarts[0]=0;
+	
+	queryCellsValid=true;
+	}
+
 void SpaceGrid::addUnit(StructuralUnit* newUnit)
 	{
+	queryCellsValid=false;
+	
 	/* Set unit's ID number: */
 	newUnit->id=nextUnitId;
 	++nextUnitId;
@@ -268,24 +457,9 @@ void SpaceGrid::addUnit(StructuralUnit* newUnit)
 	/* Link unit to its cell: */
 	cell->linkUnit(newUnit);
 	
-	if(cell->borderCaseMask!=0x0)
-		{
-		/* Create ghosts of new unit in each ghost cell associated with this cell: */
-		for(int i=0;i<26;++i)
-			if((cell->borderCaseMask&borderCases[i].caseMask)==borderCases[i].caseMask)
-				{
-				/* Create a new ghost unit for the new unit and link it to the ghost cell: */
-				GhostUnit* newGhostUnit=new GhostUnit(newUnit,borderCases[i].positionOffset);
-				newGhostUnit->id=0;
-				newGhostUnit->pred=lastGhostUnit;
-				if(lastGhostUnit!=0)
-					lastGhostUnit->succ=newGhostUnit;
-				else
-					firstGhostUnit=newGhostUnit;
-				lastGhostUnit=newGhostUnit;
-				(cell+borderCases[i].pointerOffset)->linkUnit(newGhostUnit);
-				}
-		}
+	/* Create ghosts of the new unit if periodic boundaries are not handled by minimum-image distances: */
+	if(!minimumImage)
+		createGhostUnits(newUnit);
 	}
 
 SpaceGrid::StructuralUnitList SpaceGrid::getAllUnits(void)
@@ -299,70 +473,157 @@ SpaceGrid::StructuralUnitList SpaceGrid::getAllUnits(void)
 
 StructuralUnit* SpaceGrid::findUnit(const Point& p)
 	{
-	/* Find pointer of the cell containing the query point: */
-	SpaceGridCell* cell=findCell(p);
+	/* Find index of the cell containing the query point: */
+	Index cellIndex;
+	for(int i=0;i<3;++i)
+		{
+		cellIndex[i]=int(Math::floor((p[i]-gridBox.min[i])/cellSize[i]))+1;
+		if(cellIndex[i]<1)
+			cellIndex[i]=1;
+		else if(cellIndex[i]>gridSize[i])
+			cellIndex[i]=gridSize[i];
+		}
 	
-	/* Search cell's neighbourhood for units: */
+	/* Search cell's neighbourhood for units, excluding ghost cells: */
 	Scalar minDist2=Math::sqr(maxUnitRadius);
 	StructuralUnit* result=0;
-	for(int i=0;i<27;++i)
-		{
-		/* Get pointer to cell's neighbour: */
-		SpaceGridCell* cell1=cell+cellNeighbourOffsets[i];
-		
-		/* Exclude ghost cells from search: */
-		if(!(cell1->borderCaseMask&0x40))
-			{
-			/* Test all units in the cell: */
-			for(StructuralUnit* uPtr=cell1->firstUnit;uPtr!=0;uPtr=uPtr->cellSucc)
+	Index nIndex;
+	for(nIndex[0]=cellIndex[0]-1;nIndex[0]<=cellIndex[0]+1;++nIndex[0])
+		for(nIndex[1]=cellIndex[1]-1;nIndex[1]<=cellIndex[1]+1;++nIndex[1])
+			for(nIndex[2]=cellIndex[2]-1;nIndex[2]<=cellIndex[2]+1;++nIndex[2])
 				{
-				Scalar dist2=Geometry::sqrDist(uPtr->position,p);
-				if(dist2<minDist2&&dist2<=Math::sqr(uPtr->getRadius()))
+				if(nIndex[0]<1||nIndex[0]>gridSize[0]||nIndex[1]<1||nIndex[1]>gridSize[1]||nIndex[2]<1||nIndex[2]>gridSize[2])
+					continue;
+				
+				/* Test all units in the cell: */
+				for(StructuralUnit* uPtr=cells(nIndex).firstUnit;uPtr!=0;uPtr=uPtr->cellSucc)
 					{
-					minDist2=dist2;
-					result=uPtr;
+					Scalar dist2=Geometry::sqrDist(uPtr->position,p);
+					if(dist2<minDist2&&dist2<=Math::sqr(uPtr->getRadius()))
+						{
+						minDist2=dist2;
+						result=uPtr;
+						}
 					}
 				}
-			}
-		}
 	
 	return result;
 	}
 
 StructuralUnit* SpaceGrid::findUnit(const Ray& r)
 	{
-	/* For now, intersect ray with all objects: */
+	/* Bring the query cells up to date: */
+	updateQueryCells();
+	const SpaceGridCell* cellBase=cells.getArray();
+	
+	/* Clip the ray against the grid's bounding box, extended by the layer of ghost cells: */
+	const Point& origin=r.getOrigin();
+	const Vector& dir=r.getDirection();
+	Scalar lambda0=Scalar(0);
+	Scalar lambda1=Math::Constants<Scalar>::max;
+	for(int i=0;i<3;++i)
+		{
+		Scalar lo=gridBox.min[i]-cellSize[i];
+		Scalar hi=gridBox.max[i]+cellSize[i];
+		if(dir[i]!=Scalar(0))
+			{
+			Scalar l1=(lo-origin[i])/dir[i];
+			Scalar l2=(hi-origin[i])/dir[i];
+			if(l1>l2)
+				std::swap(l1,l2);
+			if(lambda0<l1)
+				lambda0=l1;
+			if(lambda1>l2)
+				lambda1=l2;
+			}
+		else if(origin[i]<lo||origin[i]>hi)
+			return 0;
+		}
+	if(lambda0>lambda1)
+		return 0;
+	
+	/* Initialize a 3D DDA starting at the ray's entry point: */
+	Point start=origin+dir*lambda0;
+	Index cellIndex;
+	int step[3];
+	Scalar lambdaNext[3],lambdaStep[3];
+	for(int i=0;i<3;++i)
+		{
+		cellIndex[i]=int(Math::floor((start[i]-gridBox.min[i])/cellSize[i]))+1;
+		if(cellIndex[i]<0)
+			cellIndex[i]=0;
+		else if(cellIndex[i]>gridSize[i]+1)
+			cellIndex[i]=gridSize[i]+1;
+		if(dir[i]>Scalar(0))
+			{
+			step[i]=1;
+			lambdaNext[i]=(gridBox.min[i]+Scalar(cellIndex[i])*cellSize[i]-origin[i])/dir[i];
+			lambdaStep[i]=cellSize[i]/dir[i];
+			}
+		else if(dir[i]<Scalar(0))
+			{
+			step[i]=-1;
+			lambdaNext[i]=(gridBox.min[i]+Scalar(cellIndex[i]-1)*cellSize[i]-origin[i])/dir[i];
+			lambdaStep[i]=-cellSize[i]/dir[i];
+			}
+		else
+			{
+			step[i]=0;
+			lambdaNext[i]=Math::Constants<Scalar>::max;
+			lambdaStep[i]=Math::Constants<Scalar>::max;
+			}
+		}
+	
+	/* Traverse the cells along the ray until no unit in a later cell can be closer than the current closest unit: */
 	StructuralUnit* closestUnit=0;
 	Scalar closestLambda=Math::Constants<Scalar>::max;
-	Scalar dirLen2=Geometry::sqr(r.getDirection());
-	for(StructuralUnit* uPtr=firstUnit;uPtr!=0;uPtr=uPtr->succ)
+	Scalar dirLen2=Geometry::sqr(dir);
+	Scalar cellLambda=lambda0;
+	while(cellLambda<=closestLambda)
 		{
-		/* Intersect unit's bounding sphere with ray: */
-		Vector d=uPtr->getPosition()-r.getOrigin();
-		Scalar ph=(d*r.getDirection())/dirLen2;
-		Scalar det=Math::sqr(ph)+(Math::sqr(uPtr->getRadius())-Geometry::sqr(d))/dirLen2;
-		if(det>=Scalar(0))
-			{
-			det=Math::sqrt(det);
-			Scalar lambda1=ph-det;
-			Scalar lambda2=ph+det;
-			if(lambda1>=Scalar(0))
-				{
-				if(lambda1<closestLambda)
-					{
-					closestUnit=uPtr;
-					closestLambda=lambda1;
-					}
-				}
-			else if(lambda2>=Scalar(0))
-				{
-				if(Scalar(0)<closestLambda)
+		/* Units are smaller than cells, so any unit intersecting the ray inside the cell has its center in the cell's neighbourhood: */
+		Index nIndex;
+		for(nIndex[0]=cellIndex[0]-1;nIndex[0]<=cellIndex[0]+1;++nIndex[0])
+			for(nIndex[1]=cellIndex[1]-1;nIndex[1]<=cellIndex[1]+1;++nIndex[1])
+				for(nIndex[2]=cellIndex[2]-1;nIndex[2]<=cellIndex[2]+1;++nIndex[2])
 					{
-					closestUnit=uPtr;
-					closestLambda=Scalar(0);
+					if(nIndex[0]<1||nIndex[0]>gridSize[0]||nIndex[1]<1||nIndex[1]>gridSize[1]||nIndex[2]<1||nIndex[2]>gridSize[2])
+						continue;
+					
+					/* Intersect the bounding spheres of all units in the cell with the ray: */
+					unsigned int ci=(unsigned int)(&cells(nIndex)-cellBase);
+					for(unsigned int qi=queryCellStarts[ci];qi<queryCellStarts[ci+1];++qi)
+						{
+						Vector d=queryPositions[qi]-origin;
+						Scalar ph=(d*dir)/dirLen2;
+						Scalar det=Math::sqr(ph)+(Math::sqr(queryRadii[qi])-Geometry::sqr(d))/dirLen2;
+						if(det>=Scalar(0))
+							{
+							det=Math::sqrt(det);
+							Scalar lambda=ph-det;
+							if(lambda<Scalar(0)&&ph+det>=Scalar(0))
+								lambda=Scalar(0);
+							if(lambda>=Scalar(0)&&lambda<closestLambda)
+								{
+								closestUnit=queryUnits[qi];
+								closestLambda=lambda;
+								}
+							}
+						}
 					}
-				}
-			}
+		
+		/* Step to the next cell along the ray: */
+		int axis=0;
+		for(int i=1;i<3;++i)
+			if(lambdaNext[axis]>lambdaNext[i])
+				axis=i;
+		if(lambdaNext[axis]>lambda1)
+			break;
+		cellLambda=lambdaNext[axis];
+		cellIndex[axis]+=step[axis];
+		if(cellIndex[axis]<0||cellIndex[axis]>gridSize[axis]+1)
+			break;
+		lambdaNext[axis]+=lambdaStep[axis];
 		}
 	
 	return closestUnit;
@@ -392,8 +653,7 @@ SpaceGrid::StructuralUnitList SpaceGrid::findUnits(const Point& p,Scalar radius)
 	for(Index cellIndex=cellIndexMin;cellIndex[0]<cellIndexMax[0];cellIndex.preInc(cellIndexMin,cellIndexMax))
 		{
 		/* Test all units in the cell: */
-		SpaceGridCell& cell=cells(cellIndex);
-		for(StructuralUnit* uPtr=cell.firstUnit;uPtr!=0;uPtr=uPtr->cellSucc)
+		for(StructuralUnit* uPtr=cells(cellIndex).firstUnit;uPtr!=0;uPtr=uPtr->cellSucc)
 			{
 			Scalar dist2=Geometry::sqrDist(uPtr->position,p);
 			if(dist2<=Math::sqr(uPtr->getRadius()+radius))
@@ -460,8 +720,14 @@ SpaceGrid::StructuralUnitList SpaceGrid::findLinkedUnits(const Ray& r)
 
 StructuralUnit* SpaceGrid::findClosestUnit(const Point& p,Scalar maxDist)
 	{
+	/* Bring the query cells up to date: */
+	updateQueryCells();
+	const SpaceGridCell* cellBase=cells.getArray();
+	
 	/* Find index of the cell containing the query point: */
 	Index startCellIndex;
+	Index minOffset,maxOffset;
+	int maxShell=0;
 	for(int i=0;i<3;++i)
 		{
 		/* Calculate index component: */
@@ -470,79 +736,119 @@ StructuralUnit* SpaceGrid::findClosestUnit(const Point& p,Scalar maxDist)
 			startCellIndex[i]=1;
 		else if(startCellIndex[i]>gridSize[i])
 			startCellIndex[i]=gridSize[i];
+		
+		/* Limit the search to the grid on non-periodic axes, and to one period around the start cell on periodic axes: */
+		if(periodicFlags[i])
+			{
+			minOffset[i]=-(gridSize[i]/2+1);
+			maxOffset[i]=gridSize[i]/2+1;
+			}
+		else
+			{
+			minOffset[i]=1-startCellIndex[i];
+			maxOffset[i]=gridSize[i]-startCellIndex[i];
+			}
+		if(maxShell<-minOffset[i])
+			maxShell=-minOffset[i];
+		if(maxShell<maxOffset[i])
+			maxShell=maxOffset[i];
 		}
 	
-	/* Search outwards from the start cell until a unit is found: */
+	/* Search shells of cells of increasing distance around the start cell until no closer unit can be found: */
 	Scalar minDist2=Math::sqr(maxDist);
 	StructuralUnit* result=0;
-	std::queue<Index> cellQueue;
-	Misc::HashTable<SpaceGridCell*,void> pushedCells(101);
-	cellQueue.push(startCellIndex);
-	pushedCells.setEntry(Misc::HashTable<SpaceGridCell*,void>::Entry(&cells(startCellIndex)));
-	while(!cellQueue.empty())
+	for(int shell=0;shell<=maxShell;++shell)
 		{
-		/* Visit the next cell in the queue: */
-		Index cellIndex=cellQueue.front();
-		cellQueue.pop();
-		
-		/* Calculate minimal distance between query point and cell: */
-		Scalar cellDist2=Scalar(0);
+		/* Clip the shell to the searched offset range: */
+		Index shellMin,shellMax;
 		for(int i=0;i<3;++i)
 			{
-			Scalar d;
-			if((d=Scalar(cellIndex[i])*cellSize[i]-p[i])>Scalar(0))
-				cellDist2+=d*d;
-			else if((d=p[i]-Scalar(cellIndex[i]+1)*cellSize[i])>Scalar(0))
-				cellDist2+=d*d;
+			shellMin[i]=-shell>minOffset[i]?-shell:minOffset[i];
+			shellMax[i]=shell<maxOffset[i]?shell:maxOffset[i];
 			}
 		
-		/* Disregard the cell if it is farther away than the current closest unit: */
-		if(cellDist2<minDist2)
-			{
-			/* Check all structural units in the cell: */
-			SpaceGridCell* cell=&cells(cellIndex);
-			for(StructuralUnit* uPtr=cell->firstUnit;uPtr!=0;uPtr=uPtr->cellSucc)
+		/* Visit all cells on the clipped shell's surface: */
+		Index offset;
+		for(offset[0]=shellMin[0];offset[0]<=shellMax[0];++offset[0])
+			for(offset[1]=shellMin[1];offset[1]<=shellMax[1];++offset[1])
 				{
-				Scalar dist2=Geometry::sqrDist(uPtr->position,p);
-				if(minDist2>dist2)
+				/* Only visit the shell's two end caps along the third axis unless on one of the shell's side faces: */
+				bool onSide=shell==0||offset[0]==-shell||offset[0]==shell||offset[1]==-shell||offset[1]==shell;
+				int step2=onSide?1:2*shell;
+				for(offset[2]=onSide?shellMin[2]:-shell;offset[2]<=shellMax[2];offset[2]+=step2)
 					{
-					minDist2=dist2;
-					result=uPtr;
+					/* Skip end caps that lie outside the searched offset range: */
+					if(offset[2]<shellMin[2])
+						continue;
+					
+					/* Wrap the cell index around periodic axes, and calculate the position shift of the cell's units: */
+					Index cellIndex;
+					Vector shift;
+					Scalar cellDist2=Scalar(0);
+					for(int i=0;i<3;++i)
+						{
+						int index=startCellIndex[i]+offset[i];
+						
+						/* Calculate minimal distance between query point and the unwrapped cell: */
+						Scalar cellMin=gridBox.min[i]+Scalar(index-1)*cellSize[i];
+						Scalar d;
+						if((d=cellMin-p[i])>Scalar(0))
+							cellDist2+=d*d;
+						else if((d=p[i]-(cellMin+cellSize[i]))>Scalar(0))
+							cellDist2+=d*d;
+						
+						shift[i]=Scalar(0);
+						if(index<1||index>gridSize[i])
+							{
+							/* Only periodic axes reach outside the grid: */
+							int wrapped=((index-1)%gridSize[i]+gridSize[i])%gridSize[i]+1;
+							shift[i]=Scalar(index-wrapped)*cellSize[i];
+							index=wrapped;
+							}
+						cellIndex[i]=index;
+						}
+					
+					/* Disregard the cell if it is farther away than the current closest unit: */
+					if(cellDist2<minDist2)
+						{
+						/* Check all structural units in the cell: */
+						unsigned int ci=(unsigned int)(&cells(cellIndex)-cellBase);
+						for(unsigned int qi=queryCellStarts[ci];qi<queryCellStarts[ci+1];++qi)
+							{
+							Scalar dist2=Geometry::sqrDist(queryPositions[qi]+shift,p);
+							if(minDist2>dist2)
+								{
+								minDist2=dist2;
+								result=queryUnits[qi];
+								}
+							}
+						}
 					}
 				}
-			
-			/* Put all neighbours of the cell into the queue: */
-			for(int i=0;i<3;++i)
+		
+		/* Calculate the distance from the query point to the next shell: */
+		Scalar nextShellDist=Math::Constants<Scalar>::max;
+		for(int i=0;i<3;++i)
+			{
+			if(-shell>minOffset[i])
 				{
-				/* Go to left neighbour: */
-				Index n1Index=cellIndex;
-				if(n1Index[i]>1)
-					--n1Index[i];
-				else
-					n1Index[i]=gridSize[i];
-				SpaceGridCell* n1=&cells(n1Index);
-				if(!pushedCells.isEntry(n1))
-					{
-					/* Add the cell to the queue: */
-					cellQueue.push(n1Index);
-					pushedCells.setEntry(Misc::HashTable<SpaceGridCell*,void>::Entry(n1));
-					}
-				
-				/* Go to right neighbour: */
-				Index n2Index=cellIndex;
-				if(n2Index[i]<gridSize[i])
-					++n2Index[i];
-				else
-					n2Index[i]=1;
-				SpaceGridCell* n2=&cells(n2Index);
-				if(!pushedCells.isEntry(n2))
-					{
-					/* Add the cell to the queue: */
-					cellQueue.push(n2Index);
-					pushedCells.setEntry(Misc::HashTable<SpaceGridCell*,void>::Entry(n2));
-					}
+				Scalar d=p[i]-(gridBox.min[i]+Scalar(startCellIndex[i]-shell-1)*cellSize[i]);
+				if(nextShellDist>d)
+					nextShellDist=d;
+				}
+			if(shell<maxOffset[i])
+				{
+				Scalar d=gridBox.min[i]+Scalar(startCellIndex[i]+shell)*cellSize[i]-p[i];
+				if(nextShellDist>d)
+					nextShellDist=d;
 				}
 			}
+		
+		/* Stop if all cells have been visited, or if the next shell is farther away than the current closest unit: */
+		if(nextShellDist==Math::Constants<Scalar>::max)
+			break;
+		if(nextShellDist>Scalar(0)&&Math::sqr(nextShellDist)>=minDist2)
+			break;
 		}
 	
 	return result;
@@ -624,6 +930,8 @@ void SpaceGrid::toggleUnitsLock(const SpaceGrid::StructuralUnitList& units)
 
 void SpaceGrid::moveUnit(StructuralUnit* unit)
 	{
+	queryCellsValid=false;
+	
 	SpaceGridCell* cell=unit->cell;
 	
 	/* Find new grid cell containing unit: */
@@ -636,7 +944,7 @@ void SpaceGrid::moveUnit(StructuralUnit* unit)
 		cell->unlinkUnit(unit);
 		
 		/* Update any ghost units associated with the unit: */
-		if(newCell->borderCaseMask!=0x0||cell->borderCaseMask!=0x0)
+		if(!minimumImage&&(newCell->borderCaseMask!=0x0||cell->borderCaseMask!=0x0))
 			{
 			for(int i=0;i<26;++i)
 				{
@@ -719,36 +1027,11 @@ void SpaceGrid::transformUnits(const SpaceGrid::StructuralUnitList& units,const
 
 void SpaceGrid::removeUnit(StructuralUnit* unit)
 	{
-	if(unit->cell->borderCaseMask!=0x0)
-		{
-		/* Remove all ghost units associated with the unit: */
-		for(int i=0;i<26;++i)
-			if((unit->cell->borderCaseMask&borderCases[i].caseMask)==borderCases[i].caseMask)
-				{
-				/* Find ghost unit associated with unit in old ghost cell: */
-				SpaceGridCell* ghostCell=unit->cell+borderCases[i].pointerOffset;
-				GhostUnit* ghostUnit;
-				for(ghostUnit=static_cast<GhostUnit*>(ghostCell->firstUnit);ghostUnit->getSourceUnit()!=unit;ghostUnit=static_cast<GhostUnit*>(ghostUnit->cellSucc))
-					;
-				
-				/* Clear the ghost unit's vertex links: */
-				ghostUnit->clearVertexLinks();
-				
-				/* Unlink ghost unit from ghost cell: */
-				ghostCell->unlinkUnit(ghostUnit);
-				
-				/* Delete the ghost unit: */
-				if(ghostUnit->pred!=0)
-					ghostUnit->pred->succ=ghostUnit->succ;
-				else
-					firstGhostUnit=ghostUnit->succ;
-				if(ghostUnit->succ!=0)
-					ghostUnit->succ->pred=ghostUnit->pred;
-				else
-					lastGhostUnit=ghostUnit->pred;
-				delete ghostUnit;
-				}
-		}
+	queryCellsValid=false;
+	
+	/* Remove all ghost units associated with the unit: */
+	if(!minimumImage)
+		destroyGhostUnits(unit);
 	
 	/* Clear the given unit's vertex links: */
 	unit->clearVertexLinks();
@@ -776,82 +1059,47 @@ void SpaceGrid::removeUnits(const SpaceGrid::StructuralUnitList& units)
 
 void SpaceGrid::advanceTime(Scalar timeStep)
 	{
-	/* Check all existing vertex links and apply their vertex forces: */
-	for(StructuralUnit* unit=firstUnit;unit!=0;unit=unit->succ)
-		unit->checkVertexLinks(timeStep);
+	queryCellsValid=false;
 	
-	/* Compute interactions between all pairs of units: */
-	for(StructuralUnit* unit1=firstUnit;unit1!=0;unit1=unit1->succ)
+	/* Copy the states of all real and ghost units into the flat unit store: */
+	unitStore.gather(firstUnit,firstGhostUnit,cells.getArray(),cells.getNumElements());
+	
+	/* Set up the simulation step parameters: */
+	UnitStore::StepParameters sp;
+	sp.timeStep=timeStep;
+	sp.cellNeighbours=cellNeighbours;
+	sp.minimumImage=minimumImage;
+	sp.gridBox=gridBox;
+	for(int i=0;i<3;++i)
 		{
-		/* Construct neighbourhood of cells around unit's cell: */
-		for(int i=0;i<27;++i)
-			{
-			SpaceGridCell* cell=unit1->cell+cellNeighbourOffsets[i];
-			for(StructuralUnit* unit2=cell->firstUnit;unit2!=0;unit2=unit2->cellSucc)
-				if(unit1->id>unit2->id)
-					StructuralUnit::interact(unit1,unit2,timeStep);
-			}
+		sp.periodicFlags[i]=periodicFlags[i];
+		sp.cellSize[i]=cellSize[i];
+		sp.gridSize[i]=gridSize[i];
+		sp.cellIncrements[i]=int(cells.getIncrement(i));
 		}
+	sp.attenuation=Math::pow(attenuation,timeStep);
 	
-	/* Move all units to the end of the time step: */
-	Scalar att=Math::pow(attenuation,timeStep);
-	//Scalar totalLinearVelocity(0);
-	//Scalar totalAngularVelocity(0);
-	for(StructuralUnit* unit=firstUnit;unit!=0;unit=unit->succ)
+	if(accumulateForces)
 		{
-		if(!unit->locked)
-			{
-			/* Move unit according to velocities: */
-			unit->orientation.leftMultiply(Rotation(unit->angularVelocity*timeStep));
-			unit->position+=unit->linearVelocity*timeStep;
-			
-			//totalLinearVelocity+=Geometry::mag(unit->linearVelocity);
-			//totalAngularVelocity+=Geometry::mag(unit->angularVelocity);
-			
-			/* Attenuate unit's velocities: */
-			unit->linearVelocity*=att;
-			unit->angularVelocity*=att;
-			
-			/* Limit unit's position to grid box: */
-			for(int i=0;i<3;++i)
-				{
-				/* Repeat until unit's position is inside box: */
-				while(true)
-					{
-					if(unit->position[i]<gridBox.min[i])
-						{
-						if(periodicFlags[i])
-							unit->position[i]+=gridBox.getSize(i);
-						else
-							{
-							unit->position[i]=Scalar(2)*gridBox.min[i]-unit->position[i];
-							unit->linearVelocity[i]=-unit->linearVelocity[i];
-							}
-						}
-					else if(unit->position[i]>gridBox.max[i])
-						{
-						if(periodicFlags[i])
-							unit->position[i]-=gridBox.getSize(i);
-						else
-							{
-							unit->position[i]=Scalar(2)*gridBox.max[i]-unit->position[i];
-							unit->linearVelocity[i]=-unit->linearVelocity[i];
-							}
-						}
-					else
-						break;
-					}
-				}
-			
-			/* Update unit's grid linkage: */
-			moveUnit(unit);
-			}
-		else
-			{
-			unit->linearVelocity=Vector::zero;
-			unit->angularVelocity=Vector::zero;
-			}
+		/* Accumulate all vertex link and central forces in parallel: */
+		unitStore.accumulateForces(sp);
 		}
+	else
+		{
+		/* Check all existing vertex links and apply their vertex forces: */
+		unitStore.checkVertexLinks(sp);
+		
+		/* Compute interactions between all pairs of units: */
+		unitStore.interact(sp);
+		}
+	
+	/* Move all units to the end of the time step: */
+	unitStore.integrate(sp);
+	
+	/* Update the grid linkage of all units that moved to another grid cell: */
+	const StructuralUnitList& movedUnits=unitStore.getMovedUnits();
+	for(StructuralUnitList::const_iterator muIt=movedUnits.begin();muIt!=movedUnits.end();++muIt)
+		moveUnit(*muIt);
 	
 	#if 1
 	/* Update all ghost units to reflect the state of their source units: */
@@ -861,174 +1109,238 @@ void SpaceGrid::advanceTime(Scalar timeStep)
 		guPtr->updateState();
 		}
 	#endif
-	
-	//std::cout<<std::setw(20)<<totalLinearVelocity<<", "<<std::setw(20)<<totalAngularVelocity<<"         \r"<<std::flush;
 	}
 
-SpaceGrid::GridStatistics SpaceGrid::calcGridStatistics(void) const
+void SpaceGrid::getStatisticsSnapshot(SpaceGrid::StatisticsSnapshot& snapshot) const
 	{
-	/* Initialize statistics structure: */
-	GridStatistics result;
-	result.numUnits=0;
-	result.numTriangles=0;
-	result.numTetrahedra=0;
-	result.numOctahedra=0;
-	result.numSpheres=0;
-	result.numUnsharedVertices=0;
-	result.bondLengthMin=Scalar(1.2);
-	result.bondLengthMax=Scalar(2.2);
-	Scalar bondLengthBinSize=(result.bondLengthMax-result.bondLengthMin)/Scalar(GridStatistics::numBondLengthBins);
-	for(int i=0;i<GridStatistics::numBondLengthBins;++i)
-		result.bondLengthHistogram[i]=0;
-	result.averageBondLength=Scalar(0);
-	result.bondAngleMin=Scalar(0.5)*Math::Constants<Scalar>::pi;
-	result.bondAngleMax=Math::Constants<Scalar>::pi;
-	Scalar bondAngleBinSize=(result.bondAngleMax-result.bondAngleMin)/Scalar(GridStatistics::numBondAngleBins);
-	for(int i=0;i<GridStatistics::numBondAngleBins;++i)
-		result.bondAngleHistogram[i]=0;
-	result.averageBondAngle=Scalar(0);
-	result.centerDistMin=Scalar(2.0);
-	result.centerDistMax=Scalar(3.5);
-	Scalar centerDistBinSize=(result.centerDistMax-result.centerDistMin)/Scalar(GridStatistics::numCenterDistBins);
-	for(int i=0;i<GridStatistics::numCenterDistBins;++i)
-		result.centerDistHistogram[i]=0;
-	result.averageCenterDist=Scalar(0);
-	result.internalBondLengthMin=Scalar(2.2);
-	result.internalBondLengthMax=Scalar(3.2);
-	Scalar internalBondLengthBinSize=(result.internalBondLengthMax-result.internalBondLengthMin)/Scalar(GridStatistics::numInternalBondLengthBins);
-	for(int i=0;i<GridStatistics::numInternalBondLengthBins;++i)
-		result.internalBondLengthHistogram[i]=0;
-	result.averageInternalBondLength=Scalar(0);
-	result.internalBondAngleMin=Scalar(0.5)*Math::Constants<Scalar>::pi;
-	result.internalBondAngleMax=Math::Constants<Scalar>::pi;
-	Scalar internalBondAngleBinSize=(result.internalBondAngleMax-result.internalBondAngleMin)/Scalar(GridStatistics::numInternalBondAngleBins);
-	for(int i=0;i<GridStatistics::numInternalBondAngleBins;++i)
-		result.internalBondAngleHistogram[i]=0;
-	result.averageInternalBondAngle=Scalar(0);
-	
-	/* Iterate through the list of structural units: */
-	int numBonds=0;
-	int numInternalBonds=0;
+	snapshot.firstVertices.clear();
+	snapshot.positions.clear();
+	snapshot.vertices.clear();
+	snapshot.linkedFlags.clear();
+	snapshot.linkedPositions.clear();
+	snapshot.linkedVertices.clear();
+	
+	/* Copy the positions, vertices, and vertex links of all real units: */
 	for(const StructuralUnit* uPtr=firstUnit;uPtr!=0;uPtr=uPtr->succ)
 		{
-		/* Increment total unit count: */
-		++result.numUnits;
-		
-		/* Increment unit type count: */
-		/* ... */
-		
-		/* Check unit's links: */
-		Point* vertices=new Point[uPtr->getNumVertices()];
-		Vector* vertexDirs=new Vector[uPtr->getNumVertices()];
-		Scalar* vertexDists=new Scalar[uPtr->getNumVertices()];
+		snapshot.firstVertices.push_back((unsigned int)(snapshot.vertices.size()));
+		snapshot.positions.push_back(uPtr->getPosition());
 		for(int i=0;i<uPtr->getNumVertices();++i)
 			{
+			snapshot.vertices.push_back(uPtr->getVertex(i));
 			const StructuralUnit::VertexLink& vl=uPtr->getVertexLink(i);
 			if(vl.unit!=0)
 				{
+				/* Store the position of the linked unit's image closest to this unit, and the linked vertex relative to that image: */
+				Point linkedPos=uPtr->getPosition()+wrapDistance(vl.unit->getPosition()-uPtr->getPosition());
+				snapshot.linkedFlags.push_back(1);
+				snapshot.linkedPositions.push_back(linkedPos);
+				snapshot.linkedVertices.push_back(linkedPos+vl.unit->getVertexOffset(vl.vertexIndex));
+				}
+			else
+				{
+				snapshot.linkedFlags.push_back(0);
+				snapshot.linkedPositions.push_back(Point::origin);
+				snapshot.linkedVertices.push_back(Point::origin);
+				}
+			}
+		}
+	snapshot.firstVertices.push_back((unsigned int)(snapshot.vertices.size()));
+	}
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+void initGridStatistics(SpaceGrid::GridStatistics& stats) // Sets the histogram ranges of the given statistics structure and resets all counters
+	{
+	stats.numUnits=0;
+	stats.numTriangles=0;
+	stats.numTetrahedra=0;
+	stats.numOctahedra=0;
+	stats.numSpheres=0;
+	stats.numUnsharedVertices=0;
+	stats.bondLengthMin=Scalar(1.2);
+	stats.bondLengthMax=Scalar(2.2);
+	for(int i=0;i<SpaceGrid::GridStatistics::numBondLengthBins;++i)
+		stats.bondLengthHistogram[i]=0;
+	stats.averageBondLength=Scalar(0);
+	stats.bondAngleMin=Scalar(0.5)*Math::Constants<Scalar>::pi;
+	stats.bondAngleMax=Math::Constants<Scalar>::pi;
+	for(int i=0;i<SpaceGrid::GridStatistics::numBondAngleBins;++i)
+		stats.bondAngleHistogram[i]=0;
+	stats.averageBondAngle=Scalar(0);
+	stats.centerDistMin=Scalar(2.0);
+	stats.centerDistMax=Scalar(3.5);
+	for(int i=0;i<SpaceGrid::GridStatistics::numCenterDistBins;++i)
+		stats.centerDistHistogram[i]=0;
+	stats.averageCenterDist=Scalar(0);
+	stats.internalBondLengthMin=Scalar(2.2);
+	stats.internalBondLengthMax=Scalar(3.2);
+	for(int i=0;i<SpaceGrid::GridStatistics::numInternalBondLengthBins;++i)
+		stats.internalBondLengthHistogram[i]=0;
+	stats.averageInternalBondLength=Scalar(0);
+	stats.internalBondAngleMin=Scalar(0.5)*Math::Constants<Scalar>::pi;
+	stats.internalBondAngleMax=Math::Constants<Scalar>::pi;
+	for(int i=0;i<SpaceGrid::GridStatistics::numInternalBondAngleBins;++i)
+		stats.internalBondAngleHistogram[i]=0;
+	stats.averageInternalBondAngle=Scalar(0);
+	}
+
+class StatisticsWorker // Class to accumulate partial grid statistics over a range of units in a statistics snapshot
+	{
+	/* Elements: */
+	public:
+	const SpaceGrid::StatisticsSnapshot* snapshot; // Snapshot from which to calculate statistics
+	unsigned int begin,end; // Range of unit indices to process
+	SpaceGrid::GridStatistics stats; // Partial statistics; averages hold sums until reduction
+	int numBonds; // Number of processed bonds
+	int numInternalBonds; // Number of processed internal bonds
+	
+	/* Methods: */
+	void* run(void); // Accumulates statistics over the worker's range of units
+	};
+
+void* StatisticsWorker::run(void)
+	{
+	initGridStatistics(stats);
+	numBonds=0;
+	numInternalBonds=0;
+	
+	/* Iterate through the worker's range of structural units: */
+	std::vector<Point> vertices;
+	std::vector<Vector> vertexDirs;
+	std::vector<Scalar> vertexDists;
+	for(unsigned int unitIndex=begin;unitIndex<end;++unitIndex)
+		{
+		/* Increment total unit count: */
+		++stats.numUnits;
+		
+		/* Check unit's links: */
+		const Point& position=snapshot->positions[unitIndex];
+		unsigned int firstVertex=snapshot->firstVertices[unitIndex];
+		int numVertices=int(snapshot->firstVertices[unitIndex+1]-firstVertex);
+		vertices.resize(numVertices);
+		vertexDirs.resize(numVertices);
+		vertexDists.resize(numVertices);
+		for(int i=0;i<numVertices;++i)
+			{
+			unsigned int vertexIndex=firstVertex+i;
+			if(snapshot->linkedFlags[vertexIndex])
+				{
+				const Point& linkedPos=snapshot->linkedPositions[vertexIndex];
+				
 				/* Calculate position of bond midpoint: */
-				vertices[i]=Geometry::mid(uPtr->getVertex(i),vl.unit->getVertex(vl.vertexIndex));
-				Vector v1=uPtr->getPosition()-vertices[i];
+				vertices[i]=Geometry::mid(snapshot->vertices[vertexIndex],snapshot->linkedVertices[vertexIndex]);
+				Vector v1=position-vertices[i];
 				vertexDirs[i]=v1;
-				Vector v2=vl.unit->getPosition()-vertices[i];
+				Vector v2=linkedPos-vertices[i];
 				
 				/* Calculate bond lengths for this bond: */
 				Scalar l1=Geometry::mag(v1);
 				vertexDists[i]=l1;
 				Scalar l2=Geometry::mag(v2);
-				int l1Index=int(Math::floor((l1-result.bondLengthMin)/bondLengthBinSize));
-				if(l1Index<=0)
-					++result.bondLengthHistogram[0];
-				else if(l1Index>=GridStatistics::numBondLengthBins-1)
-					++result.bondLengthHistogram[GridStatistics::numBondLengthBins-1];
-				else
-					++result.bondLengthHistogram[l1Index];
-				int l2Index=int(Math::floor((l2-result.bondLengthMin)/bondLengthBinSize));
-				if(l2Index<=0)
-					++result.bondLengthHistogram[0];
-				else if(l2Index>=GridStatistics::numBondLengthBins-1)
-					++result.bondLengthHistogram[GridStatistics::numBondLengthBins-1];
-				else
-					++result.bondLengthHistogram[l2Index];
-				result.averageBondLength+=l1+l2;
+				addToHistogram(stats.bondLengthHistogram,SpaceGrid::GridStatistics::numBondLengthBins,stats.bondLengthMin,stats.bondLengthMax,l1);
+				addToHistogram(stats.bondLengthHistogram,SpaceGrid::GridStatistics::numBondLengthBins,stats.bondLengthMin,stats.bondLengthMax,l2);
+				stats.averageBondLength+=l1+l2;
 				
 				/* Calculate bond angle for this bond: */
-				Scalar cosAngle=(v1*v2)/(l1*l2);
-				if(cosAngle<Scalar(-1))
-					cosAngle=Scalar(-1);
-				else if(cosAngle>Scalar(1))
-					cosAngle=Scalar(1);
-				Scalar angle=Math::acos(cosAngle);
-				int angleIndex=int(Math::floor((angle-result.bondAngleMin)/bondAngleBinSize));
-				if(angleIndex<=0)
-					++result.bondAngleHistogram[0];
-				else if(angleIndex>=GridStatistics::numBondAngleBins-1)
-					++result.bondAngleHistogram[GridStatistics::numBondAngleBins-1];
-				else
-					++result.bondAngleHistogram[angleIndex];
-				result.averageBondAngle+=angle;
+				Scalar angle=calcAngle(v1,l1,v2,l2);
+				addToHistogram(stats.bondAngleHistogram,SpaceGrid::GridStatistics::numBondAngleBins,stats.bondAngleMin,stats.bondAngleMax,angle);
+				stats.averageBondAngle+=angle;
 				
 				/* Calculate center distance for this bond: */
-				Scalar cd=Geometry::dist(uPtr->getPosition(),vl.unit->getPosition());
-				int cdIndex=int(Math::floor((cd-result.centerDistMin)/centerDistBinSize));
-				if(cdIndex<=0)
-					++result.centerDistHistogram[0];
-				else if(cdIndex>=GridStatistics::numCenterDistBins-1)
-					++result.centerDistHistogram[GridStatistics::numCenterDistBins-1];
-				else
-					++result.centerDistHistogram[cdIndex];
-				result.averageCenterDist+=cd;
+				Scalar cd=Geometry::dist(position,linkedPos);
+				addToHistogram(stats.centerDistHistogram,SpaceGrid::GridStatistics::numCenterDistBins,stats.centerDistMin,stats.centerDistMax,cd);
+				stats.averageCenterDist+=cd;
 				
 				++numBonds;
 				}
 			else
 				{
-				vertices[i]=uPtr->getVertex(i);
-				vertexDirs[i]=uPtr->getPosition()-vertices[i];
+				vertices[i]=snapshot->vertices[vertexIndex];
+				vertexDirs[i]=position-vertices[i];
 				vertexDists[i]=Geometry::mag(vertexDirs[i]);
 				
 				/* Increment number of unshared vertices: */
-				++result.numUnsharedVertices;
+				++stats.numUnsharedVertices;
 				}
 			}
 		
 		/* Calculate internal bond lengths and bond angles: */
-		for(int i1=0;i1<uPtr->getNumVertices()-1;++i1)
-			for(int i2=i1+1;i2<uPtr->getNumVertices();++i2)
+		for(int i1=0;i1<numVertices-1;++i1)
+			for(int i2=i1+1;i2<numVertices;++i2)
 				{
 				/* Calculate internal bond length: */
 				Scalar l=Geometry::dist(vertices[i1],vertices[i2]);
-				int lIndex=int(Math::floor((l-result.internalBondLengthMin)/internalBondLengthBinSize));
-				if(lIndex<=0)
-					++result.internalBondLengthHistogram[0];
-				else if(lIndex>=GridStatistics::numInternalBondLengthBins-1)
-					++result.internalBondLengthHistogram[GridStatistics::numInternalBondLengthBins-1];
-				else
-					++result.internalBondLengthHistogram[lIndex];
-				result.averageInternalBondLength+=l;
+				addToHistogram(stats.internalBondLengthHistogram,SpaceGrid::GridStatistics::numInternalBondLengthBins,stats.internalBondLengthMin,stats.internalBondLengthMax,l);
+				stats.averageInternalBondLength+=l;
 				
 				/* Calculate internal bond angle: */
-				Scalar cosAngle=(vertexDirs[i1]*vertexDirs[i2])/(vertexDists[i1]*vertexDists[i2]);
-				if(cosAngle<Scalar(-1))
-					cosAngle=Scalar(-1);
-				else if(cosAngle>Scalar(1))
-					cosAngle=Scalar(1);
-				Scalar angle=Math::acos(cosAngle);
-				int angleIndex=int(Math::floor((angle-result.internalBondAngleMin)/internalBondAngleBinSize));
-				if(angleIndex<=0)
-					++result.internalBondAngleHistogram[0];
-				else if(angleIndex>=GridStatistics::numInternalBondAngleBins-1)
-					++result.internalBondAngleHistogram[GridStatistics::numInternalBondAngleBins-1];
-				else
-					++result.internalBondAngleHistogram[angleIndex];
-				result.averageInternalBondAngle+=angle;
+				Scalar angle=calcAngle(vertexDirs[i1],vertexDists[i1],vertexDirs[i2],vertexDists[i2]);
+				addToHistogram(stats.internalBondAngleHistogram,SpaceGrid::GridStatistics::numInternalBondAngleBins,stats.internalBondAngleMin,stats.internalBondAngleMax,angle);
+				stats.averageInternalBondAngle+=angle;
 				
 				++numInternalBonds;
 				}
-		
-		delete[] vertices;
-		delete[] vertexDirs;
-		delete[] vertexDists;
+		}
+	
+	return 0;
+	}
+
+}
+
+SpaceGrid::GridStatistics SpaceGrid::calcGridStatistics(const SpaceGrid::StatisticsSnapshot& snapshot,int numThreads)
+	{
+	/* Split the snapshot's units evenly between the requested number of workers: */
+	if(numThreads<1)
+		numThreads=1;
+	unsigned int numUnits=(unsigned int)(snapshot.positions.size());
+	std::vector<StatisticsWorker> workers(numThreads);
+	for(int i=0;i<numThreads;++i)
+		{
+		workers[i].snapshot=&snapshot;
+		workers[i].begin=(unsigned int)((size_t(numUnits)*size_t(i))/size_t(numThreads));
+		workers[i].end=(unsigned int)((size_t(numUnits)*size_t(i+1))/size_t(numThreads));
+		}
+	
+	/* Run all but the first worker in their own threads, and the first worker in the calling thread: */
+	Threads::Thread* workerThreads=numThreads>1?new Threads::Thread[numThreads-1]:0;
+	for(int i=1;i<numThreads;++i)
+		workerThreads[i-1].start(&workers[i],&StatisticsWorker::run);
+	workers[0].run();
+	for(int i=1;i<numThreads;++i)
+		workerThreads[i-1].join();
+	delete[] workerThreads;
+	
+	/* Reduce the partial statistics in worker order: */
+	GridStatistics result=workers[0].stats;
+	int numBonds=workers[0].numBonds;
+	int numInternalBonds=workers[0].numInternalBonds;
+	for(int w=1;w<numThreads;++w)
+		{
+		const GridStatistics& ws=workers[w].stats;
+		result.numUnits+=ws.numUnits;
+		result.numUnsharedVertices+=ws.numUnsharedVertices;
+		for(int i=0;i<GridStatistics::numBondLengthBins;++i)
+			result.bondLengthHistogram[i]+=ws.bondLengthHistogram[i];
+		result.averageBondLength+=ws.averageBondLength;
+		for(int i=0;i<GridStatistics::numBondAngleBins;++i)
+			result.bondAngleHistogram[i]+=ws.bondAngleHistogram[i];
+		result.averageBondAngle+=ws.averageBondAngle;
+		for(int i=0;i<GridStatistics::numCenterDistBins;++i)
+			result.centerDistHistogram[i]+=ws.centerDistHistogram[i];
+		result.averageCenterDist+=ws.averageCenterDist;
+		for(int i=0;i<GridStatistics::numInternalBondLengthBins;++i)
+			result.internalBondLengthHistogram[i]+=ws.internalBondLengthHistogram[i];
+		result.averageInternalBondLength+=ws.averageInternalBondLength;
+		for(int i=0;i<GridStatistics::numInternalBondAngleBins;++i)
+			result.internalBondAngleHistogram[i]+=ws.internalBondAngleHistogram[i];
+		result.averageInternalBondAngle+=ws.averageInternalBondAngle;
+		numBonds+=workers[w].numBonds;
+		numInternalBonds+=workers[w].numInternalBonds;
 		}
 	
 	/* Calculate average bond length: */
@@ -1049,6 +1361,14 @@ SpaceGrid::GridStatistics SpaceGrid::calcGridStatistics(void) const
 	return result;
 	}
 
+SpaceGrid::GridStatistics SpaceGrid::calcGridStatistics(void) const
+	{
+	/* Calculate statistics from a snapshot of the current state in the calling thread: */
+	StatisticsSnapshot snapshot;
+	getStatisticsSnapshot(snapshot);
+	return calcGridStatistics(snapshot,1);
+	}
+
 void SpaceGrid::readRenderingFlags(const Misc::ConfigurationFileSection& configFileSection)
 	{
 	showGridBoundary=configFileSection.retrieveValue<bool>("./showGridBoundary",showGridBoundary);
@@ -1067,6 +1387,7 @@ void SpaceGrid::readRenderingFlags(const Misc::ConfigurationFileSection& configF
 	unlinkedVertexRadius=configFileSection.retrieveValue<GLfloat>("./unlinkedVertexRadius",unlinkedVertexRadius);
 	unlinkedVertexSubdivision=configFileSection.retrieveValue<int>("./unlinkedVertexSubdivision",unlinkedVertexSubdivision);
 	unlinkedVertexMaterial=configFileSection.retrieveValue<GLMaterial>("./unlinkedVertexMaterial",unlinkedVertexMaterial);
+	batchedRendering=configFileSection.retrieveValue<bool>("./batchedRendering",batchedRendering);
 	}
 
 void SpaceGrid::setShowGridBoundary(bool newShowGridBoundary)
@@ -1119,7 +1440,198 @@ void SpaceGrid::setShowUnlinkedVertices(bool newShowUnlinkedVertices)
 	showUnlinkedVertices=newShowUnlinkedVertices;
 	}
 
-void SpaceGrid::glRenderAction(GLContextData& contextData) const
+void SpaceGrid::setBatchedRendering(bool newBatchedRendering)
+	{
+	batchedRendering=newBatchedRendering;
+	}
+
+void SpaceGrid::glRenderUnitsBatched(const SpaceGrid::RenderState& renderState,SpaceGrid::DataItem* dataItem) const
+	{
+	/* Collect all velocity and vertex link lines into a single vertex array: */
+	std::vector<LineVertex>& lvs=dataItem->lineVertices;
+	lvs.clear();
+	LineVertex lv;
+	if(renderState.showVelocities)
+		{
+		/* Add structural units' velocities: */
+		GLColor<GLfloat,4> linearColor(1.0f,0.0f,0.0f,1.0f);
+		GLColor<GLfloat,4> angularColor(0.0f,0.0f,1.0f,1.0f);
+		for(std::vector<RenderUnit>::const_iterator ruIt=renderState.units.begin();ruIt!=renderState.units.end();++ruIt)
+			{
+			lv.color=linearColor;
+			lv.position=ruIt->position;
+			lvs.push_back(lv);
+			lv.position=ruIt->position+ruIt->linearVelocity;
+			lvs.push_back(lv);
+			lv.color=angularColor;
+			lv.position=ruIt->position;
+			lvs.push_back(lv);
+			lv.position=ruIt->position+ruIt->angularVelocity;
+			lvs.push_back(lv);
+			}
+		}
+	GLsizei numVelocityVertices=GLsizei(lvs.size());
+	if(renderState.showVertexLinks)
+		{
+		/* Add vertex links: */
+		lv.color=vertexLinkColor;
+		for(std::vector<Point>::const_iterator llIt=renderState.linkLines.begin();llIt!=renderState.linkLines.end();++llIt)
+			{
+			lv.position=*llIt;
+			lvs.push_back(lv);
+			}
+		}
+	
+	if(!lvs.empty())
+		{
+		/* Render all lines from the vertex array: */
+		GLVertexArrayParts::enable(LineVertex::getPartsMask());
+		glVertexPointer(&lvs[0]);
+		if(numVelocityVertices>0)
+			{
+			glLineWidth(1.0f);
+			glDrawArrays(GL_LINES,0,numVelocityVertices);
+			}
+		if(GLsizei(lvs.size())>numVelocityVertices)
+			{
+			glLineWidth(vertexLinkLineWidth);
+			glDrawArrays(GL_LINES,numVelocityVertices,GLsizei(lvs.size())-numVelocityVertices);
+			}
+		GLVertexArrayParts::disable(LineVertex::getPartsMask());
+		}
+	
+	glEnable(GL_LIGHTING);
+	
+	if(renderState.showUnits)
+		{
+		/* Sort all units (real ones and ghost units) into per-type batches: */
+		std::vector<UnitBatch>& batches=dataItem->unitBatches;
+		for(std::vector<UnitBatch>::iterator bIt=batches.begin();bIt!=batches.end();++bIt)
+			bIt->units.clear();
+		size_t batchIndex=0;
+		for(std::vector<RenderUnit>::const_iterator ruIt=renderState.units.begin();ruIt!=renderState.units.end();++ruIt)
+			{
+			/* Find the unit's batch, starting with the previous unit's: */
+			const UnitRenderer* renderer=ruIt->renderer;
+			if(batchIndex>=batches.size()||batches[batchIndex].renderer!=renderer)
+				{
+				for(batchIndex=0;batchIndex<batches.size()&&batches[batchIndex].renderer!=renderer;++batchIndex)
+					;
+				if(batchIndex==batches.size())
+					{
+					/* Create a new batch and retrieve the unit type's model: */
+					batches.push_back(UnitBatch());
+					batches.back().renderer=renderer;
+					renderer->createMesh(batches.back().mesh);
+					}
+				}
+			batches[batchIndex].units.push_back(&*ruIt);
+			}
+		
+		/* Render all batches: */
+		glMaterial(GLMaterialEnums::FRONT,unitMaterial);
+		glEnable(GL_COLOR_MATERIAL);
+		glColorMaterial(GL_FRONT,GL_AMBIENT_AND_DIFFUSE);
+		GLVertexArrayParts::enable(UnitVertex::getPartsMask());
+		for(std::vector<UnitBatch>::iterator bIt=batches.begin();bIt!=batches.end();++bIt)
+			{
+			if(bIt->units.empty()||bIt->mesh.empty())
+				continue;
+			
+			/* Transform the batch's model into the local coordinate system of each of the batch's units: */
+			bIt->vertices.resize(bIt->units.size()*bIt->mesh.size());
+			UnitVertex* vPtr=&bIt->vertices[0];
+			for(std::vector<const RenderUnit*>::const_iterator uIt=bIt->units.begin();uIt!=bIt->units.end();++uIt)
+				{
+				const RenderUnit* ruPtr=*uIt;
+				for(UnitRenderer::Mesh::const_iterator mIt=bIt->mesh.begin();mIt!=bIt->mesh.end();++mIt,++vPtr)
+					{
+					vPtr->color=ruPtr->color;
+					vPtr->normal=ruPtr->orientation.transform(mIt->normal);
+					vPtr->position=ruPtr->position+ruPtr->orientation.transform(mIt->position-Point::origin);
+					}
+				}
+			
+			/* Render the batch with a single draw call: */
+			glVertexPointer(&bIt->vertices[0]);
+			glDrawArrays(GL_TRIANGLES,0,GLsizei(bIt->vertices.size()));
+			}
+		GLVertexArrayParts::disable(UnitVertex::getPartsMask());
+		glDisable(GL_COLOR_MATERIAL);
+		}
+	}
+
+void SpaceGrid::getRenderState(SpaceGrid::RenderState& renderState) const
+	{
+	renderState.units.clear();
+	renderState.linkLines.clear();
+	renderState.unlinkedVertices.clear();
+	
+	/* Copy the rendering flags, which are changed under the same lock as the simulation state: */
+	renderState.showUnits=showUnits;
+	renderState.showVelocities=showVelocities;
+	renderState.showVertexLinks=showVertexLinks;
+	renderState.showUnlinkedVertices=showUnlinkedVertices;
+	
+	/* Copy the states of all real units: */
+	RenderUnit ru;
+	for(const StructuralUnit* uPtr=firstUnit;uPtr!=0;uPtr=uPtr->succ)
+		{
+		ru.renderer=uPtr->getUnitRenderer();
+		ru.position=uPtr->position;
+		ru.orientation=uPtr->orientation;
+		ru.linearVelocity=uPtr->linearVelocity;
+		ru.angularVelocity=uPtr->angularVelocity;
+		if(uPtr->marked)
+			ru.color=markedUnitColor;
+		else if(uPtr->locked)
+			ru.color=lockedUnitColor;
+		else
+			ru.color=GLColor<GLfloat,4>(uPtr->color[0],uPtr->color[1],uPtr->color[2],1.0f);
+		renderState.units.push_back(ru);
+		
+		/* Copy the unit's vertex links and unlinked vertices: */
+		int numVertices=uPtr->getNumVertices();
+		for(int i=0;i<numVertices;++i)
+			{
+			const StructuralUnit::VertexLink& vl=uPtr->getVertexLink(i);
+			if(vl.unit==0)
+				renderState.unlinkedVertices.push_back(uPtr->getVertex(i));
+			else if(uPtr->id<vl.unit->id)
+				{
+				renderState.linkLines.push_back(uPtr->position);
+				renderState.linkLines.push_back(uPtr->position+wrapDistance(vl.unit->position-uPtr->position));
+				}
+			}
+		}
+	renderState.numRealUnits=renderState.units.size();
+	
+	/* Copy the states of all ghost units, whose models are their source units' models moved by the ghosts' offsets: */
+	for(const StructuralUnit* uPtr=firstGhostUnit;uPtr!=0;uPtr=uPtr->succ)
+		{
+		const GhostUnit* gPtr=static_cast<const GhostUnit*>(uPtr);
+		ru.renderer=uPtr->getUnitRenderer();
+		ru.position=gPtr->getSourceUnit()->position+gPtr->getSourceOffset();
+		ru.orientation=gPtr->getSourceUnit()->orientation;
+		ru.linearVelocity=uPtr->linearVelocity;
+		ru.angularVelocity=uPtr->angularVelocity;
+		if(uPtr->marked)
+			ru.color=markedUnitColor;
+		else if(uPtr->locked)
+			ru.color=lockedUnitColor;
+		else
+			ru.color=GLColor<GLfloat,4>(uPtr->color[0],uPtr->color[1],uPtr->color[2],1.0f);
+		renderState.units.push_back(ru);
+		
+		/* Copy the unit's unlinked vertices: */
+		int numVertices=uPtr->getNumVertices();
+		for(int i=0;i<numVertices;++i)
+			if(uPtr->getVertexLink(i).unit==0)
+				renderState.unlinkedVertices.push_back(uPtr->getVertex(i));
+		}
+	}
+
+void SpaceGrid::glRenderAction(const SpaceGrid::RenderState& renderState,GLContextData& contextData) const
 	{
 	/* Retrieve the context data item: */
 	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
@@ -1200,132 +1712,78 @@ void SpaceGrid::glRenderAction(GLContextData& contextData) const
 		}
 	#endif
 	
-	glLineWidth(1.0f);
-	
-	if(showVelocities)
+	if(batchedRendering)
 		{
-		/* Render structural units' velocities: */
-		glBegin(GL_LINES);
-		for(const StructuralUnit* uPtr=firstUnit;uPtr!=0;uPtr=uPtr->succ)
-			{
-			glColor3f(1.0f,0.0f,0.0f);
-			glVertex(uPtr->position);
-			glVertex(uPtr->position+uPtr->linearVelocity);
-			glColor3f(0.0f,0.0f,1.0f);
-			glVertex(uPtr->position);
-			glVertex(uPtr->position+uPtr->angularVelocity);
-			}
-		for(const StructuralUnit* uPtr=firstGhostUnit;uPtr!=0;uPtr=uPtr->succ)
-			{
-			glColor3f(1.0f,0.0f,0.0f);
-			glVertex(uPtr->position);
-			glVertex(uPtr->position+uPtr->linearVelocity);
-			glColor3f(0.0f,0.0f,1.0f);
-			glVertex(uPtr->position);
-			glVertex(uPtr->position+uPtr->angularVelocity);
-			}
-		glEnd();
+		/* Render velocities, vertex links, and structural units in batches: */
+		glRenderUnitsBatched(renderState,dataItem);
 		}
-	
-	if(showVertexLinks)
+	else
 		{
-		/* Render vertex links: */
-		glLineWidth(vertexLinkLineWidth);
-		glColor(vertexLinkColor);
-		glBegin(GL_LINES);
-		for(const StructuralUnit* uPtr=firstUnit;uPtr!=0;uPtr=uPtr->succ)
-			{
-			int numVertices=uPtr->getNumVertices();
-			for(int i=0;i<numVertices;++i)
-				{
-				const StructuralUnit::VertexLink& vl=uPtr->getVertexLink(i);
-				if(vl.unit!=0&&uPtr->id<vl.unit->id)
-					{
-					glVertex(uPtr->position);
-					glVertex(vl.unit->position);
-					}
-				}
-			}
-		#if 0
-		for(const StructuralUnit* uPtr=firstGhostUnit;uPtr!=0;uPtr=uPtr->succ)
+		glLineWidth(1.0f);
+		
+		if(renderState.showVelocities)
 			{
-			int numVertices=uPtr->getNumVertices();
-			for(int i=0;i<numVertices;++i)
+			/* Render structural units' velocities: */
+			glBegin(GL_LINES);
+			for(std::vector<RenderUnit>::const_iterator ruIt=renderState.units.begin();ruIt!=renderState.units.end();++ruIt)
 				{
-				const StructuralUnit::VertexLink& vl=uPtr->getVertexLink(i);
-				if(vl.unit!=0&&uPtr->id<vl.unit->id)
-					{
-					glVertex(uPtr->position);
-					glVertex(vl.unit->position+static_cast<const GhostUnit*>(uPtr)->getSourceOffset());
-					}
+				glColor3f(1.0f,0.0f,0.0f);
+				glVertex(ruIt->position);
+				glVertex(ruIt->position+ruIt->linearVelocity);
+				glColor3f(0.0f,0.0f,1.0f);
+				glVertex(ruIt->position);
+				glVertex(ruIt->position+ruIt->angularVelocity);
 				}
+			glEnd();
 			}
-		#endif
-		glEnd();
-		}
-	
-	glEnable(GL_LIGHTING);
-	
-	if(showUnits)
-		{
-		/* Render all units (real ones and ghost units): */
-		glMaterial(GLMaterialEnums::FRONT,unitMaterial);
-		glEnable(GL_COLOR_MATERIAL);
-		glColorMaterial(GL_FRONT,GL_AMBIENT_AND_DIFFUSE);
-		for(const StructuralUnit* uPtr=firstUnit;uPtr!=0;uPtr=uPtr->succ)
+		
+		if(renderState.showVertexLinks)
 			{
-			if(uPtr->marked)
-				glColor(markedUnitColor);
-			else if(uPtr->locked)
-				glColor(lockedUnitColor);
-			else
-				glColor(uPtr->getColor());
-			uPtr->glRenderAction(contextData);
+			/* Render vertex links: */
+			glLineWidth(vertexLinkLineWidth);
+			glColor(vertexLinkColor);
+			glBegin(GL_LINES);
+			for(std::vector<Point>::const_iterator llIt=renderState.linkLines.begin();llIt!=renderState.linkLines.end();++llIt)
+				glVertex(*llIt);
+			glEnd();
 			}
-		for(const StructuralUnit* uPtr=firstGhostUnit;uPtr!=0;uPtr=uPtr->succ)
+		
+		glEnable(GL_LIGHTING);
+		
+		if(renderState.showUnits)
 			{
-			if(uPtr->marked)
-				glColor(markedUnitColor);
-			else if(uPtr->locked)
-				glColor(lockedUnitColor);
-			else
-				glColor(uPtr->getColor());
-			uPtr->glRenderAction(contextData);
+			/* Render all units (real ones and ghost units): */
+			glMaterial(GLMaterialEnums::FRONT,unitMaterial);
+			glEnable(GL_COLOR_MATERIAL);
+			glColorMaterial(GL_FRONT,GL_AMBIENT_AND_DIFFUSE);
+			for(std::vector<RenderUnit>::const_iterator ruIt=renderState.units.begin();ruIt!=renderState.units.end();++ruIt)
+				{
+				/* Move model coordinate system to the unit's position and orientation and render the unit type's model: */
+				UnitRenderer::DataItem* rendererDataItem=contextData.retrieveDataItem<UnitRenderer::DataItem>(ruIt->renderer);
+				glColor(ruIt->color);
+				glPushMatrix();
+				glTranslate(ruIt->position.getComponents());
+				glRotate(ruIt->orientation);
+				glCallList(rendererDataItem->displayListId);
+				glPopMatrix();
+				}
+			glDisable(GL_COLOR_MATERIAL);
 			}
-		glDisable(GL_COLOR_MATERIAL);
 		}
 	
-	if(showUnlinkedVertices)
+	if(renderState.showUnlinkedVertices)
 		{
 		/* Render a marker for all unlinked vertices: */
 		glMaterial(GLMaterialEnums::FRONT,unlinkedVertexMaterial);
 		glPushMatrix();
 		Point lastPos=Point::origin;
-		for(const StructuralUnit* uPtr=firstUnit;uPtr!=0;uPtr=uPtr->succ)
-			{
-			int numVertices=uPtr->getNumVertices();
-			for(int i=0;i<numVertices;++i)
-				if(uPtr->getVertexLink(i).unit==0)
-					{
-					/* Render vertex marker at vertex' position: */
-					Vector offset=uPtr->getVertex(i)-lastPos;
-					glTranslate(offset);
-					glCallList(dataItem->vertexMarkerDisplayListId);
-					lastPos+=offset;
-					}
-			}
-		for(const StructuralUnit* uPtr=firstGhostUnit;uPtr!=0;uPtr=uPtr->succ)
+		for(std::vector<Point>::const_iterator uvIt=renderState.unlinkedVertices.begin();uvIt!=renderState.unlinkedVertices.end();++uvIt)
 			{
-			int numVertices=uPtr->getNumVertices();
-			for(int i=0;i<numVertices;++i)
-				if(uPtr->getVertexLink(i).unit==0)
-					{
-					/* Render vertex marker at vertex' position: */
-					Vector offset=uPtr->getVertex(i)-lastPos;
-					glTranslate(offset);
-					glCallList(dataItem->vertexMarkerDisplayListId);
-					lastPos+=offset;
-					}
+			/* Render vertex marker at vertex' position: */
+			Vector offset=*uvIt-lastPos;
+			glTranslate(offset);
+			glCallList(dataItem->vertexMarkerDisplayListId);
+			lastPos+=offset;
 			}
 		glPopMatrix();
 		}
@@ -1333,4 +1791,12 @@ void SpaceGrid::glRenderAction(GLContextData& contextData) const
 	glPopAttrib();
 	}
 
+void SpaceGrid::glRenderAction(GLContextData& contextData) const
+	{
+	/* Render from a snapshot of the current simulation state: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	getRenderState(dataItem->renderState);
+	glRenderAction(dataItem->renderState,contextData);
+	}
+
 }
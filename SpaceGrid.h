@@ -27,17 +27,17 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <GL/GLObject.h>
 #include <GL/GLColor.h>
 #include <GL/GLMaterial.h>
+#include <GL/GLGeometryVertex.h>
 
 #include "AffineSpace.h"
+#include "StructuralUnit.h"
 #include "SpaceGridCell.h"
+#include "UnitStore.h"
 
 /* Forward declarations: */
 namespace Misc {
 class ConfigurationFileSection;
 }
-namespace NCK {
-class StructuralUnit;
-}
 
 namespace NCK {
 
@@ -47,6 +47,39 @@ class SpaceGrid:public GLObject
 	public:
 	typedef Geometry::ComponentArray<Scalar,3> Size; // Type for grid and grid cell sizes
 	typedef std::vector<StructuralUnit*> StructuralUnitList; // Type for lists of structural units
+	
+	struct RenderUnit // Structure holding the state of a structural unit required for rendering
+		{
+		/* Elements: */
+		public:
+		const UnitRenderer* renderer; // Renderer shared by all units of the unit's type
+		Point position; // Unit's position
+		Rotation orientation; // Unit's orientation
+		Vector linearVelocity,angularVelocity; // Unit's linear and angular velocities
+		GLColor<GLfloat,4> color; // Unit's rendering color, reflecting its marked and locked states
+		};
+	
+	struct RenderState // Structure holding a snapshot of a space grid's simulation state for rendering
+		{
+		/* Elements: */
+		public:
+		std::vector<RenderUnit> units; // States of all real units, followed by states of all ghost units
+		size_t numRealUnits; // Number of real units at the beginning of the unit state list
+		std::vector<Point> linkLines; // Pairs of end points of lines representing the vertex links between real units
+		std::vector<Point> unlinkedVertices; // Positions of all unlinked vertices of real and ghost units
+		bool showUnits; // Flag for visualization of structural units at the time of the snapshot
+		bool showVelocities; // Flag for visualization of structural unit velocities at the time of the snapshot
+		bool showVertexLinks; // Flag for visualization of vertex links at the time of the snapshot
+		bool showUnlinkedVertices; // Flag for visualization of unlinked vertices at the time of the snapshot
+		
+		/* Constructors and destructors: */
+		RenderState(void)
+			:numRealUnits(0),
+			 showUnits(false),showVelocities(false),showVertexLinks(false),showUnlinkedVertices(false)
+			{
+			};
+		};
+	
 	private:
 	typedef Misc::Array<SpaceGridCell,3> CellArray; // Type for grid cell array
 	typedef CellArray::Index Index; // Type for indices in grid cell arrays
@@ -61,11 +94,27 @@ class SpaceGrid:public GLObject
 		Vector positionOffset; // Position offset from cell to ghost cell
 		};
 	
+	typedef GLGeometry::Vertex<void,0,GLfloat,4,void,GLfloat,3> LineVertex; // Type for vertices of batched velocity and vertex link lines
+	typedef GLGeometry::Vertex<void,0,GLfloat,4,GLfloat,GLfloat,3> UnitVertex; // Type for vertices of batched structural unit models
+	
+	struct UnitBatch // Structure to collect all structural units of the same type for batched rendering
+		{
+		/* Elements: */
+		public:
+		const UnitRenderer* renderer; // Renderer shared by all units in this batch
+		UnitRenderer::Mesh mesh; // Model of all units in this batch in local unit coordinates
+		std::vector<const RenderUnit*> units; // List of units in this batch for the current rendering pass
+		std::vector<UnitVertex> vertices; // Transformed model vertices of all units in this batch
+		};
+	
 	struct DataItem:public GLObject::DataItem
 		{
 		/* Elements: */
 		public:
 		GLuint vertexMarkerDisplayListId; // Display list ID for unlinked vertex marker
+		std::vector<UnitBatch> unitBatches; // List of per-type unit batches for batched rendering
+		std::vector<LineVertex> lineVertices; // Vertices of batched velocity and vertex link lines
+		RenderState renderState; // Snapshot of the space grid's state when rendering directly from the grid
 		
 		/* Constructors and destructors: */
 		DataItem(void)
@@ -111,6 +160,18 @@ class SpaceGrid:public GLObject
 		Scalar averageInternalBondAngle;
 		};
 	
+	struct StatisticsSnapshot // Structure holding a snapshot of the simulation state required to calculate grid statistics
+		{
+		/* Elements: */
+		public:
+		std::vector<unsigned int> firstVertices; // Index of each real unit's first vertex in the vertex arrays, followed by the total number of vertices
+		std::vector<Point> positions; // Positions of all real units
+		std::vector<Point> vertices; // Positions of all vertices of all real units
+		std::vector<char> linkedFlags; // Flags whether each vertex is linked to a vertex of another unit
+		std::vector<Point> linkedPositions; // For linked vertices, position of the linked unit's image closest to the vertex's unit
+		std::vector<Point> linkedVertices; // For linked vertices, position of the linked vertex relative to the linked unit's closest image
+		};
+	
 	typedef GLMaterial::Color Color; // Type for color values
 	
 	/* Elements: */
@@ -123,12 +184,21 @@ class SpaceGrid:public GLObject
 	BorderCase borderCases[26]; // Array of associations from a border cell to its ghost cell(s)
 	CellArray cells; // 3D array of grid cells
 	int cellNeighbourOffsets[27]; // Pointer offsets from a cell to its 27 neighbours (including itself)
+	bool minimumImage; // Flag whether periodic axes are handled by minimum-image distances instead of ghost units
+	UnitStore::CellNeighbour cellNeighbours[64*27]; // Wrapped offsets and position shifts from a cell to its 27 neighbours for each border case mask
 	unsigned int nextUnitId; // Next ID number to be assigned to a new unit
 	StructuralUnit* firstUnit; // Pointer to first structural unit in this grid
 	StructuralUnit* lastUnit; // Pointer to last structural unit in this grid
 	StructuralUnit* firstGhostUnit; // Pointer to first ghost unit in this grid
 	StructuralUnit* lastGhostUnit; // Pointer to last ghost unit in this grid
 	Scalar attenuation; // Attenuation factor for linear and angular velocities
+	UnitStore unitStore; // Flat, type-sorted copy of all unit states to calculate unit interactions
+	bool accumulateForces; // Flag whether to accumulate forces in parallel independent of unit order instead of applying them pair by pair
+	bool queryCellsValid; // Flag whether the flat per-cell unit arrays used by ray and closest-unit queries reflect the current unit positions
+	std::vector<unsigned int> queryCellStarts; // Index of the first entry of each grid cell in the query unit arrays, followed by the total number of entries
+	std::vector<StructuralUnit*> queryUnits; // Pointers to all real units sorted by grid cell
+	std::vector<Point> queryPositions; // Positions of all real units sorted by grid cell
+	std::vector<Scalar> queryRadii; // Circumsphere radii of all real units sorted by grid cell
 	
 	/* Rendering flags: */
 	bool showGridBoundary; // Flag for rendering of the grid boundaries
@@ -147,6 +217,7 @@ class SpaceGrid:public GLObject
 	GLfloat unlinkedVertexRadius; // Radius to render unlinked structural unit vertices
 	int unlinkedVertexSubdivision; // Subdivision level to render unlinked structural unit vertices
 	GLMaterial unlinkedVertexMaterial; // Material to render unlinked structural unit vertices
+	bool batchedRendering; // Flag whether to render structural units and lines in batches instead of one at a time
 	
 	/* Simulation statistics: */
 	int numUnits; // Number of real units
@@ -157,6 +228,10 @@ class SpaceGrid:public GLObject
 	/* Private methods: */
 	void initializeGrid(void); // Initializes the grid cell array
 	SpaceGridCell* findCell(const Point& p); // Returns pointer to the grid cell containing the given point
+	void updateCellNeighbours(void); // Updates the cell neighbour table for the current boundary handling mode
+	void createGhostUnits(StructuralUnit* unit); // Creates ghost units for the given unit in all ghost cells associated with its cell
+	void destroyGhostUnits(StructuralUnit* unit); // Destroys all ghost units of the given unit
+	void glRenderUnitsBatched(const RenderState& renderState,DataItem* dataItem) const; // Renders velocities, vertex links, and structural units from the given snapshot in batches
 	
 	/* Constructors and destructors: */
 	public:
@@ -170,13 +245,30 @@ class SpaceGrid:public GLObject
 		return gridBox;
 		};
 	int getPeriodicMask(void) const; // Returns bit mask describing the space grid's periodic boundary conditions
+	bool getMinimumImage(void) const // Returns true if periodic axes are handled by minimum-image distances instead of ghost units
+		{
+		return minimumImage;
+		};
+	void setMinimumImage(bool newMinimumImage); // Selects between minimum-image distances and ghost units to handle periodic axes
+	Vector wrapDistance(const Vector& dist) const; // Returns the minimum image of the given distance vector if minimum-image boundaries are enabled
 	void setAttenuation(Scalar newAttenuation); // Sets grid's attenuation factor
+	bool getAccumulateForces(void) const // Returns true if forces are accumulated in parallel independent of unit order
+		{
+		return accumulateForces;
+		};
+	void setAccumulateForces(bool newAccumulateForces); // Selects between accumulating forces in parallel and applying them pair by pair
+	int getNumSimulationThreads(void) const // Returns the number of threads used to advance simulation time
+		{
+		return unitStore.getNumThreads();
+		};
+	void setNumSimulationThreads(int newNumSimulationThreads); // Sets the number of threads used to advance simulation time
 	
 	/* Unit management methods: */
+	void updateQueryCells(void); // Updates the flat per-cell unit arrays used by ray and closest-unit queries; must be called before issuing those queries from multiple threads
 	void addUnit(StructuralUnit* newUnit); // Adds a new structural unit to this grid
 	StructuralUnitList getAllUnits(void); // Returns list of all structural units currently in the grid
-	StructuralUnit* findUnit(const Point& p); // Returns pointer to closest structural unit intersecting given ray
-	StructuralUnit* findUnit(const Ray& r); // Returns pointer to structural unit containing given point
+	StructuralUnit* findUnit(const Point& p); // Returns pointer to structural unit containing given point
+	StructuralUnit* findUnit(const Ray& r); // Returns pointer to closest structural unit intersecting given ray
 	StructuralUnitList findUnits(const Point& p,Scalar radius); // Returns list of pointers to structural units inside sphere
 	StructuralUnitList getLinkedUnits(StructuralUnit* unit); // Returns list of all structural units linked to given unit
 	StructuralUnitList findLinkedUnits(const Point& p); // Returns list of pointers to structural units linked to the one containing the given point
@@ -198,6 +290,8 @@ class SpaceGrid:public GLObject
 	
 	/* Simulation methods: */
 	void advanceTime(Scalar timeStep); // Advances simulation time by calculating structural unit interactions, moving units and handling collisions
+	void getStatisticsSnapshot(StatisticsSnapshot& snapshot) const; // Takes a snapshot of the current simulation state for calculating statistics
+	static GridStatistics calcGridStatistics(const StatisticsSnapshot& snapshot,int numThreads); // Returns statistics about the given snapshot, calculated with the given number of threads
 	GridStatistics calcGridStatistics(void) const; // Returns statistics about the current simulation state
 	
 	/* Rendering methods: */
@@ -252,6 +346,13 @@ class SpaceGrid:public GLObject
 		return showUnlinkedVertices;
 		};
 	void setShowUnlinkedVertices(bool newShowUnlinkedVertices);
+	bool getBatchedRendering(void) const
+		{
+		return batchedRendering;
+		};
+	void setBatchedRendering(bool newBatchedRendering);
+	void getRenderState(RenderState& renderState) const; // Takes a snapshot of the current simulation state for rendering
+	void glRenderAction(const RenderState& renderState,GLContextData& contextData) const; // Renders the space grid and all structural units from the given snapshot
 	void glRenderAction(GLContextData& contextData) const; // Renders the space grid and all structural units
 	};
 
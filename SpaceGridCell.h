@@ -30,6 +30,7 @@ class StructuralUnit;
 class SpaceGridCell
 	{
 	friend class SpaceGrid;
+	friend class UnitStore;
 	
 	/* Elements: */
 	private:
@@ -31,9 +31,49 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 namespace NCK {
 
-/***********************************
-Methods of class OctahedronRenderer:
-***********************************/
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+void subdivideSphereTriangle(UnitRenderer::Mesh& mesh,Scalar radius,const Vector& n0,const Vector& n1,const Vector& n2,int subdivision)
+	{
+	if(subdivision>0)
+		{
+		/* Split the triangle into four by projecting its edge midpoints onto the unit sphere: */
+		Vector n01=n0+n1;
+		n01.normalize();
+		Vector n12=n1+n2;
+		n12.normalize();
+		Vector n20=n2+n0;
+		n20.normalize();
+		subdivideSphereTriangle(mesh,radius,n0,n01,n20,subdivision-1);
+		subdivideSphereTriangle(mesh,radius,n01,n1,n12,subdivision-1);
+		subdivideSphereTriangle(mesh,radius,n20,n12,n2,subdivision-1);
+		subdivideSphereTriangle(mesh,radius,n01,n12,n20,subdivision-1);
+		}
+	else
+		{
+		/* Store the smooth-shaded triangle: */
+		UnitRenderer::MeshVertex v;
+		v.normal=n0;
+		v.position=Point::origin+n0*radius;
+		mesh.push_back(v);
+		v.normal=n1;
+		v.position=Point::origin+n1*radius;
+		mesh.push_back(v);
+		v.normal=n2;
+		v.position=Point::origin+n2*radius;
+		mesh.push_back(v);
+		}
+	}
+
+}
+
+/*******************************
+Methods of class SphereRenderer:
+*******************************/
 
 void SphereRenderer::initContext(GLContextData& contextData) const
 	{
@@ -51,6 +91,33 @@ void SphereRenderer::initContext(GLContextData& contextData) const
 	glEndList();
 	}
 
+void SphereRenderer::createMesh(UnitRenderer::Mesh& mesh) const
+	{
+	/* Create the twelve vertex directions of an icosahedron: */
+	Scalar a=Scalar(1)/Math::sqrt(Scalar(5));
+	Scalar b=Scalar(2)*a;
+	Vector n[12];
+	n[0]=Vector(0,0,1);
+	for(int i=0;i<5;++i)
+		{
+		Scalar angle0=Scalar(2)*Math::Constants<Scalar>::pi*Scalar(i)/Scalar(5);
+		Scalar angle1=Scalar(2)*Math::Constants<Scalar>::pi*(Scalar(i)+Scalar(0.5))/Scalar(5);
+		n[1+i]=Vector(Math::cos(angle0)*b,Math::sin(angle0)*b,a);
+		n[6+i]=Vector(Math::cos(angle1)*b,Math::sin(angle1)*b,-a);
+		}
+	n[11]=Vector(0,0,-1);
+	
+	/* Create the icosahedron's twenty faces, subdivided twice for a reasonable approximation of a sphere: */
+	for(int i=0;i<5;++i)
+		{
+		int i1=(i+1)%5;
+		subdivideSphereTriangle(mesh,Sphere::radius,n[0],n[1+i],n[1+i1],2);
+		subdivideSphereTriangle(mesh,Sphere::radius,n[1+i],n[6+i],n[1+i1],2);
+		subdivideSphereTriangle(mesh,Sphere::radius,n[1+i1],n[6+i],n[6+i1],2);
+		subdivideSphereTriangle(mesh,Sphere::radius,n[6+i],n[11],n[6+i1],2);
+		}
+	}
+
 /*******************************
 Static elements of class Sphere:
 *******************************/
@@ -22,13 +22,16 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #define SPHERE_INCLUDED
 
 #include "StructuralUnit.h"
+#include "UnitManager.h"
 
 namespace NCK {
 
 class SphereRenderer:public UnitRenderer
 	{
-	/* Methods: */
+	/* Methods from class UnitRenderer: */
+	public:
 	virtual void initContext(GLContextData& contextData) const;
+	virtual void createMesh(Mesh& mesh) const;
 	};
 
 class Sphere:public StructuralUnit
@@ -59,6 +62,10 @@ class Sphere:public StructuralUnit
 		{
 		return radius;
 		};
+	static Scalar getClassMass(void) // Returns mass of all spheres
+		{
+		return mass;
+		};
 	static int getClassNumVertices(void) // Returns number of vertices of sphere class
 		{
 		return 0;
@@ -77,6 +84,10 @@ class Sphere:public StructuralUnit
 		{
 		return mass;
 		};
+	virtual int getUnitType(void) const
+		{
+		return UnitManager::SPHERE;
+		};
 	virtual Vector getVertexOffset(int index) const
 		{
 		return Vector::zero;
@@ -87,6 +98,10 @@ class Sphere:public StructuralUnit
 		};
 	virtual void applyVertexForce(int index,const Vector& force,Scalar timeStep);
 	virtual void applyCentralForce(const Vector& force,Scalar timeStep);
+	virtual const UnitRenderer* getUnitRenderer(void) const
+		{
+		return unitRenderer;
+		};
 	virtual void glRenderAction(GLContextData& contextData) const;
 	};
 
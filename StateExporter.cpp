@@ -0,0 +1,248 @@
+/***********************************************************************
+StateExporter - Class to export simulation states to XYZ or PDB files
+for external analysis tools from a background thread, and functions to
+write those formats.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "StateExporter.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdexcept>
+#include <Misc/StdError.h>
+#include <Misc/MessageLogger.h>
+#include <Misc/FileNameExtensions.h>
+#include <IO/File.h>
+#include <IO/OpenFile.h>
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const Index maxPdbSerial=99999; // Largest atom serial number representable in a PDB file
+
+void writeLine(IO::File& file,const char* format,...) // Writes a formatted line of text to the given file
+	{
+	char line[256];
+	va_list ap;
+	va_start(ap,format);
+	int length=vsnprintf(line,sizeof(line),format,ap);
+	va_end(ap);
+	if(length<0||size_t(length)>=sizeof(line))
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Output line too long");
+	file.write(line,size_t(length));
+	}
+
+inline Point getBondSitePosition(const UnitState& unit,const BondSite& bondSite) // Returns the position of a bonding site of the given unit
+	{
+	return unit.position+unit.orientation.transform(bondSite.offset);
+	}
+
+Size countAtoms(const StateFileHeader& header,const UnitStateArray& states,bool exportBondSites) // Returns the number of atoms exported for the given simulation state
+	{
+	Size result(states.states.size());
+	if(exportBondSites)
+		for(UnitStateArray::UnitStateList::const_iterator sIt=states.states.begin();sIt!=states.states.end();++sIt)
+			result+=Size(header.unitTypes[sIt->unitType].bondSites.size());
+	return result;
+	}
+
+}
+
+/******************************
+Methods of class StateExporter:
+******************************/
+
+void* StateExporter::writerThreadMethod(void)
+	{
+	while(true)
+		{
+		/* Wait for the next posted snapshot: */
+		{
+		Threads::MutexCond::Lock exportLock(exportCond);
+		while(!posted&&!shutdown)
+			exportCond.wait(exportLock);
+		if(!posted)
+			break;
+		}
+		
+		try
+			{
+			/* Stream the snapshot into the export file: */
+			IO::FilePtr file=IO::openFile(snapshot.fileName.c_str(),IO::File::WriteOnly);
+			if(snapshot.format==PDB)
+				writePdbFile(*file,snapshot.header,snapshot.states,snapshot.bonds,snapshot.exportBondSites);
+			else
+				writeXyzFile(*file,snapshot.header,snapshot.states,snapshot.format==EXTENDED_XYZ,snapshot.exportBondSites);
+			}
+		catch(const std::runtime_error& err)
+			{
+			/* Show an error message: */
+			Misc::formattedUserError("StateExporter: Unable to export file %s due to exception %s",snapshot.fileName.c_str(),err.what());
+			}
+		
+		/* Release the snapshot buffer: */
+		{
+		Threads::MutexCond::Lock exportLock(exportCond);
+		posted=false;
+		busy=false;
+		}
+		}
+	
+	return 0;
+	}
+
+StateExporter::StateExporter(void)
+	:busy(false),posted(false),shutdown(false)
+	{
+	/* Start the writer thread: */
+	writerThread.start(this,&StateExporter::writerThreadMethod);
+	}
+
+StateExporter::~StateExporter(void)
+	{
+	/* Shut down the writer thread after it has finished an ongoing export: */
+	{
+	Threads::MutexCond::Lock exportLock(exportCond);
+	shutdown=true;
+	exportCond.signal();
+	}
+	writerThread.join();
+	}
+
+StateExporter::Format StateExporter::getFormat(const char* fileName)
+	{
+	if(Misc::hasCaseExtension(fileName,".pdb"))
+		return PDB;
+	else if(Misc::hasCaseExtension(fileName,".extxyz"))
+		return EXTENDED_XYZ;
+	else if(Misc::hasCaseExtension(fileName,".xyz"))
+		return XYZ;
+	else
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Unknown export format for file %s",fileName);
+	}
+
+StateExporter::Snapshot* StateExporter::startExport(void)
+	{
+	/* Grab the snapshot buffer unless the previous export is still being written: */
+	Threads::MutexCond::Lock exportLock(exportCond);
+	if(busy)
+		return 0;
+	busy=true;
+	return &snapshot;
+	}
+
+void StateExporter::postExport(StateExporter::Snapshot* newSnapshot)
+	{
+	/* Wake up the writer thread: */
+	Threads::MutexCond::Lock exportLock(exportCond);
+	posted=true;
+	exportCond.signal();
+	}
+
+void writeXyzFile(IO::File& file,const StateFileHeader& header,const UnitStateArray& states,bool extended,bool exportBondSites)
+	{
+	/* Write the number of atoms and the comment line: */
+	writeLine(file,"%u\n",(unsigned int)(countAtoms(header,states,exportBondSites)));
+	if(extended)
+		{
+		/* Record the simulation domain as the periodic lattice: */
+		const Box& d=header.domain;
+		writeLine(file,"Lattice=\"%.6f 0.0 0.0 0.0 %.6f 0.0 0.0 0.0 %.6f\" Origin=\"%.6f %.6f %.6f\" pbc=\"T T T\" Properties=species:S:1:pos:R:3 Time=%u\n",d.getSize(0),d.getSize(1),d.getSize(2),d.min[0],d.min[1],d.min[2],(unsigned int)(states.timeStamp));
+		}
+	else
+		writeLine(file,"Nanotech Construction Kit simulation step %u\n",(unsigned int)(states.timeStamp));
+	
+	/* Write one atom per unit, followed by its bonding sites: */
+	for(UnitStateArray::UnitStateList::const_iterator sIt=states.states.begin();sIt!=states.states.end();++sIt)
+		{
+		const UnitType& ut=header.unitTypes[sIt->unitType];
+		writeLine(file,"%s %.6f %.6f %.6f\n",ut.name.c_str(),sIt->position[0],sIt->position[1],sIt->position[2]);
+		if(exportBondSites)
+			for(Misc::Vector<BondSite>::const_iterator bsIt=ut.bondSites.begin();bsIt!=ut.bondSites.end();++bsIt)
+				{
+				Point p=getBondSitePosition(*sIt,*bsIt);
+				writeLine(file,"X %.6f %.6f %.6f\n",p[0],p[1],p[2]);
+				}
+		}
+	}
+
+void writePdbFile(IO::File& file,const StateFileHeader& header,const UnitStateArray& states,const std::vector<StateFileBond>& bonds,bool exportBondSites)
+	{
+	/* Write the header and the simulation domain as the unit cell: */
+	writeLine(file,"REMARK   1 NANOTECH CONSTRUCTION KIT SIMULATION STEP %u\n",(unsigned int)(states.timeStamp));
+	const Box& d=header.domain;
+	writeLine(file,"CRYST1%9.3f%9.3f%9.3f%7.2f%7.2f%7.2f P 1           1\n",d.getSize(0),d.getSize(1),d.getSize(2),90.0,90.0,90.0);
+	
+	/* Write one atom per unit, followed by its bonding sites, and remember each unit's serial number for CONECT records: */
+	bool writeConect=countAtoms(header,states,exportBondSites)<=maxPdbSerial;
+	std::vector<Index> unitSerials;
+	if(writeConect)
+		unitSerials.reserve(states.states.size());
+	Index serial=1;
+	Index unitIndex=0;
+	for(UnitStateArray::UnitStateList::const_iterator sIt=states.states.begin();sIt!=states.states.end();++sIt,++unitIndex)
+		{
+		const UnitType& ut=header.unitTypes[sIt->unitType];
+		if(writeConect)
+			unitSerials.push_back(serial);
+		unsigned int resSeq=(unitIndex+1)%10000U;
+		writeLine(file,"HETATM%5u %-4.4s %-3.3s A%4u    %8.3f%8.3f%8.3f  1.00  0.00            \n",(unsigned int)(serial%(maxPdbSerial+1)),ut.name.c_str(),ut.name.c_str(),resSeq,sIt->position[0],sIt->position[1],sIt->position[2]);
+		++serial;
+		if(exportBondSites)
+			for(Misc::Vector<BondSite>::const_iterator bsIt=ut.bondSites.begin();bsIt!=ut.bondSites.end();++bsIt,++serial)
+				{
+				Point p=getBondSitePosition(*sIt,*bsIt);
+				writeLine(file,"HETATM%5u X    %-3.3s A%4u    %8.3f%8.3f%8.3f  1.00  0.00           X\n",(unsigned int)(serial%(maxPdbSerial+1)),ut.name.c_str(),resSeq,p[0],p[1],p[2]);
+				}
+		}
+	
+	if(writeConect)
+		{
+		if(exportBondSites)
+			{
+			/* Connect each unit to its bonding sites: */
+			unitIndex=0;
+			for(UnitStateArray::UnitStateList::const_iterator sIt=states.states.begin();sIt!=states.states.end();++sIt,++unitIndex)
+				{
+				Size numBondSites(header.unitTypes[sIt->unitType].bondSites.size());
+				for(Index i=0;i<numBondSites;++i)
+					writeLine(file,"CONECT%5u%5u\n",(unsigned int)(unitSerials[unitIndex]),(unsigned int)(unitSerials[unitIndex]+1+i));
+				}
+			}
+		
+		/* Connect bonded bonding sites, or bonded units if bonding sites are not exported: */
+		for(std::vector<StateFileBond>::const_iterator bIt=bonds.begin();bIt!=bonds.end();++bIt)
+			{
+			Index s0=unitSerials[bIt->unitIndex[0]];
+			Index s1=unitSerials[bIt->unitIndex[1]];
+			if(exportBondSites)
+				{
+				s0+=1+bIt->bondSiteIndex[0];
+				s1+=1+bIt->bondSiteIndex[1];
+				}
+			writeLine(file,"CONECT%5u%5u\n",(unsigned int)(s0),(unsigned int)(s1));
+			}
+		}
+	else
+		Misc::formattedUserWarning("writePdbFile: Omitting CONECT records for %u atoms",(unsigned int)(serial-1));
+	
+	writeLine(file,"END\n");
+	}
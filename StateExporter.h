@@ -0,0 +1,97 @@
+/***********************************************************************
+StateExporter - Class to export simulation states to XYZ or PDB files
+for external analysis tools from a background thread, and functions to
+write those formats.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+Exported files contain one atom per unit, named after the unit's type
+and placed at the unit's center, optionally followed by one dummy atom
+"X" per bonding site. Extended XYZ files additionally record the
+simulation domain as the periodic lattice and the simulation step. PDB
+files record the simulation domain in a CRYST1 record and bonds in
+CONECT records, between bonding site atoms if bonding sites are
+exported, or between unit atoms otherwise; as PDB serial numbers are
+limited to five digits, CONECT records are omitted for files with more
+than 99999 atoms.
+***********************************************************************/
+
+#ifndef STATEEXPORTER_INCLUDED
+#define STATEEXPORTER_INCLUDED
+
+#include <string>
+#include <vector>
+#include <Threads/MutexCond.h>
+#include <Threads/Thread.h>
+
+#include "Common.h"
+#include "StateFile.h"
+
+/* Forward declarations: */
+namespace IO {
+class File;
+}
+
+class StateExporter
+	{
+	/* Embedded classes: */
+	public:
+	enum Format // Enumerated type for export file formats
+		{
+		XYZ,EXTENDED_XYZ,PDB
+		};
+	
+	struct Snapshot // Structure for a simulation state queued for exporting
+		{
+		/* Elements: */
+		public:
+		std::string fileName; // Name of the export file
+		Format format; // Format of the export file
+		bool exportBondSites; // Flag whether to export bonding sites in addition to unit centers
+		StateFileHeader header; // Simulation setup, to be filled in by the caller
+		UnitStateArray states; // Simulation step and unit states, to be filled in by the caller
+		std::vector<StateFileBond> bonds; // "Up" halves of all bonds, to be filled in by the caller
+		};
+	
+	/* Elements: */
+	private:
+	Threads::MutexCond exportCond; // Condition variable protecting the export state and signaling posted snapshots
+	Snapshot snapshot; // The single snapshot buffer
+	bool busy; // Flag whether the snapshot buffer is being filled in or exported
+	bool posted; // Flag whether the snapshot buffer is waiting to be exported
+	bool shutdown; // Flag to shut down the writer thread once the posted snapshot is exported
+	Threads::Thread writerThread; // Thread writing posted snapshots to export files
+	
+	/* Private methods: */
+	void* writerThreadMethod(void); // Method exporting posted snapshots until shut down
+	
+	/* Constructors and destructors: */
+	public:
+	StateExporter(void); // Creates an idle state exporter
+	~StateExporter(void); // Finishes an ongoing export
+	
+	/* Methods: */
+	static Format getFormat(const char* fileName); // Returns the export format associated with the given file name's extension
+	Snapshot* startExport(void); // Returns the snapshot buffer to be filled in by the caller; returns null if the previous export is still being written
+	void postExport(Snapshot* newSnapshot); // Starts exporting a filled-in snapshot
+	};
+
+void writeXyzFile(IO::File& file,const StateFileHeader& header,const UnitStateArray& states,bool extended,bool exportBondSites); // Writes a simulation state to the given file in plain or extended XYZ format
+void writePdbFile(IO::File& file,const StateFileHeader& header,const UnitStateArray& states,const std::vector<StateFileBond>& bonds,bool exportBondSites); // Writes a simulation state, including bonds, to the given file in PDB format
+
+#endif
@@ -0,0 +1,495 @@
+/***********************************************************************
+StateFile - Functions to read and write saved simulation states in the
+chunked NCK 3.0 file format and the legacy NCK 2.0 file format.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "StateFile.h"
+
+#include <string.h>
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include <Misc/SizedTypes.h>
+#include <Misc/StdError.h>
+#include <Misc/MessageLogger.h>
+#include <Misc/ConfigurationFile.h>
+#include <IO/File.h>
+#include <IO/SeekableFile.h>
+
+#include "IO.h"
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const char* stateFileTag2="NanotechConstructionKit 2.0\r\n";
+const char* stateFileTag3="NanotechConstructionKit 3.0\r\n";
+const Misc::UInt32 chunkAlignment=16; // Alignment of chunk data relative to the end of the chunk index
+const Misc::UInt64 chunkEntrySize=4*sizeof(Misc::UInt32)+sizeof(Misc::UInt64); // Size of an entry in a state file's chunk index
+const Misc::UInt64 bondRecordSize=4*sizeof(Index); // Size of a bond in an NCK 2.0 state file
+const size_t chunkBlockSize=1<<20; // Maximum number of bytes to read into a chunk at once
+
+inline Misc::UInt32 makeChunkId(const char id[4]) // Returns a chunk ID from a four-character code
+	{
+	return Misc::UInt32(Misc::UInt8(id[0]))|(Misc::UInt32(Misc::UInt8(id[1]))<<8)|(Misc::UInt32(Misc::UInt8(id[2]))<<16)|(Misc::UInt32(Misc::UInt8(id[3]))<<24);
+	}
+
+const Misc::UInt32 unitTypeChunkId=makeChunkId("UTYP"); // Unit type IDs
+const Misc::UInt32 positionChunkId=makeChunkId("POSN"); // Unit positions as three scalars
+const Misc::UInt32 orientationChunkId=makeChunkId("ORNT"); // Unit orientations as quaternions of four scalars
+const Misc::UInt32 linearVelocityChunkId=makeChunkId("LVEL"); // Unit linear velocities as three scalars
+const Misc::UInt32 angularVelocityChunkId=makeChunkId("AVEL"); // Unit angular velocities as three scalars
+const Misc::UInt32 bondUnitChunkId=makeChunkId("BUNT"); // Pairs of bonded unit indices
+const Misc::UInt32 bondSiteChunkId=makeChunkId("BSIT"); // Pairs of bonded bonding site indices as bytes
+
+class Adler32 // Class to calculate Adler-32 checksums of typed arrays in little-endian byte order
+	{
+	/* Elements: */
+	private:
+	static const Misc::UInt32 modulus=65521U;
+	static const size_t maxBlockSize=5552; // Largest number of bytes that can be summed before the sums can overflow
+	Misc::UInt32 a,b; // The checksum's two running sums
+	
+	/* Private methods: */
+	void addBytes(const unsigned char* bytes,size_t numBytes) // Adds a sequence of bytes to the checksum
+		{
+		while(numBytes>0)
+			{
+			size_t blockSize=numBytes<maxBlockSize?numBytes:maxBlockSize;
+			numBytes-=blockSize;
+			for(;blockSize>0;--blockSize,++bytes)
+				{
+				a+=*bytes;
+				b+=a;
+				}
+			a%=modulus;
+			b%=modulus;
+			}
+		}
+	
+	/* Constructors and destructors: */
+	public:
+	Adler32(void)
+		:a(1),b(0)
+		{
+		}
+	
+	/* Methods: */
+	template <class DataParam>
+	void add(const DataParam* items,size_t numItems) // Adds an array of items to the checksum
+		{
+		#if __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+		/* Add each item's bytes in reverse order: */
+		for(size_t i=0;i<numItems;++i)
+			{
+			unsigned char bytes[sizeof(DataParam)];
+			const unsigned char* itemBytes=reinterpret_cast<const unsigned char*>(items+i);
+			for(size_t j=0;j<sizeof(DataParam);++j)
+				bytes[j]=itemBytes[sizeof(DataParam)-1-j];
+			addBytes(bytes,sizeof(DataParam));
+			}
+		#else
+		/* Add the array's bytes directly: */
+		addBytes(reinterpret_cast<const unsigned char*>(items),numItems*sizeof(DataParam));
+		#endif
+		}
+	Misc::UInt32 getChecksum(void) const // Returns the current checksum
+		{
+		return (b<<16)|a;
+		}
+	};
+
+Misc::UInt64 getRemainingSize(IO::File& file) // Returns the number of bytes between the given file's read position and its end, or the largest representable size if the file's size is unknown
+	{
+	IO::SeekableFile* seekableFile=dynamic_cast<IO::SeekableFile*>(&file);
+	if(seekableFile==0)
+		return ~Misc::UInt64(0);
+	IO::SeekableFile::Offset size=seekableFile->getSize();
+	IO::SeekableFile::Offset pos=seekableFile->getReadPosAbs();
+	return pos<size?Misc::UInt64(size-pos):0;
+	}
+
+struct ChunkEntry // Structure for entries in a state file's chunk index
+	{
+	/* Elements: */
+	public:
+	Misc::UInt32 id; // Chunk's four-character ID
+	Misc::UInt32 itemSize; // Size of a single item in bytes
+	Misc::UInt32 numItems; // Number of items in the chunk
+	Misc::UInt32 checksum; // Adler-32 checksum of the chunk's data
+	Misc::UInt64 offset; // Offset of the chunk's data from the end of the chunk index
+	
+	/* Methods: */
+	Misc::UInt64 getDataSize(void) const // Returns the size of the chunk's data in bytes
+		{
+		return Misc::UInt64(itemSize)*Misc::UInt64(numItems);
+		}
+	};
+
+template <class DataParam>
+inline void addChunk(std::vector<ChunkEntry>& chunks,Misc::UInt32 id,const std::vector<DataParam>& data) // Appends a chunk holding the given data to a chunk index
+	{
+	ChunkEntry entry;
+	entry.id=id;
+	entry.itemSize=Misc::UInt32(sizeof(DataParam));
+	entry.numItems=Misc::UInt32(data.size());
+	Adler32 checksum;
+	checksum.add(data.data(),data.size());
+	entry.checksum=checksum.getChecksum();
+	
+	/* Place the chunk at the next aligned offset after the previous chunk: */
+	entry.offset=0;
+	if(!chunks.empty())
+		{
+		entry.offset=chunks.back().offset+chunks.back().getDataSize();
+		entry.offset=((entry.offset+chunkAlignment-1)/chunkAlignment)*chunkAlignment;
+		}
+	chunks.push_back(entry);
+	}
+
+template <class DataParam>
+inline void writeChunk(IO::File& file,Misc::UInt64& filePos,const ChunkEntry& entry,const std::vector<DataParam>& data) // Writes the given chunk's data after padding the file to the chunk's offset
+	{
+	static const char padding[chunkAlignment]={0};
+	file.write(padding,size_t(entry.offset-filePos));
+	file.write(data.data(),data.size());
+	filePos=entry.offset+entry.getDataSize();
+	}
+
+template <class DataParam>
+inline void readChunk(IO::File& file,const ChunkEntry& entry,size_t numItems,std::vector<DataParam>& data) // Reads and verifies the data of the given chunk
+	{
+	/* Check the chunk's layout: */
+	if(entry.itemSize!=sizeof(DataParam)||entry.numItems!=numItems)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Malformed chunk %.4s",reinterpret_cast<const char*>(&entry.id));
+	
+	/* Read the chunk's data in blocks, so that a corrupted item count in a file of unknown size runs into the end of the file before allocating much memory: */
+	data.clear();
+	size_t blockItems=chunkBlockSize/sizeof(DataParam);
+	while(data.size()<numItems)
+		{
+		size_t numRead=data.size();
+		size_t numBlockItems=numItems-numRead<blockItems?numItems-numRead:blockItems;
+		data.resize(numRead+numBlockItems);
+		file.read(data.data()+numRead,numBlockItems);
+		}
+	
+	/* Verify the chunk's checksum: */
+	Adler32 checksum;
+	checksum.add(data.data(),numItems);
+	if(checksum.getChecksum()!=entry.checksum)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Checksum mismatch in chunk %.4s",reinterpret_cast<const char*>(&entry.id));
+	}
+
+void readStateFile2(IO::File& file,UnitStateArray& states,std::vector<StateFileBond>& bonds) // Reads unit states and bonds from an NCK 2.0 state file
+	{
+	/* Read units into the given unit state array: */
+	readStateArray(file,states,false);
+	
+	/* Read bonds: */
+	Size numBonds=file.read<Size>();
+	if(Misc::UInt64(numBonds)>getRemainingSize(file)/bondRecordSize)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Invalid number of bonds %u",(unsigned int)(numBonds));
+	bonds.clear();
+	for(Size i=0;i<numBonds;++i)
+		{
+		StateFileBond bond;
+		for(int j=0;j<2;++j)
+			{
+			bond.unitIndex[j]=file.read<Index>();
+			bond.bondSiteIndex[j]=file.read<Index>();
+			}
+		bonds.push_back(bond);
+		}
+	}
+
+void readStateFile3(IO::File& file,UnitStateArray& states,std::vector<StateFileBond>& bonds) // Reads unit states and bonds from an NCK 3.0 state file
+	{
+	/* Read the number of units and bonds: */
+	Size numUnits=file.read<Size>();
+	Size numBonds=file.read<Size>();
+	
+	/* Read the chunk index; counts are checked against the remaining file size before allocating memory, if the file's size is known: */
+	Misc::UInt32 numChunks=file.read<Misc::UInt32>();
+	Misc::UInt64 remainingSize=getRemainingSize(file);
+	if(Misc::UInt64(numChunks)>remainingSize/chunkEntrySize)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Invalid number of chunks %u",(unsigned int)(numChunks));
+	remainingSize-=Misc::UInt64(numChunks)*chunkEntrySize;
+	std::vector<ChunkEntry> chunks;
+	for(Misc::UInt32 i=0;i<numChunks;++i)
+		{
+		ChunkEntry entry;
+		entry.id=file.read<Misc::UInt32>();
+		entry.itemSize=file.read<Misc::UInt32>();
+		entry.numItems=file.read<Misc::UInt32>();
+		entry.checksum=file.read<Misc::UInt32>();
+		entry.offset=file.read<Misc::UInt64>();
+		if(entry.offset>remainingSize||entry.getDataSize()>remainingSize-entry.offset)
+			throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Chunk %.4s extends past the end of the file",reinterpret_cast<const char*>(&entry.id));
+		chunks.push_back(entry);
+		}
+	
+	/* Read all chunks in file order: */
+	std::vector<UnitTypeID> unitTypes;
+	std::vector<Scalar> positions,orientations,linearVelocities,angularVelocities;
+	std::vector<Index> bondUnits;
+	std::vector<Misc::UInt8> bondSites;
+	Misc::UInt64 filePos=0;
+	for(std::vector<ChunkEntry>::iterator cIt=chunks.begin();cIt!=chunks.end();++cIt)
+		{
+		/* Skip to the beginning of the chunk's data: */
+		if(cIt->offset<filePos)
+			throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Chunk %.4s overlaps the previous chunk",reinterpret_cast<const char*>(&cIt->id));
+		file.skip<char>(size_t(cIt->offset-filePos));
+		
+		if(cIt->id==unitTypeChunkId)
+			readChunk(file,*cIt,numUnits,unitTypes);
+		else if(cIt->id==positionChunkId)
+			readChunk(file,*cIt,numUnits*3,positions);
+		else if(cIt->id==orientationChunkId)
+			readChunk(file,*cIt,numUnits*4,orientations);
+		else if(cIt->id==linearVelocityChunkId)
+			readChunk(file,*cIt,numUnits*3,linearVelocities);
+		else if(cIt->id==angularVelocityChunkId)
+			readChunk(file,*cIt,numUnits*3,angularVelocities);
+		else if(cIt->id==bondUnitChunkId)
+			readChunk(file,*cIt,numBonds*2,bondUnits);
+		else if(cIt->id==bondSiteChunkId)
+			readChunk(file,*cIt,numBonds*2,bondSites);
+		else
+			{
+			/* Skip the unknown chunk: */
+			file.skip<char>(size_t(cIt->getDataSize()));
+			}
+		filePos=cIt->offset+cIt->getDataSize();
+		}
+	
+	/* Check that all required chunks were present: */
+	if(unitTypes.size()!=numUnits||positions.size()!=numUnits*3||orientations.size()!=numUnits*4||linearVelocities.size()!=numUnits*3||angularVelocities.size()!=numUnits*3)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Missing unit state chunks");
+	if(bondUnits.size()!=numBonds*2||bondSites.size()!=numBonds*2)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Missing bond chunks");
+	
+	/* Assemble the unit states from their components: */
+	states.states.clear();
+	states.states.reserve(numUnits);
+	UnitState unit;
+	unit.pickId=0;
+	for(Index i=0;i<numUnits;++i)
+		{
+		unit.unitType=unitTypes[i];
+		for(int j=0;j<3;++j)
+			{
+			unit.position[j]=positions[i*3+j];
+			unit.linearVelocity[j]=linearVelocities[i*3+j];
+			unit.angularVelocity[j]=angularVelocities[i*3+j];
+			}
+		unit.orientation=Rotation::fromQuaternion(&orientations[i*4]);
+		states.states.push_back(unit);
+		}
+	
+	/* Assemble the bonds from their components: */
+	bonds.resize(numBonds);
+	for(Index i=0;i<numBonds;++i)
+		for(int j=0;j<2;++j)
+			{
+			bonds[i].unitIndex[j]=bondUnits[i*2+j];
+			bonds[i].bondSiteIndex[j]=bondSites[i*2+j];
+			}
+	}
+
+}
+
+void writeStateFile(IO::File& file,const StateFileHeader& header,const UnitStateArray& states,const std::vector<StateFileBond>& bonds)
+	{
+	/* Split the unit states into their components: */
+	Size numUnits(states.states.size());
+	std::vector<UnitTypeID> unitTypes;
+	unitTypes.reserve(numUnits);
+	std::vector<Scalar> positions,orientations,linearVelocities,angularVelocities;
+	positions.reserve(numUnits*3);
+	orientations.reserve(numUnits*4);
+	linearVelocities.reserve(numUnits*3);
+	angularVelocities.reserve(numUnits*3);
+	for(UnitStateArray::UnitStateList::const_iterator sIt=states.states.begin();sIt!=states.states.end();++sIt)
+		{
+		unitTypes.push_back(sIt->unitType);
+		const Scalar* q=sIt->orientation.getQuaternion();
+		for(int i=0;i<4;++i)
+			orientations.push_back(q[i]);
+		for(int i=0;i<3;++i)
+			{
+			positions.push_back(sIt->position[i]);
+			linearVelocities.push_back(sIt->linearVelocity[i]);
+			angularVelocities.push_back(sIt->angularVelocity[i]);
+			}
+		}
+	
+	/* Split the bonds into their components: */
+	Size numBonds(bonds.size());
+	std::vector<Index> bondUnits;
+	bondUnits.reserve(numBonds*2);
+	std::vector<Misc::UInt8> bondSites;
+	bondSites.reserve(numBonds*2);
+	for(std::vector<StateFileBond>::const_iterator bIt=bonds.begin();bIt!=bonds.end();++bIt)
+		for(int i=0;i<2;++i)
+			{
+			if(bIt->bondSiteIndex[i]>255U)
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Bonding site index %u out of range",(unsigned int)(bIt->bondSiteIndex[i]));
+			bondUnits.push_back(bIt->unitIndex[i]);
+			bondSites.push_back(Misc::UInt8(bIt->bondSiteIndex[i]));
+			}
+	
+	/* Create the chunk index: */
+	std::vector<ChunkEntry> chunks;
+	addChunk(chunks,unitTypeChunkId,unitTypes);
+	addChunk(chunks,positionChunkId,positions);
+	addChunk(chunks,orientationChunkId,orientations);
+	addChunk(chunks,linearVelocityChunkId,linearVelocities);
+	addChunk(chunks,angularVelocityChunkId,angularVelocities);
+	addChunk(chunks,bondUnitChunkId,bondUnits);
+	addChunk(chunks,bondSiteChunkId,bondSites);
+	
+	/* Write a file identifier: */
+	char tag[32];
+	memset(tag,0,sizeof(tag));
+	strcpy(tag,stateFileTag3);
+	file.write(tag,sizeof(tag));
+	
+	/* Write the list of unit types, the domain size, and simulation parameters: */
+	Misc::write(header.unitTypes,file);
+	Misc::write(header.domain,file);
+	file.write<Scalar>(header.vertexForceRadius);
+	file.write<Scalar>(header.vertexForceStrength);
+	file.write<Scalar>(header.centralForceOvershoot);
+	file.write<Scalar>(header.centralForceStrength);
+	
+	/* Write the number of units and bonds: */
+	file.write<Size>(numUnits);
+	file.write<Size>(numBonds);
+	
+	/* Write the chunk index: */
+	file.write<Misc::UInt32>(Misc::UInt32(chunks.size()));
+	for(std::vector<ChunkEntry>::iterator cIt=chunks.begin();cIt!=chunks.end();++cIt)
+		{
+		file.write<Misc::UInt32>(cIt->id);
+		file.write<Misc::UInt32>(cIt->itemSize);
+		file.write<Misc::UInt32>(cIt->numItems);
+		file.write<Misc::UInt32>(cIt->checksum);
+		file.write<Misc::UInt64>(cIt->offset);
+		}
+	
+	/* Write the chunks: */
+	Misc::UInt64 filePos=0;
+	writeChunk(file,filePos,chunks[0],unitTypes);
+	writeChunk(file,filePos,chunks[1],positions);
+	writeChunk(file,filePos,chunks[2],orientations);
+	writeChunk(file,filePos,chunks[3],linearVelocities);
+	writeChunk(file,filePos,chunks[4],angularVelocities);
+	writeChunk(file,filePos,chunks[5],bondUnits);
+	writeChunk(file,filePos,chunks[6],bondSites);
+	}
+
+int readStateFile(IO::File& file,StateFileHeader& header,UnitStateArray& states,std::vector<StateFileBond>& bonds)
+	{
+	/* Check the file identifier: */
+	char tag[32];
+	file.read(tag,sizeof(tag));
+	tag[sizeof(tag)-1]='\0';
+	int version;
+	if(strcmp(tag,stateFileTag3)==0)
+		version=3;
+	else if(strcmp(tag,stateFileTag2)==0)
+		version=2;
+	else
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Input file is not a unit file");
+	
+	/* Read the file into temporary structures to leave the given ones untouched if the file is invalid: */
+	StateFileHeader fileHeader;
+	UnitStateArray fileStates;
+	std::vector<StateFileBond> fileBonds;
+	
+	/* Read the list of unit types, the domain size, and simulation parameters: */
+	Misc::read(file,fileHeader.unitTypes);
+	Misc::read(file,fileHeader.domain);
+	fileHeader.vertexForceRadius=file.read<Scalar>();
+	fileHeader.vertexForceStrength=file.read<Scalar>();
+	fileHeader.centralForceOvershoot=file.read<Scalar>();
+	fileHeader.centralForceStrength=file.read<Scalar>();
+	
+	/* Read the unit states and bonds: */
+	if(version==3)
+		readStateFile3(file,fileStates,fileBonds);
+	else
+		readStateFile2(file,fileStates,fileBonds);
+	
+	/* Check the read units and bonds for consistency: */
+	Size numUnits(fileStates.states.size());
+	for(UnitStateArray::UnitStateList::const_iterator sIt=fileStates.states.begin();sIt!=fileStates.states.end();++sIt)
+		if(sIt->unitType>=fileHeader.unitTypes.size())
+			throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Unit type %u out of range",(unsigned int)(sIt->unitType));
+	for(std::vector<StateFileBond>::const_iterator bIt=fileBonds.begin();bIt!=fileBonds.end();++bIt)
+		for(int i=0;i<2;++i)
+			{
+			if(bIt->unitIndex[i]>=numUnits)
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Bonded unit index %u out of range",(unsigned int)(bIt->unitIndex[i]));
+			if(bIt->bondSiteIndex[i]>=fileHeader.unitTypes[fileStates.states[bIt->unitIndex[i]].unitType].bondSites.size())
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Bonding site index %u out of range",(unsigned int)(bIt->bondSiteIndex[i]));
+			}
+	
+	/* Hand the validated simulation state to the caller: */
+	std::swap(header,fileHeader);
+	std::swap(states.states,fileStates.states);
+	std::swap(bonds,fileBonds);
+	
+	return version;
+	}
+
+void readUnitTypes(const Misc::ConfigurationFileSection& configFileSection,UnitTypeList& unitTypes)
+	{
+	std::vector<std::string> unitTypeNames=configFileSection.retrieveValue<std::vector<std::string> >("./structuralUnitTypes");
+	for(std::vector<std::string>::iterator utnIt=unitTypeNames.begin();utnIt!=unitTypeNames.end();++utnIt)
+		{
+		try
+			{
+			/* Go to the unit type's configuration section: */
+			Misc::ConfigurationFileSection utSec=configFileSection.getSection(utnIt->c_str());
+			
+			/* Read a unit type definition: */
+			UnitType newUt;
+			newUt.name=utSec.retrieveString("./name",*utnIt);
+			newUt.radius=utSec.retrieveValue<Scalar>("./radius");
+			newUt.mass=utSec.retrieveValue<Scalar>("./mass");
+			newUt.invMass=Scalar(1)/newUt.mass;
+			newUt.momentOfInertia=utSec.retrieveValue<Tensor>("./momentOfInertia");
+			newUt.invMomentOfInertia=Geometry::invert(newUt.momentOfInertia);
+			newUt.bondSites=utSec.retrieveValue<Misc::Vector<BondSite> >("./bondSites");
+			newUt.meshVertices=utSec.retrieveValue<Misc::Vector<Point> >("./meshVertices");
+			newUt.meshTriangles=utSec.retrieveValue<Misc::Vector<Index> >("./meshTriangles");
+			
+			/* Store the unit type: */
+			unitTypes.push_back(newUt);
+			}
+		catch(const std::runtime_error& err)
+			{
+			Misc::formattedUserError("readUnitTypes: Ignoring unit type %s due to exception %s",utnIt->c_str(),err.what());
+			}
+		}
+	}
@@ -0,0 +1,78 @@
+/***********************************************************************
+StateFile - Functions to read and write saved simulation states in the
+chunked NCK 3.0 file format and the legacy NCK 2.0 file format.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+Layout of an NCK 3.0 state file; all data is little-endian:
+- 32-byte tag "NanotechConstructionKit 3.0\r\n", zero-padded
+- List of unit types, domain box, and four simulation parameters, in the
+  same marshalled representation as in NCK 2.0 files
+- Number of units and number of bonds
+- Chunk index: number of chunks, followed by one entry per chunk
+  containing the chunk's four-character ID, item size, number of items,
+  Adler-32 checksum of its data, and offset of its data relative to the
+  end of the chunk index
+- Chunk data in index order, each chunk starting at a multiple of 16
+  bytes from the end of the chunk index
+Unit states are split into one chunk per component (types, positions,
+orientations as quaternions, linear and angular velocities); bonds are
+split into a chunk of unit index pairs and a chunk of byte-sized bonding
+site index pairs. Readers skip chunks with unknown IDs.
+***********************************************************************/
+
+#ifndef STATEFILE_INCLUDED
+#define STATEFILE_INCLUDED
+
+#include <vector>
+
+#include "Common.h"
+
+/* Forward declarations: */
+namespace Misc {
+class ConfigurationFileSection;
+}
+namespace IO {
+class File;
+}
+
+struct StateFileHeader // Structure for the simulation setup stored in a state file
+	{
+	/* Elements: */
+	public:
+	UnitTypeList unitTypes; // List of unit types
+	Box domain; // Simulation domain
+	Scalar vertexForceRadius; // Radius of vertex force field
+	Scalar vertexForceStrength; // Strength of vertex attraction force
+	Scalar centralForceOvershoot; // Factor of how much centroid repelling force overshoots units' radii
+	Scalar centralForceStrength; // Strength of centroid repelling force
+	};
+
+struct StateFileBond // Structure for a bond between two units in a state file
+	{
+	/* Elements: */
+	public:
+	Index unitIndex[2]; // Indices of the two bonded units
+	Index bondSiteIndex[2]; // Indices of the two bonded units' bonding sites
+	};
+
+void writeStateFile(IO::File& file,const StateFileHeader& header,const UnitStateArray& states,const std::vector<StateFileBond>& bonds); // Writes a simulation state to the given file in NCK 3.0 format
+int readStateFile(IO::File& file,StateFileHeader& header,UnitStateArray& states,std::vector<StateFileBond>& bonds); // Reads a simulation state in NCK 2.0 or 3.0 format from the given file; returns the file's major format version; leaves the given structures untouched if the file is invalid
+void readUnitTypes(const Misc::ConfigurationFileSection& configFileSection,UnitTypeList& unitTypes); // Appends all unit types listed in the given configuration file section to the given list, skipping unit types whose definitions are invalid
+
+#endif
@@ -26,11 +26,52 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Misc/StandardValueCoders.h>
 #include <Math/Math.h>
 #include <Geometry/Endianness.h>
+#include <GL/gl.h>
+#include <GL/GLContextData.h>
+#include <GL/GLGeometryWrappers.h>
 
 #include "GhostUnit.h"
 
 namespace NCK {
 
+/*****************************
+Methods of class UnitRenderer:
+*****************************/
+
+void UnitRenderer::addTriangle(UnitRenderer::Mesh& mesh,const Vector& normal,const Point& p0,const Point& p1,const Point& p2)
+	{
+	MeshVertex v;
+	v.normal=normal;
+	v.position=p0;
+	mesh.push_back(v);
+	v.position=p1;
+	mesh.push_back(v);
+	v.position=p2;
+	mesh.push_back(v);
+	}
+
+void UnitRenderer::initContext(GLContextData& contextData) const
+	{
+	/* Create context data item: */
+	DataItem* dataItem=new DataItem;
+	contextData.addDataItem(this,dataItem);
+	
+	/* Create the unit's model: */
+	Mesh mesh;
+	createMesh(mesh);
+	
+	/* Create model display list: */
+	glNewList(dataItem->displayListId,GL_COMPILE);
+	glBegin(GL_TRIANGLES);
+	for(Mesh::const_iterator mIt=mesh.begin();mIt!=mesh.end();++mIt)
+		{
+		glNormal(mIt->normal);
+		glVertex(mIt->position);
+		}
+	glEnd();
+	glEndList();
+	}
+
 /***************************************
 Static elements of class StructuralUnit:
 ***************************************/
@@ -56,7 +97,7 @@ void StructuralUnit::initClass(const Misc::ConfigurationFileSection& configFileS
 	}
 
 StructuralUnit::StructuralUnit(int sNumVertices,Misc::File& file)
-	:pred(0),succ(0),cell(0),cellPred(0),cellSucc(0),
+	:pred(0),succ(0),cell(0),cellPred(0),cellSucc(0),storeIndex(0),
 	 marked(false),locked(false),
 	 numVertices(sNumVertices),vertexLinks(new VertexLink[numVertices])
 	{
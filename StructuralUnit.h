@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef STRUCTURALUNIT_INCLUDED
 #define STRUCTURALUNIT_INCLUDED
 
+#include <vector>
 #include <Misc/File.h>
 #include <Misc/HashTable.h>
 #include <GL/gl.h>
@@ -37,6 +38,7 @@ class ConfigurationFileSection;
 namespace NCK {
 class SpaceGridCell;
 class SpaceGrid;
+class UnitStore;
 }
 
 namespace NCK {
@@ -45,6 +47,16 @@ class UnitRenderer:public GLObject // Base class to help rendering structural un
 	{
 	/* Embedded classes: */
 	public:
+	struct MeshVertex // Structure for vertices of a unit's model
+		{
+		/* Elements: */
+		public:
+		Vector normal; // Vertex normal vector in local unit coordinates
+		Point position; // Vertex position in local unit coordinates
+		};
+	
+	typedef std::vector<MeshVertex> Mesh; // Type for unit models represented as lists of triangles
+	
 	struct DataItem:public GLObject::DataItem
 		{
 		/* Elements: */
@@ -63,12 +75,22 @@ class UnitRenderer:public GLObject // Base class to help rendering structural un
 			glDeleteLists(displayListId,1);
 			};
 		};
+	
+	/* Protected methods: */
+	protected:
+	static void addTriangle(Mesh& mesh,const Vector& normal,const Point& p0,const Point& p1,const Point& p2); // Appends a flat-shaded triangle to the given mesh
+	
+	/* Methods: */
+	public:
+	virtual void initContext(GLContextData& contextData) const; // Compiles the unit's model into a display list
+	virtual void createMesh(Mesh& mesh) const =0; // Appends the unit's model in local unit coordinates to the given list of triangles
 	};
 
 class StructuralUnit
 	{
 	friend class SpaceGridCell;
 	friend class SpaceGrid;
+	friend class UnitStore;
 	
 	/* Embedded classes: */
 	public:
@@ -134,6 +156,7 @@ class StructuralUnit
 	SpaceGridCell* cell; // Pointer to grid cell containing this unit
 	StructuralUnit* cellPred; // Pointer to previous unit in same grid cell
 	StructuralUnit* cellSucc; // Pointer to next unit in same grid cell
+	unsigned int storeIndex; // Index of this unit in the space grid's flat unit state store during a simulation step
 	
 	protected:
 	bool marked; // Flag if the unit has been marked for subsequent operations
@@ -149,7 +172,7 @@ class StructuralUnit
 	public:
 	static void initClass(const Misc::ConfigurationFileSection& configFileSection); // Initializes class settings based on the given configuration file section
 	StructuralUnit(const Point& sPosition,const Rotation& sOrientation,int sNumVertices) // Places structural unit at given position and orientation
-		:pred(0),succ(0),cell(0),cellPred(0),cellSucc(0),
+		:pred(0),succ(0),cell(0),cellPred(0),cellSucc(0),storeIndex(0),
 		 marked(false),locked(false),
 		 position(sPosition),orientation(sOrientation),
 		 linearVelocity(Vector::zero),angularVelocity(Vector::zero),
@@ -234,6 +257,7 @@ class StructuralUnit
 	void setColor(const Color& newColor); // Sets the unit's rendering color
 	virtual Scalar getRadius(void) const =0; // Returns radius of unit's circumsphere
 	virtual Scalar getMass(void) const =0; // Returns unit's mass
+	virtual int getUnitType(void) const =0; // Returns unit's type as an index into UnitManager::UnitType
 	virtual Vector getVertexOffset(int index) const =0; // Returns offset vector of one vertex in global coordinates
 	virtual Point getVertex(int index) const =0; // Returns position of one vertex in global coordinates
 	virtual void applyVertexForce(int index,const Vector& force,Scalar timeStep) =0; // Applies a force to one of the unit's vertices
@@ -242,6 +266,7 @@ class StructuralUnit
 	void checkVertexLinks(Scalar timeStep); // Checks all existing vertex links and applies vertex forces for valid ones
 	static void establishVertexLinks(StructuralUnit* unit1,StructuralUnit* unit2); // Tries to establish a vertex link between the given units
 	static void interact(StructuralUnit* unit1,StructuralUnit* unit2,Scalar timeStep); // Calculates centroid interaction and interaction of newly established vertex links between the given units
+	virtual const UnitRenderer* getUnitRenderer(void) const =0; // Returns the renderer for units of this unit's type
 	virtual void glRenderAction(GLContextData& contextData) const =0; // Renders the unit
 	void readVertexLinks(Misc::File& file,const IndexUnitMap& indexUnitMap); // Reads a unit's vertex links from a binary file
 	virtual void writeState(Misc::File& file) const; // Writes unit's current state to a binary file
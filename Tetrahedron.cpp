@@ -34,37 +34,15 @@ namespace NCK {
 Methods of class TetrahedronRenderer:
 ************************************/
 
-void TetrahedronRenderer::initContext(GLContextData& contextData) const
+void TetrahedronRenderer::createMesh(UnitRenderer::Mesh& mesh) const
 	{
-	/* Create context data item: */
-	DataItem* dataItem=new DataItem;
-	contextData.addDataItem(this,dataItem);
-	
-	/* Create model display list: */
-	glNewList(dataItem->displayListId,GL_COMPILE);
-	
-	/* Render tetrahedron: */
-	glBegin(GL_TRIANGLES);
-	glNormal(Tetrahedron::renderNormals[0]);
-	glVertex(Tetrahedron::renderVertices[1]);
-	glVertex(Tetrahedron::renderVertices[2]);
-	glVertex(Tetrahedron::renderVertices[3]);
-	glNormal(Tetrahedron::renderNormals[1]);
-	glVertex(Tetrahedron::renderVertices[2]);
-	glVertex(Tetrahedron::renderVertices[0]);
-	glVertex(Tetrahedron::renderVertices[3]);
-	glNormal(Tetrahedron::renderNormals[2]);
-	glVertex(Tetrahedron::renderVertices[0]);
-	glVertex(Tetrahedron::renderVertices[1]);
-	glVertex(Tetrahedron::renderVertices[3]);
-	glNormal(Tetrahedron::renderNormals[3]);
-	glVertex(Tetrahedron::renderVertices[0]);
-	glVertex(Tetrahedron::renderVertices[2]);
-	glVertex(Tetrahedron::renderVertices[1]);
-	glEnd();
-	
-	/* Finish model display list: */
-	glEndList();
+	/* Create tetrahedron: */
+	const Point* v=Tetrahedron::renderVertices;
+	const Vector* n=Tetrahedron::renderNormals;
+	addTriangle(mesh,n[0],v[1],v[2],v[3]);
+	addTriangle(mesh,n[1],v[2],v[0],v[3]);
+	addTriangle(mesh,n[2],v[0],v[1],v[3]);
+	addTriangle(mesh,n[3],v[0],v[2],v[1]);
 	}
 
 /************************************
@@ -22,13 +22,15 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #define TETRAHEDRON_INCLUDED
 
 #include "StructuralUnit.h"
+#include "UnitManager.h"
 
 namespace NCK {
 
 class TetrahedronRenderer:public UnitRenderer
 	{
-	/* Methods: */
-	virtual void initContext(GLContextData& contextData) const;
+	/* Methods from class UnitRenderer: */
+	public:
+	virtual void createMesh(Mesh& mesh) const;
 	};
 
 class Tetrahedron:public StructuralUnit
@@ -65,6 +67,10 @@ class Tetrahedron:public StructuralUnit
 		{
 		return radius;
 		};
+	static Scalar getClassMass(void) // Returns mass of all tetrahedra
+		{
+		return mass;
+		};
 	static int getClassNumVertices(void) // Returns number of vertices of tetrahedron class
 		{
 		return 4;
@@ -83,6 +89,10 @@ class Tetrahedron:public StructuralUnit
 		{
 		return mass;
 		};
+	virtual int getUnitType(void) const
+		{
+		return UnitManager::TETRAHEDRON;
+		};
 	virtual Vector getVertexOffset(int index) const
 		{
 		return orientation.transform(vertexOffsets[index]);
@@ -93,6 +103,10 @@ class Tetrahedron:public StructuralUnit
 		};
 	virtual void applyVertexForce(int index,const Vector& force,Scalar timeStep);
 	virtual void applyCentralForce(const Vector& force,Scalar timeStep);
+	virtual const UnitRenderer* getUnitRenderer(void) const
+		{
+		return unitRenderer;
+		};
 	virtual void glRenderAction(GLContextData& contextData) const;
 	};
 
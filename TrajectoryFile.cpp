@@ -0,0 +1,183 @@
+/***********************************************************************
+TrajectoryFile - Definitions and helper classes shared by the writers
+and readers of recorded simulation trajectories.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "TrajectoryFile.h"
+
+#include <string.h>
+#include <Misc/StdError.h>
+#include <IO/File.h>
+#include <Math/Math.h>
+
+#include "IO.h"
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const char* trajectoryFileTag="NCK Trajectory 1.0\r\n";
+
+}
+
+/***************************************
+Methods of struct TrajectoryFrameHeader:
+***************************************/
+
+void TrajectoryFrameHeader::write(IO::File& file) const
+	{
+	file.write<Misc::UInt8>(keyframe?1:0);
+	file.write<Index>(timeStamp);
+	file.write<Size>(numUnits);
+	file.write<Misc::UInt32>(payloadSize);
+	}
+
+void TrajectoryFrameHeader::read(IO::File& file)
+	{
+	keyframe=file.read<Misc::UInt8>()!=0;
+	timeStamp=file.read<Index>();
+	numUnits=file.read<Size>();
+	payloadSize=file.read<Misc::UInt32>();
+	}
+
+/************************************
+Methods of class TrajectoryQuantizer:
+************************************/
+
+TrajectoryQuantizer::TrajectoryQuantizer(const Box& domain)
+	:origin(domain.min)
+	{
+	/* Map the domain to the full range of 16-bit integers, such that positions wrap around periodic boundaries: */
+	for(int i=0;i<3;++i)
+		{
+		Scalar size=domain.max[i]-domain.min[i];
+		scale[i]=Scalar(65536)/size;
+		invScale[i]=size/Scalar(65536);
+		}
+	}
+
+void TrajectoryQuantizer::quantize(const Point& position,const Rotation& orientation,Misc::UInt16 qPosition[3],Misc::SInt16 qOrientation[4]) const
+	{
+	for(int i=0;i<3;++i)
+		qPosition[i]=Misc::UInt16(long(Math::floor((position[i]-origin[i])*scale[i]+Scalar(0.5)))&0xffffL);
+	
+	/* Quantize the orientation's quaternion with a non-negative real part to avoid sign flips between frames: */
+	const Scalar* q=orientation.getQuaternion();
+	Scalar sign=q[3]<Scalar(0)?Scalar(-32767):Scalar(32767);
+	for(int i=0;i<4;++i)
+		qOrientation[i]=Misc::SInt16(Math::floor(q[i]*sign+Scalar(0.5)));
+	}
+
+void TrajectoryQuantizer::dequantize(const Misc::UInt16 qPosition[3],const Misc::SInt16 qOrientation[4],Point& position,Rotation& orientation) const
+	{
+	for(int i=0;i<3;++i)
+		position[i]=origin[i]+Scalar(qPosition[i])*invScale[i];
+	
+	/* Re-normalize the dequantized quaternion: */
+	Scalar q[4];
+	Scalar len2=Scalar(0);
+	for(int i=0;i<4;++i)
+		{
+		q[i]=Scalar(qOrientation[i]);
+		len2+=q[i]*q[i];
+		}
+	if(len2>Scalar(0))
+		{
+		Scalar invLen=Scalar(1)/Math::sqrt(len2);
+		for(int i=0;i<4;++i)
+			q[i]*=invLen;
+		orientation=Rotation::fromQuaternion(q);
+		}
+	else
+		orientation=Rotation::identity;
+	}
+
+/**********************************
+Methods of class TrajectoryDecoder:
+**********************************/
+
+Misc::UInt32 TrajectoryDecoder::readUnsigned(void)
+	{
+	Misc::UInt32 result=0;
+	for(int shift=0;shift<35;shift+=7)
+		{
+		if(ptr==end)
+			throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Truncated frame payload");
+		Misc::UInt8 byte=*(ptr++);
+		result|=Misc::UInt32(byte&0x7fU)<<shift;
+		if((byte&0x80U)==0)
+			return result;
+		}
+	throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Malformed frame payload");
+	}
+
+void writeTrajectoryHeader(IO::File& file,const UnitTypeList& unitTypes,const Box& domain)
+	{
+	/* Write a file identifier: */
+	char tag[32];
+	memset(tag,0,sizeof(tag));
+	strcpy(tag,trajectoryFileTag);
+	file.write(tag,sizeof(tag));
+	
+	/* Write the list of unit types and the domain size: */
+	Misc::write(unitTypes,file);
+	Misc::write(domain,file);
+	}
+
+void readTrajectoryHeader(IO::File& file,UnitTypeList& unitTypes,Box& domain,Misc::UInt64& frameIndexOffset)
+	{
+	/* Check the file identifier: */
+	char tag[32];
+	file.read(tag,sizeof(tag));
+	tag[sizeof(tag)-1]='\0';
+	if(strcmp(tag,trajectoryFileTag)!=0)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Input file is not a trajectory file");
+	
+	/* Read the list of unit types, the domain size, and the frame index offset: */
+	Misc::read(file,unitTypes);
+	Misc::read(file,domain);
+	frameIndexOffset=file.read<Misc::UInt64>();
+	}
+
+void writeTrajectoryFrameIndex(IO::File& file,const TrajectoryFrameIndex& frameIndex)
+	{
+	file.write<Misc::UInt32>(Misc::UInt32(frameIndex.size()));
+	for(TrajectoryFrameIndex::const_iterator fIt=frameIndex.begin();fIt!=frameIndex.end();++fIt)
+		{
+		file.write<Misc::UInt64>(fIt->offset);
+		file.write<Index>(fIt->timeStamp);
+		file.write<Misc::UInt8>(fIt->keyframe?1:0);
+		}
+	}
+
+void readTrajectoryFrameIndex(IO::File& file,TrajectoryFrameIndex& frameIndex)
+	{
+	/* Read the frame index entry by entry, so that a corrupted number of frames runs into the end of the file before allocating much memory: */
+	Misc::UInt32 numFrames=file.read<Misc::UInt32>();
+	frameIndex.clear();
+	for(Misc::UInt32 i=0;i<numFrames;++i)
+		{
+		TrajectoryFrameInfo info;
+		info.offset=file.read<Misc::UInt64>();
+		info.timeStamp=file.read<Index>();
+		info.keyframe=file.read<Misc::UInt8>()!=0;
+		frameIndex.push_back(info);
+		}
+	}
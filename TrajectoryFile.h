@@ -0,0 +1,154 @@
+/***********************************************************************
+TrajectoryFile - Definitions and helper classes shared by the writers
+and readers of recorded simulation trajectories.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+Layout of a trajectory file; all data is little-endian:
+- 32-byte tag "NCK Trajectory 1.0\r\n", zero-padded
+- List of unit types and domain box, marshalled as in state files
+- 64-bit offset of the frame index, or 0 if the recording was not
+  closed properly
+- Sequence of frames, each consisting of a frame header (keyframe flag,
+  time stamp, number of units, payload size) and a payload
+- Frame index: number of frames, followed by the offset, time stamp,
+  and keyframe flag of each frame
+Frame payloads are streams of variable-length integers. Positions are
+quantized to 16 bits per component across the domain, and orientations
+to 16 bits per quaternion component. A keyframe's payload contains
+each unit's type and quantized position and orientation, followed by
+the complete list of bonds. Any other frame's payload contains the
+differences between each unit's quantized position and orientation and
+those in the preceding frame, followed by the list of bonds created or
+broken since the preceding frame. Keyframes are written at regular
+intervals and whenever units are created, destroyed, or re-ordered.
+***********************************************************************/
+
+#ifndef TRAJECTORYFILE_INCLUDED
+#define TRAJECTORYFILE_INCLUDED
+
+#include <vector>
+#include <Misc/SizedTypes.h>
+
+#include "Common.h"
+
+/* Forward declarations: */
+namespace IO {
+class File;
+}
+
+struct TrajectoryFrameHeader // Structure for the header preceding each frame in a trajectory file
+	{
+	/* Elements: */
+	public:
+	bool keyframe; // Flag whether the frame can be decoded without the frames preceding it
+	Index timeStamp; // Simulation step at which the frame was recorded
+	Size numUnits; // Number of units in the frame
+	Misc::UInt32 payloadSize; // Size of the frame's payload in bytes
+	
+	/* Methods: */
+	void write(IO::File& file) const; // Writes the frame header to the given file
+	void read(IO::File& file); // Reads the frame header from the given file
+	};
+
+struct TrajectoryFrameInfo // Structure for entries in a trajectory file's frame index
+	{
+	/* Elements: */
+	public:
+	Misc::UInt64 offset; // Offset of the frame's header in the trajectory file
+	Index timeStamp; // Simulation step at which the frame was recorded
+	bool keyframe; // Flag whether the frame can be decoded without the frames preceding it
+	};
+
+typedef std::vector<TrajectoryFrameInfo> TrajectoryFrameIndex; // Type for trajectory frame indices
+
+class TrajectoryQuantizer // Class to quantize unit positions and orientations for trajectory frames
+	{
+	/* Elements: */
+	private:
+	Point origin; // Lower corner of the simulation domain
+	Scalar scale[3]; // Scale factors from domain coordinates to quantized positions
+	Scalar invScale[3]; // Scale factors from quantized positions to domain coordinates
+	
+	/* Constructors and destructors: */
+	public:
+	TrajectoryQuantizer(const Box& domain); // Creates a quantizer for the given simulation domain
+	
+	/* Methods: */
+	void quantize(const Point& position,const Rotation& orientation,Misc::UInt16 qPosition[3],Misc::SInt16 qOrientation[4]) const; // Quantizes the given position and orientation
+	void dequantize(const Misc::UInt16 qPosition[3],const Misc::SInt16 qOrientation[4],Point& position,Rotation& orientation) const; // Reconstructs a position and orientation from their quantized representations
+	};
+
+class TrajectoryEncoder // Class to append variable-length integers to a frame payload
+	{
+	/* Elements: */
+	private:
+	std::vector<Misc::UInt8>& buffer; // Buffer receiving the encoded payload
+	
+	/* Constructors and destructors: */
+	public:
+	TrajectoryEncoder(std::vector<Misc::UInt8>& sBuffer)
+		:buffer(sBuffer)
+		{
+		}
+	
+	/* Methods: */
+	void writeUnsigned(Misc::UInt32 value) // Appends an unsigned integer in seven-bit groups
+		{
+		while(value>=0x80U)
+			{
+			buffer.push_back(Misc::UInt8(value|0x80U));
+			value>>=7;
+			}
+		buffer.push_back(Misc::UInt8(value));
+		}
+	void writeSigned(Misc::SInt32 value) // Appends a signed integer in zig-zag encoding
+		{
+		writeUnsigned((Misc::UInt32(value)<<1)^Misc::UInt32(value>>31));
+		}
+	};
+
+class TrajectoryDecoder // Class to read variable-length integers from a frame payload
+	{
+	/* Elements: */
+	private:
+	const Misc::UInt8* ptr; // Current read position
+	const Misc::UInt8* end; // End of the payload
+	
+	/* Constructors and destructors: */
+	public:
+	TrajectoryDecoder(const Misc::UInt8* sBegin,const Misc::UInt8* sEnd)
+		:ptr(sBegin),end(sEnd)
+		{
+		}
+	
+	/* Methods: */
+	Misc::UInt32 readUnsigned(void); // Reads an unsigned integer; throws an exception at the end of the payload
+	Misc::SInt32 readSigned(void) // Reads a signed integer in zig-zag encoding
+		{
+		Misc::UInt32 value=readUnsigned();
+		return Misc::SInt32(value>>1)^-Misc::SInt32(value&0x1U);
+		}
+	};
+
+void writeTrajectoryHeader(IO::File& file,const UnitTypeList& unitTypes,const Box& domain); // Writes a trajectory file header up to, but not including, the frame index offset
+void readTrajectoryHeader(IO::File& file,UnitTypeList& unitTypes,Box& domain,Misc::UInt64& frameIndexOffset); // Reads a trajectory file header
+void writeTrajectoryFrameIndex(IO::File& file,const TrajectoryFrameIndex& frameIndex); // Writes a trajectory file's frame index
+void readTrajectoryFrameIndex(IO::File& file,TrajectoryFrameIndex& frameIndex); // Reads a trajectory file's frame index
+
+#endif
@@ -0,0 +1,498 @@
+/***********************************************************************
+TrajectoryPlayer - Indirect simulation interface playing back a recorded
+simulation trajectory.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "TrajectoryPlayer.h"
+
+#include <stdexcept>
+#include <Misc/StdError.h>
+#include <Misc/MessageLogger.h>
+#include <IO/OpenFile.h>
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const IO::SeekableFile::Offset frameHeaderSize=sizeof(Misc::UInt8)+sizeof(Index)+sizeof(Size)+sizeof(Misc::UInt32); // Size of a frame header in a trajectory file
+const size_t minKeyframeUnitSize=8; // Minimum encoded size of a unit in a keyframe payload, one byte each for type, position, and orientation components
+
+}
+
+/*********************************
+Methods of class TrajectoryPlayer:
+*********************************/
+
+const Box& TrajectoryPlayer::readFileHeader(void)
+	{
+	/* Read the trajectory file header: */
+	file->setEndianness(Misc::LittleEndian);
+	Misc::UInt64 frameIndexOffset;
+	readTrajectoryHeader(*file,unitTypes,domain,frameIndexOffset);
+	
+	/* Read the frame index, or rebuild it if the recording was not closed properly: */
+	if(frameIndexOffset!=0)
+		{
+		file->setReadPosAbs(IO::SeekableFile::Offset(frameIndexOffset));
+		readTrajectoryFrameIndex(*file,frameIndex);
+		}
+	else
+		buildFrameIndex();
+	
+	if(frameIndex.empty())
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Trajectory file contains no frames");
+	
+	return domain;
+	}
+
+void TrajectoryPlayer::buildFrameIndex(void)
+	{
+	/* Scan the frame headers following the file header up to the end of the file or the first truncated frame: */
+	IO::SeekableFile::Offset fileSize=file->getSize();
+	IO::SeekableFile::Offset framePos=file->getReadPosAbs();
+	while(framePos+frameHeaderSize<=fileSize)
+		{
+		TrajectoryFrameHeader header;
+		header.read(*file);
+		IO::SeekableFile::Offset nextFramePos=framePos+frameHeaderSize+IO::SeekableFile::Offset(header.payloadSize);
+		if(nextFramePos>fileSize)
+			break;
+		
+		TrajectoryFrameInfo info;
+		info.offset=Misc::UInt64(framePos);
+		info.timeStamp=header.timeStamp;
+		info.keyframe=header.keyframe;
+		frameIndex.push_back(info);
+		
+		/* Skip the frame's payload: */
+		framePos=nextFramePos;
+		file->setReadPosAbs(framePos);
+		}
+	
+	Misc::formattedUserWarning("TrajectoryPlayer: Trajectory file was not closed properly; recovered %u frames",(unsigned int)(frameIndex.size()));
+	}
+
+void* TrajectoryPlayer::prefetchThreadMethod(void)
+	{
+	IO::SeekableFile::Offset fileSize=file->getSize();
+	while(true)
+		{
+		/* Wait for a free frame buffer and a frame to read: */
+		RawFrame* rawFrame;
+		unsigned int generation;
+		{
+		Threads::MutexCond::Lock prefetchLock(prefetchCond);
+		while(!shutdown&&(freeRawFrames.empty()||nextPrefetchFrame>=frameIndex.size()))
+			prefetchCond.wait(prefetchLock);
+		if(shutdown)
+			break;
+		rawFrame=freeRawFrames.back();
+		freeRawFrames.pop_back();
+		rawFrame->frameIndex=nextPrefetchFrame;
+		++nextPrefetchFrame;
+		generation=prefetchGeneration;
+		}
+		
+		/* Read the frame's header and payload: */
+		try
+			{
+			IO::SeekableFile::Offset framePos(frameIndex[rawFrame->frameIndex].offset);
+			file->setReadPosAbs(framePos);
+			rawFrame->header.read(*file);
+			
+			/* Check that the payload ends before the next frame, or before the end of the file for the last frame: */
+			IO::SeekableFile::Offset frameEnd=rawFrame->frameIndex+1<frameIndex.size()?IO::SeekableFile::Offset(frameIndex[rawFrame->frameIndex+1].offset):fileSize;
+			if(IO::SeekableFile::Offset(rawFrame->header.payloadSize)>frameEnd-framePos-frameHeaderSize)
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Invalid payload size %u",(unsigned int)(rawFrame->header.payloadSize));
+			rawFrame->payload.resize(rawFrame->header.payloadSize);
+			file->read(rawFrame->payload.data(),rawFrame->payload.size());
+			rawFrame->valid=true;
+			}
+		catch(const std::runtime_error& err)
+			{
+			Misc::formattedUserError("TrajectoryPlayer: Unable to read frame %u due to exception %s",(unsigned int)(rawFrame->frameIndex),err.what());
+			rawFrame->valid=false;
+			}
+		
+		/* Queue the frame unless prefetching was restarted while it was being read: */
+		{
+		Threads::MutexCond::Lock prefetchLock(prefetchCond);
+		if(generation==prefetchGeneration)
+			readyRawFrames.push_back(rawFrame);
+		else
+			freeRawFrames.push_back(rawFrame);
+		prefetchCond.broadcast();
+		}
+		}
+	
+	return 0;
+	}
+
+void TrajectoryPlayer::restartPrefetching(Index newNextFrame)
+	{
+	Threads::MutexCond::Lock prefetchLock(prefetchCond);
+	
+	/* Invalidate frames that are currently being read and return all prefetched frames to the pool: */
+	++prefetchGeneration;
+	for(std::deque<RawFrame*>::iterator rfIt=readyRawFrames.begin();rfIt!=readyRawFrames.end();++rfIt)
+		freeRawFrames.push_back(*rfIt);
+	readyRawFrames.clear();
+	
+	/* Continue reading at the given frame: */
+	nextPrefetchFrame=newNextFrame;
+	prefetchCond.broadcast();
+	}
+
+TrajectoryPlayer::RawFrame* TrajectoryPlayer::getRawFrame(void)
+	{
+	Threads::MutexCond::Lock prefetchLock(prefetchCond);
+	while(!shutdown&&readyRawFrames.empty())
+		prefetchCond.wait(prefetchLock);
+	if(shutdown)
+		return 0;
+	
+	RawFrame* result=readyRawFrames.front();
+	readyRawFrames.pop_front();
+	return result;
+	}
+
+void TrajectoryPlayer::releaseRawFrame(TrajectoryPlayer::RawFrame* rawFrame)
+	{
+	Threads::MutexCond::Lock prefetchLock(prefetchCond);
+	freeRawFrames.push_back(rawFrame);
+	prefetchCond.broadcast();
+	}
+
+void TrajectoryPlayer::decodeFrame(const TrajectoryPlayer::RawFrame& rawFrame)
+	{
+	/* Invalidate the quantized unit states until the next keyframe if the frame could not be read: */
+	if(!rawFrame.valid)
+		{
+		haveKeyframe=false;
+		return;
+		}
+	
+	try
+		{
+		/* Decode the frame's unit states; bonds are not needed for rendering and are skipped: */
+		TrajectoryDecoder decoder(rawFrame.payload.data(),rawFrame.payload.data()+rawFrame.payload.size());
+		Size numUnits=rawFrame.header.numUnits;
+		if(rawFrame.header.keyframe)
+			{
+			/* Check the number of units against the payload size before allocating memory: */
+			if(numUnits>rawFrame.payload.size()/minKeyframeUnitSize)
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Invalid number of units %u in frame %u",(unsigned int)(numUnits),(unsigned int)(rawFrame.frameIndex));
+			
+			/* Decode each unit's type and absolute quantized position and orientation: */
+			qUnitTypes.resize(numUnits);
+			qPositions.resize(numUnits*3);
+			qOrientations.resize(numUnits*4);
+			Misc::UInt16* qpPtr=qPositions.data();
+			Misc::SInt16* qoPtr=qOrientations.data();
+			for(Size unitIndex=0;unitIndex<numUnits;++unitIndex,qpPtr+=3,qoPtr+=4)
+				{
+				Misc::UInt32 unitType=decoder.readUnsigned();
+				if(unitType>=unitTypes.size())
+					throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Invalid unit type %u",(unsigned int)(unitType));
+				qUnitTypes[unitIndex]=UnitTypeID(unitType);
+				for(int i=0;i<3;++i)
+					qpPtr[i]=Misc::UInt16(decoder.readUnsigned());
+				for(int i=0;i<4;++i)
+					qoPtr[i]=Misc::SInt16(decoder.readSigned());
+				}
+			
+			haveKeyframe=true;
+			}
+		else if(haveKeyframe)
+			{
+			if(numUnits!=qUnitTypes.size())
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Mismatching number of units in frame %u",(unsigned int)(rawFrame.frameIndex));
+			
+			/* Apply the differences to each unit's quantized position and orientation: */
+			Misc::UInt16* qpPtr=qPositions.data();
+			Misc::SInt16* qoPtr=qOrientations.data();
+			for(Size unitIndex=0;unitIndex<numUnits;++unitIndex,qpPtr+=3,qoPtr+=4)
+				{
+				/* Position differences wrap around the periodic domain: */
+				for(int i=0;i<3;++i)
+					qpPtr[i]=Misc::UInt16(qpPtr[i]+Misc::UInt16(decoder.readSigned()));
+				for(int i=0;i<4;++i)
+					qoPtr[i]=Misc::SInt16(Misc::SInt32(qoPtr[i])+decoder.readSigned());
+				}
+			}
+		}
+	catch(const std::runtime_error& err)
+		{
+		Misc::formattedUserError("TrajectoryPlayer: Unable to decode frame %u due to exception %s",(unsigned int)(rawFrame.frameIndex),err.what());
+		haveKeyframe=false;
+		}
+	}
+
+void TrajectoryPlayer::postState(Index frame)
+	{
+	/* Don't post states that are not based on a keyframe: */
+	if(!haveKeyframe)
+		return;
+	
+	/* Dequantize the unit states into a new reduced unit state array: */
+	ReducedUnitStateArray& states=unitStates.startNewValue();
+	states.sessionId=sessionId;
+	states.timeStamp=frameIndex[frame].timeStamp;
+	states.states.clear();
+	states.states.reserve(qUnitTypes.size());
+	const Misc::UInt16* qpPtr=qPositions.data();
+	const Misc::SInt16* qoPtr=qOrientations.data();
+	ReducedUnitState r;
+	for(std::vector<UnitTypeID>::const_iterator utIt=qUnitTypes.begin();utIt!=qUnitTypes.end();++utIt,qpPtr+=3,qoPtr+=4)
+		{
+		Point position;
+		Rotation orientation;
+		quantizer.dequantize(qpPtr,qoPtr,position,orientation);
+		r.unitType=*utIt;
+		r.position=ReducedUnitState::Point(position);
+		r.orientation=ReducedUnitState::Rotation(orientation);
+		states.states.push_back(r);
+		}
+	unitStates.postNewValue();
+	}
+
+void TrajectoryPlayer::setTargetFrame(Index newTargetFrame)
+	{
+	/* Wake up the playback thread: */
+	Threads::MutexCond::Lock targetLock(targetCond);
+	targetFrame=newTargetFrame;
+	targetChanged=true;
+	targetCond.signal();
+	}
+
+void* TrajectoryPlayer::playbackThreadMethod(void)
+	{
+	Index nextFrame=0;
+	while(true)
+		{
+		/* Wait for the next target frame: */
+		Index target;
+		{
+		Threads::MutexCond::Lock targetLock(targetCond);
+		while(!targetChanged&&!shutdown)
+			targetCond.wait(targetLock);
+		if(shutdown)
+			break;
+		target=targetFrame;
+		targetChanged=false;
+		}
+		
+		/* Find the closest keyframe at or before the target frame: */
+		Index keyframe=target;
+		while(keyframe>0&&!frameIndex[keyframe].keyframe)
+			--keyframe;
+		
+		/* Restart decoding at the keyframe unless the target can be reached by decoding forward from the current frame: */
+		if(nextFrame<=keyframe||nextFrame>target+1||!haveKeyframe)
+			{
+			restartPrefetching(keyframe);
+			nextFrame=keyframe;
+			haveKeyframe=false;
+			}
+		
+		/* Decode all frames up to and including the target frame and post the target frame's state: */
+		while(nextFrame<=target)
+			{
+			RawFrame* rawFrame=getRawFrame();
+			if(rawFrame==0)
+				return 0;
+			decodeFrame(*rawFrame);
+			releaseRawFrame(rawFrame);
+			++nextFrame;
+			}
+		postState(target);
+		}
+	
+	return 0;
+	}
+
+TrajectoryPlayer::TrajectoryPlayer(const char* fileName,double sPlaybackRate,unsigned int prefetchSize)
+	:file(IO::openSeekableFile(fileName)),
+	 quantizer(readFileHeader()),
+	 rawFrames(prefetchSize>0?prefetchSize:1),
+	 prefetchGeneration(0),nextPrefetchFrame(0),shutdown(false),
+	 playbackRate(sPlaybackRate>0.0?sPlaybackRate:0.0),paused(false),pausedAtEnd(false),playbackTime(0.0),
+	 targetFrame(0),targetChanged(true),
+	 haveKeyframe(false)
+	{
+	/* Make all raw frame buffers available: */
+	for(std::vector<RawFrame>::iterator rfIt=rawFrames.begin();rfIt!=rawFrames.end();++rfIt)
+		freeRawFrames.push_back(&*rfIt);
+	
+	/* Validate the session; the trajectory's unit types and domain never change: */
+	sessionId=1;
+	
+	/* Start playback at the first frame: */
+	playbackTime=double(frameIndex[0].timeStamp);
+	
+	/* Start the prefetching and playback threads: */
+	prefetchThread.start(this,&TrajectoryPlayer::prefetchThreadMethod);
+	playbackThread.start(this,&TrajectoryPlayer::playbackThreadMethod);
+	}
+
+TrajectoryPlayer::~TrajectoryPlayer(void)
+	{
+	/* Shut down the prefetching and playback threads: */
+	{
+	Threads::MutexCond::Lock prefetchLock(prefetchCond);
+	shutdown=true;
+	prefetchCond.broadcast();
+	}
+	{
+	Threads::MutexCond::Lock targetLock(targetCond);
+	targetCond.signal();
+	}
+	playbackThread.join();
+	prefetchThread.join();
+	}
+
+const SimulationInterface::Parameters& TrajectoryPlayer::getParameters(void) const
+	{
+	return parameters;
+	}
+
+void TrajectoryPlayer::setParameters(const SimulationInterface::Parameters& newParameters)
+	{
+	/* Ignore */
+	}
+
+bool TrajectoryPlayer::lockNewState(void)
+	{
+	return unitStates.lockNewValue();
+	}
+
+bool TrajectoryPlayer::isLockedStateValid(void) const
+	{
+	return unitStates.getLockedValue().sessionId==sessionId;
+	}
+
+PickID TrajectoryPlayer::pick(const Point& pickPosition,Scalar pickRadius,const Rotation& pickOrientation,bool pickConnected)
+	{
+	/* Ignore */
+	return 0;
+	}
+
+PickID TrajectoryPlayer::pick(const Point& pickPosition,const Vector& pickDirection,const Rotation& pickOrientation,bool pickConnected)
+	{
+	/* Ignore */
+	return 0;
+	}
+
+PickID TrajectoryPlayer::paste(const Point& newPosition,const Rotation& newOrientation,const Vector& newLinearVelocity,const Vector& newAngularVelocity)
+	{
+	/* Ignore */
+	return 0;
+	}
+
+void TrajectoryPlayer::create(PickID pickId,UnitTypeID newTypeId,const Point& newPosition,const Rotation& newOrientation,const Vector& newLinearVelocity,const Vector& newAngularVelocity)
+	{
+	/* Ignore */
+	}
+
+void TrajectoryPlayer::setState(PickID pickId,const Point& newPosition,const Rotation& newOrientation,const Vector& newLinearVelocity,const Vector& newAngularVelocity)
+	{
+	/* Ignore */
+	}
+
+void TrajectoryPlayer::copy(PickID pickId)
+	{
+	/* Ignore */
+	}
+
+void TrajectoryPlayer::destroy(PickID pickId)
+	{
+	/* Ignore */
+	}
+
+void TrajectoryPlayer::release(PickID pickId)
+	{
+	/* Ignore */
+	}
+
+void TrajectoryPlayer::loadState(IO::File& stateFile)
+	{
+	/* Ignore */
+	}
+
+void TrajectoryPlayer::saveState(IO::File& stateFile,SimulationInterface::SaveStateCompleteCallback* completeCallback)
+	{
+	/* Ignore */
+	}
+
+const ReducedUnitStateArray& TrajectoryPlayer::getLockedState(void) const
+	{
+	return unitStates.getLockedValue();
+	}
+
+void TrajectoryPlayer::setPlaybackRate(double newPlaybackRate)
+	{
+	playbackRate=newPlaybackRate>0.0?newPlaybackRate:0.0;
+	}
+
+void TrajectoryPlayer::setPaused(bool newPaused)
+	{
+	paused=newPaused;
+	pausedAtEnd=false;
+	}
+
+bool TrajectoryPlayer::advance(double timeStep)
+	{
+	if(paused)
+		return false;
+	
+	/* Advance the playback time and find the most recent frame that became due: */
+	playbackTime+=timeStep*playbackRate;
+	Size numFrames(frameIndex.size());
+	Index newTargetFrame=targetFrame;
+	while(newTargetFrame+1<numFrames&&double(frameIndex[newTargetFrame+1].timeStamp)<=playbackTime)
+		++newTargetFrame;
+	
+	/* Pause playback at the end of the trajectory: */
+	if(newTargetFrame+1>=numFrames)
+		{
+		paused=true;
+		pausedAtEnd=true;
+		}
+	
+	if(newTargetFrame==targetFrame)
+		return false;
+	setTargetFrame(newTargetFrame);
+	return true;
+	}
+
+void TrajectoryPlayer::seek(Index frame)
+	{
+	/* Continue playback from the given frame: */
+	Index newTargetFrame=frame<frameIndex.size()?frame:Index(frameIndex.size()-1);
+	playbackTime=double(frameIndex[newTargetFrame].timeStamp);
+	setTargetFrame(newTargetFrame);
+	
+	/* Resume playback if it only paused because it reached the end of the trajectory: */
+	if(pausedAtEnd&&newTargetFrame+1<frameIndex.size())
+		{
+		paused=false;
+		pausedAtEnd=false;
+		}
+	}
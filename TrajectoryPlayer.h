@@ -0,0 +1,146 @@
+/***********************************************************************
+TrajectoryPlayer - Indirect simulation interface playing back a recorded
+simulation trajectory.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef TRAJECTORYPLAYER_INCLUDED
+#define TRAJECTORYPLAYER_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <Misc/SizedTypes.h>
+#include <Threads/MutexCond.h>
+#include <Threads/Thread.h>
+#include <Threads/TripleBuffer.h>
+#include <IO/SeekableFile.h>
+
+#include "Common.h"
+#include "IndirectSimulationInterface.h"
+#include "TrajectoryFile.h"
+
+class TrajectoryPlayer:public IndirectSimulationInterface
+	{
+	/* Embedded classes: */
+	private:
+	struct RawFrame // Structure for frames read from the trajectory file ahead of playback
+		{
+		/* Elements: */
+		public:
+		Index frameIndex; // Index of the frame in the trajectory file's frame index
+		bool valid; // Flag whether the frame was read successfully
+		TrajectoryFrameHeader header; // The frame's header
+		std::vector<Misc::UInt8> payload; // The frame's encoded payload
+		};
+	
+	/* Elements: */
+	IO::SeekableFilePtr file; // The trajectory file
+	TrajectoryFrameIndex frameIndex; // Index of all frames in the trajectory file
+	TrajectoryQuantizer quantizer; // Quantizer for unit positions and orientations
+	Parameters parameters; // Dummy simulation parameters
+	
+	/* Prefetching state: */
+	Threads::MutexCond prefetchCond; // Condition variable protecting the prefetching state and signaling read or released frames
+	std::vector<RawFrame> rawFrames; // Pool of raw frame buffers
+	std::vector<RawFrame*> freeRawFrames; // List of raw frame buffers available for reading
+	std::deque<RawFrame*> readyRawFrames; // Queue of raw frames read ahead of playback, in frame order
+	unsigned int prefetchGeneration; // Counter incremented whenever prefetching restarts at a different frame
+	Index nextPrefetchFrame; // Index of the next frame to be read by the prefetching thread
+	bool shutdown; // Flag to shut down the prefetching and playback threads
+	Threads::Thread prefetchThread; // Thread reading frames from the trajectory file ahead of playback
+	
+	/* Playback control state: */
+	double playbackRate; // Playback rate in simulation steps per second
+	bool paused; // Flag whether playback is paused
+	bool pausedAtEnd; // Flag whether playback paused by itself because it reached the end of the trajectory
+	double playbackTime; // Current playback time in simulation steps
+	Threads::MutexCond targetCond; // Condition variable protecting the target frame and signaling target frame changes
+	Index targetFrame; // Index of the frame to be posted by the playback thread
+	bool targetChanged; // Flag whether the target frame changed since the playback thread last looked at it
+	
+	/* Playback-side state: */
+	Threads::Thread playbackThread; // Thread decoding prefetched frames and posting them at the playback rate
+	bool haveKeyframe; // Flag whether the quantized unit states are based on a keyframe
+	std::vector<UnitTypeID> qUnitTypes; // Unit types of the most recently decoded frame
+	std::vector<Misc::UInt16> qPositions; // Quantized unit positions of the most recently decoded frame
+	std::vector<Misc::SInt16> qOrientations; // Quantized unit orientations of the most recently decoded frame
+	Threads::TripleBuffer<ReducedUnitStateArray> unitStates; // Triple buffer of unit states decoded from the trajectory file
+	
+	/* Private methods: */
+	const Box& readFileHeader(void); // Reads the trajectory file's header and frame index and returns the simulation domain
+	void buildFrameIndex(void); // Rebuilds the frame index of a trajectory file that was not closed properly
+	void* prefetchThreadMethod(void); // Method reading frames ahead of playback until shut down
+	void restartPrefetching(Index newNextFrame); // Discards all prefetched frames and restarts prefetching at the given frame
+	RawFrame* getRawFrame(void); // Returns the next prefetched frame; blocks until the frame has been read; returns null on shutdown
+	void releaseRawFrame(RawFrame* rawFrame); // Returns a raw frame buffer to the pool
+	void decodeFrame(const RawFrame& rawFrame); // Applies the given raw frame to the quantized unit states
+	void postState(Index frame); // Posts the quantized unit states as the state of the given frame
+	void setTargetFrame(Index newTargetFrame); // Asks the playback thread to post the given frame
+	void* playbackThreadMethod(void); // Method decoding prefetched frames up to the target frame until shut down
+	
+	/* Constructors and destructors: */
+	public:
+	TrajectoryPlayer(const char* fileName,double sPlaybackRate,unsigned int prefetchSize); // Opens the trajectory file of the given name for playback at the given rate in simulation steps per second, reading up to the given number of frames ahead; playback is driven by calls to advance
+	virtual ~TrajectoryPlayer(void);
+	
+	/* Methods from class SimulationInterface: */
+	virtual const Parameters& getParameters(void) const;
+	virtual void setParameters(const Parameters& newParameters);
+	virtual bool lockNewState(void);
+	virtual bool isLockedStateValid(void) const;
+	virtual PickID pick(const Point& pickPosition,Scalar pickRadius,const Rotation& pickOrientation,bool pickConnected);
+	virtual PickID pick(const Point& pickPosition,const Vector& pickDirection,const Rotation& pickOrientation,bool pickConnected);
+	virtual PickID paste(const Point& newPosition,const Rotation& newOrientation,const Vector& newLinearVelocity,const Vector& newAngularVelocity);
+	virtual void create(PickID pickId,UnitTypeID newTypeId,const Point& newPosition,const Rotation& newOrientation,const Vector& newLinearVelocity,const Vector& newAngularVelocity);
+	virtual void setState(PickID pickId,const Point& newPosition,const Rotation& newOrientation,const Vector& newLinearVelocity,const Vector& newAngularVelocity);
+	virtual void copy(PickID pickId);
+	virtual void destroy(PickID pickId);
+	virtual void release(PickID pickId);
+	virtual void loadState(IO::File& stateFile);
+	virtual void saveState(IO::File& stateFile,SaveStateCompleteCallback* completeCallback =0);
+	
+	/* Methods from class IndirectSimulationInterface: */
+	virtual const ReducedUnitStateArray& getLockedState(void) const;
+	
+	/* New methods: */
+	Size getNumFrames(void) const // Returns the number of frames in the trajectory
+		{
+		return Size(frameIndex.size());
+		}
+	Index getFrameTimeStamp(Index frame) const // Returns the simulation step at which the given frame was recorded
+		{
+		return frameIndex[frame].timeStamp;
+		}
+	Index getTargetFrame(void) const // Returns the index of the frame due at the current playback time
+		{
+		return targetFrame;
+		}
+	bool advance(double timeStep); // Advances the playback time by the given application time step in seconds unless paused; returns true if a different frame became due
+	double getPlaybackRate(void) const // Returns the playback rate in simulation steps per second
+		{
+		return playbackRate;
+		}
+	void setPlaybackRate(double newPlaybackRate); // Sets the playback rate in simulation steps per second
+	bool isPaused(void) const // Returns true if playback is paused
+		{
+		return paused;
+		}
+	void setPaused(bool newPaused); // Pauses or resumes playback
+	void seek(Index frame); // Moves the playback time to the given frame; keeps playback paused if it was paused explicitly, but resumes it if it paused by itself at the end of the trajectory and the given frame is not the last one
+	};
+
+#endif
@@ -0,0 +1,273 @@
+/***********************************************************************
+TrajectoryRecorder - Class to record a sequence of simulation states
+into a trajectory file from a background thread.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "TrajectoryRecorder.h"
+
+#include <utility>
+#include <stdexcept>
+#include <Misc/MessageLogger.h>
+#include <IO/OpenFile.h>
+
+/***********************************
+Methods of class TrajectoryRecorder:
+***********************************/
+
+void TrajectoryRecorder::writeFrame(const TrajectoryRecorder::Frame& frame)
+	{
+	/* Encode the frame's payload: */
+	payload.clear();
+	TrajectoryEncoder encoder(payload);
+	Size numUnits(frame.states.size());
+	Misc::UInt16 qp[3];
+	Misc::SInt16 qo[4];
+	if(frame.keyframe)
+		{
+		/* Encode each unit's type and absolute quantized position and orientation: */
+		qPositions.resize(numUnits*3);
+		qOrientations.resize(numUnits*4);
+		Misc::UInt16* qpPtr=qPositions.data();
+		Misc::SInt16* qoPtr=qOrientations.data();
+		for(std::vector<ReducedUnitState>::const_iterator sIt=frame.states.begin();sIt!=frame.states.end();++sIt,qpPtr+=3,qoPtr+=4)
+			{
+			quantizer.quantize(sIt->position,sIt->orientation,qpPtr,qoPtr);
+			encoder.writeUnsigned(sIt->unitType);
+			for(int i=0;i<3;++i)
+				encoder.writeUnsigned(qpPtr[i]);
+			for(int i=0;i<4;++i)
+				encoder.writeSigned(qoPtr[i]);
+			}
+		
+		/* Encode the complete list of bonds: */
+		encoder.writeUnsigned(Misc::UInt32(frame.bonds.size()));
+		for(std::vector<StateFileBond>::const_iterator bIt=frame.bonds.begin();bIt!=frame.bonds.end();++bIt)
+			for(int i=0;i<2;++i)
+				{
+				encoder.writeUnsigned(bIt->unitIndex[i]);
+				encoder.writeUnsigned(bIt->bondSiteIndex[i]);
+				}
+		}
+	else
+		{
+		/* Encode the differences between each unit's quantized position and orientation and those of the previous frame: */
+		Misc::UInt16* qpPtr=qPositions.data();
+		Misc::SInt16* qoPtr=qOrientations.data();
+		for(std::vector<ReducedUnitState>::const_iterator sIt=frame.states.begin();sIt!=frame.states.end();++sIt,qpPtr+=3,qoPtr+=4)
+			{
+			quantizer.quantize(sIt->position,sIt->orientation,qp,qo);
+			for(int i=0;i<3;++i)
+				{
+				/* Wrap position differences around the periodic domain: */
+				encoder.writeSigned(Misc::SInt16(Misc::UInt16(qp[i]-qpPtr[i])));
+				qpPtr[i]=qp[i];
+				}
+			for(int i=0;i<4;++i)
+				{
+				encoder.writeSigned(Misc::SInt32(qo[i])-Misc::SInt32(qoPtr[i]));
+				qoPtr[i]=qo[i];
+				}
+			}
+		
+		/* Encode the list of bond events: */
+		encoder.writeUnsigned(Misc::UInt32(frame.bondEvents.size()));
+		for(std::vector<BondEvent>::const_iterator beIt=frame.bondEvents.begin();beIt!=frame.bondEvents.end();++beIt)
+			{
+			encoder.writeUnsigned(beIt->created?1:0);
+			for(int i=0;i<2;++i)
+				{
+				encoder.writeUnsigned(beIt->bond.unitIndex[i]);
+				encoder.writeUnsigned(beIt->bond.bondSiteIndex[i]);
+				}
+			}
+		}
+	
+	/* Add the frame to the frame index: */
+	TrajectoryFrameInfo info;
+	info.offset=file->getWritePosAbs();
+	info.timeStamp=frame.timeStamp;
+	info.keyframe=frame.keyframe;
+	frameIndex.push_back(info);
+	
+	/* Write the frame header and payload: */
+	TrajectoryFrameHeader header;
+	header.keyframe=frame.keyframe;
+	header.timeStamp=frame.timeStamp;
+	header.numUnits=numUnits;
+	header.payloadSize=Misc::UInt32(payload.size());
+	header.write(*file);
+	file->write(payload.data(),payload.size());
+	}
+
+void* TrajectoryRecorder::writerThreadMethod(void)
+	{
+	try
+		{
+		while(true)
+			{
+			/* Wait for the next queued frame: */
+			Frame* frame;
+			{
+			Threads::MutexCond::Lock queueLock(queueCond);
+			while(queuedFrames.empty()&&!shutdown)
+				queueCond.wait(queueLock);
+			if(queuedFrames.empty())
+				break;
+			frame=queuedFrames.front();
+			queuedFrames.pop_front();
+			}
+			
+			/* Write the frame: */
+			writeFrame(*frame);
+			
+			/* Return the frame buffer to the pool: */
+			{
+			Threads::MutexCond::Lock queueLock(queueCond);
+			freeFrames.push_back(frame);
+			}
+			}
+		
+		/* Write the frame index and store its offset in the header: */
+		IO::SeekableFile::Offset frameIndexOffset=file->getWritePosAbs();
+		writeTrajectoryFrameIndex(*file,frameIndex);
+		file->setWritePosAbs(frameIndexOffsetPos);
+		file->write<Misc::UInt64>(Misc::UInt64(frameIndexOffset));
+		}
+	catch(const std::runtime_error& err)
+		{
+		/* Stop recording; the trajectory file will be left without a frame index: */
+		Misc::formattedUserError("TrajectoryRecorder::writerThreadMethod: Stopped recording due to exception %s",err.what());
+		}
+	
+	/* Close the trajectory file and notify the simulation: */
+	file=0;
+	{
+	Threads::MutexCond::Lock queueLock(queueCond);
+	shutdown=true;
+	while(!queuedFrames.empty())
+		{
+		freeFrames.push_back(queuedFrames.front());
+		queuedFrames.pop_front();
+		}
+	finished=true;
+	}
+	
+	return 0;
+	}
+
+TrajectoryRecorder::TrajectoryRecorder(const char* fileName,const UnitTypeList& unitTypes,const Box& domain,Index sFrameInterval,unsigned int sKeyframeInterval,unsigned int queueSize)
+	:file(IO::openSeekableFile(fileName,IO::File::WriteOnly)),
+	 quantizer(domain),
+	 frameInterval(sFrameInterval>0?sFrameInterval:1),keyframeInterval(sKeyframeInterval>0?sKeyframeInterval:1),
+	 nextFrameTimeStamp(0),haveKeyframe(false),lastTopologyVersion(0),numFramesSinceKeyframe(0),
+	 numDroppedFrames(0),
+	 frames(queueSize>0?queueSize:1),
+	 shutdown(false),finished(false)
+	{
+	/* Write the trajectory file header with an invalid frame index offset: */
+	file->setEndianness(Misc::LittleEndian);
+	writeTrajectoryHeader(*file,unitTypes,domain);
+	frameIndexOffsetPos=file->getWritePosAbs();
+	file->write<Misc::UInt64>(0);
+	
+	/* Make all frame buffers available: */
+	for(std::vector<Frame>::iterator fIt=frames.begin();fIt!=frames.end();++fIt)
+		freeFrames.push_back(&*fIt);
+	
+	/* Start the writer thread: */
+	writerThread.start(this,&TrajectoryRecorder::writerThreadMethod);
+	}
+
+TrajectoryRecorder::~TrajectoryRecorder(void)
+	{
+	/* Wait for the writer thread to write all queued frames and finish the trajectory file: */
+	finish();
+	writerThread.join();
+	}
+
+void TrajectoryRecorder::finish(void)
+	{
+	/* Shut down the writer thread after it has written all queued frames: */
+	Threads::MutexCond::Lock queueLock(queueCond);
+	shutdown=true;
+	queueCond.signal();
+	}
+
+bool TrajectoryRecorder::isFinished(void)
+	{
+	Threads::MutexCond::Lock queueLock(queueCond);
+	return finished;
+	}
+
+TrajectoryRecorder::Frame* TrajectoryRecorder::startFrame(const UnitStateArray& states,Index topologyVersion)
+	{
+	/* Schedule the next frame: */
+	nextFrameTimeStamp=states.timeStamp+frameInterval;
+	
+	/* Grab a free frame buffer, or drop the frame if the writer thread fell behind or stopped: */
+	Frame* frame=0;
+	{
+	Threads::MutexCond::Lock queueLock(queueCond);
+	if(!shutdown&&!freeFrames.empty())
+		{
+		frame=freeFrames.back();
+		freeFrames.pop_back();
+		}
+	}
+	if(frame==0)
+		{
+		++numDroppedFrames;
+		return 0;
+		}
+	
+	/* Write a keyframe if there is none yet, if units were created, destroyed, or re-ordered, or if the keyframe interval is up: */
+	frame->keyframe=!haveKeyframe||topologyVersion!=lastTopologyVersion||numFramesSinceKeyframe>=keyframeInterval;
+	frame->timeStamp=states.timeStamp;
+	
+	/* Reduce and copy the unit states: */
+	frame->states.resize(states.states.size());
+	std::vector<ReducedUnitState>::iterator rsIt=frame->states.begin();
+	for(UnitStateArray::UnitStateList::const_iterator sIt=states.states.begin();sIt!=states.states.end();++sIt,++rsIt)
+		rsIt->set(*sIt);
+	
+	/* Hand the pending bond events to the frame, or discard them if the frame is a keyframe: */
+	frame->bonds.clear();
+	frame->bondEvents.clear();
+	if(frame->keyframe)
+		{
+		haveKeyframe=true;
+		lastTopologyVersion=topologyVersion;
+		numFramesSinceKeyframe=0;
+		pendingBondEvents.clear();
+		}
+	else
+		{
+		++numFramesSinceKeyframe;
+		std::swap(frame->bondEvents,pendingBondEvents);
+		}
+	
+	return frame;
+	}
+
+void TrajectoryRecorder::postFrame(TrajectoryRecorder::Frame* frame)
+	{
+	/* Queue the frame and wake up the writer thread: */
+	Threads::MutexCond::Lock queueLock(queueCond);
+	queuedFrames.push_back(frame);
+	queueCond.signal();
+	}
@@ -0,0 +1,123 @@
+/***********************************************************************
+TrajectoryRecorder - Class to record a sequence of simulation states
+into a trajectory file from a background thread.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef TRAJECTORYRECORDER_INCLUDED
+#define TRAJECTORYRECORDER_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <Misc/SizedTypes.h>
+#include <Threads/MutexCond.h>
+#include <Threads/Thread.h>
+#include <IO/SeekableFile.h>
+
+#include "Common.h"
+#include "StateFile.h"
+#include "TrajectoryFile.h"
+
+class TrajectoryRecorder
+	{
+	/* Embedded classes: */
+	public:
+	struct BondEvent // Structure for bonds created or broken between two recorded frames
+		{
+		/* Elements: */
+		public:
+		bool created; // Flag whether the bond was created or broken
+		StateFileBond bond; // The created or broken bond
+		};
+	
+	struct Frame // Structure for a simulation state queued for writing
+		{
+		/* Elements: */
+		public:
+		bool keyframe; // Flag whether the frame will be written as a keyframe
+		Index timeStamp; // Simulation step of the frame
+		std::vector<ReducedUnitState> states; // Reduced states of all units
+		std::vector<StateFileBond> bonds; // Complete list of bonds for keyframes, to be filled in by the caller
+		std::vector<BondEvent> bondEvents; // Bonds created or broken since the previously queued frame for other frames
+		};
+	
+	/* Elements: */
+	private:
+	IO::SeekableFilePtr file; // The trajectory file
+	IO::SeekableFile::Offset frameIndexOffsetPos; // Position of the frame index offset in the trajectory file's header
+	TrajectoryQuantizer quantizer; // Quantizer for unit positions and orientations
+	
+	/* Simulation-side recording state: */
+	Index frameInterval; // Number of simulation steps between recorded frames
+	unsigned int keyframeInterval; // Maximum number of queued frames between keyframes
+	Index nextFrameTimeStamp; // Simulation step at which to record the next frame
+	bool haveKeyframe; // Flag whether a keyframe has been queued
+	Index lastTopologyVersion; // Simulation topology version of the most recently queued frame
+	unsigned int numFramesSinceKeyframe; // Number of frames queued since the most recent keyframe
+	std::vector<BondEvent> pendingBondEvents; // Bonds created or broken since the most recently queued frame
+	size_t numDroppedFrames; // Number of frames dropped because the writer thread fell behind
+	
+	/* Frame queue: */
+	Threads::MutexCond queueCond; // Condition variable protecting the frame queue and signaling queued frames
+	std::vector<Frame> frames; // Pool of frame buffers
+	std::vector<Frame*> freeFrames; // List of frame buffers available for recording
+	std::deque<Frame*> queuedFrames; // Queue of frames waiting to be written
+	bool shutdown; // Flag to shut down the writer thread once the queue is empty
+	bool finished; // Flag whether the writer thread closed the trajectory file
+	
+	/* Writer-side state: */
+	Threads::Thread writerThread; // Thread writing queued frames to the trajectory file
+	TrajectoryFrameIndex frameIndex; // Index of all written frames
+	std::vector<Misc::UInt16> qPositions; // Quantized unit positions of the most recently written frame
+	std::vector<Misc::SInt16> qOrientations; // Quantized unit orientations of the most recently written frame
+	std::vector<Misc::UInt8> payload; // Buffer to encode frame payloads
+	
+	/* Private methods: */
+	void writeFrame(const Frame& frame); // Encodes and writes the given frame to the trajectory file
+	void* writerThreadMethod(void); // Method writing queued frames until shut down
+	
+	/* Constructors and destructors: */
+	public:
+	TrajectoryRecorder(const char* fileName,const UnitTypeList& unitTypes,const Box& domain,Index sFrameInterval,unsigned int sKeyframeInterval,unsigned int queueSize); // Creates a trajectory file of the given name for the given session setup, recording every given number of simulation steps with the given number of queued frames
+	~TrajectoryRecorder(void); // Finishes the trajectory file if that has not been requested yet, and waits for the writer thread to terminate
+	
+	/* Methods: */
+	void finish(void); // Asks the writer thread to write all queued frames and the frame index and to close the trajectory file; returns immediately
+	bool isFinished(void); // Returns true if the writer thread closed the trajectory file after a finish request or a write error
+	void addBondEvent(bool created,Index unitIndex0,Index bondSiteIndex0,Index unitIndex1,Index bondSiteIndex1) // Notifies the recorder that a bond was created or broken
+		{
+		BondEvent be;
+		be.created=created;
+		be.bond.unitIndex[0]=unitIndex0;
+		be.bond.bondSiteIndex[0]=bondSiteIndex0;
+		be.bond.unitIndex[1]=unitIndex1;
+		be.bond.bondSiteIndex[1]=bondSiteIndex1;
+		pendingBondEvents.push_back(be);
+		}
+	bool isFrameDue(Index timeStamp) const // Returns true if the state of the given simulation step should be recorded
+		{
+		return timeStamp>=nextFrameTimeStamp;
+		}
+	Frame* startFrame(const UnitStateArray& states,Index topologyVersion); // Prepares a frame for the given state array and simulation topology version; returns null if the frame had to be dropped
+	void postFrame(Frame* frame); // Queues a prepared frame for writing
+	size_t getNumDroppedFrames(void) const // Returns the number of frames dropped so far
+		{
+		return numDroppedFrames;
+		}
+	};
+
+#endif
@@ -34,48 +34,22 @@ namespace NCK {
 Methods of class TriangleRenderer:
 *********************************/
 
-void TriangleRenderer::initContext(GLContextData& contextData) const
+void TriangleRenderer::createMesh(UnitRenderer::Mesh& mesh) const
 	{
-	/* Create context data item: */
-	DataItem* dataItem=new DataItem;
-	contextData.addDataItem(this,dataItem);
+	const Point* v=Triangle::renderVertices;
+	const Vector* n=Triangle::renderNormals;
 	
-	/* Create model display list: */
-	glNewList(dataItem->displayListId,GL_COMPILE);
+	/* Create triangle sides as pairs of triangles: */
+	addTriangle(mesh,n[0],v[0],v[1],v[4]);
+	addTriangle(mesh,n[0],v[0],v[4],v[3]);
+	addTriangle(mesh,n[1],v[1],v[2],v[5]);
+	addTriangle(mesh,n[1],v[1],v[5],v[4]);
+	addTriangle(mesh,n[2],v[2],v[0],v[3]);
+	addTriangle(mesh,n[2],v[2],v[3],v[5]);
 	
-	/* Render triangle sides: */
-	glBegin(GL_QUADS);
-	glNormal(Triangle::renderNormals[0]);
-	glVertex(Triangle::renderVertices[0]);
-	glVertex(Triangle::renderVertices[1]);
-	glVertex(Triangle::renderVertices[4]);
-	glVertex(Triangle::renderVertices[3]);
-	glNormal(Triangle::renderNormals[1]);
-	glVertex(Triangle::renderVertices[1]);
-	glVertex(Triangle::renderVertices[2]);
-	glVertex(Triangle::renderVertices[5]);
-	glVertex(Triangle::renderVertices[4]);
-	glNormal(Triangle::renderNormals[2]);
-	glVertex(Triangle::renderVertices[2]);
-	glVertex(Triangle::renderVertices[0]);
-	glVertex(Triangle::renderVertices[3]);
-	glVertex(Triangle::renderVertices[5]);
-	glEnd();
-	
-	/* Render triangle caps: */
-	glBegin(GL_TRIANGLES);
-	glNormal(Triangle::renderNormals[3]);
-	glVertex(Triangle::renderVertices[0]);
-	glVertex(Triangle::renderVertices[2]);
-	glVertex(Triangle::renderVertices[1]);
-	glNormal(Triangle::renderNormals[4]);
-	glVertex(Triangle::renderVertices[3]);
-	glVertex(Triangle::renderVertices[4]);
-	glVertex(Triangle::renderVertices[5]);
-	glEnd();
-	
-	/* Finish model display list: */
-	glEndList();
+	/* Create triangle caps: */
+	addTriangle(mesh,n[3],v[0],v[2],v[1]);
+	addTriangle(mesh,n[4],v[3],v[4],v[5]);
 	}
 
 /*********************************
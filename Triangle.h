@@ -22,13 +22,15 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #define TRIANGLE_INCLUDED
 
 #include "StructuralUnit.h"
+#include "UnitManager.h"
 
 namespace NCK {
 
 class TriangleRenderer:public UnitRenderer
 	{
-	/* Methods: */
-	virtual void initContext(GLContextData& contextData) const;
+	/* Methods from class UnitRenderer: */
+	public:
+	virtual void createMesh(Mesh& mesh) const;
 	};
 
 class Triangle:public StructuralUnit
@@ -66,6 +68,10 @@ class Triangle:public StructuralUnit
 		{
 		return radius;
 		};
+	static Scalar getClassMass(void) // Returns mass of all triangles
+		{
+		return mass;
+		};
 	static int getClassNumVertices(void) // Returns number of vertices of triangle class
 		{
 		return 3;
@@ -85,6 +91,10 @@ class Triangle:public StructuralUnit
 		{
 		return mass;
 		};
+	virtual int getUnitType(void) const
+		{
+		return UnitManager::TRIANGLE;
+		};
 	virtual Vector getVertexOffset(int index) const
 		{
 		return orientation.transform(vertexOffsets[index]);
@@ -95,6 +105,10 @@ class Triangle:public StructuralUnit
 		};
 	virtual void applyVertexForce(int index,const Vector& force,Scalar timeStep);
 	virtual void applyCentralForce(const Vector& force,Scalar timeStep);
+	virtual const UnitRenderer* getUnitRenderer(void) const
+		{
+		return unitRenderer;
+		};
 	virtual void glRenderAction(GLContextData& contextData) const;
 	};
 
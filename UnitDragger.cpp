@@ -64,6 +64,25 @@ void UnitDragger::updateDragger(const Vrui::NavTrackerState& currentTransformati
 	angularVelocity=dr.getScaledAxis();
 	}
 
+void UnitDragger::queueEditRequest(UnitDragger::EditRequest::Type type,bool rayBased,const NCK::Ray& ray)
+	{
+	/* Capture the dragger's current state in a new edit request: */
+	EditRequest request;
+	request.dragger=this;
+	request.type=type;
+	request.createType=createType;
+	request.draggingMode=draggingMode;
+	request.rayBased=rayBased;
+	request.ray=ray;
+	request.influenceSphereTransform=influenceSphereTransform;
+	request.influenceSphereRadius=influenceSphereRadius;
+	request.linearVelocity=linearVelocity;
+	request.angularVelocity=angularVelocity;
+	
+	/* Hand the request to the simulation thread: */
+	application->queueEditRequest(request);
+	}
+
 UnitDragger::UnitDragger(Vrui::DraggingTool* sTool,NanotechConstructionKit* sApplication)
 	:DraggingToolAdapter(sTool),
 	 application(sApplication),
@@ -109,186 +128,201 @@ void UnitDragger::dragStartCallback(Vrui::DraggingTool::DragStartCallbackData* c
 	/* Update dragger's current position, orientation and radius: */
 	updateDragger(cbData->startTransformation);
 	
-	NCK::Point p=influenceSphereTransform.getOrigin();
-	const NCK::Rotation& o=influenceSphereTransform.getRotation();
-	if(draggingMode==INTERSTITIAL_VOID)
-		{
-		/* Extract the interstitial void polyhedron surrounding the query position: */
-		delete application->currentVoid;
-		// application->currentVoid=new NCK::Polyhedron(*application->grid,application->screenCenter);
-		application->currentVoid=new NCK::Polyhedron(*application->grid,p);
-		}
-	else if(draggingMode!=INFLUENCE_SPHERE)
+	/* Queue a request to select or create structural units: */
+	queueEditRequest(EditRequest::DRAG_START,cbData->rayBased,cbData->ray);
+	}
+
+void UnitDragger::dragCallback(Vrui::DraggingTool::DragCallbackData* cbData)
+	{
+	/* Update dragger's current position, orientation and radius: */
+	updateDragger(cbData->currentTransformation);
+	
+	/* Queue a request to drag selected structural unit(s): */
+	queueEditRequest(EditRequest::DRAG);
+	}
+
+void UnitDragger::dragEndCallback(Vrui::DraggingTool::DragEndCallbackData* cbData)
+	{
+	/* Update dragger's current position, orientation and radius: */
+	updateDragger(cbData->finalTransformation);
+	
+	/* Queue a request to release dragged units: */
+	queueEditRequest(EditRequest::DRAG_END);
+	}
+
+void UnitDragger::setModes(int newCreateType,UnitDragger::DraggingMode newDraggingMode)
+	{
+	createType=newCreateType;
+	draggingMode=newDraggingMode;
+	}
+
+void UnitDragger::applyEditRequest(const UnitDragger::EditRequest& request)
+	{
+	NCK::SpaceGrid* grid=application->grid;
+	NCK::Point p=request.influenceSphereTransform.getOrigin();
+	if(request.type==EditRequest::DRAG_START)
 		{
-		NCK::SpaceGrid::StructuralUnitList selectedUnits;
-		switch(draggingMode)
+		const NCK::Rotation& o=request.influenceSphereTransform.getRotation();
+		if(request.draggingMode==INTERSTITIAL_VOID)
 			{
-			case SINGLE_UNIT:
-				{
-				NCK::StructuralUnit* unit=0;
-				if(cbData->rayBased)
-					unit=application->grid->findUnit(cbData->ray);
-				else
-					unit=application->grid->findUnit(p);
-				if(unit!=0)
-					selectedUnits.push_back(unit);
-				break;
-				}
-			
-			case LINKED_ASSEMBLY:
-				if(cbData->rayBased)
-					selectedUnits=application->grid->findLinkedUnits(cbData->ray);
-				else
-					selectedUnits=application->grid->findLinkedUnits(p);
-				break;
-			
-			default:
-				; // Just to make compiler happy
-			}
-		
-		if(createType==MARK||createType==UNMARK)
-			{
-			/* Toggle marked state for all selected units: */
-			application->grid->toggleUnitsMark(selectedUnits);
-			
-			/* Clear the selection list: */
-			selectedUnits.clear();
-			}
-		else if(createType==LOCK||createType==UNLOCK)
-			{
-			/* Toggle locking state for all selected units: */
-			application->grid->toggleUnitsLock(selectedUnits);
-			
-			/* Clear the selection list: */
-			selectedUnits.clear();
+			/* Extract the interstitial void polyhedron surrounding the query position and hand it to the front end: */
+			application->postNewVoid(new NCK::Polyhedron(*grid,p));
 			}
-		else if(createType==DELETE)
+		else if(request.draggingMode!=INFLUENCE_SPHERE)
 			{
-			/* Delete all selected units: */
-			for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
+			NCK::SpaceGrid::StructuralUnitList selectedUnits;
+			switch(request.draggingMode)
 				{
-				/* Remove the object from the space grid: */
-				application->grid->removeUnit(*uIt);
+				case SINGLE_UNIT:
+					{
+					NCK::StructuralUnit* unit=0;
+					if(request.rayBased)
+						unit=grid->findUnit(request.ray);
+					else
+						unit=grid->findUnit(p);
+					if(unit!=0)
+						selectedUnits.push_back(unit);
+					break;
+					}
 				
-				/* Delete the object: */
-				delete *uIt;
+				case LINKED_ASSEMBLY:
+					if(request.rayBased)
+						selectedUnits=grid->findLinkedUnits(request.ray);
+					else
+						selectedUnits=grid->findLinkedUnits(p);
+					break;
+				
+				default:
+					; // Just to make compiler happy
 				}
 			
-			/* Clear the selection list: */
-			selectedUnits.clear();
-			}
-		else if(createType>=FIRST_UNITTYPE&&selectedUnits.empty())
-			{
-			/* Add new structural unit at glove position and orientation: */
-			NCK::StructuralUnit* newUnit=NCK::UnitManager::createUnit(createType-FIRST_UNITTYPE,p,o);
-			if(newUnit!=0)
+			if(request.createType==MARK||request.createType==UNMARK)
+				{
+				/* Toggle marked state for all selected units: */
+				grid->toggleUnitsMark(selectedUnits);
+				
+				/* Clear the selection list: */
+				selectedUnits.clear();
+				}
+			else if(request.createType==LOCK||request.createType==UNLOCK)
+				{
+				/* Toggle locking state for all selected units: */
+				grid->toggleUnitsLock(selectedUnits);
+				
+				/* Clear the selection list: */
+				selectedUnits.clear();
+				}
+			else if(request.createType==DELETE)
 				{
-				application->grid->addUnit(newUnit);
-				selectedUnits.push_back(newUnit);
+				/* Delete all selected units: */
+				for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
+					{
+					/* Remove the object from the space grid: */
+					grid->removeUnit(*uIt);
+					
+					/* Delete the object: */
+					delete *uIt;
+					}
+				
+				/* Clear the selection list: */
+				selectedUnits.clear();
 				}
+			else if(request.createType>=FIRST_UNITTYPE&&selectedUnits.empty())
+				{
+				/* Add new structural unit at glove position and orientation: */
+				NCK::StructuralUnit* newUnit=NCK::UnitManager::createUnit(request.createType-FIRST_UNITTYPE,p,o);
+				if(newUnit!=0)
+					{
+					grid->addUnit(newUnit);
+					selectedUnits.push_back(newUnit);
+					}
+				}
+			
+			/* Start dragging found structural unit(s): */
+			DragTransform start=request.influenceSphereTransform;
+			start.doInvert();
+			for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
+				unitStates.push_back(UnitState(*uIt,start));
 			}
-		
-		/* Start dragging found structural unit(s): */
-		DragTransform start=influenceSphereTransform;
-		start.doInvert();
-		for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
-			unitStates.push_back(UnitState(*uIt,start));
 		}
-	}
-
-void UnitDragger::dragCallback(Vrui::DraggingTool::DragCallbackData* cbData)
-	{
-	/* Update dragger's current position, orientation and radius: */
-	updateDragger(cbData->currentTransformation);
-	
-	/* Drag selected structural unit(s): */
-	if(draggingMode==INFLUENCE_SPHERE)
+	else if(request.type==EditRequest::DRAG)
 		{
-		/* Find all structural units inside the influence sphere: */
-		NCK::Point p=influenceSphereTransform.getOrigin();
-		NCK::SpaceGrid::StructuralUnitList selectedUnits=application->grid->findUnits(p,influenceSphereRadius);
-		
-		switch(createType)
+		/* Drag selected structural unit(s): */
+		if(request.draggingMode==INFLUENCE_SPHERE)
 			{
-			case MARK:
-				/* Mark all units inside the sphere: */
-				for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
-					application->grid->markUnit(*uIt);
-				break;
-			
-			case UNMARK:
-				/* Unmark all units inside the sphere: */
-				for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
-					application->grid->unmarkUnit(*uIt);
-				break;
-			
-			case LOCK:
-				/* Lock all units inside the sphere: */
-				for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
-					application->grid->lockUnit(*uIt);
-				break;
-			
-			case UNLOCK:
-				/* Unlock all units inside the sphere: */
-				for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
-					application->grid->unlockUnit(*uIt);
-				break;
-			
-			case DELETE:
-				break;
+			/* Find all structural units inside the influence sphere: */
+			NCK::SpaceGrid::StructuralUnitList selectedUnits=grid->findUnits(p,request.influenceSphereRadius);
 			
-			default:
+			switch(request.createType)
 				{
-				/* Drag all units currently inside the influence sphere: */
-				// NCK::Rotation r=NCK::Rotation::rotateScaledAxis(angularVelocity); // Currently not used
-				for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
+				case MARK:
+					/* Mark all units inside the sphere: */
+					for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
+						grid->markUnit(*uIt);
+					break;
+				
+				case UNMARK:
+					/* Unmark all units inside the sphere: */
+					for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
+						grid->unmarkUnit(*uIt);
+					break;
+				
+				case LOCK:
+					/* Lock all units inside the sphere: */
+					for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
+						grid->lockUnit(*uIt);
+					break;
+				
+				case UNLOCK:
+					/* Unlock all units inside the sphere: */
+					for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
+						grid->unlockUnit(*uIt);
+					break;
+				
+				case DELETE:
+					break;
+				
+				default:
 					{
-					/* Move and rotate this unit: */
-					NCK::Point up=(*uIt)->getPosition();
-					NCK::Rotation uo=(*uIt)->getOrientation();
-					NCK::Vector d=up-p;
-					NCK::Scalar w=NCK::Scalar(1)-Geometry::mag(d)/influenceSphereRadius;
-					if(w>NCK::Scalar(0))
+					/* Drag all units currently inside the influence sphere: */
+					for(NCK::SpaceGrid::StructuralUnitList::iterator uIt=selectedUnits.begin();uIt!=selectedUnits.end();++uIt)
 						{
-						NCK::Vector disp=linearVelocity;
-						disp+=Geometry::cross(angularVelocity,d);
-						disp*=w;
-						up+=disp;
-						uo.leftMultiply(NCK::Rotation::rotateScaledAxis(angularVelocity*w));
-						application->grid->setUnitPositionOrientation(*uIt,up,uo);
-						//(*uIt)->setVelocities(NCK::Vector::zero,NCK::Vector::zero);
+						/* Move and rotate this unit: */
+						NCK::Point up=(*uIt)->getPosition();
+						NCK::Rotation uo=(*uIt)->getOrientation();
+						NCK::Vector d=up-p;
+						NCK::Scalar w=NCK::Scalar(1)-Geometry::mag(d)/request.influenceSphereRadius;
+						if(w>NCK::Scalar(0))
+							{
+							NCK::Vector disp=request.linearVelocity;
+							disp+=Geometry::cross(request.angularVelocity,d);
+							disp*=w;
+							up+=disp;
+							uo.leftMultiply(NCK::Rotation::rotateScaledAxis(request.angularVelocity*w));
+							grid->setUnitPositionOrientation(*uIt,up,uo);
+							}
 						}
 					}
 				}
 			}
+		else
+			{
+			for(UnitStateList::iterator uIt=unitStates.begin();uIt!=unitStates.end();++uIt)
+				{
+				/* Calculate goal transformation for object and set object's position and orientation: */
+				DragTransform goalTransformation=request.influenceSphereTransform*uIt->dragTransformation;
+				grid->setUnitPositionOrientation(uIt->unit,goalTransformation.getOrigin(),goalTransformation.getRotation());
+				uIt->unit->setVelocities(NCK::Vector::zero,NCK::Vector::zero);
+				}
+			}
 		}
 	else
 		{
-		for(UnitStateList::iterator uIt=unitStates.begin();uIt!=unitStates.end();++uIt)
-			{
-			/* Calculate goal transformation for object and set object's position and orientation: */
-			DragTransform goalTransformation=influenceSphereTransform*uIt->dragTransformation;
-			application->grid->setUnitPositionOrientation(uIt->unit,goalTransformation.getOrigin(),goalTransformation.getRotation());
-			uIt->unit->setVelocities(NCK::Vector::zero,NCK::Vector::zero);
-			}
+		/* Release dragged units: */
+		unitStates.clear();
 		}
 	}
 
-void UnitDragger::dragEndCallback(Vrui::DraggingTool::DragEndCallbackData* cbData)
-	{
-	/* Update dragger's current position, orientation and radius: */
-	updateDragger(cbData->finalTransformation);
-	
-	/* Release dragged units: */
-	unitStates.clear();
-	}
-
-void UnitDragger::setModes(int newCreateType,UnitDragger::DraggingMode newDraggingMode)
-	{
-	createType=newCreateType;
-	draggingMode=newDraggingMode;
-	}
-
 void UnitDragger::glRenderAction(GLContextData& contextData) const
 	{
 	/* Get a pointer to the context data item: */
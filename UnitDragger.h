@@ -48,6 +48,27 @@ class UnitDragger:public Vrui::DraggingToolAdapter,public GLObject
 		SINGLE_UNIT,LINKED_ASSEMBLY,INFLUENCE_SPHERE,INTERSTITIAL_VOID
 		};
 	
+	struct EditRequest // Structure for space grid edits queued by unit draggers to the simulation thread
+		{
+		/* Embedded classes: */
+		public:
+		enum Type // Enumerated type for edit request types
+			{
+			DRAG_START,DRAG,DRAG_END
+			};
+		
+		/* Elements: */
+		UnitDragger* dragger; // Pointer to the unit dragger that queued the request
+		Type type; // Type of the request
+		int createType; // Dragger's unit creation type at the time of the request
+		DraggingMode draggingMode; // Dragger's dragging mode at the time of the request
+		bool rayBased; // Flag whether a drag start request selects units along a ray
+		NCK::Ray ray; // Selection ray of a ray-based drag start request
+		DragTransform influenceSphereTransform; // Dragger's position and orientation at the time of the request
+		NCK::Scalar influenceSphereRadius; // Dragger's influence sphere radius at the time of the request
+		NCK::Vector linearVelocity,angularVelocity; // Dragger's linear and angular velocities at the time of the request
+		};
+	
 	private:
 	struct UnitState // Dragging state for one dragged structural unit
 		{
@@ -86,10 +107,11 @@ class UnitDragger:public Vrui::DraggingToolAdapter,public GLObject
 	DragTransform influenceSphereTransform; // Current position and orientation of influence sphere
 	NCK::Scalar influenceSphereRadius; // Current radius of dragger's influence sphere in physical coordinates
 	NCK::Vector linearVelocity,angularVelocity; // Current linear and angular velocities of dragger scaled by current frame rate
-	UnitStateList unitStates; // List of dragging states for dragged units
+	UnitStateList unitStates; // List of dragging states for dragged units; only accessed by the simulation thread
 	
 	/* Private methods: */
 	void updateDragger(const Vrui::NavTrackerState& currentTransformation);
+	void queueEditRequest(EditRequest::Type type,bool rayBased=false,const NCK::Ray& ray=NCK::Ray()); // Queues an edit request based on the dragger's current state to the simulation thread
 	
 	/* Constructors and destructors: */
 	public:
@@ -104,6 +126,7 @@ class UnitDragger:public Vrui::DraggingToolAdapter,public GLObject
 	
 	/* New methods: */
 	void setModes(int newCreateType,DraggingMode newDraggingMode);
+	void applyEditRequest(const EditRequest& request); // Applies a previously queued edit request to the space grid; called from the simulation thread
 	void glRenderAction(GLContextData& contextData) const;
 	};
 
@@ -0,0 +1,288 @@
+/***********************************************************************
+UnitFileImporter - Function to convert a unit file written by the old
+Nanotech Construction Kit into a simulation state.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "UnitFileImporter.h"
+
+#include <string.h>
+#include <vector>
+#include <Misc/SizedTypes.h>
+#include <Misc/StdError.h>
+#include <Threads/Thread.h>
+
+#include "IO.h"
+#include "MappedFile.h"
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const char* legacyUnitTypeNames[numLegacyUnitTypes]={"Triangle","Tetrahedron","Octahedron","Cylinder","Sphere"};
+const size_t fileHeaderSize=6*sizeof(Misc::Float64)+sizeof(Misc::SInt32)+sizeof(Misc::UInt32); // Domain box, periodic mask, and number of units
+const size_t unitRecordSize=sizeof(Misc::SInt32)+13*sizeof(Misc::Float64)+sizeof(Misc::SInt32); // Unit type, unit state, and number of vertex links
+const size_t vertexLinkSize=sizeof(Misc::SInt32)+sizeof(Misc::UInt32)+sizeof(Misc::SInt32); // Vertex index, linked unit index, and linked vertex index
+const UnitTypeID unmappedUnitType=UnitTypeID(~0U); // Marker for old unit types that are not mapped to new unit types
+
+inline bool hostIsBigEndian(void) // Returns true if unit file data has to be byte-swapped on the host
+	{
+	Misc::UInt16 probe=1;
+	return *reinterpret_cast<const Misc::UInt8*>(&probe)==0;
+	}
+
+template <class ValueParam>
+inline ValueParam readValue(const char*& ptr,bool swap) // Reads a little-endian value from the given pointer and advances the pointer
+	{
+	ValueParam result;
+	memcpy(&result,ptr,sizeof(ValueParam));
+	if(swap)
+		swapWords<sizeof(ValueParam)>(reinterpret_cast<Misc::UInt8*>(&result),1);
+	ptr+=sizeof(ValueParam);
+	return result;
+	}
+
+inline UnitTypeID mapUnitType(int legacyUnitType,const UnitTypeID typeMap[numLegacyUnitTypes]) // Returns the new unit type to which the given old unit type is mapped
+	{
+	return legacyUnitType>=0&&legacyUnitType<numLegacyUnitTypes?typeMap[legacyUnitType]:unmappedUnitType;
+	}
+
+class UnitDecoder // Class to decode a range of unit records from a mapped unit file
+	{
+	/* Elements: */
+	public:
+	const char* fileBegin; // Beginning of the mapped unit file
+	const size_t* recordOffsets; // Offsets of all unit records from the beginning of the unit file
+	const UnitTypeList* unitTypes; // List of new unit types
+	const UnitTypeID* typeMap; // Map from old unit types to new unit types
+	bool swap; // Flag whether unit file data has to be byte-swapped
+	Index begin,end; // Range of units to decode
+	UnitState* states; // Array receiving the states of all units
+	std::vector<StateFileBond> bonds; // Bonds decoded from the vertex links of the decoder's units
+	Size numBadLinks; // Number of vertex links that referred to invalid units or bonding sites
+	Index badUnitIndex; // Index of the first unit whose old unit type is not mapped, or ~0 if all units were decoded
+	int badUnitType; // Old unit type of the first unit that could not be decoded
+	
+	/* Methods: */
+	void* run(void); // Decodes all units in the decoder's range
+	};
+
+void* UnitDecoder::run(void)
+	{
+	bonds.clear();
+	numBadLinks=0;
+	badUnitIndex=~Index(0);
+	for(Index unitIndex=begin;unitIndex<end;++unitIndex)
+		{
+		const char* ptr=fileBegin+recordOffsets[unitIndex];
+		
+		/* Map the unit's old type to a new unit type: */
+		int legacyUnitType=readValue<Misc::SInt32>(ptr,swap);
+		UnitTypeID unitTypeId=mapUnitType(legacyUnitType,typeMap);
+		if(unitTypeId==unmappedUnitType)
+			{
+			badUnitIndex=unitIndex;
+			badUnitType=legacyUnitType;
+			break;
+			}
+		const UnitType& ut=(*unitTypes)[unitTypeId];
+		
+		/* Convert the unit's state: */
+		UnitState& unit=states[unitIndex];
+		unit.unitType=unitTypeId;
+		unit.pickId=0;
+		for(int i=0;i<3;++i)
+			unit.position[i]=Scalar(readValue<Misc::Float64>(ptr,swap));
+		Scalar quaternion[4];
+		for(int i=0;i<4;++i)
+			quaternion[i]=Scalar(readValue<Misc::Float64>(ptr,swap));
+		unit.orientation=Rotation::fromQuaternion(quaternion);
+		for(int i=0;i<3;++i)
+			unit.linearVelocity[i]=Scalar(readValue<Misc::Float64>(ptr,swap));
+		for(int i=0;i<3;++i)
+			unit.angularVelocity[i]=Scalar(readValue<Misc::Float64>(ptr,swap));
+		
+		/* Convert the unit's vertex links to bonds with preceding units: */
+		int numVertexLinks=readValue<Misc::SInt32>(ptr,swap);
+		for(int i=0;i<numVertexLinks;++i)
+			{
+			int thisVertexIndex=readValue<Misc::SInt32>(ptr,swap);
+			Index otherUnitIndex=readValue<Misc::UInt32>(ptr,swap);
+			int otherVertexIndex=readValue<Misc::SInt32>(ptr,swap);
+			bool valid=thisVertexIndex>=0&&size_t(thisVertexIndex)<ut.bondSites.size()&&otherUnitIndex<unitIndex&&otherVertexIndex>=0;
+			if(valid)
+				{
+				/* Read the linked unit's type from its record, as the linked unit might belong to another decoder: */
+				const char* otherPtr=fileBegin+recordOffsets[otherUnitIndex];
+				UnitTypeID otherUnitTypeId=mapUnitType(readValue<Misc::SInt32>(otherPtr,swap),typeMap);
+				valid=otherUnitTypeId!=unmappedUnitType&&size_t(otherVertexIndex)<(*unitTypes)[otherUnitTypeId].bondSites.size();
+				}
+			if(valid)
+				{
+				StateFileBond bond;
+				bond.unitIndex[0]=otherUnitIndex;
+				bond.bondSiteIndex[0]=Index(otherVertexIndex);
+				bond.unitIndex[1]=unitIndex;
+				bond.bondSiteIndex[1]=Index(thisVertexIndex);
+				bonds.push_back(bond);
+				}
+			else
+				++numBadLinks;
+			}
+		}
+	
+	return 0;
+	}
+
+}
+
+const char* getLegacyUnitTypeName(int legacyUnitType)
+	{
+	if(legacyUnitType<0||legacyUnitType>=numLegacyUnitTypes)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Unknown unit type %d",legacyUnitType);
+	return legacyUnitTypeNames[legacyUnitType];
+	}
+
+void importUnitFile(const char* unitFileName,const UnitTypeList& unitTypes,const std::vector<std::string>& unitTypeNames,int numThreads,UnitFileImport& result)
+	{
+	/* Map old unit types to the new unit types of the given names; unknown names leave old unit types unmapped: */
+	if(unitTypeNames.size()!=size_t(numLegacyUnitTypes))
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Wrong number of unit type names");
+	UnitTypeID typeMap[numLegacyUnitTypes];
+	for(int i=0;i<numLegacyUnitTypes;++i)
+		{
+		typeMap[i]=unmappedUnitType;
+		for(UnitTypeID utId=0;utId<unitTypes.size();++utId)
+			if(unitTypes[utId].name==unitTypeNames[i])
+				{
+				typeMap[i]=utId;
+				break;
+				}
+		}
+	
+	/* Map the unit file into memory: */
+	MappedFile unitFile(unitFileName);
+	const char* fileBegin=unitFile.begin();
+	const char* fileEnd=unitFile.end();
+	bool swap=hostIsBigEndian();
+	
+	/* Read the domain box and the number of units: */
+	if(unitFile.getSize()<fileHeaderSize)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Truncated header in unit file %s",unitFileName);
+	const char* ptr=fileBegin;
+	Point domainMin,domainMax;
+	for(int i=0;i<3;++i)
+		domainMin[i]=Scalar(readValue<Misc::Float64>(ptr,swap));
+	for(int i=0;i<3;++i)
+		domainMax[i]=Scalar(readValue<Misc::Float64>(ptr,swap));
+	result.domain=Box(domainMin,domainMax);
+	readValue<Misc::SInt32>(ptr,swap); // Periodic mask is ignored
+	Index numUnits=readValue<Misc::UInt32>(ptr,swap);
+	if(size_t(numUnits)>(unitFile.getSize()-fileHeaderSize)/unitRecordSize)
+		throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Invalid number of units in unit file %s",unitFileName);
+	
+	/* Locate all unit records, which have variable sizes due to their vertex link lists: */
+	std::vector<size_t> recordOffsets;
+	recordOffsets.reserve(numUnits);
+	for(Index unitIndex=0;unitIndex<numUnits;++unitIndex)
+		{
+		if(size_t(fileEnd-ptr)<unitRecordSize)
+			throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Truncated unit record %u in unit file %s",(unsigned int)(unitIndex),unitFileName);
+		recordOffsets.push_back(size_t(ptr-fileBegin));
+		ptr+=unitRecordSize-sizeof(Misc::SInt32);
+		int numVertexLinks=readValue<Misc::SInt32>(ptr,swap);
+		if(numVertexLinks<0||size_t(fileEnd-ptr)/vertexLinkSize<size_t(numVertexLinks))
+			throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Truncated unit record %u in unit file %s",(unsigned int)(unitIndex),unitFileName);
+		ptr+=size_t(numVertexLinks)*vertexLinkSize;
+		}
+	
+	/* Prepare the unit state array to be filled in by the decoders: */
+	result.states.states.clear();
+	result.states.states.reserve(numUnits);
+	UnitState unit;
+	for(Index unitIndex=0;unitIndex<numUnits;++unitIndex)
+		result.states.states.push_back(unit);
+	
+	/* Split the unit records into equal-sized ranges, one per decoder: */
+	if(numThreads<1)
+		numThreads=1;
+	std::vector<UnitDecoder> decoders(numThreads);
+	for(int i=0;i<numThreads;++i)
+		{
+		decoders[i].fileBegin=fileBegin;
+		decoders[i].recordOffsets=recordOffsets.data();
+		decoders[i].unitTypes=&unitTypes;
+		decoders[i].typeMap=typeMap;
+		decoders[i].swap=swap;
+		decoders[i].begin=Index((size_t(numUnits)*size_t(i))/size_t(numThreads));
+		decoders[i].end=Index((size_t(numUnits)*size_t(i+1))/size_t(numThreads));
+		decoders[i].states=result.states.states.data();
+		}
+	
+	/* Run all but the first decoder in their own threads, and the first decoder in the calling thread: */
+	Threads::Thread* decoderThreads=numThreads>1?new Threads::Thread[numThreads-1]:0;
+	for(int i=1;i<numThreads;++i)
+		decoderThreads[i-1].start(&decoders[i],&UnitDecoder::run);
+	decoders[0].run();
+	for(int i=1;i<numThreads;++i)
+		decoderThreads[i-1].join();
+	delete[] decoderThreads;
+	
+	/* Bail out if any unit had an unmapped unit type: */
+	for(std::vector<UnitDecoder>::iterator dIt=decoders.begin();dIt!=decoders.end();++dIt)
+		if(dIt->badUnitIndex!=~Index(0))
+			{
+			if(dIt->badUnitType>=0&&dIt->badUnitType<numLegacyUnitTypes)
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Unit type %s of unit %u in unit file %s is not mapped to a unit type",legacyUnitTypeNames[dIt->badUnitType],(unsigned int)(dIt->badUnitIndex),unitFileName);
+			else
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Unknown unit type %d of unit %u in unit file %s",dIt->badUnitType,(unsigned int)(dIt->badUnitIndex),unitFileName);
+			}
+	
+	/* Assign each unit a contiguous range of slots in a flat bonding site array: */
+	std::vector<Index> bondSiteBases;
+	bondSiteBases.reserve(numUnits+1);
+	Index numBondSites=0;
+	for(UnitStateArray::UnitStateList::const_iterator sIt=result.states.states.begin();sIt!=result.states.states.end();++sIt)
+		{
+		bondSiteBases.push_back(numBondSites);
+		numBondSites+=Index(unitTypes[sIt->unitType].bondSites.size());
+		}
+	std::vector<bool> bonded(numBondSites,false);
+	
+	/* Merge the decoders' bonds in unit order, dropping bonds to bonding sites that are already bonded: */
+	result.bonds.clear();
+	result.numBadLinks=0;
+	for(std::vector<UnitDecoder>::iterator dIt=decoders.begin();dIt!=decoders.end();++dIt)
+		{
+		result.numBadLinks+=dIt->numBadLinks;
+		for(std::vector<StateFileBond>::iterator bIt=dIt->bonds.begin();bIt!=dIt->bonds.end();++bIt)
+			{
+			Index site0=bondSiteBases[bIt->unitIndex[0]]+bIt->bondSiteIndex[0];
+			Index site1=bondSiteBases[bIt->unitIndex[1]]+bIt->bondSiteIndex[1];
+			if(!bonded[site0]&&!bonded[site1])
+				{
+				bonded[site0]=true;
+				bonded[site1]=true;
+				result.bonds.push_back(*bIt);
+				}
+			else
+				++result.numBadLinks;
+			}
+		}
+	}
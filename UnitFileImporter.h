@@ -0,0 +1,63 @@
+/***********************************************************************
+UnitFileImporter - Function to convert a unit file written by the old
+Nanotech Construction Kit into a simulation state.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+Layout of an old unit file; all data is little-endian, and all scalars
+are double precision:
+- Domain box as minimum and maximum corners
+- Periodic mask
+- Number of units
+- One record per unit, containing the unit's type (triangle,
+  tetrahedron, octahedron, cylinder, or sphere), position, orientation
+  as a quaternion, linear and angular velocities, the number of its
+  vertex links, and one entry per vertex link containing the unit's
+  vertex index, the index of the linked unit, which always precedes the
+  unit, and the linked unit's vertex index
+Old unit types are mapped to new unit types by name, and old vertex
+indices are used as bonding site indices of the new unit types. The
+periodic mask is ignored, as the new simulation domain is always
+periodic.
+***********************************************************************/
+
+#ifndef UNITFILEIMPORTER_INCLUDED
+#define UNITFILEIMPORTER_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "Common.h"
+#include "StateFile.h"
+
+const int numLegacyUnitTypes=5; // Number of unit types supported by old unit files
+
+struct UnitFileImport // Structure holding the contents of an old unit file converted to a simulation state
+	{
+	/* Elements: */
+	public:
+	Box domain; // Simulation domain covering the unit file's domain box
+	UnitStateArray states; // States of all imported units, in unit file order
+	std::vector<StateFileBond> bonds; // List of bonds between imported units
+	Size numBadLinks; // Number of vertex links dropped because they referred to invalid units or bonding sites, or to already bonded sites
+	};
+
+const char* getLegacyUnitTypeName(int legacyUnitType); // Returns the name of the given old unit type
+void importUnitFile(const char* unitFileName,const UnitTypeList& unitTypes,const std::vector<std::string>& unitTypeNames,int numThreads,UnitFileImport& result); // Converts all units in the given old unit file into units of the unit types whose names are listed for each old unit type, using the given number of threads
+
+#endif
@@ -0,0 +1,206 @@
+/***********************************************************************
+UnitInstanceArray - Class to represent a snapshot of unit states sorted
+by unit type and spatial grid cell for instanced rendering, view-frustum
+culling, and distance-based level-of-detail selection.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "UnitInstanceArray.h"
+
+#include <Math/Math.h>
+
+namespace {
+
+/****************
+Helper constants:
+****************/
+
+static const Index maxCellsPerAxis=32; // Maximum number of culling grid cells along each axis to limit the number of batches
+
+}
+
+/*******************************************
+Methods of class UnitInstanceArray::Frustum:
+*******************************************/
+
+UnitInstanceArray::Frustum::Frustum(const double clipMatrix[16])
+	{
+	/* Extract the frustum planes from the rows of the clip matrix: */
+	for(int i=0;i<3;++i)
+		{
+		for(int side=0;side<2;++side)
+			{
+			/* Add or subtract the i-th row to or from the fourth row: */
+			Scalar sign=side==0?Scalar(1):Scalar(-1);
+			Vector normal;
+			for(int j=0;j<3;++j)
+				normal[j]=Scalar(clipMatrix[j*4+3]+sign*clipMatrix[j*4+i]);
+			Scalar offset=-Scalar(clipMatrix[12+3]+sign*clipMatrix[12+i]);
+			planes[i*2+side]=Plane(normal,offset);
+			}
+		}
+	}
+
+bool UnitInstanceArray::Frustum::isBoxVisible(const Box& box,Scalar pad) const
+	{
+	for(int planeIndex=0;planeIndex<6;++planeIndex)
+		{
+		/* Find the padded box's vertex that is farthest along the plane's normal vector: */
+		const Vector& normal=planes[planeIndex].getNormal();
+		Point p;
+		for(int i=0;i<3;++i)
+			p[i]=normal[i]>=Scalar(0)?box.max[i]+pad:box.min[i]-pad;
+		
+		/* Bail out if even that vertex is outside the plane: */
+		if(planes[planeIndex].calcDistance(p)<Scalar(0))
+			return false;
+		}
+	
+	return true;
+	}
+
+/**********************************
+Methods of class UnitInstanceArray:
+**********************************/
+
+void UnitInstanceArray::sortInstances(Scalar cellSize)
+	{
+	Size numUnits=unsortedInstances.size();
+	
+	/* Calculate the bounding box of all unit positions and the number of unit types: */
+	Box posBox=Box::empty;
+	Size numTypes=0;
+	for(Index i=0;i<numUnits;++i)
+		{
+		posBox.addPoint(Point(unsortedInstances[i].position));
+		if(numTypes<=Size(unsortedTypes[i]))
+			numTypes=Size(unsortedTypes[i])+1;
+		}
+	
+	/* Lay out a grid of culling cells covering the bounding box: */
+	Index numCells[3];
+	Scalar cellScale[3];
+	Size totalCells=1;
+	for(int i=0;i<3;++i)
+		{
+		Scalar extent=numUnits>0?posBox.max[i]-posBox.min[i]:Scalar(0);
+		numCells[i]=Index(Math::floor(extent/cellSize))+1;
+		if(numCells[i]>maxCellsPerAxis)
+			numCells[i]=maxCellsPerAxis;
+		cellScale[i]=extent>Scalar(0)?Scalar(numCells[i])/extent:Scalar(0);
+		totalCells*=numCells[i];
+		}
+	
+	/* Calculate each unit's bucket key from its type and grid cell, and count the number of units in each bucket: */
+	Size numBuckets=numTypes*totalCells;
+	unitKeys.resize(numUnits);
+	bucketStarts.assign(numBuckets+1,0);
+	for(Index i=0;i<numUnits;++i)
+		{
+		Index key=0;
+		for(int j=2;j>=0;--j)
+			{
+			Index cell=Index((unsortedInstances[i].position[j]-posBox.min[j])*cellScale[j]);
+			if(cell>=numCells[j])
+				cell=numCells[j]-1;
+			key=key*numCells[j]+cell;
+			}
+		key+=Index(unsortedTypes[i])*totalCells;
+		unitKeys[i]=key;
+		++bucketStarts[key+1];
+		}
+	
+	/* Convert the counts into bucket start indices: */
+	for(Index b=0;b<numBuckets;++b)
+		bucketStarts[b+1]+=bucketStarts[b];
+	
+	/* Scatter all units into their buckets, advancing each bucket's start index as an insertion cursor: */
+	instances.resize(numUnits);
+	for(Index i=0;i<numUnits;++i)
+		instances[bucketStarts[unitKeys[i]]++]=unsortedInstances[i];
+	
+	/* Create a batch for each non-empty bucket; each bucket's insertion cursor now points to its end: */
+	batches.clear();
+	Index bucketBegin=0;
+	for(Index b=0;b<numBuckets;++b)
+		{
+		Index bucketEnd=bucketStarts[b];
+		if(bucketEnd>bucketBegin)
+			{
+			Batch batch;
+			batch.unitType=UnitTypeID(b/totalCells);
+			batch.firstInstance=bucketBegin;
+			batch.numInstances=bucketEnd-bucketBegin;
+			batch.bbox=Box::empty;
+			for(Index i=bucketBegin;i<bucketEnd;++i)
+				batch.bbox.addPoint(Point(instances[i].position));
+			batches.push_back(batch);
+			}
+		bucketBegin=bucketEnd;
+		}
+	}
+
+Size UnitInstanceArray::cull(const UnitInstanceArray::Frustum& frustum,const Point& eyePos,Scalar lodDistance,const std::vector<Scalar>& typeRadii,std::vector<UnitInstanceArray::DrawRange>& drawRanges) const
+	{
+	Size result=0;
+	drawRanges.clear();
+	Scalar lodDistance2=Math::sqr(lodDistance);
+	for(std::vector<Batch>::const_iterator bIt=batches.begin();bIt!=batches.end();++bIt)
+		{
+		/* Skip the batch if its bounding box, padded by its unit type's radius, is outside the frustum: */
+		Scalar radius=bIt->unitType<typeRadii.size()?typeRadii[bIt->unitType]:Scalar(0);
+		if(!frustum.isBoxVisible(bIt->bbox,radius))
+			continue;
+		
+		/* Render the batch with reduced meshes if its padded bounding box is farther from the eye than the LOD distance: */
+		bool reduced=false;
+		if(lodDistance>Scalar(0))
+			{
+			Scalar dist2(0);
+			for(int i=0;i<3;++i)
+				{
+				if(eyePos[i]<bIt->bbox.min[i]-radius)
+					dist2+=Math::sqr(bIt->bbox.min[i]-radius-eyePos[i]);
+				else if(eyePos[i]>bIt->bbox.max[i]+radius)
+					dist2+=Math::sqr(eyePos[i]-bIt->bbox.max[i]-radius);
+				}
+			reduced=dist2>lodDistance2;
+			}
+		
+		/* Append the batch to the previous draw range if they are contiguous and compatible: */
+		result+=bIt->numInstances;
+		if(!drawRanges.empty())
+			{
+			DrawRange& last=drawRanges.back();
+			if(last.unitType==bIt->unitType&&last.reduced==reduced&&last.firstInstance+last.numInstances==bIt->firstInstance)
+				{
+				last.numInstances+=bIt->numInstances;
+				continue;
+				}
+			}
+		
+		/* Start a new draw range: */
+		DrawRange dr;
+		dr.unitType=bIt->unitType;
+		dr.reduced=reduced;
+		dr.firstInstance=bIt->firstInstance;
+		dr.numInstances=bIt->numInstances;
+		drawRanges.push_back(dr);
+		}
+	
+	return result;
+	}
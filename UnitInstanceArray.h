@@ -0,0 +1,138 @@
+/***********************************************************************
+UnitInstanceArray - Class to represent a snapshot of unit states sorted
+by unit type and spatial grid cell for instanced rendering, view-frustum
+culling, and distance-based level-of-detail selection.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef UNITINSTANCEARRAY_INCLUDED
+#define UNITINSTANCEARRAY_INCLUDED
+
+#include <vector>
+#include <Geometry/Plane.h>
+
+#include "Common.h"
+
+class UnitInstanceArray
+	{
+	/* Embedded classes: */
+	public:
+	typedef Geometry::Plane<Scalar,3> Plane; // Type for frustum planes
+	
+	struct Instance // Structure describing the position and orientation of a single unit
+		{
+		/* Elements: */
+		public:
+		Scalar position[3]; // Unit's position
+		Scalar orientation[4]; // Unit's orientation as a quaternion (x, y, z, w)
+		};
+	
+	struct Batch // Structure describing a contiguous run of instances of the same unit type inside the same grid cell
+		{
+		/* Elements: */
+		public:
+		UnitTypeID unitType; // Type of all units in the batch
+		Index firstInstance; // Index of the batch's first instance
+		Size numInstances; // Number of instances in the batch
+		Box bbox; // Bounding box of the positions of all units in the batch
+		};
+	
+	struct Frustum // Structure describing a view frustum as a set of six inward-facing planes
+		{
+		/* Elements: */
+		public:
+		Plane planes[6]; // Left, right, bottom, top, near, and far frustum planes
+		
+		/* Constructors and destructors: */
+		Frustum(void) // Creates an uninitialized frustum
+			{
+			}
+		Frustum(const double clipMatrix[16]); // Extracts a frustum from a column-major OpenGL projection*modelview matrix
+		
+		/* Methods: */
+		bool isBoxVisible(const Box& box,Scalar pad) const; // Returns false if the given box, padded by the given amount, is entirely outside the frustum
+		};
+	
+	struct DrawRange // Structure describing a contiguous run of instances of the same unit type to be rendered at the same level of detail
+		{
+		/* Elements: */
+		public:
+		UnitTypeID unitType; // Type of all units in the range
+		bool reduced; // Flag whether the range is to be rendered using the unit type's reduced mesh
+		Index firstInstance; // Index of the range's first instance
+		Size numInstances; // Number of instances in the range
+		};
+	
+	/* Elements: */
+	private:
+	SessionID sessionId; // ID of the session to which the unit states belong
+	std::vector<Instance> instances; // Array of unit instances, sorted by unit type and grid cell
+	std::vector<Batch> batches; // Array of instance batches, sorted by unit type and grid cell
+	std::vector<Instance> unsortedInstances; // Temporary array of unit instances in state array order
+	std::vector<UnitTypeID> unsortedTypes; // Temporary array of unit types in state array order
+	std::vector<Index> unitKeys; // Temporary array of unit bucket keys in state array order
+	std::vector<Index> bucketStarts; // Temporary array of bucket start indices
+	
+	/* Private methods: */
+	void sortInstances(Scalar cellSize); // Sorts the temporary unit instance array by unit type and grid cell and creates instance batches
+	
+	/* Constructors and destructors: */
+	public:
+	UnitInstanceArray(void) // Creates an empty instance array
+		:sessionId(0)
+		{
+		}
+	
+	/* Methods: */
+	SessionID getSessionId(void) const // Returns the ID of the session to which the unit states belong
+		{
+		return sessionId;
+		}
+	const std::vector<Instance>& getInstances(void) const // Returns the sorted array of unit instances
+		{
+		return instances;
+		}
+	const std::vector<Batch>& getBatches(void) const // Returns the array of instance batches
+		{
+		return batches;
+		}
+	template <class UnitStateParam>
+	void set(const StateArray<UnitStateParam>& unitStates,Scalar cellSize) // Replaces the instance array with the given unit states, sorted into grid cells of the given size
+		{
+		/* Copy the unit states into the temporary arrays: */
+		sessionId=unitStates.sessionId;
+		unsortedInstances.resize(unitStates.states.size());
+		unsortedTypes.resize(unitStates.states.size());
+		std::vector<Instance>::iterator uiIt=unsortedInstances.begin();
+		std::vector<UnitTypeID>::iterator utIt=unsortedTypes.begin();
+		for(typename StateArray<UnitStateParam>::UnitStateList::const_iterator sIt=unitStates.states.begin();sIt!=unitStates.states.end();++sIt,++uiIt,++utIt)
+			{
+			for(int i=0;i<3;++i)
+				uiIt->position[i]=sIt->position[i];
+			const Scalar* q=sIt->orientation.getQuaternion();
+			for(int i=0;i<4;++i)
+				uiIt->orientation[i]=q[i];
+			*utIt=sIt->unitType;
+			}
+		
+		/* Sort the instances and create batches: */
+		sortInstances(cellSize);
+		}
+	Size cull(const Frustum& frustum,const Point& eyePos,Scalar lodDistance,const std::vector<Scalar>& typeRadii,std::vector<DrawRange>& drawRanges) const; // Fills the given list with ranges of instances that are potentially visible in the given frustum, using reduced meshes for instances farther than the LOD distance from the eye; returns the total number of instances in all ranges
+	};
+
+#endif
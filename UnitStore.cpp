@@ -0,0 +1,767 @@
+/***********************************************************************
+UnitStore - Class to hold flat, type-sorted copies of the simulation
+state of all structural units in a space grid, to calculate unit
+interactions with per-type kernels instead of virtual method calls, and
+to accumulate forces and integrate unit states in parallel.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "UnitStore.h"
+
+#include <Misc/StdError.h>
+#include <Math/Math.h>
+
+#include "StructuralUnit.h"
+#include "SpaceGridCell.h"
+#include "Triangle.h"
+#include "Tetrahedron.h"
+#include "Octahedron.h"
+#include "Cylinder.h"
+#include "Sphere.h"
+
+namespace NCK {
+
+/**************************
+Methods of class UnitStore:
+**************************/
+
+template <class UnitParam>
+void UnitStore::initUnits(unsigned int begin,unsigned int end,bool ghosts)
+	{
+	/* Ghost units have infinite mass, as forces on them are discarded: */
+	Scalar invMass=ghosts?Scalar(0):Scalar(1)/UnitParam::getClassMass();
+	for(unsigned int index=begin;index<end;++index)
+		{
+		invMasses[index]=invMass;
+		
+		/* Calculate the unit's vertex offsets in global coordinates: */
+		const Rotation& orientation=units[index]->orientation;
+		Vector* voPtr=&vertexOffsets[firstVertices[index]];
+		for(int i=0;i<UnitParam::getClassNumVertices();++i)
+			voPtr[i]=orientation.transform(UnitParam::getClassVertexOffset(i));
+		}
+	}
+
+template <class UnitParam>
+void UnitStore::checkUnitVertexLinks(unsigned int begin,unsigned int end)
+	{
+	Scalar timeStep=stepParameters->timeStep;
+	for(unsigned int index1=begin;index1<end;++index1)
+		{
+		StructuralUnit::VertexLink* vertexLinks1=units[index1]->vertexLinks;
+		const Vector* vo1=&vertexOffsets[firstVertices[index1]];
+		for(int i1=0;i1<UnitParam::getClassNumVertices();++i1)
+			{
+			StructuralUnit::VertexLink& vl1=vertexLinks1[i1];
+			if(vl1.unit!=0&&ids[index1]>vl1.unit->id)
+				{
+				/* Check if vertex link is still valid: */
+				unsigned int index2=vl1.unit->storeIndex;
+				const Vector& vo2=vertexOffsets[firstVertices[index2]+vl1.vertexIndex];
+				Vector dist=positions[index2]-positions[index1];
+				wrapDistance(dist);
+				dist+=vo2-vo1[i1];
+				Scalar distLen2=Geometry::sqr(dist);
+				if(distLen2>StructuralUnit::vertexForceRadius2)
+					{
+					/* Remove link: */
+					StructuralUnit::VertexLink& vl2=vl1.unit->vertexLinks[vl1.vertexIndex];
+					vl1.unit=0;
+					vl1.vertexIndex=-1;
+					vl2.unit=0;
+					vl2.vertexIndex=-1;
+					}
+				else
+					{
+					/* Calculate vertex attracting force: */
+					Scalar distLen=Math::sqrt(distLen2);
+					Vector force=dist*(StructuralUnit::vertexForceStrength*(StructuralUnit::vertexForceRadius-distLen)/StructuralUnit::vertexForceRadius2);
+					
+					/* Apply forces to units: */
+					applyVertexForce(index1,vo1[i1],force,timeStep);
+					applyVertexForce(index2,vo2,force,-timeStep);
+					}
+				}
+			}
+		}
+	}
+
+template <class Unit1Param,class Unit2Param>
+void UnitStore::interactPair(unsigned int index1,unsigned int index2,const Vector& shift)
+	{
+	Scalar timeStep=stepParameters->timeStep;
+	
+	/* Calculate interaction between unit's centroids: */
+	Scalar radius1=Unit1Param::getClassRadius();
+	Scalar radius2=Unit2Param::getClassRadius();
+	Scalar centralForceRadius=radius1+radius2+StructuralUnit::centralForceOvershoot;
+	Scalar centralForceRadius2=Math::sqr(centralForceRadius);
+	Vector dist=positions[index2]-positions[index1];
+	dist+=shift;
+	Scalar distLen2=Geometry::sqr(dist);
+	if(distLen2<centralForceRadius2)
+		{
+		/* Calculate centroid repelling force: */
+		Scalar distLen=Math::sqrt(distLen2);
+		Vector force=dist*(StructuralUnit::centralForceStrength*(distLen-centralForceRadius)/centralForceRadius2);
+		
+		/* Apply forces to units: */
+		applyCentralForce(index1,force,timeStep);
+		applyCentralForce(index2,force,-timeStep);
+		}
+	
+	/* Bail out if either unit type does not have vertices, or if the units are not close enough to form new vertex links: */
+	const int numVertices1=Unit1Param::getClassNumVertices();
+	const int numVertices2=Unit2Param::getClassNumVertices();
+	if(numVertices1==0||numVertices2==0||distLen2>=Math::sqr(radius1+radius2+StructuralUnit::vertexForceRadius))
+		return;
+	
+	/* Check if there is an existing vertex link between the units: */
+	StructuralUnit* unit1=units[index1];
+	StructuralUnit* unit2=units[index2];
+	StructuralUnit::VertexLink* vertexLinks1=unit1->vertexLinks;
+	for(int i1=0;i1<numVertices1;++i1)
+		if(vertexLinks1[i1].unit==unit2)
+			return;
+	
+	/* Try establishing a vertex link between the two units: */
+	StructuralUnit::VertexLink* vertexLinks2=unit2->vertexLinks;
+	const Vector* vo1=&vertexOffsets[firstVertices[index1]];
+	const Vector* vo2=&vertexOffsets[firstVertices[index2]];
+	Point position2=positions[index2]+shift;
+	for(int i1=0;i1<numVertices1;++i1)
+		{
+		StructuralUnit::VertexLink& vl1=vertexLinks1[i1];
+		if(vl1.unit==0)
+			{
+			Point p1=positions[index1]+vo1[i1];
+			for(int i2=0;i2<numVertices2;++i2)
+				{
+				StructuralUnit::VertexLink& vl2=vertexLinks2[i2];
+				if(vl2.unit==0)
+					{
+					Vector vertexDist=(position2+vo2[i2])-p1;
+					Scalar vertexDistLen2=Geometry::sqr(vertexDist);
+					if(vertexDistLen2<=StructuralUnit::vertexForceRadius2)
+						{
+						/* Link the two vertices: */
+						vl1.unit=unit2;
+						vl1.vertexIndex=i2;
+						vl2.unit=unit1;
+						vl2.vertexIndex=i1;
+						
+						/* Calculate vertex attracting force: */
+						Scalar vertexDistLen=Math::sqrt(vertexDistLen2);
+						Vector force=vertexDist*(StructuralUnit::vertexForceStrength*(StructuralUnit::vertexForceRadius-vertexDistLen)/StructuralUnit::vertexForceRadius2);
+						
+						/* Apply forces to units: */
+						applyVertexForce(index1,vo1[i1],force,timeStep);
+						applyVertexForce(index2,vo2[i2],force,-timeStep);
+						
+						/* There can be only one vertex link between two units; stop looking: */
+						return;
+						}
+					}
+				}
+			}
+		}
+	}
+
+template <class Unit1Param>
+void UnitStore::interactUnits(unsigned int begin,unsigned int end)
+	{
+	for(unsigned int index1=begin;index1<end;++index1)
+		{
+		/* Visit all units in the neighbourhood of cells around the unit's cell: */
+		unsigned int id1=ids[index1];
+		const CellNeighbour* neighbours=stepParameters->cellNeighbours+unitCellCases[index1]*27;
+		for(int i=0;i<27;++i)
+			{
+			unsigned int cellIndex=unitCells[index1]+neighbours[i].cellOffset;
+			unsigned int cellEnd=cellStarts[cellIndex+1];
+			for(unsigned int cui=cellStarts[cellIndex];cui<cellEnd;++cui)
+				{
+				unsigned int index2=cellUnits[cui];
+				if(id1>ids[index2])
+					{
+					/* Select the interaction kernel for the second unit's type: */
+					switch(unitTypes[index2])
+						{
+						case UnitManager::TRIANGLE:
+							interactPair<Unit1Param,Triangle>(index1,index2,neighbours[i].shift);
+							break;
+						
+						case UnitManager::TETRAHEDRON:
+							interactPair<Unit1Param,Tetrahedron>(index1,index2,neighbours[i].shift);
+							break;
+						
+						case UnitManager::OCTAHEDRON:
+							interactPair<Unit1Param,Octahedron>(index1,index2,neighbours[i].shift);
+							break;
+						
+						case UnitManager::CYLINDER:
+							interactPair<Unit1Param,Cylinder>(index1,index2,neighbours[i].shift);
+							break;
+						
+						case UnitManager::SPHERE:
+							interactPair<Unit1Param,Sphere>(index1,index2,neighbours[i].shift);
+							break;
+						}
+					}
+				}
+			}
+		}
+	}
+
+template <class Unit1Param,class Unit2Param>
+void UnitStore::accumulatePair(unsigned int index1,unsigned int index2,const Vector& shift,UnitStore::ThreadBuffer& buffer)
+	{
+	/* Calculate the centroid repelling force exerted on the first unit; the second unit calculates its own share from its own point of view: */
+	Scalar radius1=Unit1Param::getClassRadius();
+	Scalar radius2=Unit2Param::getClassRadius();
+	Scalar centralForceRadius=radius1+radius2+StructuralUnit::centralForceOvershoot;
+	Scalar centralForceRadius2=Math::sqr(centralForceRadius);
+	Vector dist=positions[index2]-positions[index1];
+	dist+=shift;
+	Scalar distLen2=Geometry::sqr(dist);
+	if(distLen2<centralForceRadius2)
+		{
+		Scalar distLen=Math::sqrt(distLen2);
+		Vector force=dist*(StructuralUnit::centralForceStrength*(distLen-centralForceRadius)/centralForceRadius2);
+		applyCentralForce(index1,force,stepParameters->timeStep);
+		}
+	
+	/* Record the pair as a vertex link candidate from the point of view of the unit with the bigger ID: */
+	if(Unit1Param::getClassNumVertices()>0&&Unit2Param::getClassNumVertices()>0&&ids[index1]>ids[index2]&&distLen2<Math::sqr(radius1+radius2+StructuralUnit::vertexForceRadius))
+		buffer.linkCandidates.push_back(LinkCandidate(index1,index2,shift));
+	}
+
+template <class Unit1Param>
+void UnitStore::accumulateUnits(unsigned int begin,unsigned int end,UnitStore::ThreadBuffer& buffer)
+	{
+	Scalar timeStep=stepParameters->timeStep;
+	for(unsigned int index1=begin;index1<end;++index1)
+		{
+		/* Check all of the unit's vertex links, from its own point of view: */
+		StructuralUnit::VertexLink* vertexLinks1=units[index1]->vertexLinks;
+		const Vector* vo1=&vertexOffsets[firstVertices[index1]];
+		for(int i1=0;i1<Unit1Param::getClassNumVertices();++i1)
+			{
+			StructuralUnit::VertexLink& vl1=vertexLinks1[i1];
+			if(vl1.unit!=0)
+				{
+				unsigned int index2=vl1.unit->storeIndex;
+				Vector dist=positions[index2]-positions[index1];
+				wrapDistance(dist);
+				dist+=vertexOffsets[firstVertices[index2]+vl1.vertexIndex]-vo1[i1]; // Evaluated such that both units of a link calculate exactly negated distances
+				Scalar distLen2=Geometry::sqr(dist);
+				if(distLen2>StructuralUnit::vertexForceRadius2)
+					{
+					/* Remove this unit's half of the link; the other unit removes its own half unless it is a ghost unit: */
+					if(ids[index2]==0)
+						{
+						StructuralUnit::VertexLink& vl2=vl1.unit->vertexLinks[vl1.vertexIndex];
+						vl2.unit=0;
+						vl2.vertexIndex=-1;
+						}
+					vl1.unit=0;
+					vl1.vertexIndex=-1;
+					}
+				else
+					{
+					/* Apply the vertex attracting force to this unit: */
+					Scalar distLen=Math::sqrt(distLen2);
+					Vector force=dist*(StructuralUnit::vertexForceStrength*(StructuralUnit::vertexForceRadius-distLen)/StructuralUnit::vertexForceRadius2);
+					applyVertexForce(index1,vo1[i1],force,timeStep);
+					}
+				}
+			}
+		
+		/* Visit all units in the neighbourhood of cells around the unit's cell in a fixed order: */
+		const CellNeighbour* neighbours=stepParameters->cellNeighbours+unitCellCases[index1]*27;
+		for(int i=0;i<27;++i)
+			{
+			unsigned int cellIndex=unitCells[index1]+neighbours[i].cellOffset;
+			unsigned int cellEnd=cellStarts[cellIndex+1];
+			for(unsigned int cui=cellStarts[cellIndex];cui<cellEnd;++cui)
+				{
+				unsigned int index2=cellUnits[cui];
+				if(index2!=index1)
+					{
+					/* Select the accumulation kernel for the second unit's type: */
+					switch(unitTypes[index2])
+						{
+						case UnitManager::TRIANGLE:
+							accumulatePair<Unit1Param,Triangle>(index1,index2,neighbours[i].shift,buffer);
+							break;
+						
+						case UnitManager::TETRAHEDRON:
+							accumulatePair<Unit1Param,Tetrahedron>(index1,index2,neighbours[i].shift,buffer);
+							break;
+						
+						case UnitManager::OCTAHEDRON:
+							accumulatePair<Unit1Param,Octahedron>(index1,index2,neighbours[i].shift,buffer);
+							break;
+						
+						case UnitManager::CYLINDER:
+							accumulatePair<Unit1Param,Cylinder>(index1,index2,neighbours[i].shift,buffer);
+							break;
+						
+						case UnitManager::SPHERE:
+							accumulatePair<Unit1Param,Sphere>(index1,index2,neighbours[i].shift,buffer);
+							break;
+						}
+					}
+				}
+			}
+		}
+	}
+
+void UnitStore::linkVertices(unsigned int index1,unsigned int index2,const Vector& shift)
+	{
+	/* Check if there is an existing vertex link between the units: */
+	StructuralUnit* unit1=units[index1];
+	StructuralUnit* unit2=units[index2];
+	int numVertices1=unit1->numVertices;
+	for(int i1=0;i1<numVertices1;++i1)
+		if(unit1->vertexLinks[i1].unit==unit2)
+			return;
+	
+	/* Try establishing a vertex link between the two units: */
+	int numVertices2=unit2->numVertices;
+	const Vector* vo1=&vertexOffsets[firstVertices[index1]];
+	const Vector* vo2=&vertexOffsets[firstVertices[index2]];
+	Point position2=positions[index2]+shift;
+	for(int i1=0;i1<numVertices1;++i1)
+		{
+		StructuralUnit::VertexLink& vl1=unit1->vertexLinks[i1];
+		if(vl1.unit==0)
+			{
+			Point p1=positions[index1]+vo1[i1];
+			for(int i2=0;i2<numVertices2;++i2)
+				{
+				StructuralUnit::VertexLink& vl2=unit2->vertexLinks[i2];
+				if(vl2.unit==0)
+					{
+					Vector vertexDist=(position2+vo2[i2])-p1;
+					Scalar vertexDistLen2=Geometry::sqr(vertexDist);
+					if(vertexDistLen2<=StructuralUnit::vertexForceRadius2)
+						{
+						/* Link the two vertices: */
+						vl1.unit=unit2;
+						vl1.vertexIndex=i2;
+						vl2.unit=unit1;
+						vl2.vertexIndex=i1;
+						
+						/* Calculate vertex attracting force: */
+						Scalar vertexDistLen=Math::sqrt(vertexDistLen2);
+						Vector force=vertexDist*(StructuralUnit::vertexForceStrength*(StructuralUnit::vertexForceRadius-vertexDistLen)/StructuralUnit::vertexForceRadius2);
+						
+						/* Apply forces to units: */
+						applyVertexForce(index1,vo1[i1],force,stepParameters->timeStep);
+						applyVertexForce(index2,vo2[i2],force,-stepParameters->timeStep);
+						
+						/* There can be only one vertex link between two units; stop looking: */
+						return;
+						}
+					}
+				}
+			}
+		}
+	}
+
+void UnitStore::integrateUnits(unsigned int begin,unsigned int end,UnitStore::ThreadBuffer& buffer)
+	{
+	const StepParameters& sp=*stepParameters;
+	for(unsigned int index=begin;index<end;++index)
+		{
+		StructuralUnit* unit=units[index];
+		if(!unit->locked)
+			{
+			/* Move unit according to velocities: */
+			Vector& linearVelocity=linearVelocities[index];
+			Vector& angularVelocity=angularVelocities[index];
+			unit->orientation.leftMultiply(Rotation(angularVelocity*sp.timeStep));
+			Point position=positions[index]+linearVelocity*sp.timeStep;
+			
+			/* Attenuate unit's velocities: */
+			linearVelocity*=sp.attenuation;
+			angularVelocity*=sp.attenuation;
+			
+			/* Limit unit's position to grid box: */
+			for(int i=0;i<3;++i)
+				{
+				/* Repeat until unit's position is inside box: */
+				while(true)
+					{
+					if(position[i]<sp.gridBox.min[i])
+						{
+						if(sp.periodicFlags[i])
+							position[i]+=sp.gridBox.getSize(i);
+						else
+							{
+							position[i]=Scalar(2)*sp.gridBox.min[i]-position[i];
+							linearVelocity[i]=-linearVelocity[i];
+							}
+						}
+					else if(position[i]>sp.gridBox.max[i])
+						{
+						if(sp.periodicFlags[i])
+							position[i]-=sp.gridBox.getSize(i);
+						else
+							{
+							position[i]=Scalar(2)*sp.gridBox.max[i]-position[i];
+							linearVelocity[i]=-linearVelocity[i];
+							}
+						}
+					else
+						break;
+					}
+				}
+			
+			/* Write the unit's new state back to the unit: */
+			unit->position=position;
+			unit->linearVelocity=linearVelocity;
+			unit->angularVelocity=angularVelocity;
+			
+			/* Calculate the index of the grid cell now containing the unit: */
+			int cellIndex=0;
+			for(int i=0;i<3;++i)
+				{
+				int ci=int(Math::floor((position[i]-sp.gridBox.min[i])/sp.cellSize[i]))+1;
+				if(ci<1)
+					ci=1;
+				else if(ci>sp.gridSize[i])
+					ci=sp.gridSize[i];
+				cellIndex+=ci*sp.cellIncrements[i];
+				}
+			
+			/* Remember the unit if it needs to be relinked: */
+			if((unsigned int)(cellIndex)!=unitCells[index])
+				buffer.movedUnits.push_back(unit);
+			}
+		else
+			{
+			unit->linearVelocity=Vector::zero;
+			unit->angularVelocity=Vector::zero;
+			}
+		}
+	}
+
+void UnitStore::processPhase(int threadIndex)
+	{
+	/* Determine this thread's share of stored real units: */
+	unsigned int begin=(unsigned int)((size_t(numRealUnits)*size_t(threadIndex))/size_t(numThreads));
+	unsigned int end=(unsigned int)((size_t(numRealUnits)*size_t(threadIndex+1))/size_t(numThreads));
+	ThreadBuffer& buffer=threadBuffers[threadIndex];
+	
+	switch(phase)
+		{
+		case ACCUMULATE:
+			buffer.linkCandidates.clear();
+			for(int unitType=0;unitType<UnitManager::NUM_UNITTYPES;++unitType)
+				{
+				/* Intersect the thread's share with the range of real units of the current type: */
+				unsigned int typeBegin=typeStarts[unitType]>begin?typeStarts[unitType]:begin;
+				unsigned int typeEnd=typeStarts[unitType+1]<end?typeStarts[unitType+1]:end;
+				if(typeBegin>=typeEnd)
+					continue;
+				
+				/* Call the accumulation kernel for the current type: */
+				switch(unitType)
+					{
+					case UnitManager::TRIANGLE:
+						accumulateUnits<Triangle>(typeBegin,typeEnd,buffer);
+						break;
+					
+					case UnitManager::TETRAHEDRON:
+						accumulateUnits<Tetrahedron>(typeBegin,typeEnd,buffer);
+						break;
+					
+					case UnitManager::OCTAHEDRON:
+						accumulateUnits<Octahedron>(typeBegin,typeEnd,buffer);
+						break;
+					
+					case UnitManager::CYLINDER:
+						accumulateUnits<Cylinder>(typeBegin,typeEnd,buffer);
+						break;
+					
+					case UnitManager::SPHERE:
+						accumulateUnits<Sphere>(typeBegin,typeEnd,buffer);
+						break;
+					}
+				}
+			break;
+		
+		case INTEGRATE:
+			buffer.movedUnits.clear();
+			integrateUnits(begin,end,buffer);
+			break;
+		
+		default:
+			;
+		}
+	}
+
+void UnitStore::runPhase(UnitStore::Phase newPhase)
+	{
+	/* Release the worker threads into the new phase: */
+	phase=newPhase;
+	if(numThreads>1)
+		phaseBarrier->synchronize();
+	
+	/* Process the calling thread's share: */
+	processPhase(0);
+	
+	/* Wait until all worker threads have finished the phase: */
+	if(numThreads>1)
+		phaseBarrier->synchronize();
+	}
+
+void* UnitStore::workerThreadMethod(int threadIndex)
+	{
+	while(true)
+		{
+		/* Wait for the next phase: */
+		phaseBarrier->synchronize();
+		if(phase==SHUTDOWN)
+			break;
+		
+		/* Process this thread's share and signal completion: */
+		processPhase(threadIndex);
+		phaseBarrier->synchronize();
+		}
+	
+	return 0;
+	}
+
+void UnitStore::startWorkerThreads(void)
+	{
+	threadBuffers.resize(numThreads);
+	if(numThreads>1)
+		{
+		/* Create the phase barrier and start the worker threads: */
+		phaseBarrier=new Threads::Barrier(numThreads);
+		workerThreads=new Threads::Thread[numThreads-1];
+		for(int i=1;i<numThreads;++i)
+			workerThreads[i-1].start(this,&UnitStore::workerThreadMethod,i);
+		}
+	}
+
+void UnitStore::stopWorkerThreads(void)
+	{
+	if(numThreads>1)
+		{
+		/* Release the worker threads into the shutdown phase and wait for them to terminate: */
+		phase=SHUTDOWN;
+		phaseBarrier->synchronize();
+		for(int i=1;i<numThreads;++i)
+			workerThreads[i-1].join();
+		delete[] workerThreads;
+		workerThreads=0;
+		delete phaseBarrier;
+		phaseBarrier=0;
+		}
+	}
+
+UnitStore::UnitStore(void)
+	:numRealUnits(0),
+	 numThreads(1),workerThreads(0),phaseBarrier(0),phase(SHUTDOWN),stepParameters(0)
+	{
+	for(int i=0;i<=2*UnitManager::NUM_UNITTYPES;++i)
+		typeStarts[i]=0;
+	startWorkerThreads();
+	}
+
+UnitStore::~UnitStore(void)
+	{
+	stopWorkerThreads();
+	}
+
+void UnitStore::setNumThreads(int newNumThreads)
+	{
+	if(newNumThreads<1)
+		newNumThreads=1;
+	if(numThreads!=newNumThreads)
+		{
+		/* Restart the worker threads: */
+		stopWorkerThreads();
+		numThreads=newNumThreads;
+		startWorkerThreads();
+		}
+	}
+
+void UnitStore::gather(StructuralUnit* firstUnit,StructuralUnit* firstGhostUnit,const SpaceGridCell* cellBase,unsigned int numCells)
+	{
+	/* Collect all real and ghost units and count the number of units in each type bucket: */
+	unsortedUnits.clear();
+	unsortedBuckets.clear();
+	unsigned int bucketSizes[2*UnitManager::NUM_UNITTYPES];
+	for(int i=0;i<2*UnitManager::NUM_UNITTYPES;++i)
+		bucketSizes[i]=0;
+	for(int ghosts=0;ghosts<2;++ghosts)
+		for(StructuralUnit* unit=ghosts?firstGhostUnit:firstUnit;unit!=0;unit=unit->succ)
+			{
+			int unitType=unit->getUnitType();
+			if(unitType<0||unitType>=UnitManager::NUM_UNITTYPES)
+				throw Misc::makeStdErr(__PRETTY_FUNCTION__,"Unit of unknown type %d encountered",unitType);
+			int bucket=ghosts*UnitManager::NUM_UNITTYPES+unitType;
+			unsortedUnits.push_back(unit);
+			unsortedBuckets.push_back(bucket);
+			++bucketSizes[bucket];
+			}
+	
+	/* Calculate the start index of each type bucket: */
+	typeStarts[0]=0;
+	for(int i=0;i<2*UnitManager::NUM_UNITTYPES;++i)
+		typeStarts[i+1]=typeStarts[i]+bucketSizes[i];
+	numRealUnits=typeStarts[UnitManager::NUM_UNITTYPES];
+	
+	/* Sort the units into their type buckets: */
+	unsigned int numUnits=unsortedUnits.size();
+	units.resize(numUnits);
+	unitTypes.resize(numUnits);
+	unsigned int bucketCursors[2*UnitManager::NUM_UNITTYPES];
+	for(int i=0;i<2*UnitManager::NUM_UNITTYPES;++i)
+		bucketCursors[i]=typeStarts[i];
+	for(unsigned int i=0;i<numUnits;++i)
+		{
+		unsigned int index=bucketCursors[unsortedBuckets[i]]++;
+		units[index]=unsortedUnits[i];
+		units[index]->storeIndex=index;
+		unitTypes[index]=unsortedBuckets[i]%UnitManager::NUM_UNITTYPES;
+		}
+	
+	/* Copy the type-independent unit states and count the number of grid cell entries: */
+	ids.resize(numUnits);
+	positions.resize(numUnits);
+	linearVelocities.resize(numUnits);
+	angularVelocities.resize(numUnits);
+	invMasses.resize(numUnits);
+	firstVertices.resize(numUnits);
+	unitCells.resize(numUnits);
+	unitCellCases.resize(numUnits);
+	cellStarts.assign(numCells+1,0);
+	unsigned int numVertices=0;
+	for(unsigned int index=0;index<numUnits;++index)
+		{
+		const StructuralUnit* unit=units[index];
+		ids[index]=unit->id;
+		positions[index]=unit->position;
+		linearVelocities[index]=unit->linearVelocity;
+		angularVelocities[index]=unit->angularVelocity;
+		firstVertices[index]=numVertices;
+		numVertices+=unit->numVertices;
+		unitCells[index]=unit->cell-cellBase;
+		unitCellCases[index]=unit->cell->borderCaseMask&0x3fU;
+		++cellStarts[unitCells[index]+1];
+		}
+	vertexOffsets.resize(numVertices);
+	
+	/* Initialize the type-dependent unit states using each type's kernel: */
+	for(int bucket=0;bucket<2*UnitManager::NUM_UNITTYPES;++bucket)
+		{
+		unsigned int begin=typeStarts[bucket];
+		unsigned int end=typeStarts[bucket+1];
+		bool ghosts=bucket>=UnitManager::NUM_UNITTYPES;
+		switch(bucket%UnitManager::NUM_UNITTYPES)
+			{
+			case UnitManager::TRIANGLE:
+				initUnits<Triangle>(begin,end,ghosts);
+				break;
+			
+			case UnitManager::TETRAHEDRON:
+				initUnits<Tetrahedron>(begin,end,ghosts);
+				break;
+			
+			case UnitManager::OCTAHEDRON:
+				initUnits<Octahedron>(begin,end,ghosts);
+				break;
+			
+			case UnitManager::CYLINDER:
+				initUnits<Cylinder>(begin,end,ghosts);
+				break;
+			
+			case UnitManager::SPHERE:
+				initUnits<Sphere>(begin,end,ghosts);
+				break;
+			}
+		}
+	
+	/* Sort the units into their grid cells: */
+	for(unsigned int i=0;i<numCells;++i)
+		cellStarts[i+1]+=cellStarts[i];
+	cellUnits.resize(numUnits);
+	for(unsigned int index=0;index<numUnits;++index)
+		cellUnits[cellStarts[unitCells[index]]++]=index;
+	
+	/* Each cell's insertion cursor now points to the next cell's start; shift the start indices back: */
+	for(unsigned int i=numCells;i>0;--i)
+		cellStarts[i]=cellStarts[i-1];
+	cellStarts[0]=0;
+	}
+
+void UnitStore::checkVertexLinks(const UnitStore::StepParameters& newStepParameters)
+	{
+	/* Check the vertex links of all real units of each type; spheres do not have vertices: */
+	stepParameters=&newStepParameters;
+	checkUnitVertexLinks<Triangle>(typeStarts[UnitManager::TRIANGLE],typeStarts[UnitManager::TRIANGLE+1]);
+	checkUnitVertexLinks<Tetrahedron>(typeStarts[UnitManager::TETRAHEDRON],typeStarts[UnitManager::TETRAHEDRON+1]);
+	checkUnitVertexLinks<Octahedron>(typeStarts[UnitManager::OCTAHEDRON],typeStarts[UnitManager::OCTAHEDRON+1]);
+	checkUnitVertexLinks<Cylinder>(typeStarts[UnitManager::CYLINDER],typeStarts[UnitManager::CYLINDER+1]);
+	stepParameters=0;
+	}
+
+void UnitStore::interact(const UnitStore::StepParameters& newStepParameters)
+	{
+	/* Calculate interactions of all real units of each type: */
+	stepParameters=&newStepParameters;
+	interactUnits<Triangle>(typeStarts[UnitManager::TRIANGLE],typeStarts[UnitManager::TRIANGLE+1]);
+	interactUnits<Tetrahedron>(typeStarts[UnitManager::TETRAHEDRON],typeStarts[UnitManager::TETRAHEDRON+1]);
+	interactUnits<Octahedron>(typeStarts[UnitManager::OCTAHEDRON],typeStarts[UnitManager::OCTAHEDRON+1]);
+	interactUnits<Cylinder>(typeStarts[UnitManager::CYLINDER],typeStarts[UnitManager::CYLINDER+1]);
+	interactUnits<Sphere>(typeStarts[UnitManager::SPHERE],typeStarts[UnitManager::SPHERE+1]);
+	stepParameters=0;
+	}
+
+void UnitStore::accumulateForces(const UnitStore::StepParameters& newStepParameters)
+	{
+	/* Accumulate the forces on all real units in parallel; each unit only ever changes its own velocities: */
+	stepParameters=&newStepParameters;
+	runPhase(ACCUMULATE);
+	
+	/* Establish new vertex links; the threads' candidate lists form one list in store order when concatenated: */
+	for(std::vector<ThreadBuffer>::iterator tbIt=threadBuffers.begin();tbIt!=threadBuffers.end();++tbIt)
+		for(std::vector<LinkCandidate>::iterator lcIt=tbIt->linkCandidates.begin();lcIt!=tbIt->linkCandidates.end();++lcIt)
+			linkVertices(lcIt->index1,lcIt->index2,lcIt->shift);
+	stepParameters=0;
+	}
+
+void UnitStore::integrate(const UnitStore::StepParameters& newStepParameters)
+	{
+	/* Move all real units in parallel: */
+	stepParameters=&newStepParameters;
+	runPhase(INTEGRATE);
+	stepParameters=0;
+	
+	/* Collect the units that moved to another grid cell, in store order: */
+	movedUnits.clear();
+	for(std::vector<ThreadBuffer>::iterator tbIt=threadBuffers.begin();tbIt!=threadBuffers.end();++tbIt)
+		movedUnits.insert(movedUnits.end(),tbIt->movedUnits.begin(),tbIt->movedUnits.end());
+	}
+
+}
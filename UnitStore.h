@@ -0,0 +1,199 @@
+/***********************************************************************
+UnitStore - Class to hold flat, type-sorted copies of the simulation
+state of all structural units in a space grid, to calculate unit
+interactions with per-type kernels instead of virtual method calls, and
+to accumulate forces and integrate unit states in parallel.
+Copyright (c) 2025 Oliver Kreylos
+
+The Nanotech Construction Kit is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Nanotech Construction Kit is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Nanotech Construction Kit; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef UNITSTORE_INCLUDED
+#define UNITSTORE_INCLUDED
+
+#include <vector>
+#include <Threads/Thread.h>
+#include <Threads/Barrier.h>
+#include <Geometry/Vector.h>
+
+#include "AffineSpace.h"
+#include "UnitManager.h"
+
+/* Forward declarations: */
+namespace NCK {
+class StructuralUnit;
+class SpaceGridCell;
+}
+
+namespace NCK {
+
+class UnitStore
+	{
+	/* Embedded classes: */
+	public:
+	struct CellNeighbour // Structure describing one of the 27 neighbours of a grid cell
+		{
+		/* Elements: */
+		public:
+		int cellOffset; // Index offset from the grid cell to the neighbour cell, wrapped around minimum-image periodic boundaries
+		Vector shift; // Offset to add to the positions of units in the neighbour cell to get their minimum images
+		};
+	
+	struct StepParameters // Structure holding the parameters of a single simulation step
+		{
+		/* Elements: */
+		public:
+		Scalar timeStep; // Length of the simulation step
+		const CellNeighbour* cellNeighbours; // Array of 27 neighbours (including itself) of a grid cell for each of the 64 grid border case masks
+		bool minimumImage; // Flag whether periodic axes use minimum-image distances instead of ghost units
+		Box gridBox; // Bounding box of the space grid
+		bool periodicFlags[3]; // Flags if the space grid is periodic along any of its axes
+		Scalar attenuation; // Attenuation factor for linear and angular velocities over the simulation step
+		Scalar cellSize[3]; // Size of a single grid cell
+		int gridSize[3]; // Number of grid cells in each direction, not including ghost cells
+		int cellIncrements[3]; // Index increments between neighbouring grid cells along each axis
+		};
+	
+	private:
+	enum Phase // Enumerated type for simulation step phases executed by all worker threads
+		{
+		ACCUMULATE,INTEGRATE,SHUTDOWN
+		};
+	
+	struct LinkCandidate // Structure for pairs of stored units that are close enough to form a new vertex link
+		{
+		/* Elements: */
+		public:
+		unsigned int index1,index2; // Indices of the two units, where the first unit has the bigger ID
+		Vector shift; // Offset to add to the second unit's position to get its minimum image
+		
+		/* Constructors and destructors: */
+		LinkCandidate(unsigned int sIndex1,unsigned int sIndex2,const Vector& sShift)
+			:index1(sIndex1),index2(sIndex2),shift(sShift)
+			{
+			};
+		};
+	
+	struct ThreadBuffer // Structure for per-thread results of a simulation step phase
+		{
+		/* Elements: */
+		public:
+		std::vector<LinkCandidate> linkCandidates; // List of unit pairs that might form new vertex links
+		std::vector<StructuralUnit*> movedUnits; // List of units that moved to another grid cell
+		};
+	
+	/* Elements: */
+	std::vector<StructuralUnit*> units; // Pointers to all stored units; real units sorted by type, followed by ghost units sorted by type
+	unsigned int numRealUnits; // Number of real units at the beginning of the store
+	unsigned int typeStarts[2*UnitManager::NUM_UNITTYPES+1]; // Index ranges of real units of each type followed by ghost units of each type
+	std::vector<unsigned int> ids; // IDs of all stored units
+	std::vector<int> unitTypes; // Types of all stored units
+	std::vector<Point> positions; // Positions of all stored units
+	std::vector<Vector> linearVelocities; // Linear velocities of all stored units
+	std::vector<Vector> angularVelocities; // Angular velocities of all stored units
+	std::vector<Scalar> invMasses; // Inverse masses of all stored units; zero for ghost units, which do not receive forces
+	std::vector<unsigned int> firstVertices; // Index of each stored unit's first vertex in the vertex offset array
+	std::vector<Vector> vertexOffsets; // Offsets from unit positions to unit vertices in global coordinates
+	std::vector<unsigned int> unitCells; // Index of the grid cell containing each stored unit
+	std::vector<unsigned int> unitCellCases; // Border case mask of the grid cell containing each stored unit
+	std::vector<unsigned int> cellStarts; // Index of the first entry of each grid cell in the cell unit array
+	std::vector<unsigned int> cellUnits; // Indices of stored units sorted by grid cell
+	std::vector<StructuralUnit*> unsortedUnits; // Temporary array of units in grid list order
+	std::vector<int> unsortedBuckets; // Temporary array of unit type buckets in grid list order
+	int numThreads; // Number of threads processing simulation step phases, including the calling thread
+	Threads::Thread* workerThreads; // Array of worker threads processing simulation step phases alongside the calling thread
+	Threads::Barrier* phaseBarrier; // Barrier to synchronize the calling thread and all worker threads at the beginning and end of each phase
+	Phase phase; // The currently executed simulation step phase
+	const StepParameters* stepParameters; // Parameters of the current simulation step
+	std::vector<ThreadBuffer> threadBuffers; // Per-thread result buffers
+	std::vector<StructuralUnit*> movedUnits; // List of units that moved to another grid cell during the most recent integration phase
+	
+	/* Private methods: */
+	void applyVertexForce(unsigned int index,const Vector& vertexOffset,const Vector& force,Scalar timeStep) // Applies a force to one of a stored unit's vertices
+		{
+		Scalar scale=timeStep*invMasses[index];
+		linearVelocities[index]+=force*scale;
+		angularVelocities[index]+=Geometry::cross(vertexOffset,force)*scale; // Should be moment of inertia instead of mass here
+		};
+	void applyCentralForce(unsigned int index,const Vector& force,Scalar timeStep) // Applies a force to a stored unit's centroid
+		{
+		linearVelocities[index]+=force*(timeStep*invMasses[index]);
+		};
+	void wrapDistance(Vector& dist) const // Wraps the given distance vector to its minimum image along periodic axes
+		{
+		if(stepParameters->minimumImage)
+			for(int i=0;i<3;++i)
+				if(stepParameters->periodicFlags[i])
+					{
+					Scalar size=stepParameters->gridBox.getSize(i);
+					if(dist[i]>Scalar(0.5)*size)
+						dist[i]-=size;
+					else if(dist[i]<-Scalar(0.5)*size)
+						dist[i]+=size;
+					}
+		};
+	template <class UnitParam>
+	void initUnits(unsigned int begin,unsigned int end,bool ghosts); // Initializes the type-dependent state of the given range of stored units of the given type
+	template <class UnitParam>
+	void checkUnitVertexLinks(unsigned int begin,unsigned int end); // Checks vertex links of the given range of stored real units of the given type
+	template <class Unit1Param,class Unit2Param>
+	void interactPair(unsigned int index1,unsigned int index2,const Vector& shift); // Calculates the interaction between two stored units of the given types, where the second unit's position is shifted by the given offset
+	template <class Unit1Param>
+	void interactUnits(unsigned int begin,unsigned int end); // Calculates interactions between the given range of stored real units of the given type and all their neighbours
+	template <class Unit1Param,class Unit2Param>
+	void accumulatePair(unsigned int index1,unsigned int index2,const Vector& shift,ThreadBuffer& buffer); // Accumulates the central force exerted on the first of two stored units of the given types by the second, whose position is shifted by the given offset, and records a vertex link candidate
+	template <class Unit1Param>
+	void accumulateUnits(unsigned int begin,unsigned int end,ThreadBuffer& buffer); // Accumulates all vertex link and central forces on the given range of stored real units of the given type
+	void linkVertices(unsigned int index1,unsigned int index2,const Vector& shift); // Tries to establish a vertex link between the two given stored units, where the second unit's position is shifted by the given offset
+	void integrateUnits(unsigned int begin,unsigned int end,ThreadBuffer& buffer); // Moves the given range of stored real units to the end of the simulation step
+	void processPhase(int threadIndex); // Processes the current simulation step phase for the given thread's share of stored real units
+	void runPhase(Phase newPhase); // Runs the given simulation step phase on all threads
+	void* workerThreadMethod(int threadIndex); // Method run by the worker threads
+	void startWorkerThreads(void); // Starts worker threads based on the current number of threads
+	void stopWorkerThreads(void); // Stops all worker threads
+	
+	/* Constructors and destructors: */
+	public:
+	UnitStore(void); // Creates an empty unit store processing simulation step phases in the calling thread
+	~UnitStore(void);
+	
+	/* Methods: */
+	unsigned int getNumUnits(void) const // Returns the total number of stored units
+		{
+		return units.size();
+		};
+	unsigned int getNumRealUnits(void) const // Returns the number of stored real units
+		{
+		return numRealUnits;
+		};
+	int getNumThreads(void) const // Returns the number of threads processing simulation step phases
+		{
+		return numThreads;
+		};
+	void setNumThreads(int newNumThreads); // Sets the number of threads processing simulation step phases, including the calling thread
+	void gather(StructuralUnit* firstUnit,StructuralUnit* firstGhostUnit,const SpaceGridCell* cellBase,unsigned int numCells); // Copies the states of the given lists of real and ghost units, and the cell linkage relative to the given grid cell array, into the store
+	void checkVertexLinks(const StepParameters& newStepParameters); // Checks all existing vertex links and applies vertex forces for valid ones
+	void interact(const StepParameters& newStepParameters); // Calculates interactions between all pairs of units in neighbouring grid cells
+	void accumulateForces(const StepParameters& newStepParameters); // Accumulates all vertex link and central forces in parallel, independent of unit order and number of threads, and then establishes new vertex links
+	void integrate(const StepParameters& newStepParameters); // Moves all stored real units to the end of the simulation step in parallel and writes their new states back to their unit objects
+	const std::vector<StructuralUnit*>& getMovedUnits(void) const // Returns the list of units that moved to another grid cell during the most recent integration phase, in store order
+		{
+		return movedUnits;
+		};
+	};
+
+}
+
+#endif